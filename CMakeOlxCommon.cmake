@@ -33,6 +33,8 @@ OPTION(ADVASSERT "Advanced assert" No)
 OPTION(PYTHON_DED_EMBEDDED "Python embedded in dedicated server"  No)
 OPTION(OPTIM_PROJECTILES "Enable optimisations for projectiles" Yes)
 OPTION(MEMSTATS "Enable memory statistics and debugging" No)
+OPTION(ALLOC_COUNTING "Count operator new calls for the benchmark report" No)
+OPTION(SMARTPOINTER_COLLDETECT "Detect objects owned by two independent SmartPointers (slow)" No)
 OPTION(HASBFD "Use libbfd for extended stack traces" Yes)
 OPTION(BREAKPAD "Google Breakpad support" No)
 OPTION(LINENOISE "builtin Linenose support (readline/libedit replacement)" Yes)
@@ -247,8 +249,14 @@ ENDIF(DEBUG)
 
 IF(MEMSTATS)
 	ADD_DEFINITIONS(-include ${OLXROOTDIR}/optional-includes/memdebug/memstats.h)
+ELSEIF(ALLOC_COUNTING)
+	ADD_DEFINITIONS(-DALLOC_COUNTING)
 ENDIF(MEMSTATS)
 
+IF(SMARTPOINTER_COLLDETECT)
+	ADD_DEFINITIONS(-DSMARTPOINTER_COLLDETECT)
+ENDIF(SMARTPOINTER_COLLDETECT)
+
 
 # Generic defines
 IF(WIN32)
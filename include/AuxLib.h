@@ -21,10 +21,13 @@
 
 #include <SDL.h>
 #include <string>
+#include <vector>
+#include <atomic>
 
 
 #include "SmartPointer.h"
 
+struct CmdLineIntf;
 
 // Routines
 bool		InitializeAuxLib();
@@ -78,6 +81,21 @@ protected:
 	SmartPointer<SDL_Surface> m_videoSurface;
 	SmartPointer<SDL_Surface> m_videoBufferSurface;
 	static VideoPostProcessor instance;
+
+	// What is in m_videoTexture, to find the changed parts of a new frame. Main thread only.
+	std::vector<Uint8> m_uploadedPixels;
+	bool m_uploadedPixelsValid;
+	bool m_needPresent; // set by process() when it uploaded something
+	std::atomic<bool> m_forcePresent; // e.g. after the window was exposed
+
+	struct UploadStats {
+		Uint64 frames, framesSkipped, rects, bytes;
+		size_t lastFrameBytes;
+		UploadStats() : frames(0), framesSkipped(0), rects(0), bytes(0), lastFrameBytes(0) {}
+	} m_uploadStats;
+
+	VideoPostProcessor() : m_uploadedPixelsValid(false), m_needPresent(false), m_forcePresent(false) {}
+	void uploadChangedRects();
 	
 public:
 	// IMPORTANT: Don't call this while anyone else calls/accesses anything else here.
@@ -87,6 +105,9 @@ public:
 	static void process();
 	static void render();
 	static void cloneBuffer();
+	// may be called from any thread: the next render() presents, even if nothing changed
+	static void forceRedraw() { get()->m_forcePresent = true; }
+	static void dumpUploadStats(CmdLineIntf& cli);
 
 public:
 	static VideoPostProcessor* get() { return &instance; }
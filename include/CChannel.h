@@ -23,6 +23,8 @@
 #include "Networking.h"
 #include "Timer.h"
 
+struct CmdLineIntf;
+
 template< int AMOUNT, int TIMERANGEMS, typename _Amount = size_t >
 class Rate {
 private:
@@ -354,6 +356,93 @@ public:
 	friend void TestCChannelRobustness();
 };
 
+// Reliable CChannel with selective acknowledgements and congestion control, since 0.59 beta11.
+// Packets are kept in ring buffers indexed by their sequence, the retransmit timeout follows the
+// measured RTT (RFC 6298) and the amount of packets in flight is an AIMD window like in TCP.
+// The packet format is described in CChannel.cpp.
+class CChannel4: public CChannel {
+
+public:
+	enum { RingSize = 256 }; // Max packets in flight and max reordering, power of 2
+
+private:
+	struct OutPacket_t
+	{
+		std::string data;
+		bool fragmented;
+		bool acked;
+		bool lost;			// Has to be sent again
+		int transmissions;	// 0 if not sent yet
+		AbsTime sentTime;
+	};
+	struct InPacket_t
+	{
+		std::string data;
+		bool fragmented;
+		bool received;
+	};
+	OutPacket_t		ReliableOut[RingSize];	// Sequences SndUna .. SndNext-1
+	InPacket_t		ReliableIn[RingSize];	// Sequences DeliverNext .. DeliverNext+RingSize-1
+	std::string		IncompletePacket;	// Fragments which were already taken from ReliableIn
+	int				SndUna;			// Oldest packet which is not acknowledged
+	int				SndNext;		// Sequence for the next new packet
+	int				RcvNext;		// First sequence which we did not receive yet
+	int				DeliverNext;	// First sequence which was not returned by Process() yet
+	bool			AckPending;		// Got reliable data since we sent the last acknowledge
+
+	// RTT estimation, all in ms
+	float			SRtt;
+	float			RttVar;
+	float			Rto;
+	bool			HaveRttSample;
+
+	// AIMD congestion window, in packets
+	float			Cwnd;
+	float			Ssthresh;
+	bool			InRecovery;		// We reduced Cwnd because of a loss, until RecoverySeq is acknowledged
+	int				RecoverySeq;
+
+	float			KeepAlivePacketTimeout;
+	size_t			iRetransmissions;
+
+	OutPacket_t&	outPacket( int seq ) { return ReliableOut[ seq & (RingSize - 1) ]; }
+	InPacket_t&		inPacket( int seq ) { return ReliableIn[ seq & (RingSize - 1) ]; }
+	int				packetsInFlight();
+	void			processAcks( int cumAck, Uint32 sackBits );
+	void			packetAcked( OutPacket_t & p );
+	void			onLoss( bool timeout );
+	bool			GetPacketFromBuffer(CBytestream *bs);
+
+public:
+
+	// Constructor
+	CChannel4() { Clear(); }
+
+	// Methods
+	void		Create(const NetworkAddr& _adr, const SmartPointer<NetworkSocket>& _sock);
+	void		Transmit( CBytestream *bs );
+	// This function will first return non-reliable data,
+	// and then one or many reliable packets - it will modify bs for that,
+	// so you should call it in a loop, clearing bs after each call.
+	bool		Process( CBytestream *bs );
+	void		Clear();
+
+	bool		getBufferEmpty()	{ return SndUna == SndNext; };
+	bool		getBufferFull();
+
+	void		AddReliablePacketToSend(CBytestream& bs); // The same as in CChannel but without error msg
+
+	float		getCongestionWindow() const { return Cwnd; }
+	float		getRetransmitTimeout() const { return Rto; } // ms
+	size_t		getRetransmissions() const { return iRetransmissions; }
+
+	friend void TestCChannelRobustness();
+	friend bool TestCChannelCongestion( CmdLineIntf & cli );
+};
+
 void TestCChannelRobustness();
+// Compares CChannel3 and CChannel4 over simulated connections with packet loss and lag.
+// Returns false (and reports a CNC_ERROR) if a channel lost messages or delivered them out of order.
+bool TestCChannelCongestion( CmdLineIntf & cli );
 
 #endif  //  __CCHANNEL_H__
@@ -102,6 +102,8 @@ protected:
 	void		 ParseDestroyBonus(CBytestream *bs);
     void		 ParseDropped(CBytestream *bs);
     void		 ParseSendFile(CBytestream *bs);
+	void		 ParseFileTransfer(CBytestream *bs);
+	void		 ProcessFinishedFileDownload();
 	virtual void ParseFlagInfo(CBytestream* bs);
 	virtual void ParseTeamScoreUpdate(CBytestream* bs);
 	virtual void ParseWormProps(CBytestream* bs);
@@ -29,6 +29,7 @@
 
 struct PixelPutAlpha;
 struct PixelGet;
+struct CmdLineIntf;
 
 
 #define FIRST_CHARACTER 32 // space
@@ -81,6 +82,10 @@ public:
 
 	void				Shutdown();
 
+	// Drawn strings are kept as ready surfaces (for all fonts together), see CFont.cpp
+	static void			SetTextCacheEnabled(bool enabled);
+	static void			DumpTextCacheStats(CmdLineIntf& cli);
+
 	INLINE void			SetOutline(bool _o)  {
 		OutlineFont = _o;
 	}
@@ -123,6 +128,9 @@ private:
 	bool				IsColumnFree(int x);
 	void				Parse();
 	void				PreCalculate(const SmartPointer<SDL_Surface> & bmpSurf, Color colour);
+	SmartPointer<SDL_Surface> GetTextRun(const std::string& txt, Color col, const SmartPointer<SDL_Surface>& bmpCached);
+	SmartPointer<SDL_Surface> RenderTextRun(const std::string& txt, Color col, const SmartPointer<SDL_Surface>& bmpCached);
+	void				RemoveFromTextCache();
 	
 	// Internal functions for glyph drawing, first one for normal fonts, second one for outline fonts
 	// These do the fast glyph blit without any additional checks or clipping
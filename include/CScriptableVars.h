@@ -26,6 +26,7 @@
 
 #include "Color.h"
 #include "StringUtils.h"
+#include "CaselessIndex.h"
 #include "Ref.h"
 #include "PreInitVar.h"
 #include "util/CustomVar.h"
@@ -751,10 +752,18 @@ public:
 		friend class CScriptableVars;
 
 		VarMap& m_vars;	// Reference to CScriptableVars::m_vars
+		CaselessIndex<RegisteredVar*>& m_index;	// Reference to CScriptableVars::m_index
 		std::string m_prefix;
 
 		VarRegisterHelper( CScriptableVars * parent, const std::string & prefix ): 
-			m_vars( parent->m_vars ), m_prefix(prefix) {}
+			m_vars( parent->m_vars ), m_index( parent->m_index ), m_prefix(prefix) {}
+
+		void Add( const std::string & name, const RegisteredVar & var )
+		{
+			RegisteredVar& v = m_vars[name];
+			v = var;
+			m_index.insert(name, &v);
+		}
 
 		std::string Name( const std::string & c )
 		{
@@ -772,7 +781,7 @@ public:
 										const std::string & descr = "", const std::string & descrLong = "", GameInfoGroup group = GIG_Invalid, AdvancedLevel level = ALT_Basic,
 										bool unsig = false, const T& minval = T(), const T& maxval = T() )
 		{
-			m_vars[Name(c)] = RegisteredVar(v, std::string(c), T(def), descr, descrLong, group, level, unsig, minval, maxval);
+			Add(Name(c), RegisteredVar(v, std::string(c), T(def), descr, descrLong, group, level, unsig, minval, maxval));
 			return *this; 
 		}
 
@@ -783,7 +792,7 @@ public:
 		}
 		
 		VarRegisterHelper& operator() (ScriptCallback_t cb, const std::string& c) {
-			m_vars[Name(c)] = RegisteredVar(cb, c);
+			Add(Name(c), RegisteredVar(cb, c));
 			return *this;
 		}
 		
@@ -791,7 +800,7 @@ public:
 										const std::string & descr = "", const std::string & descrLong = "", GameInfoGroup group = GIG_Invalid, AdvancedLevel level = ALT_Basic,
 										bool unsig = false, const ScriptVar_t& minval = ScriptVar_t(), const ScriptVar_t& maxval = ScriptVar_t())
 			{
-				m_vars[Name(c)] = RegisteredVar(v, c, def, descr, descrLong, group, level, unsig, minval, maxval);
+				Add(Name(c), RegisteredVar(v, c, def, descr, descrLong, group, level, unsig, minval, maxval));
 				return *this; 
 			}
 		
@@ -811,6 +820,7 @@ private:
 
 	static CScriptableVars * m_instance;
 	VarMap m_vars;	// All in-game variables and callbacks	
+	CaselessIndex<RegisteredVar*> m_index;	// For GetVar(), points into m_vars
 };
 
 #endif
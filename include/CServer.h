@@ -25,6 +25,8 @@
 #include "HTTP.h"
 #include "Timer.h"
 #include "CBanList.h"
+#include "PacketLog.h"
+#include "game/Demo.h"
 #include "game/GameMode.h"
 
 class CWorm;
@@ -128,6 +130,10 @@ private:
 	
 	std::string	netError;
 
+	PacketLogWriter	cPacketLogWriter;
+	PacketReplayer	cPacketReplayer;
+	DemoRecorder	cDemoRecorder;
+
 	friend class CServerNetEngine;
 	friend class CServerNetEngineBeta7;
 	friend class CServerNetEngineBeta9;
@@ -166,6 +172,11 @@ public:
 	void		SendPackets(bool sendPendingOnly = false);
 
 	bool		ReadPacketsFromSocket(const SmartPointer<NetworkSocket>& sock);
+	void		ProcessPacket(const SmartPointer<NetworkSocket>& sock, CBytestream& bs, const NetworkAddr& addrFrom);
+	void		InjectPacket(const NetworkAddr& addrFrom, CBytestream& bs); // as if it came from addrFrom on the main socket
+	PacketLogWriter& getPacketLogWriter() { return cPacketLogWriter; }
+	PacketReplayer& getPacketReplayer() { return cPacketReplayer; }
+	DemoRecorder& getDemoRecorder() { return cDemoRecorder; }
 
 	int			getPort() { return nPort; }
 	bool		checkBandwidth(CServerConnection *cl);
@@ -181,6 +192,7 @@ public:
 	void		DeRegisterServerUdp();
 	bool		ProcessDeRegister();
 	void		CheckTimeouts();
+	void		UpdateMetrics();
 	void		CheckWeaponSelectionTime();
 	void		DropClient(CServerConnection *cl, int reason, const std::string& sReason, bool showReason = true);
 	CWorm*		AddWorm(const WormJoinInfo& wormInfo, CServerConnection* cl);
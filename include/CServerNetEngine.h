@@ -53,6 +53,7 @@ public:
 	void		 ParseDisconnect();
 	void		 ParseGrabBonus(CBytestream *bs);
 	void		 ParseSendFile(CBytestream *bs);
+	void		 ParseFileTransfer(CBytestream *bs);
 
 	bool		 ParseChatCommand(const std::string& message);
 	
@@ -18,6 +18,7 @@
 
 class searchpath_base;
 struct NEW_ai_node_t;
+struct CmdLineIntf;
 
 class CWormBotInputHandler : public CWormInputHandler {
 public:
@@ -87,8 +88,17 @@ protected:
 	NEW_ai_node_t	*NEW_psCurrentNode;
 	NEW_ai_node_t	*NEW_psLastNode;
 	
+	// Time slicing, see CWormBot.cpp
+	Uint64		iAILastThinkTick;
+	int			iAISkippedTicks;
 	
 public:
+	// Shared cache of the traces through the terrain and the CPU budget of all bots, see CWormBot.cpp
+	static bool	bAITraceCache;
+	static int	iAITickBudget; // microseconds per physics tick, 0 for no limit
+	static void	dumpAIStats(CmdLineIntf& cli);
+	static void	benchmarkAI(CmdLineIntf& cli, int rounds);
+
 	
 	
     //
@@ -96,6 +106,8 @@ public:
     //
     bool        AI_Initialize();
     void        AI_Shutdown();
+	void		AI_GetInput(); // one step of the AI, getInput() decides if there is time for it
+	void		AI_EvaluateTargets(); // the traces of a think step for every target, for benchmarkAI()
 	
 	void		AI_Respawn();
     void        AI_Think();
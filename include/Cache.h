@@ -21,12 +21,11 @@
 #define __CACHE_H__
 
 #include <SDL.h>
-#include <vector>
-#include <map>
-#include <set>
-#include <list>
+#include <string>
+#include <unordered_map>
 #include <cassert>
 #include "SmartPointer.h"
+#include "StringUtils.h"
 #include "olx-types.h"
 
 // these forward-declaration are needed here
@@ -34,7 +33,25 @@
 class SoundSample;
 class CMap;
 class CGameScript;
- 
+struct CmdLineIntf;
+
+/*
+	Asset cache
+
+	Each section (images, sounds, maps, mods) is a hash map with case-insensitive
+	keys. The key is stored (interned) only once, in the hash map node; lookups
+	don't lowercase or copy the requested name.
+
+	All entries of a section are linked into an intrusive LRU list (head is the
+	most recently used one), so touching an entry and finding the eviction
+	candidate are both O(1).
+
+	The memory of each entry is measured once when it is saved (GetMemorySize()
+	of the surface/map/mod/sound) and summed up, so GetCacheSize() is exact and
+	cheap. ClearExtraEntries() evicts least recently used entries which are not
+	referenced from outside the cache until both Advanced.MaxCachedEntries and
+	Advanced.MaxCacheMemory (in MB) are respected.
+*/
 class CCache  {
 public:
 	CCache() { mutex = SDL_CreateMutex(); };
@@ -61,61 +78,120 @@ public:
 	void	SaveMap(const std::string& file, CMap *map);
 	size_t	GetCacheSize();
 	size_t	GetEntryCount();
+	size_t	GetMemoryLimit(); // in bytes, 0 if unlimited
+	void	DumpStats(CmdLineIntf& cli);
 
 	SDL_mutex* mutex;
 
-private:
-	class CacheItem_t { public:
-		//virtual ~CacheItem_t() {} // TODO: do we need this when there is no other virtual function? 
-		CacheItem_t() : fSaveTime(0), iFileTimeStamp(0) {}
-		CacheItem_t(const CacheItem_t& oth)  { operator=(oth); }
-		CacheItem_t(const AbsTime& savetime, Uint64 timestamp) : fSaveTime(savetime), iFileTimeStamp(timestamp) {}
-		// TODO: this op= was virtual; was there any reason for this? (no other class had overloaded it)
-		CacheItem_t& operator=(const CacheItem_t& oth)  { if (&oth != this) { fSaveTime = oth.fSaveTime; iFileTimeStamp = oth.iFileTimeStamp; } return *this; }
-		AbsTime	fSaveTime;
-		Uint64	iFileTimeStamp;
+	struct Stats_t {
+		Stats_t() : hits(0), misses(0), evictions(0), expirations(0) {}
+		Uint64 hits;
+		Uint64 misses;
+		Uint64 evictions; // removed by ClearExtraEntries
+		Uint64 expirations; // removed because the file changed on disk
 	};
 
-	class ImageItem_t : public CacheItem_t { public:
-		ImageItem_t() : CacheItem_t() { bmpSurf = NULL; }
-		ImageItem_t(const ImageItem_t& oth) { operator=(oth); }
-		ImageItem_t(SmartPointer<SDL_Surface> img, const AbsTime& savetime, Uint64 timestamp) : CacheItem_t(savetime, timestamp) { bmpSurf = img; }
-		ImageItem_t& operator=(const ImageItem_t& oth) { CacheItem_t::operator =(oth); if (&oth != this) { bmpSurf = oth.bmpSurf; } return *this; }
-		SmartPointer<SDL_Surface> bmpSurf;
-	};
-
-	class SoundItem_t : public CacheItem_t { public:
-		SoundItem_t() : CacheItem_t() { sndSample = NULL; }
-		SoundItem_t(const SoundItem_t& oth) { operator=(oth); }
-		SoundItem_t(SmartPointer<SoundSample> snd, const AbsTime& savetime, Uint64 timestamp) : CacheItem_t(savetime, timestamp) { sndSample = snd; }
-		SoundItem_t& operator=(const SoundItem_t& oth) { CacheItem_t::operator =(oth); if (&oth != this) { sndSample = oth.sndSample; } return *this; }
-		SmartPointer<SoundSample> sndSample;
-	};
-
-	class MapItem_t : public CacheItem_t { public:
-		MapItem_t() : CacheItem_t() { tMap = NULL; }
-		MapItem_t(const MapItem_t& oth) { operator=(oth); }
-		MapItem_t(SmartPointer<CMap> map, const AbsTime& savetime, Uint64 timestamp) : CacheItem_t(savetime, timestamp) { tMap = map; }
-		MapItem_t& operator=(const MapItem_t& oth) { CacheItem_t::operator =(oth); if (&oth != this) { tMap = oth.tMap; } return *this; }
-		SmartPointer<CMap> tMap;
+private:
+	template<typename _Data>
+	class Section_t { public:
+		struct Item_t {
+			Item_t() : iFileTimeStamp(0), iMemSize(0), key(NULL), lruPrev(NULL), lruNext(NULL) {}
+			SmartPointer<_Data> data;
+			AbsTime	fLastFileCheck; // last time we compared iFileTimeStamp with the file on disk
+			Uint64	iFileTimeStamp;
+			size_t	iMemSize; // accounted memory, including the key
+			const std::string* key; // interned key, owned by the hash map node
+			Item_t* lruPrev; // more recently used
+			Item_t* lruNext; // less recently used
+		};
+		typedef std::unordered_map<std::string, Item_t, stringcasehash, stringcaseequalto> Map_t;
+
+		Map_t	entries;
+		Item_t*	lruHead; // most recently used
+		Item_t*	lruTail; // least recently used
+		size_t	iMemSize;
+		Stats_t	stats;
+
+		Section_t() : lruHead(NULL), lruTail(NULL), iMemSize(0) {}
+
+		// Returns NULL if not found. Counts the hit/miss and marks the entry as most recently used.
+		Item_t* find(const std::string& key) {
+			typename Map_t::iterator it = entries.find(key);
+			if(it == entries.end()) { stats.misses++; return NULL; }
+			stats.hits++;
+			unlink(&it->second);
+			linkFront(&it->second);
+			return &it->second;
+		}
+
+		// Returns NULL if there is already an entry with this key.
+		Item_t* insert(const std::string& key, const SmartPointer<_Data>& data, size_t dataSize, Uint64 timestamp, const AbsTime& now) {
+			std::pair<typename Map_t::iterator, bool> res = entries.insert( typename Map_t::value_type(key, Item_t()) );
+			if(!res.second) return NULL;
+			Item_t* item = &res.first->second;
+			item->data = data;
+			item->fLastFileCheck = now;
+			item->iFileTimeStamp = timestamp;
+			item->iMemSize = dataSize + key.size() + sizeof(typename Map_t::value_type);
+			item->key = &res.first->first;
+			linkFront(item);
+			iMemSize += item->iMemSize;
+			return item;
+		}
+
+		void erase(Item_t* item) {
+			unlink(item);
+			iMemSize -= item->iMemSize;
+			entries.erase( entries.find(*item->key) );
+		}
+
+		void clear() {
+			entries.clear();
+			lruHead = lruTail = NULL;
+			iMemSize = 0;
+		}
+
+		// Evicts least recently used entries which are not referenced outside of the cache
+		// until there are at most maxEntries left and totalMem is not over maxMem (0 = no limit).
+		// totalMem is the size of the whole cache and is updated.
+		void evict(size_t maxEntries, size_t& totalMem, size_t maxMem) {
+			Item_t* item = lruTail;
+			while(item && (entries.size() > maxEntries || (maxMem > 0 && totalMem > maxMem))) {
+				Item_t* prev = item->lruPrev;
+				if(item->data.tryDeleteData()) {
+					totalMem -= item->iMemSize;
+					stats.evictions++;
+					erase(item);
+				}
+				item = prev;
+			}
+		}
+
+	private:
+		void linkFront(Item_t* item) {
+			item->lruPrev = NULL;
+			item->lruNext = lruHead;
+			if(lruHead) lruHead->lruPrev = item;
+			lruHead = item;
+			if(!lruTail) lruTail = item;
+		}
+
+		void unlink(Item_t* item) {
+			if(item->lruPrev) item->lruPrev->lruNext = item->lruNext;
+			else lruHead = item->lruNext;
+			if(item->lruNext) item->lruNext->lruPrev = item->lruPrev;
+			else lruTail = item->lruPrev;
+			item->lruPrev = item->lruNext = NULL;
+		}
 	};
 
-	class ModItem_t : public CacheItem_t { public:
-		ModItem_t() : CacheItem_t() { tMod = NULL; }
-		ModItem_t(const ModItem_t& oth) { operator=(oth); }
-		ModItem_t(SmartPointer<CGameScript> mod, const AbsTime& savetime, Uint64 timestamp) : CacheItem_t(savetime, timestamp) { tMod = mod; }
-		ModItem_t& operator=(const ModItem_t& oth) { CacheItem_t::operator =(oth); if (&oth != this) { tMod = oth.tMod; } return *this; }
-		SmartPointer<CGameScript> tMod;
-	};
+	template<typename _Data>
+	bool isFileUnchanged(typename Section_t<_Data>::Item_t* item);
 
-	typedef std::map<std::string, ImageItem_t > ImageCache_t;
-	ImageCache_t ImageCache;
-	typedef std::map<std::string, SoundItem_t > SoundCache_t;
-	SoundCache_t SoundCache;
-	typedef std::map<std::string, MapItem_t > MapCache_t;
-	MapCache_t MapCache;
-	typedef std::map<std::string, ModItem_t > ModCache_t;
-	ModCache_t ModCache;
+	Section_t<SDL_Surface> ImageCache;
+	Section_t<SoundSample> SoundCache;
+	Section_t<CMap> MapCache;
+	Section_t<CGameScript> ModCache;
 };
 
 extern CCache cCache;
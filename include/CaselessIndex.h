@@ -0,0 +1,98 @@
+/*
+	OpenLieroX
+
+	case-insensitive hash index over names
+
+	code under LGPL
+*/
+
+#ifndef __OLX_CASELESSINDEX_H__
+#define __OLX_CASELESSINDEX_H__
+
+#include <string>
+#include <vector>
+#include <cctype>
+#include "StringUtils.h"
+
+/*
+	Lookup table for the command registry and the scriptable vars. Both keep
+	their sorted map for listings and prefix completion (lower_bound); this
+	is the index for the exact lookups, which happen on every console line
+	and every var access from scripts.
+
+	Open addressing with linear probing, at most half full. find() takes a
+	char range, so a command name can be looked up right inside the input
+	line without copying it out.
+*/
+template<typename T>
+class CaselessIndex {
+	struct Entry {
+		std::string key;
+		size_t hash;
+		T value;
+		bool used;
+		Entry() : hash(0), value(), used(false) {}
+	};
+	std::vector<Entry> m_entries; // size is 0 or a power of two
+	size_t m_size;
+
+	static bool keyEqual(const std::string& key, const char* s, size_t len) {
+		if(key.size() != len) return false;
+		for(size_t i = 0; i < len; ++i)
+			if(tolower((uchar)key[i]) != tolower((uchar)s[i])) return false;
+		return true;
+	}
+
+	Entry* lookup(const char* s, size_t len, size_t hash) {
+		if(m_entries.empty()) return NULL;
+		const size_t mask = m_entries.size() - 1;
+		for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+			Entry& e = m_entries[i];
+			if(!e.used) return &e;
+			if(e.hash == hash && keyEqual(e.key, s, len)) return &e;
+		}
+	}
+
+	void grow() {
+		std::vector<Entry> old;
+		old.swap(m_entries);
+		m_entries.resize(old.empty() ? 64 : old.size() * 2);
+		for(size_t i = 0; i < old.size(); ++i) {
+			if(!old[i].used) continue;
+			Entry* e = lookup(old[i].key.data(), old[i].key.size(), old[i].hash);
+			e->key.swap(old[i].key);
+			e->hash = old[i].hash;
+			e->value = old[i].value;
+			e->used = true;
+		}
+	}
+
+public:
+	CaselessIndex() : m_size(0) {}
+
+	size_t size() const { return m_size; }
+	void clear() { m_entries.clear(); m_size = 0; }
+
+	// Overwrites the value if the name (in any case) is there already.
+	void insert(const std::string& key, const T& value) {
+		if((m_size + 1) * 2 > m_entries.size()) grow();
+		const size_t hash = stringcasehash()(key.data(), key.size());
+		Entry* e = lookup(key.data(), key.size(), hash);
+		if(!e->used) {
+			e->key = key;
+			e->hash = hash;
+			e->used = true;
+			m_size++;
+		}
+		e->value = value;
+	}
+
+	// Returns NULL if not found.
+	T* find(const char* s, size_t len) {
+		Entry* e = lookup(s, len, stringcasehash()(s, len));
+		return (e && e->used) ? &e->value : NULL;
+	}
+	T* find(const std::string& key) { return find(key.data(), key.size()); }
+};
+
+#endif
@@ -18,6 +18,22 @@
 #define INLINE __attribute__((always_inline)) inline
 #endif
 
+// Branch prediction hints
+#ifdef __GNUC__
+#define LIKELY(x) __builtin_expect(!!(x), 1)
+#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define LIKELY(x) (x)
+#define UNLIKELY(x) (x)
+#endif
+
+// Thread local storage for POD types
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 class DontCopyTag {
 public:
 	DontCopyTag() {}
@@ -89,4 +89,20 @@ extern Logger hints;
 extern Logger warnings;
 extern Logger errors;
 
+// Moves the output of all loggers to a background writer thread, see Debug.cpp.
+// jsonFile (if set) gets every message as a JSON line, for log analysis.
+void StartAsyncLogging(const std::string& jsonFile = "");
+void StopAsyncLogging();
+// Waits until everything logged so far is written out. timeoutMs < 0 waits forever.
+bool FlushLogs(int timeoutMs = -1);
+
+struct LogStats {
+	bool async;
+	unsigned long long enqueued, written, dropped;
+	size_t queuedBytes;
+	size_t threads;
+	LogStats() : async(false), enqueued(0), written(0), dropped(0), queuedBytes(0), threads(0) {}
+};
+LogStats GetLogStats();
+
 #endif
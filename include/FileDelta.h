@@ -0,0 +1,48 @@
+/*
+ *  FileDelta.h
+ *  OpenLieroX
+ *
+ *  rsync-style block delta of files, for updating outdated mod/map files
+ *
+ *  code under LGPL
+ *
+ */
+
+#ifndef __OLX__FILEDELTA_H__
+#define __OLX__FILEDELTA_H__
+
+#include <string>
+#include <SDL.h>
+
+/*
+ The side which has the old version of a file sends the signature of it:
+ the file is split into blocks, and for every block a weak rolling checksum
+ (like Adler32, but it can be moved by one byte in O(1)) and a strong
+ checksum (CRC32) is sent.
+
+ The side with the new version slides a window of the block size over its
+ file and looks the weak checksum of every position up in the signature.
+ On a hit which also matches the strong checksum, it writes an instruction
+ to copy that block of the old file, otherwise the byte goes literally into
+ the delta. So the delta is about as big as the changed parts.
+
+ Signature: Int(blockSize,4), Int(fileSize,4), per block Int(weak,4), Int(strong,4)
+ Delta: Int(newSize,4), Int(newAdler32,4), Int(blockSize,4), instructions, Byte(FD_End)
+	FD_Copy: Int(first block,4), Int(block count,4)
+	FD_Literal: Int(len,4), data
+
+ The result is checked with the Adler32 of the new file, so a collision of
+ both checksums gives an error and not a broken file.
+*/
+
+enum { FileDeltaMaxSignatureBlocks = 512, FileDeltaMinBlockSize = 1024 };
+
+// Block size for a file of the given size, so that the signature stays below FileDeltaMaxSignatureBlocks blocks
+Uint32 FileDeltaBlockSize(size_t fileSize);
+std::string FileDeltaSignature(const std::string& oldData);
+// Returns false if the signature is invalid.
+bool FileDeltaCreate(const std::string& signature, const std::string& newData, std::string* delta);
+// Returns false if the delta is invalid or does not fit to oldData.
+bool FileDeltaApply(const std::string& oldData, const std::string& delta, std::string* newData);
+
+#endif
@@ -24,12 +24,16 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
 #include <stdio.h>  // for FILE
 #include "ThreadPool.h"
 #include <SDL_mutex.h>
 #include "HTTP.h"
 #include "olx-types.h"
 #include "CBytestream.h"
+#include <boost/shared_ptr.hpp>
+
+struct CmdLineIntf;
 
 
 // File download states
@@ -168,14 +172,46 @@ public:
 	std::list<CHttpDownloader *> *GetDownloads()		{ return &tDownloads; }
 };
 
+// A file prepared for CUdpFileDownloader::setFileToSend: "path\0data", zlib compressed.
+// They are cached server-wide, so a map which ten clients are missing is compressed only once.
+struct UdpFileBlob {
+	std::string path;
+	Uint32 fileChecksum; // Adler32 of the file, the same as StatInfo::checksum
+	Uint32 blobChecksum; // Adler32 of data
+	std::string data;
+};
+typedef boost::shared_ptr<const UdpFileBlob> UdpFileBlobPtr;
+
+// Returns NULL if the file cannot be read. The cache key is path + mtime + size,
+// if only the mtime changed but not the Adler32 of the file, the blob is reused.
+UdpFileBlobPtr GetUdpFileBlob(const std::string& path);
+// Like FileChecksum(), but cached by path + mtime + size
+bool GetUdpFileChecksum(const std::string& path, Uint32* checksum, Uint32* size);
+void DumpUdpFileBlobCache(CmdLineIntf& cli);
+
 // In-lobby or in-game file downloader over unreliable protocol - send packets of 256 bytes
 // Actually we're using reliable CChannel to send packets so this downloader
 // doesn't contain any checks on packet lost / received in wrong order, 
 // only Adler32 checksum which is calculated by zlib.
+//
+// Since 0.59 beta11, files (not the small control messages) are sent windowed if both sides
+// support it (setWindowedTransfer): the blob is split into chunks of WindowedChunkSize bytes
+// which go as unreliable S2C_FILETRANSFER messages, up to WindowedMaxInFlight of them in flight.
+// The receiver answers with C2S_FILETRANSFER selective acks (first missing chunk + bitmap of
+// the following 32), the sender retransmits chunks which are not acked after an RTO.
+// When a windowed download gets interrupted (disconnect, abort), the received part is kept
+// in memory and the next GET: request for the same path asks the server to resume at that
+// offset, if the file (StatInfo checksum) and its blob did not change meanwhile.
+//
+// Also since 0.59 beta11, requestFile() of a file which we have in an older version (see
+// isLocalFileOutdated) sends a DELTA: request with the FileDeltaSignature of our file instead
+// of GET:. The server answers with DELTA_ACK: (path + FileDeltaCreate), or with the whole file
+// if that is smaller. The result replaces our file, see replacesLocalFile(), but only if we
+// asked for that update ourselves and the file is in one of the setReplaceableDirs().
 class CUdpFileDownloader
 {
 public:
-	CUdpFileDownloader() { reset(); bAllowFileRequest = true; };
+	CUdpFileDownloader() { reset(); bAllowFileRequest = true; bWindowed = false; };
 	~CUdpFileDownloader() { };
 
 	enum State_t 	{ S_SEND, S_RECEIVE, S_FINISHED };
@@ -213,6 +249,21 @@ public:
 	void		setDataToSend( const std::string & name, const std::string & data, bool noCompress = false );
 	void		setFileToSend( const std::string & path );
 
+	enum { WindowedChunkSize = 400, WindowedMaxInFlight = 64, WindowedAckBits = 32 };
+	void		setWindowedTransfer( bool w ) { bWindowed = w; }
+	bool		isWindowedTransfer() const { return bWindowed; }
+	bool		isSendingWindowed() const { return isSending() && cSendBlob.get() != NULL; }
+	// Sender: writes the next chunks, one S2C_FILETRANSFER message per stream in packets, each
+	// should go into its own unreliable packet. Returns true if the transfer is finished.
+	bool		sendWindowed( std::vector<CBytestream> & packets, AbsTime now, TimeDiff rtt );
+	// Sender: read a C2S_FILETRANSFER ack
+	void		receiveWindowedAck( CBytestream * bs );
+	// Receiver: read a S2C_FILETRANSFER chunk. Returns true if the download finished or an error occured,
+	// just like receive().
+	bool		receiveWindowed( CBytestream * bs, AbsTime now );
+	// Receiver: writes a C2S_FILETRANSFER ack if one is due. Returns true if something was written.
+	bool		writeWindowedAck( CBytestream * bs, AbsTime now );
+
 	void		reset();
 	
 	void		abortDownload();	// Aborts both downloading and uploading, data to send is in one packet less than 256 bytes
@@ -222,6 +273,12 @@ public:
 	void		requestFile( const std::string & path, bool retryIfFail );
 	bool		requestFilesPending(); // Re-send file request if downloading fails
 	void		removeFileFromRequest( const std::string & path );
+	// We have the file but StatInfo from the server says it differs, and the server can send deltas
+	bool		isLocalFileOutdated( const std::string & path ) const;
+	// The finished download is a newer version of a file we have, it should be overwritten
+	bool		replacesLocalFile() const { return bReplacesLocalFile; };
+	// Only files in these dirs (or these files) may be replaced, e.g. the mod and map of the lobby
+	void		setReplaceableDirs( const std::vector< std::string > & dirs ) { cReplaceableDirs = dirs; };
 	static bool	isPathValid( const std::string & path );	// Check if someone tries to access /etc/shadow to get system passwords
 	
 	struct		StatInfo
@@ -246,20 +303,51 @@ public:
 	size_t		getFilesPendingAmount() const;
 	size_t		getFilesPendingSize() const; // Calculates compressed size of all pending files, incluing the one currently downloading
 
+	// Transfers generated data of the given size between two downloaders over a simulated link
+	// (in virtual time), once with the windowed protocol and once with the old one chunk per round trip.
+	static void	benchmarkTransfer( CmdLineIntf & cli, size_t size, float loss, int rttMs );
+
 private:
 	void			processFileRequests();
+	void			setBlobToSend( const UdpFileBlobPtr & blob );
+	bool			finishReceive( size_t compressedSize ); // sData is the compressed blob
+	void			stashPartialDownload();
+	void			setDeltaToSend( const std::string & path, const std::string & signature );
+	bool			applyReceivedDelta( std::string * path );
+	bool			mayReplaceLocalFile( const std::string & path ) const;
 
 	// TODO: should use intern-pointer here
 	std::string		sFilename;
 	std::string		sData;
 	size_t			iPos;
 
+	bool			bWindowed;
+	// windowed sending
+	UdpFileBlobPtr	cSendBlob;
+	std::vector<AbsTime> cChunkSent; // AbsTime() if not sent yet
+	std::vector<bool> cChunkAcked;
+	size_t			iFirstUnacked;
+	size_t			iHighestAcked;
+	// windowed receiving; the blob is collected in sData
+	Uint32			iRecvBlobChecksum;
+	std::vector<bool> cChunkReceived;
+	size_t			iChunksReceived;
+	size_t			iFirstMissing;
+	size_t			iChunksSinceAck;
+	bool			bAckDue;
+	AbsTime			fLastAckSent;
+	std::pair<Uint32, Uint32> cLastCompleted; // blob checksum + size, to re-ack retransmits of a finished download
+
 	State_t			tPrevState;
 	State_t			tState;
 	bool			bWasError;
 	bool			bWasAborted;
 	
 	bool			bAllowFileRequest;
+	bool			bReplacesLocalFile;
+	std::set< std::string > cDeltaFailed; // get them as a whole next time
+	std::set< std::string > cUpdateRequested; // we sent DELTA: (or GET: after a failed delta) for them
+	std::vector< std::string > cReplaceableDirs;
 	
 	std::vector< std::string > tRequestedFiles;
 	
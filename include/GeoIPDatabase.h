@@ -47,12 +47,14 @@ struct GeoRecord  {
 };
 
 // The MaxMind's database reader
+// The whole database is kept in memory, so a lookup does not touch the disk
+// and lookups from several threads at once are fine.
 class GeoIPDatabase  {
-	FILE *m_file;
+	std::string m_data;
 	std::string m_fileName;
 
 	// Internal datbase data info
-	unsigned int *m_dbSegments;
+	unsigned int m_dbSegment; // records below are tree nodes
 	int m_dbType;
 	int m_recordLength;
 
@@ -61,18 +63,20 @@ class GeoIPDatabase  {
 	unsigned int seekRecord(unsigned long ipnum) const;
 	GeoRecord extractRecordCity(unsigned int seekRecord) const;
 	GeoRecord extractRecordCtry(unsigned int seekRecord) const;
-	unsigned long convertIp(const std::string& strIp) const;
 	void fillContinent(GeoRecord& res) const;
 
 public:
-	GeoIPDatabase() : m_file(NULL), m_dbSegments(NULL), m_dbType(0), m_recordLength(0) {}
-	~GeoIPDatabase();
+	GeoIPDatabase() : m_dbSegment(0), m_dbType(0), m_recordLength(0) {}
 
 	bool load(const std::string& filename);
+	bool loadFromMemory(const std::string& data);
 	void close();
-	bool loaded() const { return m_file != NULL; }
+	bool loaded() const { return !m_data.empty(); }
 
+	// Returns 0 for an invalid address. A port after the address is ignored.
+	static unsigned long convertIp(const std::string& strIp);
 	GeoRecord lookup(const std::string& ip) const;
+	GeoRecord lookup(unsigned long ipnum) const; // ipnum from convertIp, must not be 0
 
 };
 
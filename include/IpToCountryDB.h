@@ -11,21 +11,44 @@
 #define	__IPTOCOUNTRY_H__
 
 #include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <SDL.h>
 #include "SmartPointer.h"
+#include "Mutex.h"
 #include "InternDataClass.h"
 #include "GeoIPDatabase.h"
 
 struct SDL_Surface;
+struct CmdLineIntf;
 
 typedef GeoRecord IpInfo;
 
 INTERNDATA_CLASS_BEGIN(IpToCountryDB)
 private:
 	GeoIPDatabase *m_database;
+
+	// The results of the last lookups, by IP number, most recently used first
+	enum { MaxCachedIPs = 4096 };
+	typedef std::list< std::pair<unsigned long, IpInfo> > CacheList;
+	Mutex m_cacheMutex;
+	CacheList m_cache;
+	std::unordered_map<unsigned long, CacheList::iterator> m_cacheIndex;
+	Uint64 m_cacheHits, m_cacheMisses;
+
+	bool GetCachedInfo(unsigned long ipnum, IpInfo& info); // m_cacheMutex must be locked
+	void AddCachedInfo(unsigned long ipnum, const IpInfo& info); // m_cacheMutex must be locked
+	IpInfo LookupInfo(unsigned long ipnum);
+	static bool GetSpecialInfo(const std::string& address, IpInfo& info);
 public:
 	IpToCountryDB(const std::string& dbfile);
 	void LoadDBFile(const std::string& dbfile);
+	void LoadDBData(const std::string& data); // database file content, e.g. for tests
 	IpInfo GetInfoAboutIP(const std::string& Address);
+	// Same as GetInfoAboutIP for each address, but takes the cache lock only twice
+	void GetInfoAboutIPs(const std::vector<std::string>& addresses, std::vector<IpInfo>& infos);
+	void DumpCacheStats(CmdLineIntf& cli);
 	SmartPointer<SDL_Surface> GetCountryFlag(const std::string& shortcut);
 	int	GetProgress() { return 100; }
 	bool Loaded()  { return m_database != NULL && m_database->loaded(); }
@@ -0,0 +1,95 @@
+/*
+	OpenLieroX
+
+	runtime metrics (counters, gauges, histograms) in the Prometheus text format
+
+	code under LGPL
+*/
+
+#ifndef __OLX_METRICS_H__
+#define __OLX_METRICS_H__
+
+#include <string>
+#include <atomic>
+#include <SDL.h>
+#include "CodeAttributes.h"
+
+struct CmdLineIntf;
+
+/*
+	Usage: get the metric once and keep the reference, e.g.
+
+		static Metrics::Counter& sent = Metrics::counter("olx_net_packets_sent_total", "UDP/TCP packets sent");
+		sent.inc();
+
+	Registration takes a mutex, updates are single relaxed atomic operations,
+	so any thread (game, network, sound) may update without locking. Metrics
+	are never freed, the references stay valid until the end.
+
+	Metrics with the same name and different labels (like client="3") are
+	one family in the export. Labels are given as in the text format, without
+	the braces: client="3",dir="out".
+
+	The endpoint (option Misc.MetricsEndpoint or command metricsEndpoint) is
+	a thread which answers every HTTP request with the current export, on
+	127.0.0.1:<port> or, on Unix, on a domain socket "unix:<path>". The
+	console command "metrics" prints the export, and "checkMetrics" reads it
+	back over the endpoint as a self-test, also on a headless server.
+*/
+namespace Metrics {
+	class Counter : DontCopyTag {
+		std::atomic<Uint64> m_value;
+	public:
+		Counter() : m_value(0) {}
+		void inc(Uint64 n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+		Uint64 value() const { return m_value.load(std::memory_order_relaxed); }
+	};
+
+	class Gauge : DontCopyTag {
+		std::atomic<double> m_value;
+	public:
+		Gauge() : m_value(0) {}
+		void set(double v) { m_value.store(v, std::memory_order_relaxed); }
+		void add(double d);
+		double value() const { return m_value.load(std::memory_order_relaxed); }
+	};
+
+	// Buckets with fixed upper bounds; the export makes them cumulative.
+	class Histogram : DontCopyTag {
+	public:
+		enum { MaxBuckets = 16 };
+	private:
+		double m_bounds[MaxBuckets];
+		size_t m_numBounds;
+		std::atomic<Uint64> m_buckets[MaxBuckets + 1]; // the last one is +Inf
+		std::atomic<Uint64> m_count;
+		std::atomic<double> m_sum;
+	public:
+		Histogram(const double* bounds, size_t n);
+		void observe(double v);
+		size_t numBounds() const { return m_numBounds; }
+		double bound(size_t i) const { return m_bounds[i]; }
+		Uint64 bucket(size_t i) const { return m_buckets[i].load(std::memory_order_relaxed); } // not cumulative
+		Uint64 count() const { return m_count.load(std::memory_order_relaxed); }
+		double sum() const { return m_sum.load(std::memory_order_relaxed); }
+	};
+
+	// Returns the existing metric if it was registered already. The help of the first registration is kept.
+	Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+	Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+	Histogram& histogram(const std::string& name, const std::string& help, const double* bounds, size_t numBounds, const std::string& labels = "");
+
+	std::string exportText(); // Prometheus text format 0.0.4
+	void dump(CmdLineIntf& cli);
+
+	// where: "<port>" for 127.0.0.1:<port>, "unix:<path>" (not on Windows), "" or "off" to stop
+	bool startEndpoint(const std::string& where);
+	void stopEndpoint();
+	std::string endpointAddress(); // "" if not running
+
+	// Scrapes the own endpoint (started on a free port if needed) and compares it with the registry.
+	void checkEndpoint(CmdLineIntf& cli);
+	void benchmark(CmdLineIntf& cli, int ops);
+}
+
+#endif
@@ -27,7 +27,10 @@
 #include "SmartPointer.h"
 
 typedef std::map<size_t,size_t> ParamSeps;
+typedef std::vector< std::pair<size_t,size_t> > ParamSpans; // (start, length), in order
 
+// Appends the params in [from,to) to spans without copying them out. Clear and reuse spans to avoid allocations.
+void ParseParams_Spans(const std::string& params, ParamSpans& spans, size_t from = 0, size_t to = std::string::npos);
 ParamSeps ParseParams_Seps(const std::string& params);
 std::vector<std::string> ParseParams(const std::string& params);
 
@@ -119,7 +122,7 @@ void Execute(const CmdLineIntf::Command& cmd);
 INLINE void Execute(CmdLineIntf* sender, const std::string& cmd) { Execute(CmdLineIntf::Command(sender, NULL, cmd)); }
 INLINE void Execute(CmdLineIntf* sender, const SmartPointer<CmdLineIntf::ExecScope>& execScope, const std::string& cmd) { Execute(CmdLineIntf::Command(sender, execScope, cmd)); }
 
-bool havePendingCommands();
+bool havePendingCommands(); // only from the gameloop thread
 
 // Executes all commands in the queue. This is called from the gameloopthread.
 void HandlePendingCommands();
@@ -127,6 +130,7 @@ void HandlePendingCommands();
 // Executes in current thread, right now. Returns all pushed return values.
 // WARNING: Only call this if you know this is safe. If you don't really need that, use Execute above.
 std::vector<std::string> Execute_Here(const std::string& cmd);
+void Execute_Here(CmdLineIntf& sender, const std::string& cmd); // like above, but the sender gets the messages and return values
 
 
 #endif  //  __CON_COMMAND_H__
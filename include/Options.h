@@ -319,7 +319,9 @@ public:
     int     nMaxFPS;
 	int		iJpegQuality;
 	int		iMaxCachedEntries;		// Amount of entries to cache, including maps, mods, images and sounds.
+	int		iMaxCacheMemory;		// Memory budget of the cache in MB, 0 = only limited by free system memory
 	bool	bMatchLogging;			// Save screenshot of every game final score
+	bool	bRecordServerDemos;		// Record a demo of every game we host, see game/Demo.h
 	bool	bRecoverAfterCrash;		// If we should try to recover after segfault etc, or generate coredump and quit
 	bool	bCheckForUpdates;		// Check for new development version on sourceforge.net
 
@@ -331,6 +333,9 @@ public:
 	std::string sDedicatedScriptArgs;
 	int		iVerbosity;			// the higher the number, the higher the amount of debug messages; 0 is default, at 10 it shows backtraces for all warnings
 	bool	bLogTimestamps;  // Show timestamps in console output
+	bool	bLogAsync;		// Format and write log messages in a background thread
+	std::string sLogJsonFile; // If set, all log messages are also appended there as JSON lines
+	std::string sMetricsEndpoint; // "<port>" for 127.0.0.1:<port> or "unix:<path>", empty for none
 	bool	bAdvancedLobby;  // Show advanced game info in join lobby
 	bool	bShowCountryFlags;
 	int		iRandomTeamForNewWorm; // server will randomly choose a team between 0-iRandomTeamForNewWorm
@@ -0,0 +1,97 @@
+/*
+	OpenLieroX
+
+	record and replay of inbound server datagrams, for offline load tests
+
+	code under LGPL
+*/
+
+#ifndef __OLX_PACKETLOG_H__
+#define __OLX_PACKETLOG_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <SDL.h>
+#include "Networking.h"
+#include "olx-types.h"
+#include "CodeAttributes.h"
+
+class CBytestream;
+class GameServer;
+struct CmdLineIntf;
+
+/*
+	File format (all numbers are LEB128 varints):
+
+		"OLXPKTLOG" version(byte)
+		records:
+			time delta in ms to the previous record
+			address id; if it equals the number of known addresses, a new
+				address follows as length + "ip:port" string
+			data length, data
+*/
+
+class PacketLogWriter : DontCopyTag {
+private:
+	FILE* file;
+	std::string filename;
+	AbsTime startTime;
+	Uint64 lastWrittenMs; // since startTime; deltas are taken from the absolute time so that rounding doesn't add up
+	std::map<std::string, Uint32> addrIds;
+	size_t packets;
+	size_t bytes;
+public:
+	PacketLogWriter() : file(NULL), lastWrittenMs(0), packets(0), bytes(0) {}
+	~PacketLogWriter() { close(); }
+	bool open(const std::string& fn);
+	void close();
+	bool isOpen() const { return file != NULL; }
+	void write(AbsTime time, const NetworkAddr& from, const CBytestream& bs);
+	void printStatus(CmdLineIntf& cli) const;
+};
+
+struct PacketLog {
+	struct Packet {
+		Uint32 time; // in ms since the start of the recording
+		Uint32 addrId;
+		std::string data;
+	};
+	std::vector<std::string> addresses;
+	std::vector<Packet> packets;
+
+	bool load(const std::string& fn);
+	void clear() { addresses.clear(); packets.clear(); }
+};
+
+/*
+	Feeds a recorded PacketLog into the running server as if the packets had
+	arrived over the network. Every recorded source address is remapped to
+	a distinct fake loopback address (127.1.x.y), once per copy, so one log
+	can simulate many clients. The server's answers go to these addresses
+	and are dropped by the OS. Packets of the recording server's own local
+	client (127.0.0.1) are skipped.
+
+	speed scales the recorded timestamps, speed > 1 is faster than realtime.
+*/
+class PacketReplayer : DontCopyTag {
+private:
+	PacketLog log;
+	std::vector<NetworkAddr> remapped; // copy * log.addresses.size() + addrId; invalid if skipped
+	int copies;
+	float speed;
+	AbsTime startTime;
+	size_t next;
+	size_t packetsInjected;
+	size_t bytesInjected;
+public:
+	PacketReplayer() : copies(0), speed(1.0f), next(0), packetsInjected(0), bytesInjected(0) {}
+	bool start(const std::string& fn, int copies, float speed, CmdLineIntf& cli);
+	void stop();
+	bool isActive() const { return copies > 0; }
+	bool frame(GameServer* server); // returns true if something was injected
+	void printStatus(CmdLineIntf& cli) const;
+};
+
+#endif
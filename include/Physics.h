@@ -23,6 +23,7 @@ class CProjectile;
 class CBonus;
 class CNinjaRope;
 class CMap;
+struct CmdLineIntf;
 
 // HINT: I call this class PhysicsEngine, though it doesn't matches the meaning
 // of engine completely as I intented it for Hirudo. But it can probably easily be
@@ -46,6 +47,7 @@ public:
 	// TODO: later, we should have a class World and all objects and the map are included there
 	// in the end, I want to have one single simulate(CWorld* world);
 	void simulateWorm(CWorm* worm, bool local);
+	void checkWormSteps(CmdLineIntf& cli, int steps); // row/column terrain probes against per-pixel ones
 	void simulateProjectiles(Iterator<CProjectile*>::Ref projs);
 	void simulateBonuses(CBonus* bonuses, size_t count);
 	
@@ -0,0 +1,75 @@
+/*
+	OpenLieroX
+
+	frame profiler with scoped zones
+
+	code under LGPL
+*/
+
+#ifndef __OLX_PROFILER_H__
+#define __OLX_PROFILER_H__
+
+#include <string>
+#include <map>
+#include <SDL.h>
+#include "CodeAttributes.h"
+
+struct CmdLineIntf;
+
+/*
+	Usage: put PROFILE_ZONE("name") at the top of a scope. The name must be a
+	string literal (only the pointer is recorded).
+
+	When the profiler is off, a zone costs one well-predicted branch on
+	Profiler::enabled. When it is on, each finished zone is written into a ring
+	buffer owned by the current thread (no locking on the recording path).
+
+	The console command "profiler" switches it on and off, exports the buffers
+	in the Chrome trace_event JSON format (open with chrome://tracing) and prints
+	the zones which took the most time. Dedicated servers print that summary
+	periodically while profiling.
+*/
+namespace Profiler {
+	extern bool enabled;
+
+	struct ThreadBuffer;
+	ThreadBuffer* getThreadBuffer(); // of the current thread, created on first use
+	Uint64 getTicks(); // in microseconds
+
+	void start();
+	void stop();
+	void clear();
+	bool exportChromeTrace(const std::string& filename);
+	void printTopZones(CmdLineIntf& cli, size_t count, Uint64 sinceTicks = 0);
+
+	struct ZoneStat {
+		Uint64 total; // in microseconds
+		Uint32 max;
+		Uint32 calls;
+		ZoneStat() : total(0), max(0), calls(0) {}
+	};
+	typedef std::map<const char*, ZoneStat> ZoneStats; // by pointer, names are literals
+	// Adds all recorded zones which started at or after sinceTicks.
+	void collectZoneStats(ZoneStats& stats, Uint64 sinceTicks = 0);
+
+	// Called once per main loop frame.
+	void frame();
+}
+
+class ProfileZone : DontCopyTag {
+private:
+	const char* name;
+	Profiler::ThreadBuffer* buffer;
+	Uint64 startTicks;
+	void begin(const char* n);
+	void end();
+public:
+	ProfileZone(const char* n) : buffer(NULL) { if(UNLIKELY(Profiler::enabled)) begin(n); }
+	~ProfileZone() { if(UNLIKELY(buffer != NULL)) end(); }
+};
+
+#define PROFILE_ZONE__CONCAT2(a, b) a##b
+#define PROFILE_ZONE__CONCAT(a, b) PROFILE_ZONE__CONCAT2(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_ZONE__CONCAT(__profileZone_, __LINE__)(name)
+
+#endif
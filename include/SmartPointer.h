@@ -9,6 +9,10 @@
 
 #include <limits.h>
 #include <cassert>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <SDL_mutex.h>
 
 #ifdef DEBUG
@@ -47,11 +51,37 @@ template <> void SmartPointer_ObjectDeinit<SoundSample> ( SoundSample * obj ); /
 template <> void SmartPointer_ObjectDeinit<CMap> ( CMap * obj ); // Requires to be defined elsewhere
 template <> void SmartPointer_ObjectDeinit<CGameScript> ( CGameScript * obj ); // Requires to be defined elsewhere
 
-#ifdef DEBUG
-extern SDL_mutex *SmartPointer_CollMutex;
-extern std::map< void *, SDL_mutex * > * SmartPointer_CollisionDetector;
+/*
+	Opt-in debugging aid (cmake -DSMARTPOINTER_COLLDETECT=Yes): detects two
+	independent SmartPointers owning the same object (which would free it twice).
+	It takes a global mutex on every init/deinit, so it is off by default.
+*/
+#ifdef SMARTPOINTER_COLLDETECT
+void SmartPointer_CollDetect_Register(void* obj);
+void SmartPointer_CollDetect_Unregister(void* obj);
 #endif
 
+// Shared by all SmartPointers to the same object.
+struct SmartPointer_RefCounter {
+	typedef void (*DestroyFunc) (SmartPointer_RefCounter*);
+	std::atomic<int> refCount;
+	DestroyFunc destroyCoAllocated; // set if the object lives in the same allocation, see SmartPointer::New
+	SmartPointer_RefCounter(DestroyFunc d) : refCount(1), destroyCoAllocated(d) {}
+};
+
+template < typename _Type >
+struct SmartPointer_CoAllocated {
+	SmartPointer_RefCounter counter;
+	typename std::aligned_storage< sizeof(_Type), std::alignment_of<_Type>::value >::type storage;
+
+	static void destroy(SmartPointer_RefCounter* c) {
+		SmartPointer_CoAllocated* block = reinterpret_cast<SmartPointer_CoAllocated*>(c);
+		reinterpret_cast<_Type*>(&block->storage)->~_Type();
+		block->counter.~SmartPointer_RefCounter();
+		::operator delete(block);
+	}
+};
+
 /*
 	standard smartpointer based on simple refcounting
 
@@ -61,6 +91,11 @@ extern std::map< void *, SDL_mutex * > * SmartPointer_CollisionDetector;
 	object in different threads. Also there is absolutly no
 	thread safty on the pointer itself, you have to care
 	about this yourself.
+
+	The refcount is a lock-free atomic counter. Copies only increment it,
+	the last reset() decrements it to zero and calls SmartPointer_ObjectDeinit.
+	SmartPointer::New constructs the object right behind its counter, which
+	saves one allocation and keeps both in the same cache line.
 */
 
 /*template < typename _Obj >
@@ -72,151 +107,101 @@ public:
 	typedef _Type value_type;
 private:
 	_Type* obj;
-	int* refCount;
-	SDL_mutex* mutex;
+	SmartPointer_RefCounter* counter;
 
 
 	void init(_Type* newObj) {
-#ifdef DEBUG
-		if (SmartPointer_CollMutex == NULL)
-			SmartPointer_CollMutex = SDL_CreateMutex();
-#endif
-
 		if( newObj == NULL )
 			return;
-		if(!mutex) {
-			mutex = SDL_CreateMutex();
-			obj = newObj;
-			refCount = new int;
-			*refCount = 1;
-			#ifdef DEBUG
-			SDL_LockMutex(SmartPointer_CollMutex);
-			if( SmartPointer_CollisionDetector == NULL )
-			{
-				//hints << "SmartPointer collision detector initialized" << endl; // Causes a crash during static init
-				SmartPointer_CollisionDetector = new std::map< void *, SDL_mutex * > ();
-			}
-			if( SmartPointer_CollisionDetector->count(obj) != 0 ) // Should be faster than find() I think
-			{
-				errors << "ERROR! SmartPointer collision detected, old mutex " << (*SmartPointer_CollisionDetector)[obj] 
-						<< ", new ptr (" << this << " " << obj << " " << refCount << " " << mutex << " " << (refCount?*refCount:-99) << ") new " << newObj << endl;
-				SDL_UnlockMutex(SmartPointer_CollMutex);
-				assert(false); // TODO: maybe do smth like *(int *)NULL = 1; to generate coredump? Simple assert(false) won't help us a lot
-			}
-			else
-				SmartPointer_CollisionDetector->insert( std::make_pair( obj, mutex ) );
-			SDL_UnlockMutex(SmartPointer_CollMutex);
-			#endif
-		}
+		obj = newObj;
+		counter = new SmartPointer_RefCounter(NULL);
+#ifdef SMARTPOINTER_COLLDETECT
+		SmartPointer_CollDetect_Register(obj);
+#endif
 	}
 
 	void reset() {
-		if(mutex) {
-			lock();
-			(*refCount)--;
-			if(*refCount == 0) {
-				#ifdef DEBUG
-				SDL_LockMutex(SmartPointer_CollMutex);
-				if( !SmartPointer_CollisionDetector || SmartPointer_CollisionDetector->count(obj) == 0 )
-				{
-					errors << "ERROR! SmartPointer already deleted reference ("
-							<< this << " " << obj << " " << refCount << " " << mutex << " " << (refCount?*refCount:-99) << ")" << endl;
-					if(!SmartPointer_CollisionDetector)
-						errors << "SmartPointer_CollisionDetector is already uninitialised" << endl;
-					SDL_UnlockMutex(SmartPointer_CollMutex);
-					assert(false);
-				}
-				else
-				{
-					SmartPointer_CollisionDetector->erase(obj);
-					if( SmartPointer_CollisionDetector->empty() )
-					{
-						delete SmartPointer_CollisionDetector;
-						SmartPointer_CollisionDetector = NULL;
-						if (SmartPointer_CollMutex)
-						{
-							SDL_DestroyMutex(SmartPointer_CollMutex);
-							SmartPointer_CollMutex = NULL;
-						}
-
-						// WARNING: this is called at a very end for global objects and most other objects are already uninitialised.
-						// For me, even the internal string structure doesn't work anymore (I get a std::length_error) and thus we cannot use the logging system.
-						// TODO: Remove any global objects! We should not have any globals, at least not such complex globals.
-						#ifdef DEBUG						
-						printf("SmartPointer collision detector de-initialized, everything is freed now\n");
-						#endif
-					}
+		if(counter) {
+			// acq_rel: the thread which deletes must see all writes of the others
+			if(counter->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+#ifdef SMARTPOINTER_COLLDETECT
+				SmartPointer_CollDetect_Unregister(obj);
+#endif
+				if(counter->destroyCoAllocated)
+					counter->destroyCoAllocated(counter);
+				else {
+					SmartPointer_ObjectDeinit( obj );
+					delete counter; // safe, because there is no other ref anymore
 				}
-				if( SmartPointer_CollMutex )
-					SDL_UnlockMutex(SmartPointer_CollMutex);
-				#endif
-				SmartPointer_ObjectDeinit( obj );
-				delete refCount; // safe, because there is no other ref anymore
-				obj = NULL;
-				refCount = NULL;
-				unlock();
-				SDL_DestroyMutex(mutex); // safe because there is no other ref anymore
-				mutex = NULL;
-		 	} else
-		 		unlock();
+			}
 		}
 		obj = NULL;
-		refCount = NULL;
-		mutex = NULL;
+		counter = NULL;
 	}
 
 	void incCounter() {
-		assert(*refCount > 0 && *refCount < INT_MAX);
-		(*refCount)++;
-	}
-
-	void lock() {
-		//printf("SmartPointer::lock    (%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
-		SDL_mutexP(mutex);
-	}
-	void unlock() {
-		//printf("SmartPointer::unlock  (%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
-		SDL_mutexV(mutex);
+		assert(counter->refCount.load(std::memory_order_relaxed) > 0);
+		assert(counter->refCount.load(std::memory_order_relaxed) < INT_MAX);
+		// relaxed is enough: we already hold a reference, so it cannot drop to zero meanwhile
+		counter->refCount.fetch_add(1, std::memory_order_relaxed);
 	}
 
 public:
-	SmartPointer() : obj(NULL), refCount(NULL), mutex(NULL) {
-		//printf("SmartPointer::construc(%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
+	SmartPointer() : obj(NULL), counter(NULL) {
 		_SpecificInitFunctor()(this);
 	}
 	~SmartPointer() {
-		//printf("SmartPointer::destruct(%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
 		reset();
 	}
 
 	// Default copy constructor and operator=
 	// If you specify any template<> params here these funcs will be silently ignored by compiler
-	SmartPointer(const SmartPointer& pt) : obj(NULL), refCount(NULL), mutex(NULL) { operator=(pt); }
+	SmartPointer(const SmartPointer& pt) : obj(pt.obj), counter(pt.counter) { if(counter) incCounter(); }
 	SmartPointer& operator=(const SmartPointer& pt) {
-		if(mutex == pt.mutex) return *this; // ignore this case
+		if(counter == pt.counter) return *this; // ignore this case
+		// inc first, pt may be owned by the object we are about to release
+		SmartPointer_RefCounter* newCounter = pt.counter;
+		_Type* newObj = pt.obj;
+		if(newCounter) newCounter->refCount.fetch_add(1, std::memory_order_relaxed);
 		reset();
-		mutex = pt.mutex;
-		if(mutex) {
-			lock();
-			obj = pt.obj; refCount = pt.refCount;
-			incCounter();
-			unlock();
-		} else { obj = NULL; refCount = NULL; }
+		obj = newObj; counter = newCounter;
 		return *this;
 	}
 
 	// WARNING: Be carefull, don't assing a pointer to different SmartPointer objects,
 	// else they will get freed twice in the end. Always copy the SmartPointer itself.
 	// In short: SmartPointer ptr(SomeObj); SmartPointer ptr1( ptr.get() ); // It's wrong, don't do that.
-	SmartPointer(_Type* pt): obj(NULL), refCount(NULL), mutex(NULL) { operator=(pt); }
+	SmartPointer(_Type* pt): obj(NULL), counter(NULL) { init(pt); }
 	SmartPointer& operator=(_Type* pt) {
-		//printf("SmartPointer::op=Type (%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
 		if(obj == pt) return *this; // ignore this case
 		reset();
 		init(pt);
 		return *this;
 	}
 
+	// Constructs the object and its refcounter in one allocation.
+	// The object is destroyed by its destructor, not by SmartPointer_ObjectDeinit,
+	// so don't use this for types with a specialized deinit (SDL_Surface, CMap, ...).
+	template< typename... _Args >
+	static SmartPointer New(_Args&&... args) {
+		SmartPointer_CoAllocated<_Type>* block = static_cast<SmartPointer_CoAllocated<_Type>*>(::operator new(sizeof(SmartPointer_CoAllocated<_Type>)));
+		_Type* newObj = NULL;
+		try {
+			newObj = new (&block->storage) _Type(std::forward<_Args>(args)...);
+		}
+		catch(...) {
+			::operator delete(block);
+			throw;
+		}
+		SmartPointer ret;
+		ret.obj = newObj;
+		ret.counter = new (&block->counter) SmartPointer_RefCounter(&SmartPointer_CoAllocated<_Type>::destroy);
+#ifdef SMARTPOINTER_COLLDETECT
+		SmartPointer_CollDetect_Register(newObj);
+#endif
+		return ret;
+	}
+
 	_Type* get() const { return obj; }	// The smartpointer itself won't change when returning address of obj, so it's const.
 
 	// HINT: no convenient cast functions in this class to avoid error-prone automatic casts
@@ -226,26 +211,19 @@ public:
 	
 	// refcount may be changed from another thread, though if refcount==1 or 0 it won't change
 	int getRefCount() {
-		int ret = 0;
-		if(mutex) {
-			lock();
-			ret = *refCount;
-			unlock(); // Here the other thread may change refcount, that's why it's approximate
-		}
-		return ret;
+		if(counter)
+			return counter->refCount.load(std::memory_order_acquire); // the other thread may change refcount, that's why it's approximate
+		return 0;
 	}
 
 	// Returns true only if the data is deleted (no other smartpointer used it), sets pointer to NULL then
 	bool tryDeleteData() {
-		if(mutex) {
-			lock();
-			if( *refCount == 1 )
+		if(counter) {
+			if( counter->refCount.load(std::memory_order_acquire) == 1 )
 			{
-				unlock(); // Locks mutex again inside reset(), since we're only ones using data refcount cannot change from other thread
-				reset();
+				reset(); // since we're the only ones using data, refcount cannot change from other thread
 				return true;	// Data deleted
 			}
-			unlock();
 			return false; // Data not deleted
 		}
 		return true;	// Data was already deleted
@@ -213,6 +213,28 @@ struct stringcaseless {
 	}
 };
 
+// Case-insensitive FNV-1a hash, to be used together with stringcaseequalto in hash containers.
+// It doesn't allocate, so lookups don't need a lowercased copy of the key.
+struct stringcasehash {
+	size_t operator()(const std::string& s) const {
+		return (*this)(s.data(), s.size());
+	}
+	size_t operator()(const char* s, size_t len) const {
+		Uint32 h = 2166136261U;
+		for(size_t i = 0; i < len; ++i) {
+			h ^= (Uint32)tolower((uchar)s[i]);
+			h *= 16777619U;
+		}
+		return (size_t)h;
+	}
+};
+
+struct stringcaseequalto {
+	bool operator()(const std::string& s1, const std::string& s2) const {
+		return stringcaseequal(s1, s2);
+	}
+};
+
 
 struct const_string_iterator {
 	const std::string& str;
@@ -89,7 +89,9 @@ public:
 	TaskManager();
 	~TaskManager();
 	
-	enum QueueType { QT_NoQueue, QT_GlobalQueue, QT_QueueToSameTypeAndBreakCurrent };
+	// QT_Scheduler is for short work which does not block (no network, no waiting for other threads):
+	// it runs on a TaskScheduler worker, without handing it to a new thread.
+	enum QueueType { QT_NoQueue, QT_GlobalQueue, QT_QueueToSameTypeAndBreakCurrent, QT_Scheduler };
 	void start(Task* t, QueueType queue = QT_NoQueue);
 	ScopedTask haveTaskOfType(const std::type_info& taskType); // call with typeid(TaskClass)
 	void finishQueuedTasks();
@@ -0,0 +1,88 @@
+/*
+ *  TaskScheduler.h
+ *  OpenLieroX
+ *
+ *  work-stealing scheduler for short engine tasks
+ *
+ *  code under LGPL
+ *
+ */
+
+#ifndef __OLX__TASKSCHEDULER_H__
+#define __OLX__TASKSCHEDULER_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <boost/function.hpp>
+#include "CodeAttributes.h"
+
+struct CmdLineIntf;
+struct TaskSchedulerIntern;
+
+/*
+ The TaskScheduler runs many small tasks on a fixed set of worker threads,
+ one per CPU core (minus the one of the main thread). It is meant for
+ splitting up CPU work, e.g. with parallel_for.
+
+ Use the ThreadPool (or the TaskManager) instead for everything which
+ blocks (network, DNS, waiting for other threads) or which runs for a long
+ time in a loop, like the AI pathfinding. A blocked task also blocks a
+ worker.
+
+ Every worker has its own deques (one per priority). Tasks spawned from a
+ worker go to the back of its own deque and the worker takes them from the
+ back again, so nested work stays on the same core. Idle workers steal
+ from the front of the other deques. Tasks from other threads go to a
+ global queue. Latency-critical tasks are always taken before background
+ tasks.
+
+ A thread which waits for a TaskGroup runs queued tasks meanwhile, but only
+ those of at most the priority of the group. So the game loop waiting for
+ its parallel_for does not get stuck in background loading work.
+*/
+
+class TaskGroup : DontCopyTag {
+public:
+	enum Priority { P_LatencyCritical = 0, P_Background = 1, P_Count };
+private:
+	friend struct TaskSchedulerIntern;
+	std::atomic<int> pending;
+	Priority priority;
+public:
+	TaskGroup(Priority p = P_LatencyCritical) : pending(0), priority(p) {}
+	~TaskGroup() { wait(); }
+	Priority getPriority() const { return priority; }
+	bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+	void wait(); // the calling thread helps running tasks meanwhile
+};
+
+class TaskScheduler : DontCopyTag {
+private:
+	friend class TaskGroup;
+	TaskSchedulerIntern* data;
+public:
+	typedef boost::function<void()> Func;
+	typedef boost::function<void(size_t, size_t)> RangeFunc; // [begin, end)
+
+	TaskScheduler(unsigned int workers);
+	~TaskScheduler(); // runs all left tasks and stops the workers
+
+	unsigned int workerCount() const;
+	// If group is set, it must not be destroyed before the task finished (its destructor waits).
+	void spawn(const Func& f, TaskGroup* group);
+	void spawn(const Func& f, TaskGroup::Priority p = TaskGroup::P_Background); // fire and forget
+	// Calls body for chunks of [begin, end) of about grain elements (0: choose automatically)
+	// and returns when all are done.
+	void parallel_for(size_t begin, size_t end, size_t grain, const RangeFunc& body, TaskGroup::Priority p = TaskGroup::P_LatencyCritical);
+	void dumpState(CmdLineIntf& cli) const;
+};
+
+extern TaskScheduler* taskScheduler;
+
+void InitTaskScheduler();
+void UnInitTaskScheduler();
+
+// Runs serially if there is no scheduler (yet), so it can be used everywhere.
+void parallel_for(size_t begin, size_t end, size_t grain, const TaskScheduler::RangeFunc& body, TaskGroup::Priority p = TaskGroup::P_LatencyCritical);
+
+#endif
@@ -76,7 +76,7 @@ public:
 
 extern ThreadPool* threadPool;
 
-void InitThreadPool(unsigned int size = 40);
+void InitThreadPool(unsigned int size = 0); // 0: from the CPU count
 void UnInitThreadPool();
 
 extern ThreadId mainThreadId;
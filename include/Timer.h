@@ -33,11 +33,17 @@ struct TimeCounter {
 	SDL_mutex* mutex;
 	AbsTime time;
 	Uint32 lastTicks;
+	bool manual; // if set, the time only moves on via advance() (deterministic benchmark runs)
 	
-	TimeCounter() : time(0), lastTicks(0) { mutex = SDL_CreateMutex(); lastTicks = SDL_GetTicks(); }
+	TimeCounter() : time(0), lastTicks(0), manual(false) { mutex = SDL_CreateMutex(); lastTicks = SDL_GetTicks(); }
 	~TimeCounter() { SDL_DestroyMutex(mutex); mutex = NULL; }
 	AbsTime update() {
 		if(mutex) SDL_mutexP(mutex);
+		if(manual) {
+			AbsTime t = time;
+			if(mutex) SDL_mutexV(mutex);
+			return t;
+		}
 		Uint32 curTicks = SDL_GetTicks();
 		if(curTicks < lastTicks) {
 			AbsTime t = time;
@@ -52,6 +58,17 @@ struct TimeCounter {
 		if(mutex) SDL_mutexV(mutex);
 		return t;
 	}
+	void setManual(bool m) {
+		if(mutex) SDL_mutexP(mutex);
+		manual = m;
+		lastTicks = SDL_GetTicks(); // don't count the time spent in manual mode when we switch back
+		if(mutex) SDL_mutexV(mutex);
+	}
+	void advance(TimeDiff td) {
+		if(mutex) SDL_mutexP(mutex);
+		time += td;
+		if(mutex) SDL_mutexV(mutex);
+	}
 };
 extern TimeCounter timeCounter;
 
@@ -72,13 +89,13 @@ std::string		GetDateTime();
 /*
 	Timer class
 
-	After start(), there is a thread which will push frequently events to the
-	SDL event queue. It will use the settings at the time of starting the timer.
-	All later changes are ignored. If you hit start again, the current thread
-	will stop and a new one with the new settings will be started. stop() will
-	stop the timer.
+	After start(), the timer service thread (shared by all timers, see
+	Timer.cpp) will push frequently events to the SDL event queue. It will use
+	the settings at the time of starting the timer. All later changes are
+	ignored. If you hit start again, the timer is rescheduled with the new
+	settings. stop() will stop the timer.
 	
-	After stop() returns, no more events belonging to this thread
+	After stop() returns, no more events belonging to this timer
 	will be handled (this is guaranteed). Though it's possible that there
 	is one last event handled exactly at the time of calling stop() when
 	calling it from another thread than the main thread. If you call stop()
@@ -87,7 +104,7 @@ std::string		GetDateTime();
 	The events itself will be handled in the main thread
 	(in the thread that calls ProcessEvents()).
 
-	If the callback-functions returns false, the thread will also stop.
+	If the callback-functions returns false, the timer will also stop.
 
 	You can also use startHeadless() which will run independently from the
 	object. That means that stop() has no effect on the thread. The only
@@ -74,6 +74,8 @@
 #include "CServer.h"
 #include "Geometry.h"
 #include "MainLoop.h"
+#include "Profiler.h"
+#include "OLXCommand.h"
 #include "gusanos/allegro.h"
 
 
@@ -544,6 +546,8 @@ bool VideoPostProcessor::resetVideo() {
 		errors << "failed to init video texture: " << SDL_GetError() << endl;
 		return false;
 	}
+	// the new texture is empty
+	m_uploadedPixelsValid = false;
 	
 	// No need to reinit this.
 	if(!m_videoBufferSurface.get()) {
@@ -567,13 +571,132 @@ void VideoPostProcessor::flipBuffers() {
 // IMPORTANT: this has to be called from main thread!
 
 void VideoPostProcessor::process() {
+	PROFILE_ZONE("VideoPostProcessor::process");
 	ProcessScreenshots();
 	
-	void* pixels = get()->m_videoBufferSurface->pixels;
-	SDL_UpdateTexture(get()->m_videoTexture.get(), NULL, pixels, get()->screenWidth() * sizeof (uint32_t));
+	get()->uploadChangedRects();
+}
+
+/*
+ Most frames (menus, lobby, spectating) change only small parts of the screen.
+ We keep a copy of what we have uploaded into the texture and compare the new
+ frame with it in tiles. Only the changed tiles are uploaded, merged to
+ rectangles, and if nothing changed at all, render() does not even present.
+
+ Comparing is much cheaper than uploading and it also catches drawing which
+ does not go through the common drawing functions (direct pixel access,
+ Gusanos, widgets which redraw the same content every frame).
+*/
+enum { UploadTileW = 32, UploadTileH = 16 };
+
+void VideoPostProcessor::uploadChangedRects() {
+	SDL_Surface* surf = m_videoBufferSurface.get();
+	if(!surf || !m_videoTexture.get()) return;
+	const int bpp = surf->format->BytesPerPixel;
+	const size_t rowBytes = (size_t)surf->w * bpp;
+	const Uint8* pixels = (const Uint8*)surf->pixels;
+
+	std::vector<SDL_Rect> rects;
+	if(!m_uploadedPixelsValid || m_uploadedPixels.size() != rowBytes * surf->h) {
+		m_uploadedPixels.resize(rowBytes * surf->h);
+		SDL_Rect r = { 0, 0, surf->w, surf->h };
+		rects.push_back(r);
+	}
+	else {
+		const int tilesX = (surf->w + UploadTileW - 1) / UploadTileW;
+		std::vector<bool> changed(tilesX);
+		std::vector<size_t> lastBand, curBand; // indices into rects which end at the current band
+		for(int y = 0; y < surf->h; y += UploadTileH) {
+			const int bandH = MIN((int)UploadTileH, surf->h - y);
+			changed.assign(tilesX, false);
+			for(int row = y; row < y + bandH; ++row) {
+				const Uint8* src = pixels + row * surf->pitch;
+				const Uint8* old = &m_uploadedPixels[row * rowBytes];
+				if(memcmp(src, old, rowBytes) == 0) continue;
+				for(int t = 0; t < tilesX; ++t) {
+					if(changed[t]) continue;
+					const size_t off = (size_t)t * UploadTileW * bpp;
+					const size_t len = MIN((size_t)UploadTileW * bpp, rowBytes - off);
+					if(memcmp(src + off, old + off, len) != 0)
+						changed[t] = true;
+				}
+			}
+
+			// Runs of changed tiles in this band. A run with the same columns
+			// as one in the band above extends that rectangle.
+			curBand.clear();
+			for(int t = 0; t < tilesX; ) {
+				if(!changed[t]) { ++t; continue; }
+				int end = t;
+				while(end < tilesX && changed[end]) ++end;
+				const int x = t * UploadTileW;
+				const int w = MIN(end * UploadTileW, surf->w) - x;
+				bool extended = false;
+				for(size_t i = 0; i < lastBand.size(); ++i) {
+					SDL_Rect& r = rects[lastBand[i]];
+					if(r.x == x && r.w == w) {
+						r.h += bandH;
+						curBand.push_back(lastBand[i]);
+						extended = true;
+						break;
+					}
+				}
+				if(!extended) {
+					SDL_Rect r = { x, y, w, bandH };
+					curBand.push_back(rects.size());
+					rects.push_back(r);
+				}
+				t = end;
+			}
+			lastBand.swap(curBand);
+		}
+
+		// Many small uploads cost more than one big one
+		size_t area = 0;
+		for(size_t i = 0; i < rects.size(); ++i)
+			area += (size_t)rects[i].w * rects[i].h;
+		if(area * 4 > (size_t)surf->w * surf->h * 3) {
+			rects.clear();
+			SDL_Rect r = { 0, 0, surf->w, surf->h };
+			rects.push_back(r);
+		}
+	}
+
+	m_uploadStats.frames++;
+	m_uploadStats.lastFrameBytes = 0;
+	if(rects.empty()) {
+		m_uploadStats.framesSkipped++;
+		return;
+	}
+
+	for(size_t i = 0; i < rects.size(); ++i) {
+		const SDL_Rect& r = rects[i];
+		const Uint8* src = pixels + r.y * surf->pitch + r.x * bpp;
+		if(SDL_UpdateTexture(m_videoTexture.get(), &r, src, surf->pitch) != 0) {
+			// try again with the whole frame next time
+			m_uploadedPixelsValid = false;
+			break;
+		}
+		for(int row = r.y; row < r.y + r.h; ++row)
+			memcpy(&m_uploadedPixels[row * rowBytes + r.x * bpp], pixels + row * surf->pitch + r.x * bpp, r.w * bpp);
+		m_uploadStats.rects++;
+		m_uploadStats.lastFrameBytes += (size_t)r.w * r.h * bpp;
+		m_uploadedPixelsValid = true;
+	}
+	m_uploadStats.bytes += m_uploadStats.lastFrameBytes;
+	m_needPresent = true;
+}
+
+void VideoPostProcessor::dumpUploadStats(CmdLineIntf& cli) {
+	const UploadStats& s = get()->m_uploadStats;
+	cli.writeMsg("video frames: " + itoa(s.frames) + ", unchanged (not uploaded): " + itoa(s.framesSkipped));
+	cli.writeMsg("uploaded: " + itoa(s.rects) + " rects, " + itoa(s.bytes / 1024) + " KB, " +
+				 itoa(s.lastFrameBytes) + " bytes in the last frame (whole frame: " +
+				 itoa(get()->screenWidth() * get()->screenHeight() * 4) + " bytes)");
 }
 
 void VideoPostProcessor::render() {
+	PROFILE_ZONE("VideoPostProcessor::render");
 	//TestCircleDrawing(psScreen);
 	//TestPolygonDrawing(psScreen);
 	//DrawLoadingAni(psScreen, 320, 260, 50, 50, Color(128,128,128), Color(128,128,128,128), LAT_CIRCLES);
@@ -581,6 +704,11 @@ void VideoPostProcessor::render() {
 	
 	if(!get()->m_renderer.get()) return;
 	
+	// Nothing changed, the window still shows the last frame
+	const bool forced = get()->m_forcePresent.exchange(false);
+	if(!get()->m_needPresent && !forced) return;
+	get()->m_needPresent = false;
+	
 	SDL_RenderClear(get()->m_renderer.get());
 	SDL_RenderCopy(get()->m_renderer.get(), get()->m_videoTexture.get(), NULL, NULL);
 	SDL_RenderPresent(get()->m_renderer.get());
@@ -593,6 +721,7 @@ void VideoPostProcessor::cloneBuffer() {
 void VideoPostProcessor::uninit() {
 	instance.m_videoSurface = NULL; // should never be used before resetVideo() is called
 	instance.m_videoTexture = NULL;
+	instance.m_uploadedPixelsValid = false;
 	instance.m_renderer = NULL;
 	instance.m_window = NULL;
 }
@@ -614,6 +743,9 @@ void ShutdownAuxLib()
 	UnSubclassWindow();
 #endif
 
+	// stop the timer thread, it would block the final threadPool->waitAll()
+	ShutdownTimers();
+
 	// free all cached stuff like surfaces and sounds
 	// HINT: we have to do it before we uninit the specific engines
 	cCache.Clear();
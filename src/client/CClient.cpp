@@ -57,6 +57,7 @@
 #include "game/ServerList.h"
 #include "CGameScript.h"
 #include "client/ClientConnectionRequestInfo.h"
+#include "Profiler.h"
 #include <zip.h> // For unzipping downloaded mod
 #include "game/GameState.h"
 
@@ -694,6 +695,15 @@ const float fDownloadRetryTimeout = 4.0;	// Server should calculate CRC for larg
 
 void CClient::ProcessUdpUploads()
 {
+	// Acks of the windowed download which are due without a new chunk (see ParseFileTransfer)
+	if( cNetChan && getUdpFileDownloader()->isWindowedTransfer() )
+	{
+		CBytestream ack;
+		ack.writeByte(C2S_FILETRANSFER);
+		if( getUdpFileDownloader()->writeWindowedAck(&ack, tLX->currentTime) )
+			cNetChan->Transmit(&ack);
+	}
+
 	// Server requested some file (CRC check on our map) or we're sending file request
 	if( getUdpFileDownloader()->isSending() ) 
 	{
@@ -982,6 +992,7 @@ void CClient::ProcessModDownloads()
 // Main frame
 void CClient::Frame()
 {
+	PROFILE_ZONE("CClient::Frame");
 	// could be that some console command wants to quit
 	if(!tLX || game.state <= Game::S_Lobby)
 		return;
@@ -1026,6 +1037,7 @@ void CClient::NewNet_Frame()
 // Read the packets
 bool CClient::ReadPackets()
 {	
+	PROFILE_ZONE("CClient::ReadPackets");
 	bool anythingNew = false;
 
 	while(true) {
@@ -2145,7 +2157,9 @@ CChannel * CClient::createChannel(const Version& v)
 {
 	if( cNetChan )
 		delete cNetChan;
-	if( v >= OLXBetaVersion(0,58,1) )
+	if( v >= OLXBetaVersion(0,59,11) )
+		cNetChan = new CChannel4();
+	else if( v >= OLXBetaVersion(0,58,1) )
 		cNetChan = new CChannel3();
 	else if( v >= OLXBetaVersion(0,57,6) )
 		cNetChan = new CChannel2();
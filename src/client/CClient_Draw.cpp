@@ -57,11 +57,13 @@
 #include "game/Game.h"
 #include "gusanos/gusgame.h"
 #include "gusanos/luaapi/context.h"
+#include "gusanos/luaapi/memory.h"
 #include "game/SinglePlayer.h"
 #include "gusanos/network.h"
 #include "CodeAttributes.h"
 #include "CGameScript.h"
 #include "CWormHuman.h"
+#include "Profiler.h"
 
 
 SmartPointer<SDL_Surface> bmpMenuButtons = NULL;
@@ -413,6 +415,7 @@ void CClient::DrawBox(SDL_Surface * dst, int x, int y, int w)
 // Main drawing routines
 void CClient::Draw(const SmartPointer<SDL_Surface>& bmpDest)
 {
+	PROFILE_ZONE("CClient::Draw");
 #ifdef DEBUG
 	struct DrawDebugStrPostHandler {
 		CClient& cl;
@@ -704,6 +707,9 @@ void CClient::Draw(const SmartPointer<SDL_Surface>& bmpDest)
 		dbgtxtHudLines.push_back("Objects: " + cast<std::string>(game.objects.size()));
 		dbgtxtHudLines.push_back("Players: " + cast<std::string>(game.players.size()));
 		dbgtxtHudLines.push_back("Lua Mem: " + cast<std::string>(lua_gc(luaIngame, LUA_GCCOUNT, 0)));
+		if(LuaMemory* mem = LuaMemory::get(luaIngame))
+			if(mem->managed())
+				dbgtxtHudLines.push_back("Lua GC: " + itoa(mem->lastFrameGCTime()) + " us");
 	}
 	
 	foreach(i, hudDebugInfo)
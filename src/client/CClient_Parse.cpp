@@ -340,6 +340,7 @@ void CClientNetEngine::ParseConnected(CBytestream *bs)
 		}
 		client->cNetChan->Create(addr, client->tSocket);
 	}
+	client->getUdpFileDownloader()->setWindowedTransfer( client->getServerVersion() >= OLXBetaVersion(0,59,11) );
 	
 	if( client->getServerVersion().isBanned() )
 	{
@@ -615,6 +616,10 @@ bool CClientNetEngine::ParsePacket(CBytestream *bs)
                 ParseSendFile(bs);
                 break;
 
+			case S2C_FILETRANSFER:
+				ParseFileTransfer(bs);
+				break;
+
             case S2C_REPORTDAMAGE:
                 ParseReportDamage(bs);
                 break;
@@ -2082,93 +2087,128 @@ void CClientNetEngine::ParseDropped(CBytestream *bs)
 		NewNet::EndRound();
 }
 
-// Server sent us some file
-void CClientNetEngine::ParseSendFile(CBytestream *bs)
+// Server sent us a chunk of a file with the windowed transfer
+void CClientNetEngine::ParseFileTransfer(CBytestream *bs)
 {
-
 	client->fLastFileRequestPacketReceived = tLX->currentTime;
-	if( client->getUdpFileDownloader()->receive(bs) )
+	if( client->getUdpFileDownloader()->receiveWindowed(bs, tLX->currentTime) )
+		ProcessFinishedFileDownload();
+	// Acks go unreliable, there is no need to resend old ones
+	CBytestream ack;
+	ack.writeByte(C2S_FILETRANSFER);
+	if( client->getUdpFileDownloader()->writeWindowedAck(&ack, tLX->currentTime) )
+		client->cNetChan->Transmit(&ack);
+}
+
+// A file (or a file info) from the server is complete
+void CClientNetEngine::ProcessFinishedFileDownload()
+{
+	if( CUdpFileDownloader::isPathValid( client->getUdpFileDownloader()->getFilename() ) &&
+		( ! IsFileAvailable( client->getUdpFileDownloader()->getFilename() ) || client->getUdpFileDownloader()->replacesLocalFile() ) &&
+		client->getUdpFileDownloader()->isFinished() )
 	{
-		if( CUdpFileDownloader::isPathValid( client->getUdpFileDownloader()->getFilename() ) &&
-			! IsFileAvailable( client->getUdpFileDownloader()->getFilename() ) &&
-			client->getUdpFileDownloader()->isFinished() )
+		// Server sent us some file we don't have (or a newer version which we requested) - okay, save it
+		FILE * ff=OpenGameFile( client->getUdpFileDownloader()->getFilename(), "wb" );
+		if( ff == NULL )
 		{
-			// Server sent us some file we don't have - okay, save it
-			FILE * ff=OpenGameFile( client->getUdpFileDownloader()->getFilename(), "wb" );
-			if( ff == NULL )
-			{
-				errors << "CClientNetEngine::ParseSendFile(): cannot write file " << client->getUdpFileDownloader()->getFilename() << endl;
-				return;
-			};
-			fwrite( client->getUdpFileDownloader()->getData().data(), 1, client->getUdpFileDownloader()->getData().size(), ff );
-			fclose(ff);
+			errors << "CClientNetEngine::ProcessFinishedFileDownload(): cannot write file " << client->getUdpFileDownloader()->getFilename() << endl;
+			return;
+		};
+		fwrite( client->getUdpFileDownloader()->getData().data(), 1, client->getUdpFileDownloader()->getData().size(), ff );
+		fclose(ff);
 
-			if( client->getUdpFileDownloader()->getFilename().find("levels/") == 0 &&
-					IsFileAvailable( "levels/" + client->getGameLobby()[FT_Map].as<LevelInfo>()->path.get() ) )
-			{
-				client->bDownloadingMap = false;
-				client->bWaitingForMap = false;
-				client->FinishMapDownloads();
-				client->sMapDownloadName = "";
+		if( client->getUdpFileDownloader()->getFilename().find("levels/") == 0 &&
+				IsFileAvailable( "levels/" + client->getGameLobby()[FT_Map].as<LevelInfo>()->path.get() ) )
+		{
+			client->bDownloadingMap = false;
+			client->bWaitingForMap = false;
+			client->FinishMapDownloads();
+			client->sMapDownloadName = "";
 
-				DeprecatedGUI::bJoin_Update = true;
-				DeprecatedGUI::bHost_Update = true;
-			}
-			if( client->getUdpFileDownloader()->getFilename().find("skins/") == 0 )
-			{
-				// Loads skin from disk automatically on next frame
-				DeprecatedGUI::bJoin_Update = true;
-				DeprecatedGUI::bHost_Update = true;
-			}
-			if( ! client->bHaveMod &&
-				client->getUdpFileDownloader()->getFilename().find( client->getGameLobby()[FT_Mod].as<ModInfo>()->path ) == 0 &&
-				IsFileAvailable(client->getGameLobby()[FT_Mod].as<ModInfo>()->path + "/script.lgs", false) )
-			{
-				client->bDownloadingMod = false;
-				client->bWaitingForMod = false;
-				client->FinishModDownloads();
-				client->sModDownloadName = "";
+			DeprecatedGUI::bJoin_Update = true;
+			DeprecatedGUI::bHost_Update = true;
+		}
+		if( client->getUdpFileDownloader()->getFilename().find("skins/") == 0 )
+		{
+			// Loads skin from disk automatically on next frame
+			DeprecatedGUI::bJoin_Update = true;
+			DeprecatedGUI::bHost_Update = true;
+		}
+		if( client->getUdpFileDownloader()->getFilename().find( client->getGameLobby()[FT_Mod].as<ModInfo>()->path ) == 0 &&
+			( ( ! client->bHaveMod && IsFileAvailable(client->getGameLobby()[FT_Mod].as<ModInfo>()->path + "/script.lgs", false) ) ||
+			// updating an outdated mod, see below
+			( client->bHaveMod && client->bDownloadingMod && client->getUdpFileDownloader()->getFilesPendingAmount() == 0 ) ) )
+		{
+			client->bDownloadingMod = false;
+			client->bWaitingForMod = false;
+			client->FinishModDownloads();
+			client->sModDownloadName = "";
 
-				DeprecatedGUI::bJoin_Update = true;
-				DeprecatedGUI::bHost_Update = true;
-			}
+			DeprecatedGUI::bJoin_Update = true;
+			DeprecatedGUI::bHost_Update = true;
+		}
 
-			client->getUdpFileDownloader()->requestFilesPending(); // Immediately request another file
-			client->fLastFileRequest = tLX->currentTime;
+		client->getUdpFileDownloader()->requestFilesPending(); // Immediately request another file
+		client->fLastFileRequest = tLX->currentTime;
 
-		}
-		else
-		if( client->getUdpFileDownloader()->getFilename() == "STAT_ACK:" &&
-			client->getUdpFileDownloader()->getFileInfo().size() > 0 &&
-			! client->bHaveMod &&
-			client->getUdpFileDownloader()->isFinished() )
+	}
+	else
+	if( client->getUdpFileDownloader()->getFilename() == "STAT_ACK:" &&
+		client->getUdpFileDownloader()->getFileInfo().size() > 0 &&
+		( ! client->bHaveMod || client->bDownloadingMod ) &&
+		client->getUdpFileDownloader()->isFinished() )
+	{
+		// Got filenames list of mod dir - push "script.lgs" to the end of list to download all other data before.
+		// If we have the mod already, get the files which differ; they go as deltas (see FileDelta.h).
+		// Only the files of the lobby mod and map may be replaced by these updates.
+		std::vector<std::string> replaceable;
+		replaceable.push_back( client->getGameLobby()[FT_Mod].as<ModInfo>()->path + "/" );
+		if( client->getGameLobby()[FT_Map].as<LevelInfo>()->path.get() != "" )
+			replaceable.push_back( "levels/" + client->getGameLobby()[FT_Map].as<LevelInfo>()->path.get() );
+		client->getUdpFileDownloader()->setReplaceableDirs( replaceable );
+		uint f;
+		for( f=0; f<client->getUdpFileDownloader()->getFileInfo().size(); f++ )
 		{
-			// Got filenames list of mod dir - push "script.lgs" to the end of list to download all other data before
-			uint f;
-			for( f=0; f<client->getUdpFileDownloader()->getFileInfo().size(); f++ )
+			if( client->getUdpFileDownloader()->getFileInfo()[f].filename.find( client->getGameLobby()[FT_Mod].as<ModInfo>()->path ) == 0 &&
+				( ! IsFileAvailable( client->getUdpFileDownloader()->getFileInfo()[f].filename ) ||
+				client->getUdpFileDownloader()->isLocalFileOutdated( client->getUdpFileDownloader()->getFileInfo()[f].filename ) ) &&
+				stringcaserfind( client->getUdpFileDownloader()->getFileInfo()[f].filename, "/script.lgs" ) != std::string::npos )
 			{
-				if( client->getUdpFileDownloader()->getFileInfo()[f].filename.find( client->getGameLobby()[FT_Mod].as<ModInfo>()->path ) == 0 &&
-					! IsFileAvailable( client->getUdpFileDownloader()->getFileInfo()[f].filename ) &&
-					stringcaserfind( client->getUdpFileDownloader()->getFileInfo()[f].filename, "/script.lgs" ) != std::string::npos )
-				{
-					client->getUdpFileDownloader()->requestFile( client->getUdpFileDownloader()->getFileInfo()[f].filename, true );
-					client->fLastFileRequest = tLX->currentTime + 1.5f;	// Small delay so server will be able to send all the info
-					client->iModDownloadingSize = client->getUdpFileDownloader()->getFilesPendingSize();
-				}
+				client->getUdpFileDownloader()->requestFile( client->getUdpFileDownloader()->getFileInfo()[f].filename, true );
+				client->fLastFileRequest = tLX->currentTime + 1.5f;	// Small delay so server will be able to send all the info
+				client->iModDownloadingSize = client->getUdpFileDownloader()->getFilesPendingSize();
 			}
-			for( f=0; f<client->getUdpFileDownloader()->getFileInfo().size(); f++ )
+		}
+		for( f=0; f<client->getUdpFileDownloader()->getFileInfo().size(); f++ )
+		{
+			if( client->getUdpFileDownloader()->getFileInfo()[f].filename.find( client->getGameLobby()[FT_Mod].as<ModInfo>()->path ) == 0 &&
+				( ! IsFileAvailable( client->getUdpFileDownloader()->getFileInfo()[f].filename ) ||
+				client->getUdpFileDownloader()->isLocalFileOutdated( client->getUdpFileDownloader()->getFileInfo()[f].filename ) ) &&
+				stringcaserfind( client->getUdpFileDownloader()->getFileInfo()[f].filename, "/script.lgs" ) == std::string::npos )
 			{
-				if( client->getUdpFileDownloader()->getFileInfo()[f].filename.find( client->getGameLobby()[FT_Mod].as<ModInfo>()->path ) == 0 &&
-					! IsFileAvailable( client->getUdpFileDownloader()->getFileInfo()[f].filename ) &&
-					stringcaserfind( client->getUdpFileDownloader()->getFileInfo()[f].filename, "/script.lgs" ) == std::string::npos )
-				{
-					client->getUdpFileDownloader()->requestFile( client->getUdpFileDownloader()->getFileInfo()[f].filename, true );
-					client->fLastFileRequest = tLX->currentTime + 1.5f;	// Small delay so server will be able to send all the info
-					client->iModDownloadingSize = client->getUdpFileDownloader()->getFilesPendingSize();
-				}
+				client->getUdpFileDownloader()->requestFile( client->getUdpFileDownloader()->getFileInfo()[f].filename, true );
+				client->fLastFileRequest = tLX->currentTime + 1.5f;	// Small delay so server will be able to send all the info
+				client->iModDownloadingSize = client->getUdpFileDownloader()->getFilesPendingSize();
 			}
 		}
+		if( client->bHaveMod && client->getUdpFileDownloader()->getFilesPendingAmount() == 0 )
+		{
+			// Our version of the mod is up to date
+			client->bDownloadingMod = false;
+			client->bWaitingForMod = false;
+			client->FinishModDownloads();
+			client->sModDownloadName = "";
+		}
 	}
+}
+
+// Server sent us some file
+void CClientNetEngine::ParseSendFile(CBytestream *bs)
+{
+
+	client->fLastFileRequestPacketReceived = tLX->currentTime;
+	if( client->getUdpFileDownloader()->receive(bs) )
+		ProcessFinishedFileDownload();
 	if( client->getUdpFileDownloader()->isReceiving() )
 	{
 		// Speed up download - server will send next packet when receives ping, or once in 0.5 seconds
@@ -17,12 +17,16 @@
 // Jason Boettcher
 
 
+#include <list>
+#include <unordered_map>
 #include "LieroX.h"
 
 #include "GfxPrimitives.h"
 #include "PixelFunctors.h"
 #include "Unicode.h"
 #include "MathLib.h"
+#include "Mutex.h"
+#include "OLXCommand.h"
 
 
 //
@@ -34,9 +38,116 @@
 
 // For font drawing use FontGenerator tool in /tools/fontgenerator
 
+
+/*
+ Text run cache
+
+ The scoreboard, the chat box, the server list and the console draw the same
+ strings every frame. Drawing a string glyph by glyph means a blit per glyph
+ for the precached colours and a PixelGet/PixelPutAlpha per pixel for all
+ others. So DrawAdv renders a string once into an alpha surface and then
+ only blits that, the clip rect (and so max_w) is applied by the blit.
+
+ The cache is shared by all fonts. It is an LRU list limited by the memory
+ of the surfaces, the key is (font, spacing, outline, colour, string).
+*/
+
+namespace {
+
+struct TextRunCache {
+	struct Entry {
+		std::string key;
+		SmartPointer<SDL_Surface> surf; // NULL if nothing visible
+		size_t memory;
+	};
+	typedef std::list<Entry> List;
+
+	Mutex mutex;
+	List entries; // most recently used first
+	std::unordered_map<std::string, List::iterator> index;
+	size_t memory;
+	size_t maxMemory;
+	bool enabled;
+	Uint64 hits, misses, evictions;
+
+	TextRunCache() : memory(0), maxMemory(4 * 1024 * 1024), enabled(true), hits(0), misses(0), evictions(0) {}
+
+	bool get(const std::string& key, SmartPointer<SDL_Surface>& surf) {
+		std::unordered_map<std::string, List::iterator>::iterator it = index.find(key);
+		if(it == index.end()) {
+			misses++;
+			return false;
+		}
+		hits++;
+		entries.splice(entries.begin(), entries, it->second);
+		surf = it->second->surf;
+		return true;
+	}
+
+	void put(const std::string& key, const SmartPointer<SDL_Surface>& surf) {
+		Entry e;
+		e.key = key;
+		e.surf = surf;
+		e.memory = sizeof(Entry) + key.size() * 2 + (surf.get() ? (size_t)surf->pitch * surf->h : 0);
+		if(e.memory > maxMemory / 4) return; // would throw out too much
+		entries.push_front(e);
+		index[key] = entries.begin();
+		memory += e.memory;
+		while(memory > maxMemory && !entries.empty()) {
+			erase(--entries.end());
+			evictions++;
+		}
+	}
+
+	void erase(List::iterator it) {
+		memory -= it->memory;
+		index.erase(it->key);
+		entries.erase(it);
+	}
+};
+
+TextRunCache textRunCache;
+
+std::string TextRunKey(const CFont* font, int spacing, int vspacing, bool outline, Color col, const std::string& txt) {
+	std::string key((const char*)&font, sizeof(font));
+	key += std::string((const char*)&spacing, sizeof(spacing));
+	key += std::string((const char*)&vspacing, sizeof(vspacing));
+	key += (char)outline;
+	key += (char)col.r; key += (char)col.g; key += (char)col.b; key += (char)col.a;
+	key += txt;
+	return key;
+}
+
+}
+
+void CFont::SetTextCacheEnabled(bool enabled) {
+	Mutex::ScopedLock lock(textRunCache.mutex);
+	textRunCache.enabled = enabled;
+}
+
+void CFont::DumpTextCacheStats(CmdLineIntf& cli) {
+	Mutex::ScopedLock lock(textRunCache.mutex);
+	const TextRunCache& c = textRunCache;
+	cli.writeMsg("text run cache: " + std::string(c.enabled ? "enabled" : "disabled") + ", " +
+				 itoa(c.entries.size()) + " strings, " + itoa(c.memory / 1024) + "/" + itoa(c.maxMemory / 1024) + " KB");
+	cli.writeMsg("hits: " + itoa(c.hits) + ", misses: " + itoa(c.misses) + ", evictions: " + itoa(c.evictions));
+}
+
+void CFont::RemoveFromTextCache() {
+	Mutex::ScopedLock lock(textRunCache.mutex);
+	const CFont* self = this;
+	const std::string prefix((const char*)&self, sizeof(self));
+	for(TextRunCache::List::iterator it = textRunCache.entries.begin(); it != textRunCache.entries.end(); ) {
+		TextRunCache::List::iterator cur = it++;
+		if(cur->key.compare(0, prefix.size(), prefix) == 0)
+			textRunCache.erase(cur);
+	}
+}
+
 ///////////////////
 // Load a font
 int CFont::Load(const std::string& fontname, bool _colour) {
+	RemoveFromTextCache();
 
 	// Load the font
 	LOAD_IMAGE_WITHALPHA(bmpFont, fontname);
@@ -69,6 +180,7 @@ int CFont::Load(const std::string& fontname, bool _colour) {
 ///////////////////
 // Shutdown the font
 void CFont::Shutdown() {
+	RemoveFromTextCache();
 }
 
 
@@ -276,6 +388,22 @@ void CFont::DrawAdv(SDL_Surface * dst, int x, int y, int max_w, Color col, const
 	}
 
 
+	// Draw the whole string with one blit from the text run cache.
+	// Lines after a line break start at newrect.x, the cached run starts them at x.
+	if (newrect.x == x) {
+		bool useCache = false;
+		{
+			Mutex::ScopedLock lock(textRunCache.mutex);
+			useCache = textRunCache.enabled;
+		}
+		if (useCache) {
+			SmartPointer<SDL_Surface> run = GetTextRun(txt, col, bmpCached);
+			if (run.get())
+				DrawImageAdv(dst, run, 0, 0, x, y, run->w, run->h);
+			return;
+		}
+	}
+
 	// Lock the surfaces
 	// If we use cached font, we do not access the pixels
 	if (!bmpCached.get())  {
@@ -361,6 +489,109 @@ void CFont::DrawAdv(SDL_Surface * dst, int x, int y, int max_w, Color col, const
 	}
 }
 
+///////////////////
+// Get the surface of the whole string from the text run cache, render it if it is not there
+SmartPointer<SDL_Surface> CFont::GetTextRun(const std::string& txt, Color col, const SmartPointer<SDL_Surface>& bmpCached) {
+	// A font which is not colorized looks the same in all colours
+	const std::string key = TextRunKey(this, Spacing, VSpacing, OutlineFont, Colorize ? col : Color(), txt);
+	SmartPointer<SDL_Surface> run;
+	{
+		Mutex::ScopedLock lock(textRunCache.mutex);
+		if (textRunCache.get(key, run))
+			return run;
+	}
+
+	run = RenderTextRun(txt, col, bmpCached);
+
+	Mutex::ScopedLock lock(textRunCache.mutex);
+	textRunCache.put(key, run);
+	return run;
+}
+
+///////////////////
+// Render a string into a new alpha surface, with the same layout as DrawAdv
+SmartPointer<SDL_Surface> CFont::RenderTextRun(const std::string& txt, Color col, const SmartPointer<SDL_Surface>& bmpCached) {
+	const int lineH = bmpFont.get()->h + VSpacing;
+
+	// Size
+	int w = 0, h = bmpFont.get()->h;
+	int x = 0;
+	for (std::string::const_iterator p = txt.begin(); p != txt.end();) {
+		if (*p == '\n') {
+			x = 0;
+			h += lineH;
+			p++;
+			continue;
+		}
+		int l = TranslateCharacter(p, txt.end());
+		if (l == -1)
+			continue;
+		w = MAX(w, x + FontWidth[l]);
+		x += FontWidth[l] + Spacing;
+	}
+
+	SmartPointer<SDL_Surface> run = gfxCreateSurfaceAlpha(w, h);
+	if (!run.get())
+		return NULL; // nothing visible
+	FillSurface(run.get(), Color(0, 0, 0, 0));
+
+	SDL_Surface* src = bmpCached.get() ? bmpCached.get() : bmpFont.get();
+	if (!LockSurface(run))
+		return NULL;
+	if (!LockSurface(src)) {
+		UnlockSurface(run);
+		return NULL;
+	}
+
+	x = 0;
+	int y = 0;
+	for (std::string::const_iterator p = txt.begin(); p != txt.end();) {
+		if (*p == '\n') {
+			x = 0;
+			y += lineH;
+			p++;
+			continue;
+		}
+		int l = TranslateCharacter(p, txt.end());
+		if (l == -1)
+			continue;
+
+		for (int j = 0; j < bmpFont.get()->h; ++j) {
+			for (int i = MAX(0, -x); i < FontWidth[l]; ++i) {
+				const Uint32 pixel = GetPixel(src, CharacterOffset[l] + i, j);
+				Uint8 R, G, B, A;
+				GetColour4(pixel, src->format, &R, &G, &B, &A);
+
+				Color c;
+				if (bmpCached.get()) {
+					// Precached: blitted as it is
+					if (IsTransparent(src, pixel))
+						continue;
+					c = Color(R, G, B, A);
+				} else if (OutlineFont && R == 255 && G == 255 && B == 255)
+					c = Color(col.r, col.g, col.b, (col.a * A) / 255);
+				else if (!R && !G && !B)
+					c = Color(OutlineFont ? 0 : col.r, OutlineFont ? 0 : col.g, OutlineFont ? 0 : col.b, (col.a * A) / 255);
+				else
+					continue;
+
+				if (c.a == 0)
+					continue;
+				// Glyphs may overlap with negative spacing, keep the more visible pixel
+				Uint8 oldR, oldG, oldB, oldA;
+				GetColour4(GetPixel(run.get(), x + i, y + j), run->format, &oldR, &oldG, &oldB, &oldA);
+				if (c.a > oldA)
+					PutPixel(run.get(), x + i, y + j, c.get(run->format));
+			}
+		}
+		x += FontWidth[l] + Spacing;
+	}
+
+	UnlockSurface(src);
+	UnlockSurface(run);
+	return run;
+}
+
 /////////////////////////
 // Draws an outlined character
 void CFont::DrawGlyphOutline_Internal(SDL_Surface *dst, const SDL_Rect& r, int sx, int sy, Color col, int glyph_index, PixelPutAlpha& putter, PixelGet& getter)
@@ -29,6 +29,7 @@
 #include "Timer.h"
 #include "Options.h"
 #include "AuxLib.h"
+#include "OLXCommand.h"
 
 
 #ifdef DEBUG
@@ -81,54 +82,65 @@ static AbsTime getCurrentTime()
 	return tLX->currentTime;
 }
 
+// Don't stat the file on every cache hit, browsing the map list would hit the disk all the time
+static const TimeDiff fileCheckInterval = TimeDiff(1.0f);
+
+static Uint64 getFileTimeStamp(const std::string& file)
+{
+	struct stat st;
+	if(!StatFile(file, &st)) return 0;
+	return st.st_mtime;
+}
+
+template<typename _Data>
+bool CCache::isFileUnchanged(typename Section_t<_Data>::Item_t* item)
+{
+	AbsTime now = getCurrentTime();
+	if(now < item->fLastFileCheck + fileCheckInterval)
+		return true;
+	item->fLastFileCheck = now;
+	return getFileTimeStamp(*item->key) == item->iFileTimeStamp;
+}
+
 //////////////
 // Save an image to the cache
-void CCache::SaveImage__unsafe(const std::string& file1, const SmartPointer<SDL_Surface> & img)
+void CCache::SaveImage__unsafe(const std::string& file, const SmartPointer<SDL_Surface> & img)
 {
 	if (img.get() == NULL)
 		return;
 
-	std::string file = file1;
-	stringlwr(file);
-	if( ImageCache.find(file) != ImageCache.end() )	// Error - already in cache
-	{
-		errors << "Error: image already in cache - memleak: " << file << endl;
-		return;
-	}
 	//notes << "CCache::SaveImage(): " << img << " " << file << endl;
-	ImageCache[file] = ImageItem_t(img, getCurrentTime(), 0);
+	if( ImageCache.insert(file, img, GetSurfaceMemorySize(img.get()), 0, getCurrentTime()) == NULL )	// Error - already in cache
+		errors << "Error: image already in cache - memleak: " << file << endl;
 }
 
 //////////////
 // Save a sound sample to the cache
-void CCache::SaveSound(const std::string& file1, const SmartPointer<SoundSample> & smp)
+void CCache::SaveSound(const std::string& file, const SmartPointer<SoundSample> & smp)
 {
 	ScopedLock lock(mutex);
 	if (smp.get() == NULL)
 		return;
 
-	std::string file = file1;
-	stringlwr(file);
-	if( SoundCache.find(file) != SoundCache.end() )
-	{
+#ifndef DEDICATED_ONLY
+	size_t size = sizeof(SoundSample) + smp->GetMemorySize();
+#else
+	size_t size = sizeof(SoundSample);
+#endif
+	if( SoundCache.insert(file, smp, size, 0, getCurrentTime()) == NULL )
 		errors << "Error: sound already in cache - memleak: " << file << endl;
-		return;
-	};
-	SoundCache[file] = SoundItem_t( smp, getCurrentTime(), 0 );
 }
 
 //////////////
 // Save a map to the cache
-void CCache::SaveMap(const std::string& file1, CMap *map)
+void CCache::SaveMap(const std::string& file, CMap *map)
 {
 	{
 		ScopedLock lock(mutex);
 		if (map == NULL)
 			return;
 
-		std::string file = file1;
-		stringlwr(file);
-		if( MapCache.find(file) != MapCache.end() )	// Error - already in cache
+		if( MapCache.entries.find(file) != MapCache.entries.end() )	// Error - already in cache
 		{
 			errors << "Error: map already in cache: " << file << endl;
 			return;
@@ -142,16 +154,14 @@ void CCache::SaveMap(const std::string& file1, CMap *map)
 		if (!cached_map->NewFrom(map))
 			return;
 
-		struct stat st;
-		StatFile(file1, &st);
-		MapCache[file] = MapItem_t( cached_map, getCurrentTime(), st.st_mtime );
+		MapCache.insert(file, cached_map, cached_map->GetMemorySize(), getFileTimeStamp(file), getCurrentTime());
 	}
 	ClearExtraEntries(); // Cache can get very big when browsing through levels - clear it here
 }
 
 //////////////
 // Save a mod to the cache
-void CCache::SaveMod(const std::string& file1, const SmartPointer<CGameScript> & mod)
+void CCache::SaveMod(const std::string& file, const SmartPointer<CGameScript> & mod)
 {
 	if(mod.get() == NULL) {
 		errors << "SaveMod: tried to safe NULL gamescript" << endl;
@@ -166,98 +176,80 @@ void CCache::SaveMod(const std::string& file1, const SmartPointer<CGameScript> &
 	// dont save gus mods
 	if(mod->gusEngineUsed()) return;
 	
-	std::string file = file1;
-	stringlwr(file);
-
-	ScopedLock lock(mutex);
-	if( ModCache.find(file) != ModCache.end() )	// Error - already in cache
+	Uint64 timestamp = getFileTimeStamp(file);
+	
 	{
-		errors << "Error: mod already in cache - memleak: " << file << endl;
-		return;
+		ScopedLock lock(mutex);
+		if( ModCache.insert(file, mod, mod->GetMemorySize(), timestamp, getCurrentTime()) == NULL )	// Error - already in cache
+		{
+			errors << "Error: mod already in cache - memleak: " << file << endl;
+			return;
+		}
 	}
-
-	struct stat st;
-	StatFile(file1, &st);
-	ModCache[file] = ModItem_t( mod, getCurrentTime(), st.st_mtime );
+	ClearExtraEntries();
 }
 
 //////////////
 // Get an image from the cache
-SmartPointer<SDL_Surface> CCache::GetImage__unsafe(const std::string& file1)
+SmartPointer<SDL_Surface> CCache::GetImage__unsafe(const std::string& file)
 {
-	std::string file = file1;
-	stringlwr(file);
-	ImageCache_t::iterator item = ImageCache.find(file);
-	if(item != ImageCache.end())
-	{
-		item->second.fSaveTime = getCurrentTime();
-		return item->second.bmpSurf;
-	}
+	Section_t<SDL_Surface>::Item_t* item = ImageCache.find(file);
+	if(item)
+		return item->data;
 	return NULL;
 }
 
 //////////////
 // Get a sound sample from the cache
-SmartPointer<SoundSample> CCache::GetSound(const std::string& file1)
+SmartPointer<SoundSample> CCache::GetSound(const std::string& file)
 {
 	ScopedLock lock(mutex);
-	std::string file = file1;
-	stringlwr(file);
-	SoundCache_t::iterator item = SoundCache.find(file);
-	if(item != SoundCache.end())
-	{
-		item->second.fSaveTime = getCurrentTime();
-		return item->second.sndSample;
-	};
+	Section_t<SoundSample>::Item_t* item = SoundCache.find(file);
+	if(item)
+		return item->data;
 	return NULL;
 }
 
 //////////////
 // Get a map from the cache
-SmartPointer<CMap> CCache::GetMap(const std::string& file1)
+SmartPointer<CMap> CCache::GetMap(const std::string& file)
 {
 	ScopedLock lock(mutex);
-	std::string file = file1;
-	stringlwr(file);
-	MapCache_t::iterator item = MapCache.find(file);
-	if(item != MapCache.end())
+	Section_t<CMap>::Item_t* item = MapCache.find(file);
+	if(item)
 	{
 		// If the file has changed, don't consider it as found and erase it from the cache
-		struct stat st;
-		StatFile(item->first, &st);
-		if (item->second.iFileTimeStamp != (Uint64)st.st_mtime)  {
-			item->second.tMap = NULL;
+		if (!isFileUnchanged<CMap>(item))  {
+			MapCache.stats.hits--;
+			MapCache.stats.misses++;
+			MapCache.stats.expirations++;
 			MapCache.erase(item);
 			return NULL;
 		}
 
-		item->second.fSaveTime = getCurrentTime();
-		return item->second.tMap;
+		return item->data;
 	}
 	return NULL;
 }
 
 //////////////
 // Get a mod from the cache
-SmartPointer<CGameScript> CCache::GetMod(const std::string& file1)
+SmartPointer<CGameScript> CCache::GetMod(const std::string& file)
 {
 	ScopedLock lock(mutex);
-	std::string file = file1;
-	stringlwr(file);
-	ModCache_t::iterator item = ModCache.find(file);
-	if(item != ModCache.end())
+	Section_t<CGameScript>::Item_t* item = ModCache.find(file);
+	if(item)
 	{
 		// If the file has changed, don't consider it as found and erase it from the cache
-		struct stat st;
-		StatFile(item->first, &st);
-		if (item->second.iFileTimeStamp != (Uint64)st.st_mtime)  {
-			item->second.tMod = NULL;
+		if (!isFileUnchanged<CGameScript>(item))  {
+			ModCache.stats.hits--;
+			ModCache.stats.misses++;
+			ModCache.stats.expirations++;
 			ModCache.erase(item);
 			return NULL;
 		}
 
-		item->second.fSaveTime = getCurrentTime();
-		return item->second.tMod;
+		return item->data;
 	};
 	return NULL;
 }
@@ -284,151 +276,78 @@ void CCache::ClearSounds() {
 size_t CCache::GetCacheSize()
 {
 	ScopedLock lock(mutex);
-
-	size_t res = sizeof(CCache);
-	for (ImageCache_t::iterator it = ImageCache.begin(); it != ImageCache.end(); it++)
-		res += GetSurfaceMemorySize(it->second.bmpSurf.get()) + it->first.size();
-
-	for (ModCache_t::iterator it = ModCache.begin(); it != ModCache.end(); it++)
-		res += it->second.tMod.get()->GetMemorySize() + it->first.size();
-
-	for (MapCache_t::iterator it = MapCache.begin(); it != MapCache.end(); it++)
-		res += it->second.tMap.get()->GetMemorySize() + it->first.size();
-
-#ifndef DEDICATED_ONLY
-	for (SoundCache_t::iterator it = SoundCache.begin(); it != SoundCache.end(); it++)
-		res += it->first.size() + sizeof(SoundSample) + it->second.sndSample->GetMemorySize();
-#endif
-
-	return res;
+	return sizeof(CCache) + ImageCache.iMemSize + SoundCache.iMemSize + MapCache.iMemSize + ModCache.iMemSize;
 }
 
 size_t CCache::GetEntryCount() {
 	ScopedLock lock(mutex);
 	
 	size_t res = 0;
-	res += ImageCache.size();
-	res += ModCache.size();
-	res += MapCache.size();
-	res += SoundCache.size();
+	res += ImageCache.entries.size();
+	res += ModCache.entries.size();
+	res += MapCache.entries.size();
+	res += SoundCache.entries.size();
 	
 	return res;
 }
 
+///////////////////////
+// Get the memory budget of the cache (in bytes), 0 if there is none
+size_t CCache::GetMemoryLimit()
+{
+	if(tLXOptions == NULL || tLXOptions->iMaxCacheMemory <= 0)
+		return 0;
+	return (size_t)tLXOptions->iMaxCacheMemory * 1024 * 1024;
+}
+
 void CCache::ClearExtraEntries()
 {
-	static const int estimatedCacheEntrySize = 1024*300;
-	size_t availableMem = GetFreeSysMemory() + GetCacheSize();
-	int estimatedMaxPossibleEntries = int(availableMem / estimatedCacheEntrySize);
-	if(estimatedMaxPossibleEntries < tLXOptions->iMaxCachedEntries) {
-		warnings << "The estimated possible max entry count in cache (" << estimatedMaxPossibleEntries << ") ";
-		warnings << "is lower than the current set maximum (" << tLXOptions->iMaxCachedEntries << ")" << endl;
-		hints << "Free system memory: " << (GetFreeSysMemory() / 1024) << " KB" << endl; 
-		notes << "Lowering cache limit now" << endl;
-		tLXOptions->iMaxCachedEntries = estimatedMaxPossibleEntries;
+	size_t maxMem = GetMemoryLimit();
+	size_t cacheSize = GetCacheSize();
+	size_t availableMem = GetFreeSysMemory() + cacheSize;
+	if(maxMem == 0 || availableMem < maxMem) {
+		if(maxMem > 0) {
+			warnings << "The available memory for the cache (" << (availableMem / 1024) << " KB) ";
+			warnings << "is lower than the current set maximum (" << tLXOptions->iMaxCacheMemory << " MB)" << endl;
+			notes << "Using the available memory as cache limit for now" << endl;
+		}
+		maxMem = availableMem;
 	}
 
+	size_t maxEntries = (tLXOptions->iMaxCachedEntries > 0) ? (size_t)tLXOptions->iMaxCachedEntries : 0;
+
 	ScopedLock lock(mutex);
-	
-	if( (int)MapCache.size() >= tLXOptions->iMaxCachedEntries / 50 )
-	{	// Sorted by last-access time, iterators are not invalidated in a map when element is erased
-		typedef std::multimap< AbsTime, MapCache_t :: iterator > TimeSorted_t;
-		TimeSorted_t TimeSorted;
-		int count = 0;
-		for( MapCache_t :: iterator it = MapCache.begin(); it != MapCache.end(); it++  )
-		{
-			TimeSorted.insert( std::make_pair( it->second.fSaveTime, it ) );
-			if( it->second.tMap.getRefCount() <= 1 )
-				count ++;
-		}
-		{
-			int clearCount = (int)MIN( (size_t)count, MapCache.size() - tLXOptions->iMaxCachedEntries / 50 );
-			for( TimeSorted_t :: iterator it1 = TimeSorted.begin();
-					it1 != TimeSorted.end() && clearCount > 0; it1++, clearCount-- )
-			{
-				if( it1->second->second.tMap.tryDeleteData() )
-				{
-					clearCount --;
-					MapCache.erase( it1->second );
-				}
-			}
-		}
-	}
-	
-	// Delete mods first, and images/sounds after, 'cause they are used by mods mainly
-	if( (int)ModCache.size() >= tLXOptions->iMaxCachedEntries / 50 )
-	{	// Sorted by last-access time, iterators are not invalidated in a map when element is erased
-		typedef std::multimap< AbsTime, ModCache_t :: iterator > TimeSorted_t;
-		TimeSorted_t TimeSorted;
-		int count = 0;
-		for( ModCache_t :: iterator it = ModCache.begin(); it != ModCache.end(); it++  )
-		{
-			TimeSorted.insert( std::make_pair( it->second.fSaveTime, it ) );
-			if( it->second.tMod.getRefCount() <= 1 )
-				count ++;
-		}
-		{
-			int clearCount = (int)MIN( (size_t)count, ModCache.size() - tLXOptions->iMaxCachedEntries / 50 );
-			for( TimeSorted_t :: iterator it1 = TimeSorted.begin();
-					it1 != TimeSorted.end() && clearCount > 0; it1++, clearCount-- )
-			{
-				if( it1->second->second.tMod.tryDeleteData() )
-				{
-					clearCount --;
-					ModCache.erase( it1->second );
-				}
-			}
-		}
-	}
+	cacheSize = sizeof(CCache) + ImageCache.iMemSize + SoundCache.iMemSize + MapCache.iMemSize + ModCache.iMemSize;
 
-	if( (int)ImageCache.size() >= tLXOptions->iMaxCachedEntries )
-	{	// Sorted by last-access time, iterators are not invalidated in a map when element is erased
-		typedef std::multimap< AbsTime, ImageCache_t :: iterator > TimeSorted_t;
-		TimeSorted_t TimeSorted;
-		int count = 0;
-		for( ImageCache_t :: iterator it = ImageCache.begin(); it != ImageCache.end(); it++  )
-		{
-			TimeSorted.insert( std::make_pair( it->second.fSaveTime, it ) );
-			if( it->second.bmpSurf.getRefCount() <= 1 )
-				count ++;
+	// Delete maps and mods first, and images/sounds after, 'cause they are used by mods mainly
+	MapCache.evict(maxEntries / 50, cacheSize, maxMem);
+	ModCache.evict(maxEntries / 50, cacheSize, maxMem);
+	ImageCache.evict(maxEntries, cacheSize, maxMem);
+	SoundCache.evict(maxEntries, cacheSize, maxMem);
+}
+
+void CCache::DumpStats(CmdLineIntf& cli)
+{
+	ScopedLock lock(mutex);
+
+	struct Row {
+		const char* name; size_t entries; size_t size; const Stats_t& stats;
+		Row(const char* n, size_t e, size_t s, const Stats_t& st) : name(n), entries(e), size(s), stats(st) {}
+		void print(CmdLineIntf& cli) {
+			Uint64 requests = stats.hits + stats.misses;
+			cli.writeMsg(std::string(name) + ": " + itoa(entries) + " entries, " + itoa(size / 1024) + " KB, " +
+						 itoa(stats.hits) + " hits, " + itoa(stats.misses) + " misses (" +
+						 itoa(requests ? (stats.hits * 100 / requests) : 0) + "% hit rate), " +
+						 itoa(stats.evictions) + " evictions, " + itoa(stats.expirations) + " expired");
 		}
-		{
-			int clearCount = (int)MIN( (size_t)count, ImageCache.size() - tLXOptions->iMaxCachedEntries );
-			for( TimeSorted_t :: iterator it1 = TimeSorted.begin();
-					it1 != TimeSorted.end() && clearCount > 0; it1++ )
-			{
-				if( it1->second->second.bmpSurf.tryDeleteData() )
-				{
-					clearCount --;
-					ImageCache.erase( it1->second );
-				};
-			};
-		};
 	};
 
-	if( (int)SoundCache.size() >= tLXOptions->iMaxCachedEntries )
-	{	// Sorted by last-access time, iterators are not invalidated in a map when element is erased
-		typedef std::multimap< AbsTime, SoundCache_t :: iterator > TimeSorted_t;
-		TimeSorted_t TimeSorted;
-		int count = 0;
-		for( SoundCache_t :: iterator it = SoundCache.begin(); it != SoundCache.end(); it++  )
-		{
-			TimeSorted.insert( std::make_pair( it->second.fSaveTime, it ) );
-			if( it->second.sndSample.getRefCount() <= 1 )
-				count ++;
-		}
-		{
-			int clearCount = (int)MIN( (size_t)count, SoundCache.size() - tLXOptions->iMaxCachedEntries );
-			for( TimeSorted_t :: iterator it1 = TimeSorted.begin();
-					it1 != TimeSorted.end() && clearCount > 0; it1++, clearCount-- )
-			{
-				if( it1->second->second.sndSample.tryDeleteData() )
-				{
-					clearCount --;
-					SoundCache.erase( it1->second );
-				}
-			}
-		}
-	}
-}
+	Row(" images", ImageCache.entries.size(), ImageCache.iMemSize, ImageCache.stats).print(cli);
+	Row(" sounds", SoundCache.entries.size(), SoundCache.iMemSize, SoundCache.stats).print(cli);
+	Row(" maps", MapCache.entries.size(), MapCache.iMemSize, MapCache.stats).print(cli);
+	Row(" mods", ModCache.entries.size(), ModCache.iMemSize, ModCache.stats).print(cli);
 
+	size_t total = sizeof(CCache) + ImageCache.iMemSize + SoundCache.iMemSize + MapCache.iMemSize + ModCache.iMemSize;
+	size_t limit = GetMemoryLimit();
+	cli.writeMsg("total: " + itoa(total / 1024) + " KB, limit: " + (limit ? (itoa(limit / 1024) + " KB") : std::string("none")));
+}
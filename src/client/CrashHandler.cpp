@@ -263,6 +263,9 @@ public:
 		for (unsigned int i = 0; i < sizeof(signal_data) / sizeof(signal_def); i++)
 			if (signr == signal_data[i].id)
 			{ d = &signal_data[i]; break; }
+		// get out what was logged before the crash, unless the log writer itself crashed
+		FlushLogs(500);
+
 		if (d)
 			printf("Got signal 0x%02X (%s): %s\n", signr, d->name, d->description);
 		else
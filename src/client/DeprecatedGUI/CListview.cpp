@@ -14,6 +14,8 @@
 // Jason Boettcher
 
 
+#include <vector>
+#include <algorithm>
 #include "LieroX.h"
 
 #include "DeprecatedGUI/Menu.h"
@@ -364,17 +366,13 @@ lv_item_t* CListview::AddItem(const std::string& sIndex, int iIndex, Color iColo
 	item->iColour = iColour;
 	item->iBgColour = tLX->clBlack;
 	item->iBgColour.a = SDL_ALPHA_TRANSPARENT;
-    item->_iID = iItemID++;
+    item->_iID = iItemCount; // its position, like UpdateItemIDs would set it
 
 	// Add it to the list
 	if(tItems) {
-		lv_item_t *i = tItems;
-		for(;i;i = i->tNext) {
-			if(i->tNext == NULL) {
-				i->tNext = item;
-				break;
-			}
-		}
+		if(!tLastItem)
+			for(tLastItem = tItems; tLastItem->tNext; tLastItem = tLastItem->tNext) {}
+		tLastItem->tNext = item;
 	}
 	else {
 		tItems = item;
@@ -553,54 +551,38 @@ void CListview::RemoveItem(int iIndex)
 	lv_item_t *i = tItems;
 	lv_item_t *next = NULL;
 	lv_subitem_t *s,*sub;
-	int first = true;
-	int found = false;
-
-	// Find the item and it's previous item
-	prev = i;
-	for(;i;i=i->tNext) {
-
-		if(i->iIndex == iIndex) {
-			found=true;
-			next = i->tNext;
-
-			// If it's the first item, we do it differently
-			if(first) {
-
-				// Free the sub items
-				for(s=i->tSubitems;s;s=sub) {
-					sub = s->tNext;
-					if (s->tWidget == tFocusedSubWidget)
-						tFocusedSubWidget = NULL;
-					delete s;
-				}
-				delete i;
-
-				// Set the first one to point to the next in the list
-				tItems = next;
-			} else {
-				// Free the sub items
-				for(s=i->tSubitems;s;s=sub) {
-					sub = s->tNext;
-					if (s->tWidget == tFocusedSubWidget)
-						tFocusedSubWidget = NULL;
-					delete s;
-				}
-				delete i;
 
-				// The previous item now points to the next one
-				prev->tNext = next;
-			}
+	// Remove all items with this index; prev stays at the last kept item
+	while(i) {
+		next = i->tNext;
+		if(i->iIndex != iIndex) {
+			prev = i;
 			i = next;
-			iItemCount--;
-			//break;
+			continue;
 		}
 
-		if(!i)
-			break;
+		// Free the sub items
+		for(s=i->tSubitems;s;s=sub) {
+			sub = s->tNext;
+			if (s->tWidget == tFocusedSubWidget)
+				tFocusedSubWidget = NULL;
+			if (s->tWidget == tMouseOverSubWidget)
+				tMouseOverSubWidget = NULL;
+			if (s->tWidget == holdedWidget)
+				holdedWidget = NULL;
+			delete s;
+		}
+		if (i == tMouseOver)
+			tMouseOver = NULL;
+		delete i;
 
-		prev = i;
-		first=false;
+		// Unlink it, if it was the first item the list starts at the next one now
+		if(prev)
+			prev->tNext = next;
+		else
+			tItems = next;
+		i = next;
+		iItemCount--;
 	}
 
 	// Find the last item
@@ -683,6 +665,36 @@ void CListview::ReSort()
 	SortBy(i,col->iSorted==1);
 }
 
+namespace {
+
+// Sort key of an item, the number is parsed only once per sort
+struct SortEntry {
+	lv_item_t *item;
+	lv_subitem_t *sub;
+	int number;
+	bool isNumber;
+};
+
+// Numbers are compared as numbers, everything else case insensitive.
+// Items without the column come first when sorting ascending, last otherwise.
+struct SortEntryLess {
+	bool ascending;
+	bool operator()(const SortEntry& a, const SortEntry& b) const {
+		if (a.sub && b.sub)  {
+			if (a.isNumber && b.isNumber)
+				return ascending ? (a.number < b.number) : (a.number > b.number);
+			int tmp = stringcasecmp(a.sub->sText, b.sub->sText);
+			return ascending ? (tmp < 0) : (tmp > 0);
+		}
+		if (ascending)
+			return a.sub == NULL && b.sub != NULL;
+		else
+			return a.sub != NULL && b.sub == NULL;
+	}
+};
+
+}
+
 ///////////////
 // Sorts the listview by specified column, ascending or descending
 void CListview::SortBy(int column, bool ascending)
@@ -696,76 +708,29 @@ void CListview::SortBy(int column, bool ascending)
 	if (!item)
 		return;
 
-	lv_item_t *prev_item = NULL;
-	lv_subitem_t *subitem1 = NULL;
-	lv_subitem_t *subitem2 = NULL;
-
-	bool bSwapped = true;
-
-	// Bubble sort the list
-	while (bSwapped)  {
-		bSwapped = false;
-		prev_item = NULL;
-		for(item=tItems;item->tNext;item=item->tNext) {
-			subitem1=item->tSubitems;
-			subitem2=item->tNext->tSubitems;
-
-			// Get subitem 1
-			int i;
-			for(i=0;i != column && subitem1;subitem1=subitem1->tNext,i++) {	}
-
-			// Get subitem 2
-			for(i=0;i != column && subitem2;subitem2=subitem2->tNext,i++) { }
-
-			bool swap = false;
-			if (subitem2 && subitem1)  {
-				// Swap the two items?
-				bool failed1,failed2;
-				int nat_cmp1 = from_string<int>(subitem1->sText,failed1);
-				int nat_cmp2 = from_string<int>(subitem2->sText,failed2);
-				// First try, if we compare numbers
-				if (!failed1 && !failed2)  {
-					if (ascending)
-						swap = nat_cmp1 > nat_cmp2;
-					else
-						swap = nat_cmp2 > nat_cmp1;
-				// String comparison
-				} else {
-					int tmp = stringcasecmp(subitem1->sText,subitem2->sText);
-					if (ascending)
-						swap = tmp > 0;
-					else
-						swap = tmp < 0;
-				}
-			} else  {
-				if (ascending)
-					swap = subitem1 != NULL;
-				else
-					swap = subitem2 != NULL;
-			}
-
-			// Swap if they're not in the right order
-			if (swap)  {
-				lv_item_t *it3 = item->tNext;
-				lv_item_t *it4 = item->tNext->tNext;
-				if (prev_item)
-					prev_item->tNext = it3;
-				else
-					tItems = it3;
-				it3->tNext = item;
-				item->tNext = it4;
-				if (!it4)  {
-					tLastItem = it3;
-					break;
-				}
-				bSwapped = true;
-				prev_item = item;
-				continue;
-			}
-
-			prev_item = item;
-		}
-	}
+	std::vector<SortEntry> entries;
+	entries.reserve(iItemCount);
+	for (; item; item = item->tNext)  {
+		SortEntry e;
+		e.item = item;
+		e.sub = item->tSubitems;
+		for (int i = 0; i != column && e.sub; e.sub = e.sub->tNext, i++) {}
+		bool failed = true;
+		e.number = e.sub ? from_string<int>(e.sub->sText, failed) : 0;
+		e.isNumber = !failed;
+		entries.push_back(e);
+	}
+
+	// Stable, so items which compare equal keep their order (like with the bubble sort before)
+	SortEntryLess less = { ascending };
+	std::stable_sort(entries.begin(), entries.end(), less);
+
+	// Relink the list in the new order
+	for (size_t i = 0; i + 1 < entries.size(); i++)
+		entries[i].item->tNext = entries[i + 1].item;
+	entries.back().item->tNext = NULL;
+	tItems = entries.front().item;
+	tLastItem = entries.back().item;
 
 	// Update the ID of the selected item
 	int i=0;
@@ -237,7 +237,9 @@ typedef void (*EventHandlerFct) (SDL_Event* ev);
 static void EvHndl_WindowEvent(SDL_Event* ev) {
 	switch(ev->window.event) {
 		case SDL_WINDOWEVENT_EXPOSED:
-			// We are redrawing anyway. (I hope.)
+		case SDL_WINDOWEVENT_SIZE_CHANGED:
+			// Unchanged frames are not presented, so do it here.
+			VideoPostProcessor::forceRedraw();
 			break;
 	
 		case SDL_WINDOWEVENT_FOCUS_GAINED:
@@ -221,7 +221,9 @@ bool GameOptions::Init() {
 		( tLXOptions->nMaxFPS, "Advanced.MaxFPS", 95 )
 		( tLXOptions->iJpegQuality, "Advanced.JpegQuality", 80 )
 		( tLXOptions->iMaxCachedEntries, "Advanced.MaxCachedEntries", 300 ) // Should be enough for every mod (we have 2777 .png and .wav files total now) and does not matter anyway with SmartPointer
+		( tLXOptions->iMaxCacheMemory, "Advanced.MaxCacheMemory", 256 )
 		( tLXOptions->bMatchLogging, "Advanced.MatchLogging", true )
+		( tLXOptions->bRecordServerDemos, "Advanced.RecordServerDemos", false )
 		( tLXOptions->bRecoverAfterCrash, "Advanced.RecoverAfterCrash",
 #ifndef DEDICATED_ONLY
 																		true )
@@ -239,6 +241,9 @@ bool GameOptions::Init() {
 		( tLXOptions->sDedicatedScriptArgs, "Misc.DedicatedScriptArgs", "cfg/dedicated_config" )
 		( tLXOptions->iVerbosity, "Misc.Verbosity", 0 )	
 		( tLXOptions->bLogTimestamps, "Misc.LogTimestamps", false )	
+		( tLXOptions->bLogAsync, "Misc.LogAsync", true )
+		( tLXOptions->sLogJsonFile, "Misc.LogJsonFile", "" )
+		( tLXOptions->sMetricsEndpoint, "Misc.MetricsEndpoint", "" )
 		( tLXOptions->bAdvancedLobby, "Misc.ShowAdvancedLobby", false )
 		( tLXOptions->bShowCountryFlags, "Misc.ShowCountryFlags", true )
 		( tLXOptions->doProjectileSimulationInDedicated, "Misc.DoProjectileSimulationInDedicated", true )
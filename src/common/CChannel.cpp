@@ -25,6 +25,8 @@
 #include "MathLib.h"
 #include "CServer.h"
 #include "CodeAttributes.h"
+#include "Metrics.h"
+#include "OLXCommand.h"
 
 
 
@@ -137,6 +139,13 @@ void CChannel_056b::Create(const NetworkAddr& _adr, const SmartPointer<NetworkSo
 
 ///////////////////
 // Transmitt data, as well as handling reliable packets
+// For the metrics endpoint, all channel versions together
+static void CountRetransmits( size_t packets )
+{
+	static Metrics::Counter& retransmits = Metrics::counter("olx_channel_retransmits_total", "Reliable packets sent again by CChannel");
+	retransmits.inc( packets );
+}
+
 void CChannel_056b::Transmit( CBytestream *bs )
 {	
 	CBytestream outpack;
@@ -149,6 +158,7 @@ void CChannel_056b::Transmit( CBytestream *bs )
 	{
 		//hints << "Remote side dropped a reliable packet, resending..." << endl;
 		SendReliable = 1;
+		CountRetransmits( 1 );
 	}
 
 
@@ -619,6 +629,7 @@ void CChannel2::Transmit(CBytestream *unreliableData)
 		tLX->currentTime - fLastSent >= DataPacketTimeout )
 	{
 		NextReliablePacketToSend = LastReliableOut;
+		CountRetransmits( ReliableOut.size() );
 	}
 	
 	// Add packet headers and data - send all packets with indexes from NextReliablePacketToSend and up.
@@ -1172,6 +1183,7 @@ void CChannel3::Transmit(CBytestream *unreliableData)
 		tLX->currentTime - fLastSent >= DataPacketTimeout )
 	{
 		NextReliablePacketToSend = LastReliableOut;	
+		CountRetransmits( ReliableOut.size() );
 	}
 	
 	// Add packet headers and data - send all packets with indexes from NextReliablePacketToSend and up.
@@ -1268,6 +1280,646 @@ void CChannel3::AddReliablePacketToSend(CBytestream& bs) // The same as in CChan
 }
 
 
+/*
+CChannel4 packet format, all integers are little-endian:
+
+	CRC16 (2 bytes) of the rest of the packet
+	Cumulative ack (2 bytes) - all reliable packets up to and including this sequence were received
+	SACK bits (4 bytes) - bit N set means that sequence cumulative ack + 2 + N was received too
+	Packet count (1 byte), then for every packet:
+		Sequence (2 bytes)
+		Size (2 bytes) - with SEQUENCE_HIGHEST_BIT set if the packet is a fragment, like in CChannel3
+		Data
+	Unreliable data till the end of the packet
+
+Sequences are 15 bit, so the cumulative ack never starts with 0xFFFF and the packet
+can't begin with four 0xFF like a connectionless packet.
+
+Every packet acks everything we got, so a lost packet with acks does not matter much,
+and with the SACK bits the sender knows exactly which packets are missing and sends only those again.
+A packet is considered lost if it is not acked after its retransmit timeout, which is
+calculated from the measured RTT like in TCP (RFC 6298), or if packets sent after it were acked already (see processAcks()).
+The amount of not acknowledged packets is limited by an AIMD congestion window: it grows by one packet
+per acked packet (slow start) up to Ssthresh and by one packet per window after that,
+and on a loss it is halved, so we don't flood slow connections with resends but can send bulk data fast on good ones.
+*/
+
+enum {
+	SEQUENCE4_MASK = 0x7FFF,
+	SACK_BITS = 32,
+	DUPLICATE_ACK_THRESHOLD = 3, // Packet is lost if that many later packets are acked
+	CWND_MIN = 2,
+	CWND_INITIAL = 4,
+	RTO_MIN_MS = 50,
+	RTO_MAX_MS = 3000,
+	RTO_INITIAL_MS = 300, // The same as CChannel3 resend timeout with a usual ping
+	RTO_GRANULARITY_MS = 20 // The other side acks only once per frame
+};
+
+static int SequenceDiff4( int s1, int s2 )
+{
+	int diff = (s1 - s2) & SEQUENCE4_MASK;
+	if( diff > SEQUENCE4_MASK / 2 )
+		diff -= SEQUENCE4_MASK + 1;
+	return diff;
+}
+
+static int NextSequence4( int s, int inc = 1 )
+{
+	return (s + inc) & SEQUENCE4_MASK;
+}
+
+void CChannel4::Clear()
+{
+	CChannel::Clear();
+	for( int f = 0; f < RingSize; f++ )
+	{
+		ReliableOut[f].data.clear();
+		ReliableOut[f].fragmented = false;
+		ReliableOut[f].acked = false;
+		ReliableOut[f].lost = false;
+		ReliableOut[f].transmissions = 0;
+		ReliableOut[f].sentTime = AbsTime();
+		ReliableIn[f].data.clear();
+		ReliableIn[f].fragmented = false;
+		ReliableIn[f].received = false;
+	}
+	IncompletePacket.clear();
+	SndUna = SndNext = 0;
+	RcvNext = DeliverNext = 0;
+	AckPending = false;
+
+	SRtt = 0;
+	RttVar = 0;
+	Rto = RTO_INITIAL_MS;
+	HaveRttSample = false;
+
+	Cwnd = CWND_INITIAL;
+	Ssthresh = RingSize / 2;
+	InRecovery = false;
+	RecoverySeq = 0;
+
+	KeepAlivePacketTimeout = KEEP_ALIVE_PACKET_TIMEOUT;
+	iRetransmissions = 0;
+}
+
+void CChannel4::Create(const NetworkAddr& _adr, const SmartPointer<NetworkSocket>& _sock)
+{
+	Clear();
+	CChannel::Create( _adr, _sock );
+}
+
+void CChannel4::AddReliablePacketToSend(CBytestream& bs) // The same as in CChannel but without error msg
+{
+	if(bs.GetLength() == 0)
+		return;
+
+	Messages.push_back(bs);
+	// The messages are joined in Transmit() in one bigger packet, until it will hit bandwidth limit
+}
+
+bool CChannel4::getBufferFull()
+{
+	return SequenceDiff4( SndNext, SndUna ) >= MIN( (int)Cwnd, RingSize - 1 );
+}
+
+// Sent packets which are neither acked nor considered lost
+int CChannel4::packetsInFlight()
+{
+	int count = 0;
+	for( int seq = SndUna; seq != SndNext; seq = NextSequence4(seq) )
+	{
+		const OutPacket_t & p = outPacket(seq);
+		if( p.transmissions > 0 && !p.acked && !p.lost )
+			count++;
+	}
+	return count;
+}
+
+void CChannel4::packetAcked( OutPacket_t & p )
+{
+	if( p.acked || p.transmissions == 0 )
+		return;
+	p.acked = true;
+
+	// Karn's algorithm - the ack of a resent packet may be for any of the copies, so don't measure it
+	if( p.transmissions == 1 )
+	{
+		float rtt = (float)(tLX->currentTime - p.sentTime).milliseconds();
+		if( !HaveRttSample )
+		{
+			SRtt = rtt;
+			RttVar = rtt / 2;
+			HaveRttSample = true;
+		}
+		else
+		{
+			RttVar = 0.75f * RttVar + 0.25f * fabs( SRtt - rtt );
+			SRtt = 0.875f * SRtt + 0.125f * rtt;
+		}
+		Rto = CLAMP( SRtt + MAX( (float)RTO_GRANULARITY_MS, 4 * RttVar ), (float)RTO_MIN_MS, (float)RTO_MAX_MS );
+		iPing = (int)SRtt;
+	}
+
+	if( Cwnd < Ssthresh )
+		Cwnd += 1;	// Slow start
+	else
+		Cwnd += 1 / Cwnd;	// Congestion avoidance
+	Cwnd = MIN( Cwnd, (float)(RingSize - 1) );
+}
+
+void CChannel4::onLoss( bool timeout )
+{
+	if( InRecovery && !timeout )
+		return;	// Only one window reduction per round trip
+	Ssthresh = MAX( Cwnd / 2, (float)CWND_MIN );
+	Cwnd = timeout ? (float)CWND_MIN : Ssthresh;
+	if( timeout )
+		Rto = MIN( Rto * 2, (float)RTO_MAX_MS );	// Back off, the other side may be gone
+	InRecovery = true;
+	RecoverySeq = SndNext;
+}
+
+void CChannel4::processAcks( int cumAck, Uint32 sackBits )
+{
+	for( int seq = SndUna; SequenceDiff4( seq, cumAck ) <= 0; seq = NextSequence4(seq) )
+		packetAcked( outPacket(seq) );
+
+	int highestAcked = cumAck;
+	for( int bit = 0; bit < SACK_BITS; bit++ )
+	{
+		if( !(sackBits & (1u << bit)) )
+			continue;
+		int seq = NextSequence4( cumAck, bit + 2 );
+		if( SequenceDiff4( seq, SndNext ) >= 0 )
+			break;
+		packetAcked( outPacket(seq) );
+		highestAcked = seq;
+	}
+
+	while( SndUna != SndNext && outPacket(SndUna).acked )
+	{
+		OutPacket_t & p = outPacket(SndUna);
+		p.data.clear();	// Keeps the capacity
+		p.acked = p.lost = false;
+		p.transmissions = 0;
+		SndUna = NextSequence4(SndUna);
+	}
+
+	if( InRecovery && SequenceDiff4( SndUna, RecoverySeq ) >= 0 )
+		InRecovery = false;
+
+	// Fast retransmit - a packet is lost if a packet sent after it was acked, and either DUPLICATE_ACK_THRESHOLD
+	// packets after it were acked or it is older than the RTT plus some time for reordering.
+	// Small windows (slow game traffic) would otherwise always wait for the retransmit timeout.
+	bool lost = false;
+	if( SequenceDiff4( highestAcked, SndUna ) > 0 )
+	{
+		const AbsTime lastAckedSent = outPacket(highestAcked).sentTime;
+		for( int seq = SndUna; seq != highestAcked; seq = NextSequence4(seq) )
+		{
+			OutPacket_t & p = outPacket(seq);
+			if( p.acked || p.lost || p.transmissions == 0 || p.sentTime >= lastAckedSent )
+				continue;
+			if( SequenceDiff4( highestAcked, seq ) >= DUPLICATE_ACK_THRESHOLD ||
+				( HaveRttSample && tLX->currentTime - p.sentTime >= TimeDiff( (int)(SRtt * 1.25f) ) ) )
+			{
+				p.lost = true;
+				lost = true;
+			}
+		}
+	}
+	if( lost )
+		onLoss( false );
+}
+
+// Get reliable packet from local buffer (merge fragmented packet)
+bool CChannel4::GetPacketFromBuffer(CBytestream *bs)
+{
+	// Fragments are moved out of the ring buffer at once, so a big packet cannot block it
+	while( DeliverNext != RcvNext )
+	{
+		InPacket_t & p = inPacket(DeliverNext);
+		IncompletePacket += p.data;
+		p.data.clear();	// Keeps the capacity
+		p.received = false;
+		DeliverNext = NextSequence4(DeliverNext);
+		if( !p.fragmented )
+		{
+			bs->Clear();
+			bs->writeData( IncompletePacket );
+			bs->ResetPosToBegin();
+			IncompletePacket.clear();
+			return true;
+		}
+	}
+	return false;
+}
+
+// This function will first return non-reliable data,
+// and then one or many reliable packets - it will modify bs for that,
+// so you should call it in a loop, clearing bs after each call.
+bool CChannel4::Process(CBytestream *bs)
+{
+	bs->ResetPosToBegin();
+	if( bs->GetLength() == 0 )
+		return GetPacketFromBuffer(bs);
+
+	UpdateReceiveStatistics( bs->GetLength() );
+
+	// CRC16 check
+	if( bs->GetLength() < 9 ||
+		(unsigned)bs->readInt(2) != crc16( bs->peekData( bs->GetRestLen() ).c_str(), bs->GetRestLen() ) )
+	{
+		iPacketsDropped++;	// Update statistics
+		return GetPacketFromBuffer(bs);
+	}
+
+	int cumAck = bs->readInt(2);
+	Uint32 sackBits = (Uint32)bs->readInt(4);
+	// The other side cannot ack packets which we didn't send yet
+	if( cumAck > SEQUENCE4_MASK || SequenceDiff4( cumAck, SndNext ) >= 0 ||
+		SequenceDiff4( cumAck, SndUna ) < -RingSize )
+	{
+		iPacketsDropped++;	// Update statistics
+		return GetPacketFromBuffer(bs);
+	}
+	iPacketsGood++;	// Update statistics
+
+	if( SequenceDiff4( cumAck, SndUna ) >= -1 )	// Older packets, which came late, have outdated acks
+		processAcks( cumAck, sackBits );
+
+	// Put packets in buffer
+	int count = bs->readByte();
+	for( int f = 0; f < count && !bs->isPosAtEnd(); f++ )
+	{
+		int seq = bs->readInt(2);
+		int size = bs->readInt(2);
+		bool fragmented = (size & SEQUENCE_HIGHEST_BIT) != 0;
+		size &= ~SEQUENCE_HIGHEST_BIT;
+		if( (size_t)size > bs->GetRestLen() )
+		{
+			iPacketsDropped++;
+			break;
+		}
+		AckPending = true;	// Ack duplicates too, our last ack may have been lost
+		int dist = SequenceDiff4( seq, DeliverNext );
+		if( seq > SEQUENCE4_MASK || dist < 0 || dist >= RingSize || inPacket(seq).received )
+		{
+			bs->Skip( size );
+			continue;
+		}
+		InPacket_t & p = inPacket(seq);
+		p.data = bs->readData( size );
+		p.fragmented = fragmented;
+		p.received = true;
+	}
+
+	while( SequenceDiff4( RcvNext, DeliverNext ) < RingSize && inPacket(RcvNext).received )
+		RcvNext = NextSequence4(RcvNext);
+
+	if( bs->GetRestLen() > 0 )	// Non-reliable data left in this packet
+		return true;	// Do not modify bs, allow user to read non-reliable data at the end of bs
+
+	if( GetPacketFromBuffer(bs) )	// We can return some reliable packet
+		return true;
+
+	// We've got valid empty packet, return empty packet - bs->GetRestLen() == 0 here.
+	// It is required to update server statistics, so clients that don't send packets won't timeout.
+	return true;
+}
+
+void CChannel4::Transmit(CBytestream *unreliableData)
+{
+	// Retransmit timeout - everything which is unacked for too long is lost
+	bool timeout = false;
+	for( int seq = SndUna; seq != SndNext; seq = NextSequence4(seq) )
+	{
+		OutPacket_t & p = outPacket(seq);
+		if( !p.acked && !p.lost && p.transmissions > 0 &&
+			tLX->currentTime - p.sentTime >= TimeDiff( (int)Rto ) )
+		{
+			p.lost = true;
+			timeout = true;
+		}
+	}
+	if( timeout )
+		onLoss( true );
+
+	// Add reliable messages to the ring buffer, as many as the send window allows
+	while( !Messages.empty() && !getBufferFull() )
+	{
+		OutPacket_t & p = outPacket(SndNext);
+		p.acked = p.lost = false;
+		p.transmissions = 0;
+		if( Messages.front().GetLength() > MAX_FRAGMENTED_PACKET_SIZE )
+		{
+			// Fragment the packet
+			Messages.front().ResetPosToBegin();
+			p.data = Messages.front().readData( MAX_FRAGMENTED_PACKET_SIZE );
+			p.fragmented = true;
+			CBytestream rest;
+			rest.writeData( Messages.front().readData() );
+			Messages.front() = rest;
+		}
+		else
+		{
+			p.data = Messages.front().data();
+			p.fragmented = false;
+			Messages.pop_front();
+			while( ! Messages.empty() &&
+					p.data.size() + Messages.front().GetLength() <= MAX_FRAGMENTED_PACKET_SIZE )
+			{
+				p.data += Messages.front().data();
+				Messages.pop_front();
+			}
+		}
+		SndNext = NextSequence4(SndNext);
+	}
+
+	// Acks
+	CBytestream bs;
+	int cumAck = (RcvNext - 1) & SEQUENCE4_MASK;
+	Uint32 sackBits = 0;
+	for( int bit = 0; bit < SACK_BITS; bit++ )
+	{
+		int seq = NextSequence4( cumAck, bit + 2 );
+		if( SequenceDiff4( seq, DeliverNext ) < RingSize && inPacket(seq).received )
+			sackBits |= 1u << bit;
+	}
+	bs.writeInt( cumAck, 2 );
+	bs.writeInt( (int)sackBits, 4 );
+
+	// Lost packets first, then new ones while the window allows it
+	CBytestream packetData;
+	int count = 0;
+	int inFlight = packetsInFlight();
+	for( int pass = 0; pass < 2; pass++ )
+	{
+		for( int seq = SndUna; seq != SndNext && count < 255; seq = NextSequence4(seq) )
+		{
+			OutPacket_t & p = outPacket(seq);
+			if( p.acked )
+				continue;
+			if( pass == 0 ? !p.lost : (p.transmissions > 0 || inFlight >= (int)Cwnd) )
+				continue;
+			// Always send the first packet, it fits because of fragmentation
+			if( count > 0 && bs.GetLength() + 1 + packetData.GetLength() + 4 + p.data.size() > MAX_PACKET_SIZE-2 )  // Substract CRC16 size
+				break;
+
+			packetData.writeInt( seq, 2 );
+			packetData.writeInt( (int)p.data.size() | (p.fragmented ? SEQUENCE_HIGHEST_BIT : 0), 2 );
+			packetData.writeData( p.data );
+			if( p.transmissions > 0 )
+			{
+				iRetransmissions++;
+				CountRetransmits( 1 );
+			}
+			p.transmissions++;
+			p.lost = false;
+			p.sentTime = tLX->currentTime;
+			count++;
+			inFlight++;
+		}
+	}
+
+	if( unreliableData->GetLength() == 0 && count == 0 && !AckPending &&
+		tLX->currentTime - fLastSent < KeepAlivePacketTimeout )
+	{
+		// Nothing to send really, send one empty packet per second so we won't timeout
+		cOutgoingRate.addData( 0 );
+		return;
+	}
+
+	bs.writeByte( count );
+	bs.Append( &packetData );
+
+	if( count == 0 || bs.GetLength() + unreliableData->GetLength() <= MAX_PACKET_SIZE-2 ) // Substract CRC16 size
+		bs.Append(unreliableData);
+
+	// Add CRC16
+	CBytestream bs1;
+	bs1.writeInt( crc16( bs.data().c_str(), bs.GetLength() ), 2);
+	bs1.Append(&bs);
+
+	// Send the packet
+	Socket->setRemoteAddress(RemoteAddr);
+	bs1.Send(Socket.get());
+
+	AckPending = false;
+
+	UpdateTransmitStatistics( bs1.GetLength() );
+}
+
+
+///////////////////
+// Congestion test for CChannel - compares the channel versions over simulated bad connections
+
+namespace {
+
+struct ChannelSimResult
+{
+	int sent;
+	int received;
+	int orderErrors;
+	float avgLatency;	// ms, of the small game messages
+	int maxLatency;
+	int bulkTime;		// ms until all of the bulk data arrived, -1 if it didn't
+	size_t bytesSent;	// by both sides
+	size_t resends;
+};
+
+// The lag "socket" which delays or drops packets between from and to
+struct LaggyLink
+{
+	SmartPointer<NetworkSocket> in;
+	std::multimap< int, CBytestream > buf;
+	int packetLoss, lagMin, lagMax;
+
+	void forward( int testtime )
+	{
+		while( true )
+		{
+			CBytestream b;
+			b.Read(in.get());
+			if( b.GetLength() == 0 )
+				break;
+			b.ResetPosToBegin();
+			if( GetRandomInt(99) < packetLoss )
+				continue;
+			buf.insert( std::make_pair( testtime + lagMin + GetRandomInt(lagMax - lagMin), b ) );
+		}
+		while( !buf.empty() && buf.begin()->first <= testtime )
+		{
+			buf.begin()->second.ResetPosToBegin();
+			buf.begin()->second.Send(in.get());
+			buf.erase( buf.begin() );
+		}
+	}
+};
+
+size_t ChannelResends( CChannel & ) { return 0; }
+size_t ChannelResends( CChannel4 & c ) { return c.getRetransmissions(); }
+
+// c1 sends a small reliable game message every 50ms (with the send time, to measure the latency)
+// and at second 2 a burst of bulk data (like a file or a big game state),
+// c2 sends a small reliable message every 200ms back, so both sides have to ack.
+template< typename Channel >
+ChannelSimResult SimulateChannel( int packetLoss, int lagMin, int lagMax )
+{
+	enum { SIM_TIME = 20000, SIM_TIMEOUT = 120000, BULK_START = 2000, BULK_PACKETS = 200, BULK_SIZE = 300 };
+
+	Channel c1, c2;
+	SmartPointer<NetworkSocket> s1 = new NetworkSocket(); s1->OpenUnreliable(0);
+	SmartPointer<NetworkSocket> s2 = new NetworkSocket(); s2->OpenUnreliable(0);
+	LaggyLink l1, l2;
+	l1.in = new NetworkSocket(); l1.in->OpenUnreliable(0);
+	l2.in = new NetworkSocket(); l2.in->OpenUnreliable(0);
+	l1.packetLoss = l2.packetLoss = packetLoss;
+	l1.lagMin = l2.lagMin = lagMin;
+	l1.lagMax = l2.lagMax = lagMax;
+	tLX->currentTime = AbsTime(0);
+	c1.Create( l1.in->localAddress(), s1 );
+	c2.Create( l2.in->localAddress(), s2 );
+	l1.in->setRemoteAddress( s2->localAddress() );
+	l2.in->setRemoteAddress( s1->localAddress() );
+
+	ChannelSimResult r = ChannelSimResult();
+	r.bulkTime = -1;
+	int nextExpected = 0, bulkReceived = 0, latencySum = 0, latencyCount = 0;
+	for( int testtime = 0; testtime < SIM_TIMEOUT; testtime += 10 )
+	{
+		tLX->currentTime = AbsTime(testtime);
+
+		if( testtime < SIM_TIME && testtime % 50 == 0 )
+		{
+			CBytestream b;
+			b.writeByte(0);
+			b.writeInt(r.sent++, 4);
+			b.writeInt(testtime, 4);
+			c1.AddReliablePacketToSend(b);
+		}
+		if( testtime == BULK_START )
+		{
+			for( int f = 0; f < BULK_PACKETS; f++ )
+			{
+				CBytestream b;
+				b.writeByte(1);
+				b.writeInt(r.sent++, 4);
+				for( int i = 0; i < BULK_SIZE; i++ )
+					b.writeByte(i);
+				c1.AddReliablePacketToSend(b);
+			}
+		}
+		if( testtime < SIM_TIME && testtime % 200 == 0 )
+		{
+			CBytestream b;
+			b.writeInt(testtime, 4);
+			c2.AddReliablePacketToSend(b);
+		}
+
+		CBytestream empty;
+		c1.Transmit( &empty );
+		c2.Transmit( &empty );
+		l1.forward( testtime );
+		l2.forward( testtime );
+
+		while( true )
+		{
+			CBytestream b;
+			b.Read(s2.get());
+			if( b.GetLength() == 0 )
+				break;
+			while( c2.Process( &b ) )
+			{
+				while( b.GetRestLen() != 0 )
+				{
+					int type = b.readByte();
+					int idx = b.readInt(4);
+					if( idx != nextExpected )
+						r.orderErrors++;
+					nextExpected = idx + 1;
+					r.received++;
+					if( type == 0 )
+					{
+						int latency = testtime - b.readInt(4);
+						latencySum += latency;
+						latencyCount++;
+						r.maxLatency = MAX( r.maxLatency, latency );
+					}
+					else
+					{
+						b.Skip(BULK_SIZE);
+						if( ++bulkReceived == BULK_PACKETS )
+							r.bulkTime = testtime - BULK_START;
+					}
+				}
+				b.Clear();
+			}
+		}
+		while( true )
+		{
+			CBytestream b;
+			b.Read(s1.get());
+			if( b.GetLength() == 0 )
+				break;
+			while( c1.Process( &b ) )
+				b.Clear();
+		}
+
+		if( testtime >= SIM_TIME && r.received == r.sent && c1.getBufferEmpty() && c1.Messages.empty() )
+			break;
+	}
+
+	r.avgLatency = latencyCount ? (float)latencySum / latencyCount : 0;
+	r.bytesSent = c1.getOutgoing() + c2.getOutgoing();
+	r.resends = ChannelResends(c1);
+	return r;
+}
+
+// Writes the result to cli, with CNC_ERROR when messages got lost or came in the wrong order.
+// Returns false in that case.
+bool PrintChannelSimResult( CmdLineIntf & cli, const std::string & name, const ChannelSimResult & r )
+{
+	const bool ok = r.received == r.sent && r.orderErrors == 0;
+	std::string msg = "  " + name + ": received " + itoa(r.received) + "/" + itoa(r.sent) +
+			", order errors " + itoa(r.orderErrors) +
+			", latency avg " + ftoa(r.avgLatency, 0) + "ms max " + itoa(r.maxLatency) + "ms" +
+			", bulk data " + (r.bulkTime >= 0 ? itoa(r.bulkTime) + "ms" : std::string("not finished")) +
+			", " + itoa(r.bytesSent / 1024) + " KB on the wire";
+	if( r.resends > 0 )
+		msg += ", " + itoa(r.resends) + " resends";
+	cli.writeMsg( msg, ok ? CNC_NORMAL : CNC_ERROR );
+	return ok;
+}
+
+}
+
+bool TestCChannelCongestion( CmdLineIntf & cli )
+{
+	cli.writeMsg( "Testing CChannel congestion control" );
+	struct Scenario { int packetLoss, lagMin, lagMax; };
+	static const Scenario scenarios[] = {
+		{ 0, 20, 30 },
+		{ 2, 50, 100 },
+		{ 10, 50, 150 },
+		{ 25, 100, 400 },
+	};
+	// The simulation drives the channels with its own clock
+	const AbsTime oldTime = tLX->currentTime;
+	bool ok = true;
+	for( size_t f = 0; f < sizeof(scenarios) / sizeof(scenarios[0]); f++ )
+	{
+		const Scenario & s = scenarios[f];
+		cli.writeMsg( "Loss " + itoa(s.packetLoss) + "%, lag " + itoa(s.lagMin) + "-" + itoa(s.lagMax) + "ms:" );
+		ok &= PrintChannelSimResult( cli, "CChannel3", SimulateChannel<CChannel3>( s.packetLoss, s.lagMin, s.lagMax ) );
+		ok &= PrintChannelSimResult( cli, "CChannel4", SimulateChannel<CChannel4>( s.packetLoss, s.lagMin, s.lagMax ) );
+	}
+	tLX->currentTime = oldTime;
+	return ok;
+}
+
+
 
 
 // CRC16 stolen from Linux kernel sources
@@ -46,6 +46,8 @@
 #include "game/Game.h"
 #include "CodeAttributes.h"
 #include "CGameScript.h"
+#include "OLXCommand.h"
+#include "Profiler.h"
 
 
 ////////////////////
@@ -117,12 +119,9 @@ bool CMap::NewFrom(CMap* map)
 	
 	AdditionalData = map->AdditionalData;
 	
-	bMapSavingToMemory = false;
-	bmpSavedImage = NULL;
-	if( savedPixelFlags )
-		delete[] savedPixelFlags;
-	savedPixelFlags = NULL;
-	savedMapCoords.clear();
+	NewNet_Deinit();
+	terrainVersion++;
+	terrainRegionVersions.clear();
 	
 	Created = true;
 
@@ -163,8 +162,11 @@ size_t CMap::GetMemorySize()
 #ifdef _AI_DEBUG
 	res += GetSurfaceMemorySize(bmpDebugImage.get());
 #endif
-	if( bmpSavedImage.get() != NULL )
-		res += GetSurfaceMemorySize(bmpSavedImage.get()) + Width * Height; // Saved pixel flags
+	for( size_t i = 0; i < savedTiles.size(); i++ )
+		res += sizeof(SavedTile_t) + savedTiles[i].second->image.capacity();
+	for( size_t i = 0; i < savedTilePool.size(); i++ )
+		res += sizeof(SavedTile_t) + savedTilePool[i]->image.capacity();
+	res += savedTileBits.size() * sizeof(Uint32);
 	if( bmpBackImageHiRes.get() )
 		res += GetSurfaceMemorySize(bmpBackImageHiRes.get());
 	return res;
@@ -1039,6 +1041,7 @@ int CMap::CarveHole(int size, CVec pos, bool wrapAround)
 		return 0;
 			
 	SaveToMemoryInternal( map_x, map_y, w, h );
+	MarkTerrainChanged( map_x, map_y, w, h );
 
 	// Variables
 	byte bpp = hole.get()->format->BytesPerPixel;
@@ -1157,6 +1160,7 @@ int CMap::PlaceDirt(int size, CVec pos)
 	int hole_clip_x = -MIN(sx,(int)0);
 	
 	SaveToMemoryInternal( clip_x, clip_y, clip_w, clip_h );
+	MarkTerrainChanged( clip_x, clip_y, clip_w - clip_x, clip_h - clip_y );
 
 	lockFlags();
 
@@ -1269,6 +1273,7 @@ int CMap::PlaceGreenDirt(CVec pos)
 	int green_clip_x = -MIN(sx,(int)0);
 	
 	SaveToMemoryInternal( clip_x, clip_y, clip_w, clip_h );
+	MarkTerrainChanged( clip_x, clip_y, clip_w - clip_x, clip_h - clip_y );
 
 	short screenbpp = getMainPixelFormat()->BytesPerPixel;
 
@@ -1563,6 +1568,7 @@ void CMap::PlaceStone(int size, CVec pos)
 
 	UnlockSurface(stone);
 
+	MarkTerrainChanged(sx, sy, w, h);
 	UpdateArea(sx, sy, w, h);
 
     // Calculate the total dirt count
@@ -2060,30 +2066,43 @@ void CMap::DEBUG_DrawPixelFlags(int x, int y, int w, int h)
 }
 
 
-void CMap::NewNet_SaveToMemory()
+/*
+ Terrain snapshots for the commit/rollback net mechanism
+
+ The map is split into MAP_SAVE_CHUNK x MAP_SAVE_CHUNK tiles. Nothing is
+ copied when the snapshot is taken. CarveHole()/PlaceDirt()/PlaceGreenDirt()
+ call SaveToMemoryInternal() before they change something, and every tile
+ which is not saved yet is copied then (copy on write). A bitset tells which
+ tiles are saved, the list of saved tiles makes restoring and dropping a
+ snapshot O(changed tiles). The copies come from a pool, so after the first
+ rollbacks nothing gets allocated anymore.
+*/
+
+void CMap::RecycleSavedTiles()
 {
-	if( bMapSavingToMemory )
+	for( size_t i = 0; i < savedTiles.size(); i++ )
 	{
-		errors("Error: calling CMap::SaveToMemory() twice\n");
-		return;
+		const uint tile = savedTiles[i].first;
+		savedTileBits[tile / 32] &= ~(1u << (tile % 32));
+		savedTilePool.push_back(savedTiles[i].second);
 	}
-	bMapSavingToMemory = true;
-	if( bmpSavedImage.get() == NULL )
+	savedTiles.clear();
+}
+
+void CMap::NewNet_SaveToMemory()
+{
+	// Saving again without a restore commits the current state
+	RecycleSavedTiles();
+	
+	const uint tilesX = (Width + MAP_SAVE_CHUNK - 1) / MAP_SAVE_CHUNK;
+	const uint tilesY = (Height + MAP_SAVE_CHUNK - 1) / MAP_SAVE_CHUNK;
+	if( tilesX != savedTilesX || tilesY != savedTilesY )
 	{
-		if( bmpBackImageHiRes.get() )
-			bmpSavedImage = gfxCreateSurface(Width*2, Height*2);
-		else
-			bmpSavedImage = gfxCreateSurface(Width, Height);
-			
-		if( bmpSavedImage.get() == NULL )
-		{
-			errors("Error: CMap::SaveToMemory(): cannot allocate GFX surface\n");
-			return;
-		}
-		savedPixelFlags = new uchar[Width * Height];
+		savedTilesX = tilesX;
+		savedTilesY = tilesY;
+		savedTileBits.assign((tilesX * tilesY + 31) / 32, 0);
 	}
-	
-	savedMapCoords.clear();
+	bMapSavingToMemory = true;
 }
 
 void CMap::NewNet_RestoreFromMemory()
@@ -2093,105 +2112,311 @@ void CMap::NewNet_RestoreFromMemory()
 		errors("Error: calling CMap::RestoreFromMemory() twice\n");
 		return;
 	}
-	if( bmpSavedImage.get() == NULL || savedPixelFlags == NULL )
-	{
-		errors("Error: CMap::RestoreFromMemory(): bmpSavedImage is NULL\n");
+	
+	const bool hiRes = bmpBackImageHiRes.get() != NULL;
+	if( hiRes && !LockSurface(bmpDrawImage) )
 		return;
-	}
+	lockFlags();
 	
-	for( std::set< SavedMapCoord_t > :: iterator it = savedMapCoords.begin();
-			it != savedMapCoords.end(); it++ )
+	for( size_t i = 0; i < savedTiles.size(); i++ )
 	{
-		int startX = it->X*MAP_SAVE_CHUNK;
-		int sizeX = (int) MIN( MAP_SAVE_CHUNK, Width - startX );
-		int startY = it->Y*MAP_SAVE_CHUNK;
-		int sizeY = (int) MIN( MAP_SAVE_CHUNK, Height - startY  );
-
-		LOCK_OR_QUIT(bmpSavedImage);
-		lockFlags();
-	
-		if( bmpBackImageHiRes.get() )
+		const SavedTile_t* saved = savedTiles[i].second;
+		const int startX = (savedTiles[i].first % savedTilesX) * MAP_SAVE_CHUNK;
+		const int startY = (savedTiles[i].first / savedTilesX) * MAP_SAVE_CHUNK;
+		const int sizeX = (int) MIN( MAP_SAVE_CHUNK, (int)Width - startX );
+		const int sizeY = (int) MIN( MAP_SAVE_CHUNK, (int)Height - startY );
+		
+		for( int y = 0; y < sizeY; y++ )
+			memcpy( material->line[startY + y] + startX, saved->flags + y * MAP_SAVE_CHUNK, sizeX );
+		MarkTerrainChanged( startX, startY, sizeX, sizeY );
+		
+		if( hiRes && !saved->image.empty() )
 		{
-			LOCK_OR_QUIT(bmpDrawImage);
-			DrawImageAdv( bmpDrawImage.get(), bmpSavedImage, startX*2, startY*2, startX*2, startY*2, sizeX*2, sizeY*2 );
-			UnlockSurface(bmpDrawImage);
+			const int bpp = bmpDrawImage->format->BytesPerPixel;
+			for( int y = 0; y < sizeY * 2; y++ )
+				memcpy( (Uint8*)bmpDrawImage->pixels + (startY * 2 + y) * bmpDrawImage->pitch + startX * 2 * bpp,
+						&saved->image[y * MAP_SAVE_CHUNK * 2 * bpp], sizeX * 2 * bpp );
 		}
-
-		for( int y=startY; y<startY+sizeY; y++ )
-			memcpy( (char*)material->surf->pixels + y*material->surf->pitch + startX, savedPixelFlags + y*material->surf->pitch + startX, sizeX*sizeof(uchar) );
+	}
 	
-		unlockFlags();
-		UnlockSurface(bmpSavedImage);
-		
+	unlockFlags();
+	if( hiRes )
+		UnlockSurface(bmpDrawImage);
+	
+	for( size_t i = 0; i < savedTiles.size(); i++ )
+	{
+		const int startX = (savedTiles[i].first % savedTilesX) * MAP_SAVE_CHUNK;
+		const int startY = (savedTiles[i].first / savedTilesX) * MAP_SAVE_CHUNK;
+		const int sizeX = (int) MIN( MAP_SAVE_CHUNK, (int)Width - startX );
+		const int sizeY = (int) MIN( MAP_SAVE_CHUNK, (int)Height - startY );
 		if( tLXOptions->bShadows )
-		{
 			UpdateArea(startX, startY, sizeX, sizeY, true);
-		}
 		else
-		{
 			UpdateMiniMapRect(startX-10, startY-10, sizeX+20, sizeY+20);
-		}
 	}
-
+	
+	RecycleSavedTiles();
 	bMapSavingToMemory = false;
-	savedMapCoords.clear();
 }
 
 void CMap::NewNet_Deinit()
 {
-		bMapSavingToMemory = false;
-		bmpSavedImage = NULL;
-		if( savedPixelFlags )
-			delete[] savedPixelFlags;
-		savedPixelFlags = NULL;
-		savedMapCoords.clear();
+	RecycleSavedTiles();
+	for( size_t i = 0; i < savedTilePool.size(); i++ )
+		delete savedTilePool[i];
+	savedTilePool.clear();
+	savedTileBits.clear();
+	savedTilesX = savedTilesY = 0;
+	bMapSavingToMemory = false;
 }
 
 void CMap::SaveToMemoryInternal(int x, int y, int w, int h)
 {
-	if( ! bMapSavingToMemory )
+	if( ! bMapSavingToMemory || w <= 0 || h <= 0 )
 		return;
-	if( bmpSavedImage.get() == NULL || savedPixelFlags == NULL )
+	
+	const int gridX = MAX(x, 0) / MAP_SAVE_CHUNK;
+	const int gridMaxX = MIN((x + w - 1) / MAP_SAVE_CHUNK, (int)savedTilesX - 1);
+	const int gridY = MAX(y, 0) / MAP_SAVE_CHUNK;
+	const int gridMaxY = MIN((y + h - 1) / MAP_SAVE_CHUNK, (int)savedTilesY - 1);
+	
+	const bool hiRes = bmpBackImageHiRes.get() != NULL;
+	bool locked = false;
+	for( int fy = gridY; fy <= gridMaxY; fy++ )
+		for( int fx = gridX; fx <= gridMaxX; fx++ )
+		{
+			const uint tile = fy * savedTilesX + fx;
+			if( savedTileBits[tile / 32] & (1u << (tile % 32)) )
+				continue;
+			
+			if( !locked )
+			{
+				if( hiRes && !LockSurface(bmpDrawImage) )
+					return;
+				lockFlags();
+				locked = true;
+			}
+			
+			SavedTile_t* saved = NULL;
+			if( savedTilePool.empty() )
+				saved = new SavedTile_t();
+			else
+			{
+				saved = savedTilePool.back();
+				savedTilePool.pop_back();
+			}
+			savedTileBits[tile / 32] |= 1u << (tile % 32);
+			savedTiles.push_back(std::make_pair(tile, saved));
+			
+			const int startX = fx * MAP_SAVE_CHUNK;
+			const int startY = fy * MAP_SAVE_CHUNK;
+			const int sizeX = (int) MIN( MAP_SAVE_CHUNK, (int)Width - startX );
+			const int sizeY = (int) MIN( MAP_SAVE_CHUNK, (int)Height - startY );
+			
+			for( int y = 0; y < sizeY; y++ )
+				memcpy( saved->flags + y * MAP_SAVE_CHUNK, material->line[startY + y] + startX, sizeX );
+			
+			if( hiRes )
+			{
+				const int bpp = bmpDrawImage->format->BytesPerPixel;
+				saved->image.resize(MAP_SAVE_CHUNK * MAP_SAVE_CHUNK * 4 * bpp);
+				for( int y = 0; y < sizeY * 2; y++ )
+					memcpy( &saved->image[y * MAP_SAVE_CHUNK * 2 * bpp],
+							(Uint8*)bmpDrawImage->pixels + (startY * 2 + y) * bmpDrawImage->pitch + startX * 2 * bpp, sizeX * 2 * bpp );
+			}
+			else
+				saved->image.clear();
+		}
+	
+	if( locked )
 	{
-		errors("Error: CMap::SaveToMemoryInternal(): bmpSavedImage is NULL\n");
-		return;
+		unlockFlags();
+		if( hiRes )
+			UnlockSurface(bmpDrawImage);
 	}
+}
 
-	int gridX = x / MAP_SAVE_CHUNK;
-	int gridMaxX = 1 + (x+w) / MAP_SAVE_CHUNK;
+// Adler32 over all pixel flags
+static Uint32 MaterialChecksum(CMap* map, ALLEGRO_BITMAP* material, uint width, uint height)
+{
+	uLong sum = adler32(0L, Z_NULL, 0);
+	map->lockFlags(false);
+	for( uint y = 0; y < height; y++ )
+		sum = adler32(sum, (const Bytef*)material->line[y], width);
+	map->unlockFlags(false);
+	return (Uint32)sum;
+}
+
+void CMap::NewNet_BenchmarkRollback(CmdLineIntf& cli, int maxCraters)
+{
+	if( !Created || !material )
+	{
+		cli.writeMsg("no map loaded", CNC_ERROR);
+		return;
+	}
+	if( bMapSavingToMemory )
+	{
+		cli.writeMsg("the map has a snapshot already", CNC_ERROR);
+		return;
+	}
+	
+	const Uint32 checksum = MaterialChecksum(this, material, Width, Height);
+	// a fixed seed, so the runs are comparable
+	Uint32 random = 12345;
+	for( int craters = 1; ; craters *= 4 )
+	{
+		craters = MIN(craters, maxCraters);
+		
+		Uint64 start = Profiler::getTicks();
+		NewNet_SaveToMemory();
+		const Uint64 saveTime = Profiler::getTicks() - start;
+		
+		start = Profiler::getTicks();
+		for( int i = 0; i < craters; i++ )
+		{
+			random = random * 1664525u + 1013904223u;
+			const float x = (float)((random >> 8) % Width);
+			random = random * 1664525u + 1013904223u;
+			const float y = (float)((random >> 8) % Height);
+			CarveHole(4, CVec(x, y), false);
+		}
+		const Uint64 carveTime = Profiler::getTicks() - start;
+		const size_t tiles = savedTiles.size();
+		
+		start = Profiler::getTicks();
+		NewNet_RestoreFromMemory();
+		const Uint64 restoreTime = Profiler::getTicks() - start;
+		
+		cli.writeMsg(itoa(craters) + " craters, " + itoa(tiles) + "/" + itoa(savedTilesX * savedTilesY) + " tiles saved: snapshot " +
+					 itoa(saveTime) + " us, carving with copy on write " + itoa(carveTime) + " us, rollback " + itoa(restoreTime) + " us");
+		if( MaterialChecksum(this, material, Width, Height) != checksum )
+		{
+			cli.writeMsg("the map differs after the rollback", CNC_ERROR);
+			break;
+		}
+		if( craters >= maxCraters )
+			break;
+	}
 	
-	int gridY = y / MAP_SAVE_CHUNK;
-	int gridMaxY = 1 + (y+h) / MAP_SAVE_CHUNK;
+	// For comparison: what copying the whole terrain for every snapshot would cost
+	Uint64 start = Profiler::getTicks();
+	std::vector<uchar> flagsCopy(Width * Height);
+	lockFlags(false);
+	for( uint y = 0; y < Height; y++ )
+		memcpy( &flagsCopy[y * Width], material->line[y], Width );
+	unlockFlags(false);
+	cli.writeMsg("copying all pixel flags: " + itoa(Profiler::getTicks() - start) + " us (without the image)");
+}
 
-	for( int fy = gridY; fy < gridMaxY; fy++ )
-		for( int fx = gridX; fx < gridMaxX; fx++ )
-			if( savedMapCoords.count( SavedMapCoord_t( fx, fy ) ) == 0 )
-			{
-				savedMapCoords.insert( SavedMapCoord_t( fx, fy ) );
-				
-				int startX = fx*MAP_SAVE_CHUNK;
-				int sizeX = (int) MIN( MAP_SAVE_CHUNK, Width - startX );
-				int startY = fy*MAP_SAVE_CHUNK;
-				int sizeY = (int) MIN( MAP_SAVE_CHUNK, Height - startY  );
-
-				LOCK_OR_QUIT(bmpSavedImage);
-				lockFlags();
-				
-				if( bmpBackImageHiRes.get() )
-				{
-					LOCK_OR_QUIT(bmpDrawImage);
-					DrawImageAdv( bmpSavedImage.get(), bmpDrawImage, startX*2, startY*2, startX*2, startY*2, sizeX*2, sizeY*2 );
-					UnlockSurface(bmpDrawImage);
-				}
 
-				for( int y=startY; y<startY+sizeY; y++ )
-					memcpy( savedPixelFlags + y*material->surf->pitch + startX, (char*)material->surf->pixels + y*material->surf->pitch + startX, sizeX*sizeof(uchar) );
+void CMap::CheckPixelFlagProbes(CmdLineIntf& cli, int probes)
+{
+	if( !Created || !material )
+	{
+		cli.writeMsg("no map loaded", CNC_ERROR);
+		return;
+	}
+
+	// positions also a bit outside of the map, for the edge handling
+	std::vector< VectorD2<int> > pos(probes);
+	Uint32 random = 4711;
+	for( int i = 0; i < probes; i++ )
+	{
+		random = random * 1664525u + 1013904223u;
+		pos[i].x = (int)((random >> 8) % (Width + 40)) - 20;
+		random = random * 1664525u + 1013904223u;
+		pos[i].y = (int)((random >> 8) % (Height + 40)) - 20;
+	}
 
-				unlockFlags();
-				UnlockSurface(bmpSavedImage);
+	size_t mismatches = 0;
+	Uint32 sum = 0; // so that the compiler does not drop the per-pixel loop
+	Uint64 perPixelTime = 0, batchedTime = 0;
+	for( int wrap = 0; wrap < 2; wrap++ )
+	{
+		const bool wrapAround = wrap != 0;
+		Uint64 start = Profiler::getTicks();
+		std::vector<uchar> expected(probes * 17);
+		for( int i = 0; i < probes; i++ )
+		{
+			// like moveAndCheckWormCollision did it: 7 pixels of the row, 10 of the column
+			for( int x = 0; x < 7; x++ )
+			{
+				int px = pos[i].x - 3 + x;
+				if( wrapAround ) px = WrapAroundX(px);
+				expected[i * 17 + x] = GetPixelFlag(px, pos[i].y, wrapAround);
 			}
+			for( int y = 0; y < 10; y++ )
+			{
+				int py = pos[i].y - 4 + y;
+				if( wrapAround ) py = WrapAroundY(py);
+				expected[i * 17 + 7 + y] = GetPixelFlag(pos[i].x, py, wrapAround);
+			}
+		}
+		perPixelTime += Profiler::getTicks() - start;
+
+		start = Profiler::getTicks();
+		std::vector<uchar> got(probes * 17);
+		for( int i = 0; i < probes; i++ )
+		{
+			GetPixelFlagRow(pos[i].x - 3, pos[i].y, 7, &got[i * 17], wrapAround);
+			GetPixelFlagColumn(pos[i].x, pos[i].y - 4, 10, &got[i * 17 + 7], wrapAround);
+		}
+		batchedTime += Profiler::getTicks() - start;
+
+		for( size_t i = 0; i < got.size(); i++ )
+		{
+			sum += got[i];
+			if( got[i] != expected[i] ) mismatches++;
+		}
+	}
+
+	cli.writeMsg(itoa(probes) + " worm probes with and without wrap around: per pixel " + itoa(perPixelTime) +
+				 " us, by row/column " + itoa(batchedTime) + " us (flag sum " + itoa(sum) + ")");
+	if( mismatches > 0 )
+		cli.writeMsg(itoa(mismatches) + " pixel flags differ", CNC_ERROR);
+	else
+		cli.writeMsg("all pixel flags are the same");
 }
 
+void CMap::MarkTerrainChanged(int x, int y, int w, int h)
+{
+	if( terrainRegionVersions.empty() )
+	{
+		if( Width == 0 || Height == 0 )
+			return;
+		// the changes before are not known per region
+		terrainRegionsX = (Width + TERRAIN_REGION_SIZE - 1) / TERRAIN_REGION_SIZE;
+		terrainRegionsY = (Height + TERRAIN_REGION_SIZE - 1) / TERRAIN_REGION_SIZE;
+		terrainRegionVersions.assign(terrainRegionsX * terrainRegionsY, terrainVersion);
+	}
+	
+	terrainVersion++;
+	const int rx1 = CLAMP(x / TERRAIN_REGION_SIZE, 0, (int)terrainRegionsX - 1);
+	const int ry1 = CLAMP(y / TERRAIN_REGION_SIZE, 0, (int)terrainRegionsY - 1);
+	const int rx2 = CLAMP((x + w - 1) / TERRAIN_REGION_SIZE, 0, (int)terrainRegionsX - 1);
+	const int ry2 = CLAMP((y + h - 1) / TERRAIN_REGION_SIZE, 0, (int)terrainRegionsY - 1);
+	for( int ry = ry1; ry <= ry2; ry++ )
+		for( int rx = rx1; rx <= rx2; rx++ )
+			terrainRegionVersions[ry * terrainRegionsX + rx] = terrainVersion;
+}
+
+bool CMap::TerrainChangedSince(int x1, int y1, int x2, int y2, Uint32 version) const
+{
+	if( terrainVersion <= version )
+		return false;
+	if( terrainRegionVersions.empty() )
+		return true;
+	
+	const int rx1 = CLAMP(MIN(x1, x2) / TERRAIN_REGION_SIZE, 0, (int)terrainRegionsX - 1);
+	const int ry1 = CLAMP(MIN(y1, y2) / TERRAIN_REGION_SIZE, 0, (int)terrainRegionsY - 1);
+	const int rx2 = CLAMP(MAX(x1, x2) / TERRAIN_REGION_SIZE, 0, (int)terrainRegionsX - 1);
+	const int ry2 = CLAMP(MAX(y1, y2) / TERRAIN_REGION_SIZE, 0, (int)terrainRegionsY - 1);
+	for( int ry = ry1; ry <= ry2; ry++ )
+		for( int rx = rx1; rx <= rx2; rx++ )
+			if( terrainRegionVersions[ry * terrainRegionsX + rx] > version )
+				return true;
+	return false;
+}
 
 ///////////////////
 // Shutdown the map
@@ -2216,12 +2441,7 @@ void CMap::Shutdown()
 		NumObjects = 0;
 		AdditionalData.clear();
 
-		bMapSavingToMemory = false;
-		bmpSavedImage = NULL;
-		if( savedPixelFlags )
-			delete[] savedPixelFlags;
-		savedPixelFlags = NULL;
-		savedMapCoords.clear();
+		NewNet_Deinit();
 	}
 	// Safety
 	else  {
@@ -2233,15 +2453,14 @@ void CMap::Shutdown()
 		bmpMiniMap = NULL;
 		Objects = NULL;
 		AdditionalData.clear();
-		bMapSavingToMemory = false;
-		bmpSavedImage = NULL;
-		savedPixelFlags = NULL;
-		savedMapCoords.clear();
+		NewNet_Deinit();
 	}
 
 	gusShutdown();
 	Created = false;
 	FileName = "";
+	terrainVersion++;
+	terrainRegionVersions.clear();
 
 	unlockFlags();
 }
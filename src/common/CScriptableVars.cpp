@@ -310,9 +310,8 @@ std::string CScriptableVars::StripClassName( const std::string & c )
 RegisteredVar* CScriptableVars::GetVar( const std::string & name )
 {
 	Init();
-	VarMap::iterator it = m_instance->m_vars.find(name);
-	if(it != m_instance->m_vars.end()) return &it->second;
-	return NULL;
+	RegisteredVar** var = m_instance->m_index.find(name);
+	return var ? *var : NULL;
 }
 
 
@@ -338,6 +337,11 @@ void CScriptableVars::DeRegisterVars( const std::string & base )
 		VarMap::iterator cp = it; ++it;
 		m_instance->m_vars.erase( cp );
 	}
+
+	// the index has no erase, so it is rebuilt; deregistering is rare
+	m_instance->m_index.clear();
+	for( VarMap::iterator it = m_instance->m_vars.begin(); it != m_instance->m_vars.end(); ++it )
+		m_instance->m_index.insert( it->first, &it->second );
 }
 
 std::string CScriptableVars::DumpVars()
@@ -50,6 +50,9 @@
 #include "game/Mod.h"
 #include "level/FastTraceLine.h"
 #include "CClientNetEngine.h"
+#include "Physics.h"
+#include "Profiler.h"
+#include "OLXCommand.h"
 
 
 // used by searchpath algo
@@ -990,6 +993,281 @@ void do_some_tests_with_fastTraceLine() {
 #endif
 
 
+/*
+  Shared trace cache and time slicing
+  -----------------------------------
+
+  Most of the AI time goes into traces through the terrain: every bot traces
+  to every target, checks the trajectory of its weapon and searches shooting
+  spots around its target, and does it again in the next tick although
+  nothing changed. The traces are keyed by the quantized start and end points
+  (AI_CACHE_CELL pixels), so bots near each other or with the same target
+  share them. An entry is valid as long as the terrain in its bounding box,
+  widened by a cell, did not change (see CMap::TerrainChangedSince()).
+
+  Results are approximate by up to a cell, which is fine for bots (they run
+  only on the host and don't need to be deterministic). Only used from the
+  game thread, not by the path search.
+
+  The scheduler gives all bots together iAITickBudget microseconds per physics
+  tick. When half of it is used, only bots which were skipped in the last tick
+  may think; a bot which was skipped AI_MAX_SKIPPED times in a row thinks in
+  any case. A skipped bot keeps its input from the last tick.
+*/
+
+bool CWormBotInputHandler::bAITraceCache = true;
+int CWormBotInputHandler::iAITickBudget = 5000;
+
+enum {
+	AI_CACHE_SIZE = 4096, // power of two
+	AI_CACHE_CELL = 4,
+	AI_MAX_SKIPPED = 8
+};
+
+enum AITraceKind {
+	AIT_TRACELINE = 1,
+	AIT_WEAPONLINE,
+	AIT_TRAJECTORY,
+	AIT_WORMLINE
+};
+
+struct AITraceKey {
+	short sx, sy, tx, ty; // cells
+	short kind, param;
+
+	AITraceKey() : sx(0), sy(0), tx(0), ty(0), kind(0), param(0) {}
+	AITraceKey(AITraceKind k, int p, CVec start, CVec target) : kind((short)k), param((short)p) {
+		sx = (short)CLAMP((int)start.x / AI_CACHE_CELL, -1, 32000);
+		sy = (short)CLAMP((int)start.y / AI_CACHE_CELL, -1, 32000);
+		tx = (short)CLAMP((int)target.x / AI_CACHE_CELL, -1, 32000);
+		ty = (short)CLAMP((int)target.y / AI_CACHE_CELL, -1, 32000);
+	}
+	bool operator==(const AITraceKey& k) const {
+		return sx == k.sx && sy == k.sy && tx == k.tx && ty == k.ty && kind == k.kind && param == k.param;
+	}
+	size_t hash() const {
+		Uint32 h = (Uint32)(Uint16)sx * 73856093u ^ (Uint32)(Uint16)sy * 19349663u ^
+			(Uint32)(Uint16)tx * 83492791u ^ (Uint32)(Uint16)ty * 2654435761u ^ (Uint32)(kind * 31 + param) * 40503u;
+		return (h ^ (h >> 15)) & (AI_CACHE_SIZE - 1);
+	}
+};
+
+struct AITraceEntry {
+	AITraceKey key;
+	Uint32 version; // of the terrain
+	int x1, y1, x2, y2; // bounding box of the checked pixels
+	int result;
+	uchar type;
+	bool used;
+	AITraceEntry() : version(0), x1(0), y1(0), x2(0), y2(0), result(0), type(0), used(false) {}
+};
+
+static struct AITraceCache {
+	AITraceEntry entries[AI_CACHE_SIZE];
+	const CMap* map;
+	Uint32 mapVersion;
+	Uint64 hits, misses, stale;
+
+	AITraceCache() : map(NULL), mapVersion(0), hits(0), misses(0), stale(0) {}
+
+	void clear() {
+		for(int i = 0; i < AI_CACHE_SIZE; ++i)
+			entries[i].used = false;
+	}
+
+	// NULL if there is no valid entry, else the entry
+	const AITraceEntry* find(const AITraceKey& key) {
+		const CMap* m = game.gameMap();
+		// a new map (maybe at the same address) starts with lower versions
+		if(m != map || m->GetTerrainVersion() < mapVersion) {
+			clear();
+			map = m;
+		}
+		mapVersion = m->GetTerrainVersion();
+
+		AITraceEntry& e = entries[key.hash()];
+		if(!e.used || !(e.key == key)) {
+			misses++;
+			return NULL;
+		}
+		if(m->TerrainChangedSince(e.x1, e.y1, e.x2, e.y2, e.version)) {
+			stale++;
+			return NULL;
+		}
+		hits++;
+		return &e;
+	}
+
+	void add(const AITraceKey& key, CVec a, CVec b, int margin, int result, uchar type) {
+		// a lookup with the same key can start and end anywhere in the same cells,
+		// so its trace can touch pixels up to a cell away from this one
+		margin += AI_CACHE_CELL;
+		AITraceEntry& e = entries[key.hash()];
+		e.key = key;
+		e.version = map ? map->GetTerrainVersion() : 0;
+		e.x1 = (int)MIN(a.x, b.x) - margin;
+		e.y1 = (int)MIN(a.y, b.y) - margin;
+		e.x2 = (int)MAX(a.x, b.x) + margin;
+		e.y2 = (int)MAX(a.y, b.y) + margin;
+		e.result = result;
+		e.type = type;
+		e.used = true;
+	}
+} aiTraceCache;
+
+static struct AIScheduler {
+	AbsTime tickTime;
+	Uint64 tick;
+	Uint64 usedThisTick;
+	Uint64 thinks, skipped, forced, ticks, totalTime, maxTickTime;
+
+	AIScheduler() : tick(0), usedThisTick(0), thinks(0), skipped(0), forced(0), ticks(0), totalTime(0), maxTickTime(0) {}
+
+	void startTick() {
+		if(tickTime == GetPhysicsTime() && tick > 0) return;
+		if(usedThisTick > 0) {
+			ticks++;
+			maxTickTime = MAX(maxTickTime, usedThisTick);
+		}
+		tickTime = GetPhysicsTime();
+		tick++;
+		usedThisTick = 0;
+	}
+
+	bool mayThink(Uint64 lastThinkTick, int skippedTicks) {
+		const Uint64 budget = (Uint64)MAX(CWormBotInputHandler::iAITickBudget, 0);
+		if(budget == 0 || usedThisTick < budget / 2)
+			return true;
+		if(skippedTicks >= AI_MAX_SKIPPED) {
+			forced++;
+			return true;
+		}
+		return usedThisTick < budget && lastThinkTick + 1 < tick;
+	}
+
+	void used(Uint64 t) {
+		usedThisTick += t;
+		totalTime += t;
+		thinks++;
+	}
+} aiScheduler;
+
+// CWorm::traceLine with the cache
+static int cachedTraceLine(CWorm* w, CVec target, CVec start, int *nType, int divs = 5, uchar checkflag = PX_EMPTY)
+{
+	if(!CWormBotInputHandler::bAITraceCache || game.gameMap() == NULL)
+		return w->traceLine(target, start, nType, divs, checkflag);
+
+	const AITraceKey key(AIT_TRACELINE, divs * 256 + checkflag, start, target);
+	if(const AITraceEntry* e = aiTraceCache.find(key)) {
+		if(nType) *nType = e->type;
+		return e->result;
+	}
+
+	int type = PX_EMPTY;
+	const int res = w->traceLine(target, start, &type, divs, checkflag);
+	aiTraceCache.add(key, start, target, 1, res, (uchar)type);
+	if(nType) *nType = type;
+	return res;
+}
+
+static int cachedTraceLine(CWorm* w, CVec target, float *fDist, int *nType, int divs = 5)
+{
+	const int res = cachedTraceLine(w, target, w->getPos(), nType, divs);
+	if (fDist && res) *fDist = (float)((int)(w->getPos() - target).GetLength() / res);
+	return res;
+}
+
+// traceWormLine without the collision point
+static int cachedTraceWormLine(CVec target, CVec start)
+{
+	if(!CWormBotInputHandler::bAITraceCache || game.gameMap() == NULL)
+		return traceWormLine(target, start, NULL);
+
+	const AITraceKey key(AIT_WORMLINE, 0, start, target);
+	if(const AITraceEntry* e = aiTraceCache.find(key))
+		return e->result;
+
+	const int res = traceWormLine(target, start, NULL);
+	aiTraceCache.add(key, start, target, 3, res, 0);
+	return res;
+}
+
+// The terrain part of traceWeaponLine(): the first i where the line hits dirt or rock, -1 if none
+static int traceWeaponTerrain(CVec pos, CVec dir, int nTotalLength, int first_division, int divisions, uchar *nType)
+{
+	int divs = first_division;
+	for(int i=0; i<nTotalLength; i+=divs) {
+		uchar px = game.gameMap()->GetPixelFlag( (int)pos.x, (int)pos.y );
+
+		if (i>first_division)
+			divs = divisions;
+
+		if((px & PX_DIRT) || (px & PX_ROCK)) {
+			*nType = px;
+			return i;
+		}
+
+		pos += dir * (float)divs;
+	}
+
+	*nType = PX_EMPTY;
+	return -1;
+}
+
+static int cachedTraceWeaponTerrain(CVec start, CVec target, CVec dir, int nTotalLength, int first_division, int divisions, uchar *nType)
+{
+	if(!CWormBotInputHandler::bAITraceCache)
+		return traceWeaponTerrain(start, dir, nTotalLength, first_division, divisions, nType);
+
+	const AITraceKey key(AIT_WEAPONLINE, first_division * 16 + divisions, start, target);
+	if(const AITraceEntry* e = aiTraceCache.find(key)) {
+		*nType = e->type;
+		return e->result;
+	}
+
+	const int res = traceWeaponTerrain(start, dir, nTotalLength, first_division, divisions, nType);
+	aiTraceCache.add(key, start, target, 1, res, *nType);
+	return res;
+}
+
+// The check of weaponCanHit(): true if nothing is in the way of the projectile on the parabola
+static bool trajectoryFree(proj_t* proj, const Parabola& p, CVec from, CVec to, float x_vel, float& minY, float& maxY)
+{
+	float last_y = (p.a * (from.x + 5) * (from.x + 5) + p.b * (from.x + 5) + p.c);
+	for (float x = from.x + 5; x < to.x; x++)  {
+		float y = (p.a * x * x + p.b *x + p.c);
+		minY = MIN(minY, MIN(y, 2 * y - last_y));
+		maxY = MAX(maxY, MAX(y, 2 * y - last_y));
+
+		// Rock or dirt, trajectory not free
+		if (CProjectile::CheckCollision(proj, 1, CVec(x, y), CVec(x_vel, y - last_y)))
+			return false;
+
+		last_y = y;
+	}
+	return true;
+}
+
+static bool cachedTrajectoryFree(proj_t* proj, const Parabola& p, CVec from, CVec to, float x_vel, CVec wormPos, CVec trgPos, float alpha)
+{
+	float minY = MIN(from.y, to.y), maxY = MAX(from.y, to.y);
+	if(!CWormBotInputHandler::bAITraceCache)
+		return trajectoryFree(proj, p, from, to, x_vel, minY, maxY);
+
+	const int size = (proj->Type == PRJ_PIXEL) ? 1 : 2;
+	const AITraceKey key(AIT_TRAJECTORY, size * 256 + (int)RAD2DEG(alpha) + 90, wormPos, trgPos);
+	if(const AITraceEntry* e = aiTraceCache.find(key))
+		return e->result != 0;
+
+	const bool res = trajectoryFree(proj, p, from, to, x_vel, minY, maxY);
+	// the projectile leaves the map at the latest at its border
+	const float h = (float)game.gameMap()->GetHeight();
+	aiTraceCache.add(key, CVec(from.x - 1, CLAMP(minY, -1.0f, h)), CVec(to.x + 1, CLAMP(maxY, -1.0f, h)), size + 1, res, 0);
+	return res;
+}
+
+
 void CWormBotInputHandler::AI_Respawn() {
 	if(findNewTarget()) {
 		AI_CreatePath(true);
@@ -1026,6 +1304,22 @@ void CWormBotInputHandler::getInput() {
 		return;
 	}
 	
+	aiScheduler.startTick();
+	if(!aiScheduler.mayThink(iAILastThinkTick, iAISkippedTicks)) {
+		// keep the input of the last tick
+		aiScheduler.skipped++;
+		iAISkippedTicks++;
+		return;
+	}
+	iAILastThinkTick = aiScheduler.tick;
+	iAISkippedTicks = 0;
+	
+	const Uint64 start = Profiler::getTicks();
+	AI_GetInput();
+	aiScheduler.used(Profiler::getTicks() - start);
+}
+
+void CWormBotInputHandler::AI_GetInput() {
 	worm_state_t *ws = &m_worm->tState.write();
 	
 
@@ -1121,6 +1415,78 @@ void CWormBotInputHandler::getInput() {
 	m_worm->iMoveDirectionSide = m_worm->iFaceDirectionSide;
 }
 
+void CWormBotInputHandler::AI_EvaluateTargets() {
+	const int oldTarget = nAITargetWormId;
+	for_each_iterator(CWorm*, w, game.aliveWorms()) {
+		if(w->get() == m_worm) continue;
+		const CVec trg = w->get()->getPos();
+		nAITargetWormId = w->get()->getID();
+
+		float dist = 0;
+		int type = PX_EMPTY;
+		traceWeaponLine(trg, &dist, &type);
+		cachedTraceLine(m_worm, trg, &dist, &type, 1);
+		cachedTraceWormLine(trg, m_worm->vPos);
+		weaponCanHit(100, 100, trg);
+		AI_FindShootingSpot();
+	}
+	nAITargetWormId = oldTarget;
+}
+
+void CWormBotInputHandler::dumpAIStats(CmdLineIntf& cli) {
+	const Uint64 lookups = aiTraceCache.hits + aiTraceCache.misses + aiTraceCache.stale;
+	cli.writeMsg(std::string("trace cache ") + (bAITraceCache ? "on" : "off") + ": " + itoa(lookups) + " lookups, " +
+				 itoa(aiTraceCache.hits) + " hits (" + ftoa(lookups ? 100.0f * aiTraceCache.hits / lookups : 0.0f) + "%), " +
+				 itoa(aiTraceCache.stale) + " stale after terrain changes");
+	cli.writeMsg("scheduler: budget " + itoa(iAITickBudget) + " us/tick, " + itoa(aiScheduler.thinks) + " thinks, " +
+				 itoa(aiScheduler.skipped) + " skipped, " + itoa(aiScheduler.forced) + " forced after " + itoa(AI_MAX_SKIPPED) + " skipped ticks");
+	cli.writeMsg("AI time: avg " + ftoa(aiScheduler.ticks ? float(aiScheduler.totalTime) / aiScheduler.ticks : 0.0f) +
+				 " us/tick, max " + itoa(aiScheduler.maxTickTime) + " us/tick");
+}
+
+void CWormBotInputHandler::benchmarkAI(CmdLineIntf& cli, int rounds) {
+	if(game.gameMap() == NULL) {
+		cli.writeMsg("no map loaded", CNC_ERROR);
+		return;
+	}
+
+	std::vector<CWormBotInputHandler*> bots;
+	for_each_iterator(CWorm*, w, game.aliveWorms()) {
+		if(!w->get()->getLocal()) continue;
+		CWormBotInputHandler* ai = dynamic_cast<CWormBotInputHandler*> (w->get()->inputHandler());
+		if(ai) bots.push_back(ai);
+	}
+	if(bots.empty()) {
+		cli.writeMsg("no local bots alive", CNC_ERROR);
+		return;
+	}
+
+	const bool oldCache = bAITraceCache;
+	float perBot[2];
+	Uint64 hits = 0, lookups = 0;
+	for(int c = 0; c < 2; ++c) {
+		bAITraceCache = (c == 1);
+		aiTraceCache.clear();
+		const Uint64 oldHits = aiTraceCache.hits;
+		const Uint64 oldLookups = aiTraceCache.hits + aiTraceCache.misses + aiTraceCache.stale;
+
+		const Uint64 start = Profiler::getTicks();
+		for(int r = 0; r < rounds; ++r)
+			for(size_t i = 0; i < bots.size(); ++i)
+				bots[i]->AI_EvaluateTargets();
+		perBot[c] = float(Profiler::getTicks() - start) / float(rounds * bots.size());
+
+		hits = aiTraceCache.hits - oldHits;
+		lookups = aiTraceCache.hits + aiTraceCache.misses + aiTraceCache.stale - oldLookups;
+	}
+	bAITraceCache = oldCache;
+
+	cli.writeMsg(itoa(bots.size()) + " bots, " + itoa(rounds) + " rounds of target evaluation, the terrain does not change");
+	cli.writeMsg("without cache: " + ftoa(perBot[0]) + " us per bot, " + itoa(perBot[0] > 0 ? int(10000.0f / perBot[0]) : 0) + " bots in 10 ms");
+	cli.writeMsg("with cache:    " + ftoa(perBot[1]) + " us per bot, " + itoa(perBot[1] > 0 ? int(10000.0f / perBot[1]) : 0) +
+				 " bots in 10 ms (" + ftoa(lookups ? 100.0f * hits / lookups : 0.0f) + "% hits)");
+}
+
 static bool moveToOwnBase(int t, CVec& pos) {
 	Flag* ownFlag = cClient->flagInfo()->getFlag(t);
 	if(!ownFlag) return false; // strange
@@ -1333,7 +1699,7 @@ CWorm *CWormBotInputHandler::findTarget()
 		// Prefer targets we have free line of sight to
 		float length;
 		int type;
-		m_worm->traceLine(w->getPos(),&length,&type,1);
+		cachedTraceLine(m_worm, w->getPos(),&length,&type,1);
 		if (! (type & PX_ROCK))  {
 			// Line of sight not blocked
 			if (fSightDistance < 0 || l < fSightDistance)  {
@@ -1401,7 +1767,7 @@ CWorm* CWormBotInputHandler::nearestEnemyWorm() {
 		// Prefer targets we have free line of sight to
 		float length;
 		int type;
-		m_worm->traceLine(w->getPos(),&length,&type,1);
+		cachedTraceLine(m_worm, w->getPos(),&length,&type,1);
 		if (! (type & PX_ROCK))  {
 			// Line of sight not blocked
 			if (fSightDistance < 0 || l < fSightDistance)  {
@@ -1740,7 +2106,7 @@ void CWormBotInputHandler::AI_SimpleMove(bool bHaveTarget)
     // If our line is blocked, try some evasive measures
     float fDist = 0;
     int type = 0;
-    m_worm->traceLine(cPosTarget, &fDist, &type, 1);
+    cachedTraceLine(m_worm, cPosTarget, &fDist, &type, 1);
 	if(fDist < 0.75f || cPosTarget.y < m_worm->vPos.get().y) {
 
         // Change direction
@@ -1877,22 +2243,7 @@ bool CWormBotInputHandler::weaponCanHit(float gravity, float speed, CVec cTrgPos
 #endif
 
 	// Check
-	float last_y = (p.a * (from.x + 5) * (from.x + 5) + p.b * (from.x + 5) + p.c);
-	for (float x = from.x + 5; x < to.x; x++)  {
-		float y = (p.a * x * x + p.b *x + p.c);
-
-		// Rock or dirt, trajectory not free
-		if (CProjectile::CheckCollision(wpnproj, 1, CVec(x, y), CVec(x_vel, y - last_y)))
-			return false;
-
-		last_y = y;
-
-#ifdef DEBUG
-		//PutPixel(game.gameMap()->GetDebugImage(), CLAMP((int)x, 0, (int)game.gameMap()->GetWidth()-1)*2, CLAMP((int)y, 0, (int)game.gameMap()->GetHeight()-1)*2, Color(0, 255, 0));
-#endif
-	}
-
-	return true;
+	return cachedTrajectoryFree(wpnproj, p, from, to, x_vel, m_worm->vPos, cTrgPos, alpha);
 }
 
 
@@ -2368,7 +2719,7 @@ int CWormBotInputHandler::AI_GetBestWeapon(int iGameMode, float fDistance, bool
 
 		// If we are close enough, shoot the napalm
 		if (m_worm->vPos.get().y <= cTrgPos.y && (m_worm->vPos-cTrgPos).GetLength2() < 10000.0f)  {
-			if (traceWormLine(cTrgPos,m_worm->vPos) && !m_worm->tWeapons[1].Reloading) {
+			if (cachedTraceWormLine(cTrgPos,m_worm->vPos) && !m_worm->tWeapons[1].Reloading) {
 				CWorm* w = game.wormById(nAITargetWormId, false);
 				if (w && w->CheckOnGround())
 					return 1;
@@ -2770,22 +3121,24 @@ int CWormBotInputHandler::traceWeaponLine(CVec target, float *fDist, int *nType)
 	}
 
 
+	// The terrain is traced once, the worms are checked on the same steps
+	uchar terrainType = PX_EMPTY;
+	const int terrainHit = cachedTraceWeaponTerrain(pos, target, dir, nTotalLength, first_division, divisions, &terrainType);
+
 	// Trace the line
 	int divs = first_division;
 	int i;
 	for(i=0; i<nTotalLength; i+=divs) {
-		uchar px = game.gameMap()->GetPixelFlag( (int)pos.x, (int)pos.y );
-
 		if (i>first_division)  // we aren't close to a wall, so we can shoot through only thin wall
 			divs = divisions;
 
 		// Dirt or rock
-		if((px & PX_DIRT) || (px & PX_ROCK)) {
+		if(terrainHit >= 0 && i >= terrainHit) {
         	if(nTotalLength != 0)
             	*fDist = (float)i / (float)nTotalLength;
             else
             	*fDist = 0;
-			*nType = px;
+			*nType = terrainType;
 			return i;
 		}
 
@@ -3456,7 +3809,7 @@ void CWormBotInputHandler::AI_MoveToTarget()
 					if ((m_worm->vPos - w->get()->getPos()).GetLength2() <= 2500)  {
 						float dist;
 						int type;
-						m_worm->traceLine(w->get()->getPos(), &dist, &type);
+						cachedTraceLine(m_worm, w->get()->getPos(), &dist, &type);
 						if (type & PX_EMPTY)
 							AI_Jump();
 					}
@@ -3691,7 +4044,7 @@ find_one_visible_node:
 		*/
 
 		float traceDist = -1; int type;
-		int length = m_worm->traceLine(nodePos, &traceDist, &type); // HINT: this is only a line, not the whole worm
+		int length = cachedTraceLine(m_worm, nodePos, &traceDist, &type); // HINT: this is only a line, not the whole worm
 															 // NOTE: this can return dirt, even if there's also rock between us two
 		bool direct_traceLine_possible = (float)(length*length) > (nodePos-m_worm->vPos).GetLength2();
 
@@ -4008,7 +4361,7 @@ CVec CWormBotInputHandler::AI_FindShootingSpot()
 		possible_pos.y = 40.0f * cosf(j) + psAITarget->getPos().y;
 		//PutPixel(game.gameMap()->GetDebugImage(), possible_pos.x * 2, possible_pos.y * 2, Color(255, 0, 0));
 
-		if (AI_IsInAir(possible_pos, 1) && m_worm->traceLine(possible_pos, psAITarget->getPos(), NULL) >= 40)  {
+		if (AI_IsInAir(possible_pos, 1) && cachedTraceLine(m_worm, possible_pos, psAITarget->getPos(), NULL) >= 40)  {
 			//drawpoint(game.gameMap()->GetDebugImage(), possible_pos);
 			return possible_pos;
 		}
@@ -4018,7 +4371,7 @@ CVec CWormBotInputHandler::AI_FindShootingSpot()
 	possible_pos = psAITarget->getPos();
 	for (int i = 0; i < 10; i++)  {
 		possible_pos.x += 5;
-		if (!traceWormLine(possible_pos, psAITarget->getPos(), NULL))  {
+		if (!cachedTraceWormLine(possible_pos, psAITarget->getPos()))  {
 			possible_pos.x -= 5;
 			if (fabs(psAITarget->getPos().x - possible_pos.x) >= 15)
 				return possible_pos;
@@ -4028,7 +4381,7 @@ CVec CWormBotInputHandler::AI_FindShootingSpot()
 	possible_pos = psAITarget->getPos();
 	for (int i = 0; i < 10; i++)  {
 		possible_pos.x -= 5;
-		if (!traceWormLine(possible_pos, psAITarget->getPos(), NULL))  {
+		if (!cachedTraceWormLine(possible_pos, psAITarget->getPos()))  {
 			possible_pos.x -= 5;
 			if (fabs(psAITarget->getPos().x - possible_pos.x) >= 15)
 				return possible_pos;
@@ -4106,6 +4459,8 @@ CWormBotInputHandler::CWormBotInputHandler(CWorm* w) : CWormInputHandler(w) {
 	fLastWeaponChange = 0;
 	fLastCompleting = AbsTime();
 	fLastGoBack = AbsTime();
+	iAILastThinkTick = 0;
+	iAISkippedTicks = 0;
 
 	if(w->tProfile.get())
 		iAiDiffLevel = CLAMP(w->tProfile->nDifficulty, 0, 3);
@@ -18,6 +18,7 @@
 
 
 #include <limits.h>
+#include <atomic>
 #include "LieroX.h"
 #include "Debug.h"
 #include "CServer.h"
@@ -36,14 +37,21 @@
 #include "DedicatedControl.h"
 #include "CGameMode.h"
 #include "Cache.h"
+#include "GfxPrimitives.h"
+#include "Profiler.h"
+#include "game/Benchmark.h"
 #include "CServerConnection.h"
 #include "CServerNetEngine.h"
 #include "CChannel.h"
 #include "IpToCountryDB.h"
+#include "GeoIPDatabase.h"
 #include "Unicode.h"
 #include "Autocompletion.h"
 #include "OLXCommand.h"
 #include "TaskManager.h"
+#include "TaskScheduler.h"
+#include "FileDownload.h"
+#include "FileDelta.h"
 #include "game/Mod.h"
 #include "StringUtils.h"
 #include "game/Game.h"
@@ -51,10 +59,19 @@
 #include "game/WormInputHandler.h"
 #include "sound/SoundsBase.h"
 #include "game/Level.h"
+#include "game/GameState.h"
 #include "game/ServerList.h"
 #include "EventQueue.h"
 #include "client/ClientConnectionRequestInfo.h"
 #include "gusanos/luaapi/context.h"
+#include "gusanos/luaapi/memory.h"
+#include "gusanos/LuaCallbacks.h"
+#include "gusanos/network.h"
+#include "gusanos/server.h"
+#include "CWormBot.h"
+#include "Physics.h"
+#include "Metrics.h"
+#include "CaselessIndex.h"
 
 
 CmdLineIntf& stdoutCLI() {
@@ -84,19 +101,18 @@ CmdLineIntf& stdoutCLI() {
 	return cli;
 }
 
-ParamSeps ParseParams_Seps(const std::string& params) {
+void ParseParams_Spans(const std::string& params, ParamSpans& spans, size_t from, size_t to) {
+	if(to > params.size()) to = params.size();
 	bool quote = false;
-	size_t start = 0;
-	ParamSeps res;
-	ParamSeps::iterator lastentry = res.begin();
+	size_t start = from;
 	
-	const_string_iterator i (params);
-	for(; i.pos < params.size(); IncUtf8StringIterator(i, const_string_iterator(params, params.size()))) {
+	const_string_iterator i (params, from);
+	for(; i.pos < to; IncUtf8StringIterator(i, const_string_iterator(params, to))) {
 
 		// Check delimeters
 		if(*i == ' ' || *i == ',') {
 			if(start < i.pos)
-				lastentry = res.insert(lastentry, ParamSeps::value_type(start, i.pos - start));
+				spans.push_back(std::make_pair(start, i.pos - start));
 			start = i.pos + 1;
 			
 			continue;
@@ -104,11 +120,11 @@ ParamSeps ParseParams_Seps(const std::string& params) {
 
 		// TODO: do we really want this?
 		// Check comments
-		if (i.pos + 1 < params.size())  {
+		if (i.pos + 1 < to)  {
 			if(*i == '/' && params[i.pos+1] == '/') {
 				if(start < i.pos)
-					lastentry = res.insert(lastentry, ParamSeps::value_type(start, i.pos - start));
-				start = params.size() + 1;
+					spans.push_back(std::make_pair(start, i.pos - start));
+				start = to + 1;
 				
 				// Just end here
 				break;
@@ -122,14 +138,14 @@ ParamSeps ParseParams_Seps(const std::string& params) {
 			start = i.pos;
 			
 			// Read until another quote
-			for(; i.pos < params.size(); IncUtf8StringIterator(i, const_string_iterator(params, params.size()))) {
+			for(; i.pos < to; IncUtf8StringIterator(i, const_string_iterator(params, to))) {
 				if(*i == '"') {
 					quote = false;
 					break;
 				}
 			}
 			if(quote) break; // if we are still in the quote, break (else we would make an addition i++ => crash)
-			lastentry = res.insert(lastentry, ParamSeps::value_type(start, i.pos - start));
+			spans.push_back(std::make_pair(start, i.pos - start));
 			start = i.pos + 1;
 			continue;
 		}
@@ -141,7 +157,7 @@ ParamSeps ParseParams_Seps(const std::string& params) {
 			
 			// Read until all brackets closed
 			unsigned int bracketDepth = 1;
-			for(; i.pos < params.size(); IncUtf8StringIterator(i, const_string_iterator(params, params.size()))) {
+			for(; i.pos < to; IncUtf8StringIterator(i, const_string_iterator(params, to))) {
 				if(*i == '(') bracketDepth++;
 				else if(*i == ')') { bracketDepth--; if(bracketDepth == 0) break; }
 			}
@@ -152,19 +168,32 @@ ParamSeps ParseParams_Seps(const std::string& params) {
 	}
 	
 	// Add the last token
-	if(start < params.size()) {
-		lastentry = res.insert(lastentry, ParamSeps::value_type(start, params.size() - start));
+	if(start < to) {
+		spans.push_back(std::make_pair(start, to - start));
 	}
-	
+}
+
+
+ParamSeps ParseParams_Seps(const std::string& params) {
+	ParamSpans spans;
+	ParseParams_Spans(params, spans);
+	ParamSeps res;
+	for(ParamSpans::iterator i = spans.begin(); i != spans.end(); ++i)
+		res.insert(res.end(), *i);
 	return res;
 }
 
+static void ParseParams(const std::string& params, std::vector<std::string>& res, size_t from, size_t to) {
+	ParamSpans spans;
+	ParseParams_Spans(params, spans, from, to);
+	res.reserve(spans.size());
+	for(ParamSpans::iterator i = spans.begin(); i != spans.end(); ++i)
+		res.push_back(params.substr(i->first, i->second));
+}
 
 std::vector<std::string> ParseParams(const std::string& params) {
 	std::vector<std::string> res;
-	ParamSeps seps = ParseParams_Seps(params);
-	for(ParamSeps::iterator i = seps.begin(); i != seps.end(); ++i)
-		res.push_back(params.substr(i->first, i->second));
+	ParseParams(params, res, 0, params.size());
 	return res;
 }
 
@@ -319,7 +348,13 @@ struct Command : CommandDesc {
 	virtual void exec(CmdLineIntf* caller, const std::vector<std::string>& params) = 0;
 
 	void exec(CmdLineIntf* caller, const std::string& params) {
-		std::vector<std::string> ps = ParseParams(params);
+		exec(caller, params, 0, params.size());
+	}
+
+	// the params are in line[from,to), so the dispatcher doesn't need to cut them out first
+	void exec(CmdLineIntf* caller, const std::string& line, size_t from, size_t to) {
+		std::vector<std::string> ps;
+		ParseParams(line, ps, from, to);
 		
 		// if we want max 1 param but we give more, this is a small hack to dont be too strict
 		if(maxParams == 1 && ps.size() > 1) {
@@ -366,8 +401,10 @@ struct Command : CommandDesc {
 	
 };
 
+// sorted for the help and the autocompletion, the index is for the dispatch
 typedef std::map<std::string, Command*, stringcaseless> CommandMap;
 static CommandMap commands;
+static CaselessIndex<Command*> commandIndex;
 
 
 
@@ -508,9 +545,8 @@ bool autoCompleteForFileListCache(Command*, AutocompleteRequest& request) {
 // Find a command with the same name
 static Command *Cmd_GetCommand(const std::string& strName)
 {
-	CommandMap::iterator it = commands.find(strName);
-	if(it != commands.end()) return it->second;
-	return NULL;
+	Command** cmd = commandIndex.find(strName);
+	return cmd ? *cmd : NULL;
 }
 
 CommandDesc* GetCommandDesc(const std::string& cmdname) {
@@ -524,7 +560,8 @@ static void registerCommand(const std::string& name, Command* cmd) {
 		errors << "Command '" << cmd->fullDesc() << "' as " << name << " will overwrite command " << old->name << endl;
 	}
 #endif
-	commands.insert( CommandMap::value_type(name, cmd) );
+	if(commands.insert( CommandMap::value_type(name, cmd) ).second)
+		commandIndex.insert(name, cmd);
 }
 
 static void registerCommand(Command* cmd) {
@@ -2265,6 +2302,8 @@ void Cmd_dumpSysState::exec(CmdLineIntf* caller, const std::vector<std::string>&
 	threadPool->dumpState(stdoutCLI());
 	hints << "Tasks:" << endl;
 	taskManager->dumpState(stdoutCLI());
+	hints << "Task scheduler:" << endl;
+	if(taskScheduler) taskScheduler->dumpState(stdoutCLI());
 	hints << "Free system memory: " << (GetFreeSysMemory() / 1024) << " KB" << endl;
 	hints << "Cache size: " << (cCache.GetCacheSize() / 1024) << " KB" << endl;
 	hints << "Current time: " << GetDateTimeText() << endl;
@@ -2298,12 +2337,614 @@ void Cmd_createDummyTask::exec(CmdLineIntf* caller, const std::vector<std::strin
 }
 #endif
 
+COMMAND(profiler, "frame profiler: switch on/off, print the most expensive zones or export a Chrome trace", "on|off|clear|top [count]|export [file]", 1, 2);
+void Cmd_profiler::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(params[0] == "on") {
+		Profiler::start();
+		caller->writeMsg("profiler started");
+	}
+	else if(params[0] == "off") {
+		Profiler::stop();
+		caller->writeMsg("profiler stopped");
+	}
+	else if(params[0] == "clear")
+		Profiler::clear();
+	else if(params[0] == "top") {
+		size_t count = 10;
+		if(params.size() > 1) {
+			bool fail = false;
+			count = from_string<int>(params[1], fail);
+			if(fail) { printUsage(caller); return; }
+		}
+		Profiler::printTopZones(*caller, count);
+	}
+	else if(params[0] == "export") {
+		std::string file = (params.size() > 1) ? params[1] : "profile.json";
+		if(Profiler::exportChromeTrace(file))
+			caller->writeMsg("profile written to " + GetWriteFullFileName(file));
+		else
+			caller->writeMsg("cannot write " + file, CNC_ERROR);
+	}
+	else
+		printUsage(caller);
+}
+
+COMMAND(benchmark, "run the deterministic headless benchmark and quit (dedicated only). without parameters, list the scenarios", "[scenario] [frames] [bots] [seed] [outputfile]", 0, 5);
+void Cmd_benchmark::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(params.size() == 0) {
+		Benchmark::listScenarios(*caller);
+		return;
+	}
+
+	Benchmark::Settings s;
+	s.scenario = params[0];
+	bool fail = false;
+	if(params.size() > 1) s.frames = from_string<int>(params[1], fail);
+	if(!fail && params.size() > 2) s.bots = from_string<int>(params[2], fail);
+	if(!fail && params.size() > 3) s.seed = from_string<Uint32>(params[3], fail);
+	if(params.size() > 4) s.outputFile = params[4];
+	if(fail) {
+		printUsage(caller);
+		return;
+	}
+
+	if(!Benchmark::start(s, *caller) && bDedicated && tLXOptions->sDedicatedScript == "/dev/null")
+		// nobody else would control this server, so don't hang around (-benchmark on the command line)
+		game.state = Game::S_Quit;
+}
+
+struct SmartPointerBenchJob {
+	SmartPointer<int> shared;
+	bool useShared;
+	size_t copies;
+};
+
+static Result smartPointerBenchThread(void* param) {
+	SmartPointerBenchJob* job = (SmartPointerBenchJob*)param;
+	SmartPointer<int> own = SmartPointer<int>::New(0);
+	const SmartPointer<int>& src = job->useShared ? job->shared : own;
+	for(size_t i = 0; i < job->copies; ++i) {
+		SmartPointer<int> copy(src);
+		if(copy.get() == NULL) return false; // keeps the copy alive for the optimizer
+	}
+	return true;
+}
+
+COMMAND(benchSmartPointer, "measure SmartPointer copy/destroy throughput, with one shared and with one object per thread", "[threads] [copies per thread]", 0, 2);
+void Cmd_benchSmartPointer::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int threads = 4;
+	int copies = 1000000;
+	if(params.size() > 0) threads = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) copies = from_string<int>(params[1], fail);
+	if(fail || threads <= 0 || copies <= 0) {
+		printUsage(caller);
+		return;
+	}
+
+	for(int shared = 1; shared >= 0; --shared) {
+		SmartPointerBenchJob job;
+		job.shared = SmartPointer<int>::New(0);
+		job.useShared = shared != 0;
+		job.copies = copies;
+
+		const Uint64 start = Profiler::getTicks();
+		std::vector<ThreadPoolItem*> items;
+		for(int i = 0; i < threads; ++i)
+			items.push_back(threadPool->start(smartPointerBenchThread, &job, "SmartPointer benchmark"));
+		for(size_t i = 0; i < items.size(); ++i)
+			threadPool->wait(items[i]);
+		const Uint64 time = MAX(Profiler::getTicks() - start, (Uint64)1);
+
+		const Uint64 total = (Uint64)threads * copies;
+		caller->writeMsg(std::string(shared ? "shared object" : "object per thread") + ": " +
+						 itoa(total) + " copies in " + itoa(time / 1000) + " ms, " +
+						 itoa(total * 1000 / time) + " copies/ms, " + itoa(threads) + " threads");
+	}
+}
+
+struct EventQueueBenchJob {
+	EventQueue* queue;
+	size_t events;
+};
+
+static Result eventQueueBenchThread(void* param) {
+	EventQueueBenchJob* job = (EventQueueBenchJob*)param;
+	EventItem ev;
+	ev.type = SDL_USEREVENT;
+	ev.user.code = UE_NopWakeup;
+	for(size_t i = 0; i < job->events; ++i)
+		job->queue->push(ev);
+	return true;
+}
+
+COMMAND(benchEventQueue, "measure EventQueue throughput with several producer threads and one consumer", "[producers] [events per producer]", 0, 2);
+void Cmd_benchEventQueue::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int producers = 8;
+	int events = 100000;
+	if(params.size() > 0) producers = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) events = from_string<int>(params[1], fail);
+	if(fail || producers <= 0 || events <= 0) {
+		printUsage(caller);
+		return;
+	}
+
+	EventQueue queue;
+	EventQueueBenchJob job;
+	job.queue = &queue;
+	job.events = events;
+
+	const Uint64 start = Profiler::getTicks();
+	std::vector<ThreadPoolItem*> items;
+	for(int i = 0; i < producers; ++i)
+		items.push_back(threadPool->start(eventQueueBenchThread, &job, "EventQueue benchmark"));
+	const Uint64 total = (Uint64)producers * events;
+	EventItem ev;
+	for(Uint64 received = 0; received < total; ++received)
+		queue.wait(ev);
+	const Uint64 time = MAX(Profiler::getTicks() - start, (Uint64)1);
+	for(size_t i = 0; i < items.size(); ++i)
+		threadPool->wait(items[i]);
+
+	caller->writeMsg(itoa(total) + " events from " + itoa(producers) + " producers in " + itoa(time / 1000) + " ms, " +
+					 itoa(total * 1000 / time) + " events/ms");
+}
+
+struct TaskSchedulerBenchJob {
+	std::vector<Uint32>* data;
+	int passes;
+	void operator()(size_t begin, size_t end) const {
+		for(int p = 0; p < passes; ++p)
+			for(size_t i = begin; i < end; ++i)
+				(*data)[i] = (*data)[i] * 1664525u + 1013904223u;
+	}
+};
+
+COMMAND(benchTaskScheduler, "compare parallel_for on the task scheduler with a serial loop", "[elements] [passes]", 0, 2);
+void Cmd_benchTaskScheduler::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int elements = 1000000;
+	int passes = 50;
+	if(params.size() > 0) elements = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) passes = from_string<int>(params[1], fail);
+	if(fail || elements <= 0 || passes <= 0) {
+		printUsage(caller);
+		return;
+	}
+
+	std::vector<Uint32> serialData(elements, 1), parallelData(elements, 1);
+	TaskSchedulerBenchJob job;
+	job.passes = passes;
+
+	job.data = &serialData;
+	Uint64 start = Profiler::getTicks();
+	job(0, serialData.size());
+	const Uint64 serialTime = MAX(Profiler::getTicks() - start, (Uint64)1);
+
+	job.data = &parallelData;
+	start = Profiler::getTicks();
+	parallel_for(0, parallelData.size(), 0, job);
+	const Uint64 parallelTime = MAX(Profiler::getTicks() - start, (Uint64)1);
+
+	caller->writeMsg("serial: " + itoa(serialTime / 1000) + " ms, parallel_for: " + itoa(parallelTime / 1000) + " ms with " +
+					 itoa(taskScheduler ? taskScheduler->workerCount() : 0) + " workers, speedup " +
+					 ftoa((float)serialTime / parallelTime));
+	if(serialData != parallelData)
+		caller->writeMsg("parallel result differs from the serial one", CNC_ERROR);
+}
+
+COMMAND(dumpFileBlobCache, "print the state of the cache of compressed files for in-game downloads", "", 0, 0);
+void Cmd_dumpFileBlobCache::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	DumpUdpFileBlobCache(*caller);
+}
+
+COMMAND(benchUdpFileTransfer, "simulate an in-game file download over a lossy link", "[KB] [loss%] [rttMs]", 0, 3);
+void Cmd_benchUdpFileTransfer::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int kb = 2048;
+	float loss = 0.0f;
+	int rtt = 0;
+	if(params.size() > 0) kb = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) loss = from_string<float>(params[1], fail);
+	if(!fail && params.size() > 2) rtt = from_string<int>(params[2], fail);
+	if(fail || kb <= 0 || loss < 0.0f || loss >= 100.0f || rtt < 0) {
+		printUsage(caller);
+		return;
+	}
+	CUdpFileDownloader::benchmarkTransfer(*caller, (size_t)kb * 1024, loss / 100.0f, rtt);
+}
+
+COMMAND(checkChannelCongestion, "compare the channel versions over simulated connections with packet loss and lag, all messages must arrive in order", "", 0, 0);
+void Cmd_checkChannelCongestion::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	TestCChannelCongestion(*caller);
+}
+
+COMMAND(benchFileDelta, "measure the delta of a file with some changed parts against sending it whole", "[KB] [changes]", 0, 2);
+void Cmd_benchFileDelta::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int kb = 1024;
+	int changes = 3;
+	if(params.size() > 0) kb = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) changes = from_string<int>(params[1], fail);
+	if(fail || kb <= 0 || changes < 0) {
+		printUsage(caller);
+		return;
+	}
+
+	// semi-compressible old version, changes are inserted, removed or replaced ranges of about 1 KB
+	Uint32 seed = 42;
+	std::string oldData;
+	oldData.reserve((size_t)kb * 1024);
+	while(oldData.size() < (size_t)kb * 1024) {
+		seed = seed * 1103515245 + 12345;
+		oldData += ((seed >> 16) % 3 == 0) ? std::string("weapon speed = ") : std::string(1, (char)(seed >> 16));
+	}
+	std::string newData = oldData;
+	for(int i = 0; i < changes; ++i) {
+		seed = seed * 1103515245 + 12345;
+		const size_t pos = (seed >> 8) % newData.size();
+		std::string part(1024, (char)seed);
+		switch((seed >> 4) % 3) {
+			case 0: newData.insert(pos, part); break;
+			case 1: newData.erase(pos, part.size()); break;
+			default: newData.replace(pos, part.size(), part);
+		}
+	}
+
+	Uint64 start = Profiler::getTicks();
+	const std::string signature = FileDeltaSignature(oldData);
+	const Uint64 sigTime = Profiler::getTicks() - start;
+	std::string delta, result, compressedDelta, compressedFull;
+	start = Profiler::getTicks();
+	FileDeltaCreate(signature, newData, &delta);
+	const Uint64 createTime = Profiler::getTicks() - start;
+	start = Profiler::getTicks();
+	const bool ok = FileDeltaApply(oldData, delta, &result) && result == newData;
+	const Uint64 applyTime = Profiler::getTicks() - start;
+	Compress(delta, &compressedDelta);
+	Compress(newData, &compressedFull);
+
+	caller->writeMsg("file " + itoa(newData.size() / 1024) + " KB, " + itoa(changes) + " changes, block size " + itoa(FileDeltaBlockSize(oldData.size())));
+	caller->writeMsg("signature " + itoa(signature.size()) + " bytes (" + itoa(sigTime / 1000) + " ms), delta " +
+					 itoa(compressedDelta.size()) + " bytes compressed (" + itoa(createTime / 1000) + " ms, apply " +
+					 itoa(applyTime / 1000) + " ms), whole file " + itoa(compressedFull.size()) + " bytes compressed");
+	if(!ok)
+		caller->writeMsg("applying the delta did not give the new file", CNC_ERROR);
+}
+
+// A synthetic GeoIP country database: a random prefix tree down to /24, the leafs are countries
+struct SyntheticGeoIPBuilder {
+	std::string nodes;
+	Uint32 random;
+	SyntheticGeoIPBuilder() : random(4711) {}
+
+	void putRecord(Uint32 node, int side, Uint32 value) {
+		for(int j = 0; j < 3; ++j)
+			nodes[node * 6 + side * 3 + j] = (char)((value >> (j * 8)) & 0xff);
+	}
+	Uint32 build(int depth) {
+		random = random * 1664525u + 1013904223u;
+		if(depth == 24 || (depth >= 8 && (random >> 16) % 4 == 0))
+			return 16776960 /* COUNTRY_BEGIN */ + 1 + (random >> 8) % 250;
+		const Uint32 node = (Uint32)(nodes.size() / 6);
+		nodes.append(6, '\0');
+		putRecord(node, 0, build(depth + 1));
+		putRecord(node, 1, build(depth + 1));
+		return node;
+	}
+	std::string create() {
+		build(0);
+		return nodes + "\xff\xff\xff\x01"; // structure info: country edition
+	}
+};
+
+COMMAND(benchGeoIP, "measure GeoIP lookups per second on a synthetic country database", "[lookups] [distinct IPs]", 0, 2);
+void Cmd_benchGeoIP::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int lookups = 1000000;
+	int distinct = 1000;
+	if(params.size() > 0) lookups = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) distinct = from_string<int>(params[1], fail);
+	if(fail || lookups <= 0 || distinct <= 0) {
+		printUsage(caller);
+		return;
+	}
+
+	SyntheticGeoIPBuilder builder;
+	const std::string data = builder.create();
+	std::vector<std::string> ips;
+	Uint32 random = 1234;
+	for(int i = 0; i < distinct; ++i) {
+		random = random * 1664525u + 1013904223u;
+		ips.push_back(itoa(11 + (random >> 24) % 100) + "." + itoa((random >> 16) & 0xff) + "." +
+					  itoa((random >> 8) & 0xff) + "." + itoa(1 + random % 254) + ":23400");
+	}
+
+	IpToCountryDB db;
+	db.LoadDBData(data);
+	GeoIPDatabase raw;
+	raw.loadFromMemory(data);
+	if(!db.Loaded() || !raw.loaded()) {
+		caller->writeMsg("cannot load the synthetic database", CNC_ERROR);
+		return;
+	}
+
+	Uint64 start = Profiler::getTicks();
+	size_t known = 0;
+	for(int i = 0; i < lookups; ++i)
+		if(raw.lookup(ips[i % distinct]).countryCode != "--") known++;
+	const Uint64 rawTime = MAX(Profiler::getTicks() - start, (Uint64)1);
+
+	start = Profiler::getTicks();
+	for(int i = 0; i < lookups; ++i)
+		if(db.GetInfoAboutIP(ips[i % distinct]).countryCode != "UN") known--;
+	const Uint64 cachedTime = MAX(Profiler::getTicks() - start, (Uint64)1);
+
+	std::vector<std::string> batch;
+	std::vector<IpInfo> infos;
+	start = Profiler::getTicks();
+	for(int i = 0; i < lookups; ) {
+		batch.clear();
+		for(; i < lookups && batch.size() < 64; ++i)
+			batch.push_back(ips[i % distinct]);
+		db.GetInfoAboutIPs(batch, infos);
+	}
+	const Uint64 batchTime = MAX(Profiler::getTicks() - start, (Uint64)1);
+
+	caller->writeMsg("synthetic database: " + itoa(data.size() / 1024) + " KB, " + itoa(distinct) + " distinct IPs");
+	caller->writeMsg("lookups per second: tree walk " + itoa((Uint64)lookups * 1000000 / rawTime) +
+					 ", cached " + itoa((Uint64)lookups * 1000000 / cachedTime) +
+					 ", cached in batches of 64 " + itoa((Uint64)lookups * 1000000 / batchTime));
+	if(known != 0)
+		caller->writeMsg("cached results differ from the database", CNC_ERROR);
+	db.DumpCacheStats(*caller);
+}
+
+COMMAND(luaGCStats, "print heap size and garbage collector times of the game Lua state", "", 0, 0);
+void Cmd_luaGCStats::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(!luaIngame) {
+		caller->writeMsg("Lua is not loaded", CNC_ERROR);
+		return;
+	}
+	if(LuaMemory* mem = LuaMemory::get(luaIngame))
+		mem->dumpStats(*caller);
+}
+
+COMMAND(benchLuaGC, "compare frame times of an allocating Lua script with Lua's GC pacing and with the frame budget", "[frames] [tables per frame]", 0, 2);
+void Cmd_benchLuaGC::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int frames = 2000;
+	int tables = 500;
+	if(params.size() > 0) frames = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) tables = from_string<int>(params[1], fail);
+	if(fail || frames <= 0 || tables <= 0) {
+		printUsage(caller);
+		return;
+	}
+	LuaMemory::benchmark(*caller, frames, tables);
+}
+
+COMMAND(luaCallbackStats, "print how many Lua callbacks were called, with shared parameters and batched", "", 0, 0);
+void Cmd_luaCallbackStats::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	luaCallbacks.dumpStats(*caller);
+}
+
+COMMAND(benchLuaCallbacks, "compare per-object Lua callbacks with batched ones", "[objects] [callbacks] [frames]", 0, 3);
+void Cmd_benchLuaCallbacks::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int objects = 200;
+	int callbacks = 4;
+	int frames = 200;
+	if(params.size() > 0) objects = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) callbacks = from_string<int>(params[1], fail);
+	if(!fail && params.size() > 2) frames = from_string<int>(params[2], fail);
+	if(fail || objects <= 0 || callbacks <= 0 || frames <= 0) {
+		printUsage(caller);
+		return;
+	}
+	LuaCallbacks::benchmark(*caller, objects, callbacks, frames);
+}
+
+COMMAND(dumpCacheStats, "dump cache entries, memory usage and hit/miss statistics", "", 0, 0);
+void Cmd_dumpCacheStats::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	cCache.DumpStats(*caller);
+}
+
+COMMAND(dumpVideoUploadStats, "print how many frames were skipped and how much was uploaded to the screen texture", "", 0, 0);
+void Cmd_dumpVideoUploadStats::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	VideoPostProcessor::dumpUploadStats(*caller);
+}
+
+COMMAND(dumpTextCacheStats, "print the state of the cache of drawn strings", "", 0, 0);
+void Cmd_dumpTextCacheStats::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	CFont::DumpTextCacheStats(*caller);
+}
+
+// Draws a scoreboard with the given number of players, like the one in the game
+static void DrawBenchScoreboard(SDL_Surface* dst, int players) {
+	static const Color teamColors[] = { Color(2, 184, 252), Color(255, 2, 2), Color(32, 253, 0), Color(253, 244, 0) };
+	for(int i = 0; i < players; ++i) {
+		const int y = 20 + i * 14;
+		const Color c = teamColors[i % 4];
+		tLX->cFont.Draw(dst, 20, y, c, "Player " + itoa(i + 1));
+		tLX->cFont.DrawAdv(dst, 160, y, 120, tLX->clNormalLabel, "some long clan tag [" + itoa(i) + "]");
+		tLX->cFont.DrawCentre(dst, 320, y, tLX->clNormalLabel, itoa(10 + i * 3 % 17));
+		tLX->cFont.DrawCentre(dst, 380, y, tLX->clNormalLabel, itoa(i % 5));
+		tLX->cFont.DrawCentre(dst, 440, y, c, itoa(40 + i * 7 % 90) + " ms");
+	}
+}
+
+COMMAND(benchFontScoreboard, "draw a scoreboard offscreen with and without the text run cache", "[players] [rounds]", 0, 2);
+void Cmd_benchFontScoreboard::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int players = 32;
+	int rounds = 200;
+	if(params.size() > 0) players = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) rounds = from_string<int>(params[1], fail);
+	if(fail || players <= 0 || rounds <= 0) {
+		printUsage(caller);
+		return;
+	}
+	if(bDedicated) {
+		caller->writeMsg("no fonts in dedicated mode", CNC_ERROR);
+		return;
+	}
+
+	SmartPointer<SDL_Surface> dst = gfxCreateSurface(640, 480);
+	if(!dst.get()) {
+		caller->writeMsg("cannot create the surface", CNC_ERROR);
+		return;
+	}
+
+	Uint64 times[2];
+	for(int cached = 0; cached < 2; ++cached) {
+		CFont::SetTextCacheEnabled(cached != 0);
+		if(cached) DrawBenchScoreboard(dst.get(), players); // fill the cache
+		const Uint64 start = Profiler::getTicks();
+		for(int r = 0; r < rounds; ++r)
+			DrawBenchScoreboard(dst.get(), players);
+		times[cached] = MAX(Profiler::getTicks() - start, (Uint64)1);
+	}
+	CFont::SetTextCacheEnabled(true);
+
+	caller->writeMsg(itoa(players) + " players, per scoreboard: glyph by glyph " + itoa(times[0] / rounds) +
+					 " us, cached " + itoa(times[1] / rounds) + " us, speedup " + ftoa((float)times[0] / times[1]));
+	CFont::DumpTextCacheStats(*caller);
+}
+
+COMMAND(logStats, "print statistics of the asynchronous logging", "", 0, 0);
+void Cmd_logStats::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	LogStats s = GetLogStats();
+	if(!s.async) {
+		caller->writeMsg("logging is synchronous");
+		return;
+	}
+	caller->writeMsg("async logging: " + itoa(s.enqueued) + " messages queued, " + itoa(s.written) + " written, " +
+					 itoa(s.dropped) + " dropped, " + itoa(s.queuedBytes) + " bytes pending, " + itoa(s.threads) + " threads");
+}
+
 COMMAND(dumpConnections, "dump connections of server", "", 0, 0);
 void Cmd_dumpConnections::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
 	if(cServer) cServer->DumpConnections();
 	else caller->writeMsg("server not initialised");
 }
 
+COMMAND(recordPackets, "record all packets the server receives into a packet log, for replayPackets", "start [file]|stop|status", 1, 2);
+void Cmd_recordPackets::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(!cServer || !cServer->isServerRunning()) {
+		caller->writeMsg("server not running", CNC_WARNING);
+		return;
+	}
+	PacketLogWriter& writer = cServer->getPacketLogWriter();
+	if(params[0] == "start") {
+		std::string file = (params.size() > 1) ? params[1] : ("packetlogs/packets-" + GetDateTimeFilename() + ".olxpkt");
+		if(writer.open(file))
+			caller->writeMsg("recording packets to " + file);
+		else
+			caller->writeMsg("cannot open " + file, CNC_WARNING);
+	}
+	else if(params[0] == "stop")
+		writer.close();
+	else if(params[0] == "status")
+		writer.printStatus(*caller);
+	else
+		printUsage(caller);
+}
+
+COMMAND(replayPackets, "feed a recorded packet log into the server, optionally as several remapped copies and faster than realtime", "file [copies] [speed]|stop|status", 1, 3);
+void Cmd_replayPackets::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(!cServer || !cServer->isServerRunning()) {
+		caller->writeMsg("server not running", CNC_WARNING);
+		return;
+	}
+	PacketReplayer& replayer = cServer->getPacketReplayer();
+	if(params[0] == "stop") {
+		replayer.stop();
+		return;
+	}
+	if(params[0] == "status") {
+		replayer.printStatus(*caller);
+		return;
+	}
+
+	bool fail = false;
+	int copies = 1;
+	float speed = 1.0f;
+	if(params.size() > 1) copies = from_string<int>(params[1], fail);
+	if(!fail && params.size() > 2) speed = from_string<float>(params[2], fail);
+	if(fail) {
+		printUsage(caller);
+		return;
+	}
+	replayer.start(params[0], copies, speed, *caller);
+}
+
+COMMAND(demo, "record server demos or inspect them", "record [file]|stop|status|info file|dump file [fromSecond] [records]", 1, 4);
+void Cmd_demo::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(params[0] == "record" || params[0] == "stop" || params[0] == "status") {
+		if(!cServer || !cServer->isServerRunning()) {
+			caller->writeMsg("server not running", CNC_WARNING);
+			return;
+		}
+		DemoRecorder& recorder = cServer->getDemoRecorder();
+		if(params[0] == "record") {
+			std::string file = (params.size() > 1) ? params[1] : ("demos/" + GetDateTimeFilename() + ".olxdemo");
+			if(recorder.start(file))
+				caller->writeMsg("recording demo to " + file);
+			else
+				caller->writeMsg("cannot open " + file, CNC_WARNING);
+		}
+		else if(params[0] == "stop")
+			recorder.stop();
+		else
+			recorder.printStatus(*caller);
+		return;
+	}
+
+	if((params[0] != "info" && params[0] != "dump") || params.size() < 2) {
+		printUsage(caller);
+		return;
+	}
+
+	bool fail = false;
+	float fromSecond = 0;
+	int maxRecords = 50;
+	if(params.size() > 2) fromSecond = from_string<float>(params[2], fail);
+	if(!fail && params.size() > 3) maxRecords = from_string<int>(params[3], fail);
+	if(fail) {
+		printUsage(caller);
+		return;
+	}
+
+	DemoPlayer player;
+	if(!player.open(params[1])) {
+		caller->writeMsg("cannot open demo " + params[1], CNC_WARNING);
+		return;
+	}
+	const DemoPlayer::Header& h = player.getHeader();
+	if(params[0] == "info") {
+		caller->writeMsg("recorded by " + h.gameVersion + ", map " + h.map + ", mod " + h.mod);
+		caller->writeMsg(itoa(player.getKeyframeCount()) + " keyframes, every " +
+						 itoa(h.recordEveryFrames * h.keyframeEveryRecords) + " frames, first frame " + itoa(player.getFirstFrame()));
+		return;
+	}
+
+	const Uint64 frame = player.getFirstFrame() + (Uint64)MAX(fromSecond * Game::FixedFPS, 0.0f);
+	if(!player.seek(frame)) {
+		caller->writeMsg("cannot seek to frame " + itoa(frame), CNC_WARNING);
+		return;
+	}
+	caller->writeMsg("frame " + itoa(player.getFrame()) + ": " + itoa(player.getState().objs.size()) + " objects");
+	for(int i = 0; i < maxRecords; ++i) {
+		std::vector<std::string> changes;
+		if(!player.step(&changes)) break;
+		caller->writeMsg("frame " + itoa(player.getFrame()) + ":");
+		for(size_t j = 0; j < changes.size(); ++j)
+			caller->writeMsg("  " + changes[j]);
+	}
+}
+
 COMMAND(dumpGameSettings, "dump game settings (all layers)", "", 0, 0);
 void Cmd_dumpGameSettings::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
 	gameSettings.dumpAllLayers();
@@ -2345,6 +2986,170 @@ void Cmd_getServerList::exec(CmdLineIntf* caller, const std::vector<std::string>
 	ServerList::get()->eachConst(argPusher);
 }
 
+COMMAND(benchServerListRefresh, "refresh fake servers on localhost and print how long it takes (from the network menu)", "[servers] [max in flight]", 0, 2);
+void Cmd_benchServerListRefresh::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int servers = 1000;
+	int inFlight = 32;
+	if(params.size() > 0) servers = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) inFlight = from_string<int>(params[1], fail);
+	if(fail || servers <= 0 || inFlight <= 0) {
+		printUsage(caller);
+		return;
+	}
+	ServerList::get()->benchmarkRefresh(*caller, servers, inFlight);
+}
+
+COMMAND(benchTerrainRollback, "take a terrain snapshot, carve craters and roll back, for increasing crater counts", "[max craters]", 0, 1);
+void Cmd_benchTerrainRollback::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int maxCraters = 1000;
+	if(params.size() > 0) maxCraters = from_string<int>(params[0], fail);
+	if(fail || maxCraters <= 0) {
+		printUsage(caller);
+		return;
+	}
+	if(!game.gameMap() || !game.gameMap()->isLoaded()) {
+		caller->writeMsg("no map loaded", CNC_ERROR);
+		return;
+	}
+	game.gameMap()->NewNet_BenchmarkRollback(*caller, maxCraters);
+}
+
+COMMAND(checkWormProbes, "check the row-wise terrain probes of the worm collision against per-pixel lookups on the current map", "[probes]", 0, 1);
+void Cmd_checkWormProbes::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int probes = 100000;
+	if(params.size() > 0) probes = from_string<int>(params[0], fail);
+	if(fail || probes <= 0) {
+		printUsage(caller);
+		return;
+	}
+	if(!game.gameMap() || !game.gameMap()->isLoaded()) {
+		caller->writeMsg("no map loaded", CNC_ERROR);
+		return;
+	}
+	game.gameMap()->CheckPixelFlagProbes(*caller, probes);
+}
+
+COMMAND(checkWormSteps, "check the worm movement with the row-wise terrain probes against per-pixel lookups, for all alive worms", "[steps]", 0, 1);
+void Cmd_checkWormSteps::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int steps = 50;
+	if(params.size() > 0) steps = from_string<int>(params[0], fail);
+	if(fail || steps <= 0) {
+		printUsage(caller);
+		return;
+	}
+	if(game.state < Game::S_Playing) {
+		caller->writeMsg("game is not running", CNC_ERROR);
+		return;
+	}
+	PhysicsEngine::Get()->checkWormSteps(*caller, steps);
+}
+
+COMMAND(botAIStats, "print hits of the bot trace cache and how often bots were skipped because of the AI time budget", "", 0, 0);
+void Cmd_botAIStats::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	CWormBotInputHandler::dumpAIStats(*caller);
+}
+
+COMMAND(botAIBudget, "get/set the CPU time of all bots together per physics tick, 0 for no limit", "[microseconds]", 0, 1);
+void Cmd_botAIBudget::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(params.size() > 0) {
+		bool fail = false;
+		int budget = from_string<int>(params[0], fail);
+		if(fail || budget < 0) {
+			printUsage(caller);
+			return;
+		}
+		CWormBotInputHandler::iAITickBudget = budget;
+	}
+	caller->writeMsg("bot AI budget: " + itoa(CWormBotInputHandler::iAITickBudget) + " us per tick");
+}
+
+COMMAND(benchBotAI, "time the target evaluation of the local bots without and with the trace cache", "[rounds]", 0, 1);
+void Cmd_benchBotAI::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int rounds = 100;
+	if(params.size() > 0) rounds = from_string<int>(params[0], fail);
+	if(fail || rounds <= 0) {
+		printUsage(caller);
+		return;
+	}
+	CWormBotInputHandler::benchmarkAI(*caller, rounds);
+}
+
+COMMAND(metrics, "print all metrics in the Prometheus text format", "", 0, 0);
+void Cmd_metrics::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	Metrics::dump(*caller);
+}
+
+COMMAND(metricsEndpoint, "get/set where the metrics are served over HTTP", "[port|unix:path|off]", 0, 1);
+void Cmd_metricsEndpoint::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(params.size() > 0) {
+		if(!Metrics::startEndpoint(params[0])) {
+			caller->writeMsg("cannot open metrics endpoint " + params[0], CNC_ERROR);
+			return;
+		}
+		tLXOptions->sMetricsEndpoint = (params[0] == "off") ? "" : params[0];
+	}
+	const std::string addr = Metrics::endpointAddress();
+	caller->writeMsg("metrics endpoint: " + (addr != "" ? addr : "off"));
+}
+
+COMMAND(checkMetrics, "scrape the own metrics endpoint and compare it with the registry", "", 0, 0);
+void Cmd_checkMetrics::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	Metrics::checkEndpoint(*caller);
+}
+
+COMMAND(benchMetrics, "time metric updates and the export", "[ops]", 0, 1);
+void Cmd_benchMetrics::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int ops = 1000000;
+	if(params.size() > 0) ops = from_string<int>(params[0], fail);
+	if(fail || ops <= 0) {
+		printUsage(caller);
+		return;
+	}
+	Metrics::benchmark(*caller, ops);
+}
+
+COMMAND(gusInterest, "print the Gusanos areas of interest of the connections, or switch them on/off", "[on|off]", 0, 1);
+void Cmd_gusInterest::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	if(params.size() > 0) {
+		bool fail = false;
+		bool on = from_string<bool>(params[0], fail);
+		if(fail) {
+			printUsage(caller);
+			return;
+		}
+		Net_Control::interestEnabled = on;
+	}
+	caller->writeMsg(std::string("area of interest ") + (Net_Control::interestEnabled ? "on" : "off") +
+					 ", view " + itoa(2 * Net_Control::interestViewW) + "x" + itoa(2 * Net_Control::interestViewH) +
+					 ", margin " + itoa(Net_Control::interestMargin));
+	if(!game.isServer() || !network.getNetControl()) {
+		caller->writeMsg("no Gusanos server running");
+		return;
+	}
+	caller->writeMsg("last grid queries: " + itoa(Server::lastInterestTime) + " us");
+	network.getNetControl()->olxDumpInterest(*caller);
+}
+
+COMMAND(benchGusInterest, "simulate the Gusanos node updates on a big map, without and with area of interest", "[players] [nodes] [seconds]", 0, 3);
+void Cmd_benchGusInterest::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int players = 32, nodes = 1000, seconds = 5;
+	if(params.size() > 0 && !fail) players = from_string<int>(params[0], fail);
+	if(params.size() > 1 && !fail) nodes = from_string<int>(params[1], fail);
+	if(params.size() > 2 && !fail) seconds = from_string<int>(params[2], fail);
+	if(fail || players <= 0 || nodes <= 0 || seconds <= 0) {
+		printUsage(caller);
+		return;
+	}
+	Net_Control::olxBenchmarkInterest(*caller, players, nodes, seconds);
+}
+
 COMMAND(debugFindProblems, "do some system checks and print problems - no output means everything seems ok", "", 0, 0);
 void Cmd_debugFindProblems::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
 	if(game.state >= Game::S_Preparing) { // game is running
@@ -2522,26 +3327,33 @@ void Cmd_lua::exec(CmdLineIntf *caller, const std::vector<std::string>& params)
 }
 
 
+// the same chars as TrimSpaces() removes
+static bool isTrimmedSpace(char c) {
+	return isspace((uchar)c) && !isgraph((uchar)c);
+}
+
 static void HandleCommand(const CmdLineIntf::Command& command) {
 	assert(isGameloopThread());
 
-	std::string cmdstr = command.cmd; TrimSpaces(cmdstr);
-	std::string params;
-	size_t f = cmdstr.find(' ');
-	if(f != std::string::npos) {
-		params = cmdstr.substr(f + 1);
-		TrimSpaces(params);
-		cmdstr = cmdstr.substr(0, f);
-	}
-	if(cmdstr == "") return;
-	
-	CommandMap::iterator cmd = commands.find(cmdstr);
+	// find the name and the params in place, the name is looked up and the params are tokenized right in the line
+	const std::string& line = command.cmd;
+	size_t start = 0, end = line.size();
+	while(start < end && isTrimmedSpace(line[start])) ++start;
+	while(end > start && isTrimmedSpace(line[end - 1])) --end;
+	if(start == end) return;
+
+	size_t nameEnd = line.find(' ', start);
+	if(nameEnd == std::string::npos || nameEnd > end) nameEnd = end;
+	size_t paramsStart = nameEnd;
+	while(paramsStart < end && isTrimmedSpace(line[paramsStart])) ++paramsStart;
+
+	Command** cmd = commandIndex.find(line.data() + start, nameEnd - start);
 	
-	if(cmd != commands.end()) {
-		cmd->second->exec(command.sender, params);
+	if(cmd) {
+		(*cmd)->exec(command.sender, line, paramsStart, end);
 	}
 	// we must handle this command seperate
-	else if( stringcaseequal(cmdstr, "nextsignal") ) {
+	else if( stringcaseequal(line.substr(start, nameEnd - start), "nextsignal") ) {
 		if(DedicatedControl::Get()) {
 			if(!DedicatedControl::Get()->GetNextSignal(command.sender)) return;
 		}
@@ -2549,25 +3361,67 @@ static void HandleCommand(const CmdLineIntf::Command& command) {
 			command.sender->writeMsg("nextsignal is only available in dedicated mode");
 	}
 	else {
-		command.sender->writeMsg("unknown command: " + cmdstr + " " + params);
+		command.sender->writeMsg("unknown command: " + line.substr(start, nameEnd - start) + " " + line.substr(paramsStart, end - paramsStart));
 	}
 	
 	command.sender->finalizeReturn();
 }
 
 
+/*
+	Multi-producer single-consumer queue (Dmitry Vyukov's intrusive MPSC).
+	Execute() is called from any thread (the dedicated script pipe, stdin,
+	the network code), only the gameloop thread pops. A push is one atomic
+	exchange and never waits for the gameloop; a pop doesn't touch the
+	producers' side at all.
+
+	tail is always a dummy node: the first pending command is tail->next.
+	A producer which is between the exchange and setting next makes its
+	command (and the ones after it) invisible for a moment; pop() returns
+	false then and the gameloop gets them in the next frame.
+*/
 struct CmdQueue {
-	
-	SDL_mutex* pendingCommandsMutex;
-	std::list<CmdLineIntf::Command> pendingCommands;
-	
+
+	struct Node {
+		std::atomic<Node*> next;
+		CmdLineIntf::Command command;
+		Node() : next(NULL) {}
+		Node(const CmdLineIntf::Command& c) : next(NULL), command(c) {}
+	};
+
+	std::atomic<Node*> head; // last pushed node
+	Node* tail; // only for the consumer
+
 	CmdQueue() {
-		pendingCommandsMutex = SDL_CreateMutex();
+		tail = new Node();
+		head.store(tail, std::memory_order_relaxed);
 	}
-	
+
 	~CmdQueue() {
-		SDL_DestroyMutex(pendingCommandsMutex);
-		pendingCommandsMutex = NULL;
+		CmdLineIntf::Command command;
+		while(pop(command)) {}
+		delete tail;
+		tail = NULL;
+	}
+
+	void push(const CmdLineIntf::Command& command) {
+		Node* n = new Node(command);
+		Node* prev = head.exchange(n, std::memory_order_acq_rel);
+		prev->next.store(n, std::memory_order_release);
+	}
+
+	bool empty() const {
+		return tail->next.load(std::memory_order_acquire) == NULL;
+	}
+
+	bool pop(CmdLineIntf::Command& command) {
+		Node* next = tail->next.load(std::memory_order_acquire);
+		if(next == NULL) return false;
+		command = next->command;
+		next->command = CmdLineIntf::Command(); // next is the new dummy, don't keep the sender/scope alive
+		delete tail;
+		tail = next;
+		return true;
 	}
 
 };
@@ -2576,28 +3430,16 @@ static CmdQueue cmdQueue;
 
 
 void Execute(const CmdLineIntf::Command& command) {
-	ScopedLock lock(cmdQueue.pendingCommandsMutex);
-	cmdQueue.pendingCommands.push_back(command);
+	cmdQueue.push(command);
 }
 
 bool havePendingCommands() {
-	ScopedLock lock(cmdQueue.pendingCommandsMutex);
-	return !cmdQueue.pendingCommands.empty();
+	return !cmdQueue.empty();
 }
 
 void HandlePendingCommands() {
-	while(true) {
-		CmdLineIntf::Command command;
-		{
-			ScopedLock lock(cmdQueue.pendingCommandsMutex);
-			if(cmdQueue.pendingCommands.size() > 0) {
-				command = cmdQueue.pendingCommands.front();
-				cmdQueue.pendingCommands.pop_front();
-			}
-			else
-				break;
-		}
-
+	CmdLineIntf::Command command;
+	while(cmdQueue.pop(command)) {
 		if(command.execScope.get())
 			command.execScope->execNow(command);
 		HandleCommand(command);
@@ -2611,6 +3453,98 @@ void HandlePendingCommands() {
 	}
 }
 
+
+// lines like a dedicated script sends them
+static const char* benchCommandLines[] = {
+	"getGameState",
+	"getVar GameOptions.Server.MaxPlayers",
+	"GETVAR gameoptions.server.maxplayers  ",
+	"  getGameState // no params",
+};
+static const size_t benchCommandLineCount = sizeof(benchCommandLines) / sizeof(benchCommandLines[0]);
+
+// every producer sends as its own CLI, so the consumer can check the order per producer
+struct CommandBenchCli : CmdLineIntf {
+	size_t received;
+	bool outOfOrder;
+	CommandBenchCli() : received(0), outOfOrder(false) {}
+	virtual void pushReturnArg(const std::string& str) {}
+	virtual void finalizeReturn() {}
+	virtual void writeMsg(const std::string& msg, CmdLineMsgType type = CNC_NORMAL) {}
+};
+
+struct CommandBenchJob {
+	CmdQueue* queue;
+	CommandBenchCli* sender;
+	size_t commands;
+};
+
+static Result commandBenchThread(void* param) {
+	CommandBenchJob* job = (CommandBenchJob*)param;
+	for(size_t i = 0; i < job->commands; ++i)
+		job->queue->push(CmdLineIntf::Command(job->sender, NULL, benchCommandLines[i % benchCommandLineCount]));
+	return true;
+}
+
+// Producers push like the dedicated pipe thread does, this thread pops and dispatches like HandlePendingCommands().
+// Returns the time in microseconds.
+static Uint64 benchCommandQueue(std::vector<CommandBenchCli>& senders, size_t perProducer, bool dispatch) {
+	CmdQueue queue;
+	std::vector<CommandBenchJob> jobs(senders.size());
+	for(size_t i = 0; i < senders.size(); ++i) {
+		senders[i] = CommandBenchCli();
+		CommandBenchJob job = { &queue, &senders[i], perProducer };
+		jobs[i] = job;
+	}
+
+	const Uint64 start = Profiler::getTicks();
+	std::vector<ThreadPoolItem*> items;
+	for(size_t i = 0; i < jobs.size(); ++i)
+		items.push_back(threadPool->start(&commandBenchThread, &jobs[i], "command queue benchmark"));
+	const size_t total = senders.size() * perProducer;
+	CmdLineIntf::Command command;
+	for(size_t done = 0; done < total; ) {
+		if(!queue.pop(command)) continue; // a producer is in the middle of a push
+		CommandBenchCli* sender = (CommandBenchCli*)command.sender;
+		if(command.cmd != benchCommandLines[sender->received % benchCommandLineCount])
+			sender->outOfOrder = true;
+		sender->received++;
+		if(dispatch) HandleCommand(command);
+		done++;
+	}
+	const Uint64 time = MAX(Profiler::getTicks() - start, (Uint64)1);
+	for(size_t i = 0; i < items.size(); ++i)
+		threadPool->wait(items[i]);
+	return time;
+}
+
+COMMAND(benchCommands, "measure commands per second through the command queue and the dispatch, as the dedicated script pipe uses them", "[producers] [commands per producer]", 0, 2);
+void Cmd_benchCommands::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	bool fail = false;
+	int producers = 1;
+	int commands = 200000;
+	if(params.size() > 0) producers = from_string<int>(params[0], fail);
+	if(!fail && params.size() > 1) commands = from_string<int>(params[1], fail);
+	if(fail || producers <= 0 || commands <= 0) {
+		printUsage(caller);
+		return;
+	}
+
+	std::vector<CommandBenchCli> senders(producers);
+	const Uint64 total = (Uint64)producers * commands;
+	for(int dispatch = 0; dispatch < 2; ++dispatch) {
+		const Uint64 time = benchCommandQueue(senders, commands, dispatch != 0);
+		caller->writeMsg(std::string(dispatch ? "queue and dispatch: " : "queue only:         ") + itoa(total) + " commands in " +
+						 itoa(time / 1000) + " ms, " + itoa(total * 1000000 / time) + " commands/s");
+		for(int i = 0; i < producers; ++i)
+			if(senders[i].received != (size_t)commands || senders[i].outOfOrder) {
+				caller->writeMsg("the commands of producer " + itoa(i) + " got lost or out of order", CNC_ERROR);
+				break;
+			}
+	}
+	caller->writeMsg(itoa(producers) + " producers, " + itoa(commandIndex.size()) + " commands registered");
+}
+
 std::vector<std::string> Execute_Here(const std::string& cmd) {
 	if(!isGameloopThread()) {
 		errors << "cannot Execute_Here(" + cmd + "): we are not in the gameloop thread" << endl;
@@ -2637,6 +3571,14 @@ std::vector<std::string> Execute_Here(const std::string& cmd) {
 	return directCli.returns;
 }
 
+void Execute_Here(CmdLineIntf& sender, const std::string& cmd) {
+	if(!isGameloopThread()) {
+		errors << "cannot Execute_Here(" + cmd + "): we are not in the gameloop thread" << endl;
+		return;
+	}
+	HandleCommand(CmdLineIntf::Command(&sender, NULL, cmd));
+}
+
 
 ///////////////////
 // Auto complete a command
@@ -17,11 +17,10 @@
 
 #include <time.h>
 
-std::string GetLogTimeStamp()
+static std::string GetLogTimeStamp(time_t unif_time)
 {
 	// TODO: please recode this, don't use C-strings!
 	char buf[64];
-	const time_t unif_time = time(NULL);
 	struct tm *t = localtime(&unif_time);
 	if (t == NULL)
 		return "";
@@ -45,7 +44,13 @@ Logger errors(-1,-1,1, "E: ");
 
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include "ThreadPool.h"
+#include "ReadWriteLock.h"
+#include "FindFile.h"
 #include "Options.h"
 #include "OLXConsole.h"
 #include "StringUtils.h"
@@ -85,13 +90,21 @@ struct ConPrint : PrintOutFct {
 	}
 };
 
+struct LogCallstack {
+	enum { MaxSize = 64 };
+	void* buffer[MaxSize];
+	int size;
+	LogCallstack() : size(0) {}
+};
+
 // true if last was newline
-static bool logger_output(Logger& log, const std::string& buf) {
+// callstack is the one of the logging thread if we are the writer thread, see AsyncLog
+static bool logger_output(Logger& log, const std::string& buf, time_t logTime, const LogCallstack* callstack) {
 	bool ret = true;
 
 	std::string prefix = log.prefix;
 	if (tLXOptions && tLXOptions->bLogTimestamps)
-		prefix = GetLogTimeStamp() + prefix;
+		prefix = GetLogTimeStamp(logTime) + prefix;
 
 	if((tLXOptions ? tLXOptions->iVerbosity : 0) >= log.minCoutVerb) {
 		SDL_mutexP(globalCoutMutex);
@@ -101,7 +114,10 @@ static bool logger_output(Logger& log, const std::string& buf) {
 		SDL_mutexV(globalCoutMutex);
 	}
 	if((tLXOptions ? tLXOptions->iVerbosity : 0) >= log.minCallstackVerb) {
-		DumpCallstackPrintf();
+		if(callstack)
+			DumpCallstack(StdoutPrintFct(), callstack->buffer, callstack->size);
+		else
+			DumpCallstackPrintf();
 	}
 	if(tLXOptions && Con_IsInited() && tLXOptions->iVerbosity >= log.minIngameConVerb) {
 		// the check is a bit hacky (see Con_AddText) but I really dont want to overcomplicate this
@@ -119,16 +135,305 @@ static bool logger_output(Logger& log, const std::string& buf) {
 				ret = PrettyPrint(prefix, buf, ConPrint<CNC_DEV>(), log.lastWasNewline);
 		}
 		if(tLXOptions->iVerbosity >= log.minCallstackVerb) {
-			DumpCallstack(ConPrint<CNC_DEV>());
+			if(callstack)
+				DumpCallstack(ConPrint<CNC_DEV>(), callstack->buffer, callstack->size);
+			else
+				DumpCallstack(ConPrint<CNC_DEV>());
 		}
 	}
 	return ret;
 }
 
+
+
+/*
+	Asynchronous logging
+
+	Every thread which logs gets its own single-producer ring buffer (LogRing)
+	and appends to it without any lock. A writer thread collects the messages
+	of all rings, orders them by a global sequence number and does the
+	formatting and output (stdout, ingame console, JSON lines file).
+
+	Memory is bounded by the ring size and by MaxQueuedBytes. If either is
+	exhausted, the message is dropped and counted; the writer reports drops.
+	Loggers which always print (errors) are never dropped, they are printed
+	synchronously then. The queue is flushed at shutdown and by the crash
+	handler. Callstacks are captured on the logging thread.
+
+	Until StartAsyncLogging (and after StopAsyncLogging), or if the writer
+	thread itself logs, everything is printed synchronously as before.
+*/
+
+namespace {
+
+struct LogEntry {
+	Logger* logger;
+	std::string msg;
+	time_t time;
+	Uint64 seq;
+	ThreadId thread;
+	bool withCallstack;
+	LogCallstack callstack;
+	LogEntry() : logger(NULL), time(0), seq(0), thread(0), withCallstack(false) {}
+};
+
+struct LogRing {
+	enum { Size = 256 };
+	LogEntry entries[Size];
+	std::atomic<size_t> head; // next to write, only changed by the owning thread
+	std::atomic<size_t> tail; // next to read, only changed by the writer
+	ThreadId thread;
+	LogRing() : head(0), tail(0), thread(0) {}
+};
+
+static const size_t MaxQueuedBytes = 4 * 1024 * 1024;
+
+struct AsyncLog {
+	std::atomic<bool> running;
+	std::atomic<bool> writerIdle;
+	std::atomic<Uint64> seq;
+	std::atomic<Uint64> enqueued;
+	std::atomic<Uint64> written;
+	std::atomic<Uint64> dropped;
+	std::atomic<size_t> queuedBytes;
+	Uint64 reportedDropped; // writer only
+
+	SDL_mutex* ringsMutex; // only for registering rings
+	std::vector<LogRing*> rings; // they are never freed, threads of the pool are reused anyway
+	SDL_sem* wakeup;
+	ThreadPoolItem* thread;
+	std::atomic<ThreadId> writerThread;
+	bool quit;
+	FILE* jsonFile;
+
+	AsyncLog() : running(false), writerIdle(false), seq(0), enqueued(0), written(0), dropped(0), queuedBytes(0), reportedDropped(0),
+	ringsMutex(NULL), wakeup(NULL), thread(NULL), writerThread(0), quit(false), jsonFile(NULL) {}
+
+	LogRing* myRing() {
+		static THREAD_LOCAL LogRing* ring = NULL;
+		if(!ring) {
+			ring = new LogRing();
+			ring->thread = getCurrentThreadId();
+			ScopedLock lock(ringsMutex);
+			rings.push_back(ring);
+		}
+		return ring;
+	}
+
+	void wakeWriter() {
+		if(writerIdle.exchange(false))
+			SDL_SemPost(wakeup);
+	}
+
+	// false if the caller should print it itself
+	bool push(Logger& log, std::string& msg, const LogCallstack* callstack) {
+		if(!running.load(std::memory_order_acquire)) return false;
+		if(writerThread.load(std::memory_order_relaxed) == getCurrentThreadId()) return false;
+
+		LogRing* ring = myRing();
+		const size_t h = ring->head.load(std::memory_order_relaxed);
+		if(h - ring->tail.load(std::memory_order_acquire) >= LogRing::Size ||
+		   queuedBytes.load(std::memory_order_relaxed) + msg.size() > MaxQueuedBytes) {
+			if(log.minCoutVerb < 0) return false; // always printed, e.g. errors; these are what we need when in trouble
+			dropped++;
+			return true;
+		}
+
+		LogEntry& e = ring->entries[h % LogRing::Size];
+		e.logger = &log;
+		e.msg.swap(msg);
+		e.time = ::time(NULL);
+		e.thread = ring->thread;
+		e.withCallstack = callstack != NULL;
+		if(callstack) e.callstack = *callstack;
+		e.seq = seq++;
+		queuedBytes += e.msg.size();
+		enqueued++;
+		ring->head.store(h + 1, std::memory_order_seq_cst);
+		wakeWriter();
+		return true;
+	}
+
+	bool collect(std::vector<LogEntry>& batch) {
+		std::vector<LogRing*> all;
+		{
+			ScopedLock lock(ringsMutex);
+			all = rings;
+		}
+		foreach(r, all) {
+			LogRing* ring = *r;
+			const size_t h = ring->head.load(std::memory_order_acquire);
+			size_t t = ring->tail.load(std::memory_order_relaxed);
+			for(; t != h; ++t) {
+				LogEntry& e = ring->entries[t % LogRing::Size];
+				batch.push_back(LogEntry());
+				std::swap(batch.back(), e);
+			}
+			ring->tail.store(t, std::memory_order_release);
+		}
+		return !batch.empty();
+	}
+
+	static bool bySeq(const LogEntry& a, const LogEntry& b) { return a.seq < b.seq; }
+
+	void writeJson(const LogEntry& e) {
+		std::string msg = e.msg;
+		if(!msg.empty() && msg[msg.size()-1] == '\n') msg.erase(msg.size()-1);
+		std::string level = e.logger->prefix;
+		TrimSpaces(level);
+		if(!level.empty() && level[level.size()-1] == ':') level.erase(level.size()-1);
+		std::string line = "{\"time\":" + to_string<long long>((long long)e.time) +
+			",\"thread\":" + to_string<unsigned long long>((unsigned long long)e.thread) +
+			",\"seq\":" + itoa(e.seq) +
+			",\"level\":\"" + level + "\",\"msg\":\"";
+		for(std::string::const_iterator c = msg.begin(); c != msg.end(); ++c) {
+			if(*c == '"' || *c == '\\') { line += '\\'; line += *c; }
+			else if(*c == '\n') line += "\\n";
+			else if(*c == '\t') line += "\\t";
+			else if((unsigned char)*c < 0x20) {
+				char buf[8];
+				sprintf(buf, "\\u%04x", (unsigned int)(unsigned char)*c);
+				line += buf;
+			}
+			else line += *c;
+		}
+		line += "\"}\n";
+		fwrite(line.data(), 1, line.size(), jsonFile);
+	}
+
+	void write(std::vector<LogEntry>& batch) {
+		std::sort(batch.begin(), batch.end(), bySeq);
+		size_t bytes = 0;
+		foreach(e, batch) {
+			e->logger->lastWasNewline = logger_output(*e->logger, e->msg, e->time, e->withCallstack ? &e->callstack : NULL);
+			if(jsonFile) writeJson(*e);
+			bytes += e->msg.size();
+		}
+		if(jsonFile) fflush(jsonFile);
+		queuedBytes -= bytes;
+		written += batch.size();
+		batch.clear();
+
+		const Uint64 d = dropped.load();
+		if(d != reportedDropped) {
+			// we are the writer, so this is printed synchronously
+			warnings << "logging: dropped " << (d - reportedDropped) << " messages because the log queue was full" << endl;
+			reportedDropped = d;
+		}
+	}
+
+	Result run() {
+		writerThread = getCurrentThreadId();
+		std::vector<LogEntry> batch;
+		while(true) {
+			if(collect(batch)) {
+				write(batch);
+				continue;
+			}
+			if(quit) break;
+			writerIdle.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(collect(batch)) {
+				writerIdle.store(false);
+				write(batch);
+				continue;
+			}
+			SDL_SemWait(wakeup);
+		}
+		writerThread = 0;
+		return true;
+	}
+
+	struct Writer : Action {
+		AsyncLog* log;
+		Writer(AsyncLog* l) : log(l) {}
+		Result handle() { return log->run(); }
+	};
+};
+
+static AsyncLog asyncLog;
+
+}
+
+void StartAsyncLogging(const std::string& jsonFile) {
+	if(asyncLog.running) return;
+	if(!asyncLog.ringsMutex) {
+		asyncLog.ringsMutex = SDL_CreateMutex();
+		asyncLog.wakeup = SDL_CreateSemaphore(0);
+	}
+	if(jsonFile != "") {
+		asyncLog.jsonFile = OpenGameFile(jsonFile, "a");
+		if(!asyncLog.jsonFile)
+			warnings << "cannot open log file " << jsonFile << endl;
+	}
+	asyncLog.quit = false;
+	asyncLog.writerIdle = false;
+	asyncLog.thread = threadPool->start(new AsyncLog::Writer(&asyncLog), "async logging");
+	asyncLog.running = true;
+}
+
+void StopAsyncLogging() {
+	if(!asyncLog.running) return;
+	asyncLog.running = false;
+	asyncLog.quit = true;
+	SDL_SemPost(asyncLog.wakeup);
+	threadPool->wait(asyncLog.thread, NULL);
+	asyncLog.thread = NULL;
+
+	// whatever came in while we were stopping
+	std::vector<LogEntry> batch;
+	if(asyncLog.collect(batch))
+		asyncLog.write(batch);
+
+	if(asyncLog.jsonFile) {
+		fclose(asyncLog.jsonFile);
+		asyncLog.jsonFile = NULL;
+	}
+}
+
+bool FlushLogs(int timeoutMs) {
+	if(!asyncLog.running) return true;
+	if(asyncLog.writerThread == getCurrentThreadId()) return false;
+	const Uint64 target = asyncLog.enqueued;
+	asyncLog.wakeWriter();
+	const Uint32 start = SDL_GetTicks();
+	while(asyncLog.written < target) {
+		if(timeoutMs >= 0 && SDL_GetTicks() - start >= (Uint32)timeoutMs) return false;
+		SDL_Delay(1);
+	}
+	return true;
+}
+
+LogStats GetLogStats() {
+	LogStats s;
+	s.async = asyncLog.running;
+	s.enqueued = asyncLog.enqueued;
+	s.written = asyncLog.written;
+	s.dropped = asyncLog.dropped;
+	s.queuedBytes = asyncLog.queuedBytes;
+	if(asyncLog.ringsMutex) {
+		ScopedLock lock(asyncLog.ringsMutex);
+		s.threads = asyncLog.rings.size();
+	}
+	return s;
+}
+
 Logger& Logger::flush() {
 	lock();
-	lastWasNewline = logger_output(*this, buffer);
-	buffer = "";
+	std::string msg;
+	msg.swap(buffer);
+	unlock();
+
+	LogCallstack callstack;
+	const bool withCallstack = (tLXOptions ? tLXOptions->iVerbosity : 0) >= minCallstackVerb;
+	if(withCallstack && asyncLog.running)
+		callstack.size = GetCallstack(0, callstack.buffer, LogCallstack::MaxSize);
+
+	if(asyncLog.push(*this, msg, withCallstack ? &callstack : NULL))
+		return *this;
+
+	lock();
+	lastWasNewline = logger_output(*this, msg, ::time(NULL), NULL);
 	unlock();
 	return *this;
 }
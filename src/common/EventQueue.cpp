@@ -13,6 +13,7 @@
 
 
 #include <list>
+#include <atomic>
 #include <cassert>
 #include <time.h>
 #include <SDL_events.h>
@@ -28,23 +29,198 @@ static void InitQuitSignalHandler();
 
 EventQueue* mainQueue = NULL;
 
+/*
+	The queue is multi-producer, single-consumer:
+
+	- ring: a bounded lock-free ring buffer (D. Vyukov's sequence number
+	  scheme). Producers claim a cell with a CAS on enqueuePos and publish
+	  it with the cell sequence. Cells are recycled, push doesn't allocate.
+	- overflow: if the ring is full, pushes go to a mutex protected list.
+	  While it is not empty, all pushes go there, so the order of the events
+	  of one producer is kept.
+	- pending: consumer-private. copyCustomEvents/removeCustomEvents move
+	  everything there to be able to work on the whole queue.
+
+	The consumer side (poll, wait, copy/removeCustomEvents) is owned by an
+	atomic flag. Only one thread polls in practice, so that is uncontended.
+	wait() sleeps on a futex (Linux) or a condition (elsewhere) and producers
+	only wake it if it is actually sleeping.
+*/
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define EVENTQUEUE_FUTEX
+#endif
+
 struct EventQueueIntern {
-	SDL_mutex* mutex;
-	SDL_cond* cond;
-	std::list<EventItem> queue;
-	EventQueueIntern() : mutex(NULL), cond(NULL) {}
+	enum { RingSize = 4096 };
+
+	struct Cell {
+		std::atomic<size_t> seq;
+		EventItem item;
+	};
+
+	Cell* ring;
+	std::atomic<size_t> enqueuePos;
+	size_t dequeuePos; // only touched by the consumer
+
+	SDL_mutex* overflowMutex;
+	std::list<EventItem> overflow;
+	std::atomic<size_t> overflowCount;
+
+	std::list<EventItem> pending;
+	std::atomic<bool> consumerBusy;
+
+	std::atomic<Uint32> wakeSeq;
+	std::atomic<bool> consumerSleeping;
+#ifndef EVENTQUEUE_FUTEX
+	SDL_mutex* sleepMutex;
+	SDL_cond* sleepCond;
+#endif
+
+	EventQueueIntern() : ring(NULL), enqueuePos(0), dequeuePos(0), overflowMutex(NULL), overflowCount(0), consumerBusy(false), wakeSeq(0), consumerSleeping(false)
+#ifndef EVENTQUEUE_FUTEX
+	, sleepMutex(NULL), sleepCond(NULL)
+#endif
+	{}
+
 	void init() {
-		mutex = SDL_CreateMutex();
-		cond = SDL_CreateCond();
+		ring = new Cell[RingSize];
+		for(size_t i = 0; i < RingSize; ++i)
+			ring[i].seq.store(i, std::memory_order_relaxed);
+		overflowMutex = SDL_CreateMutex();
+#ifndef EVENTQUEUE_FUTEX
+		sleepMutex = SDL_CreateMutex();
+		sleepCond = SDL_CreateCond();
+#endif
+	}
+
+	struct ConsumerScope {
+		EventQueueIntern* q;
+		ConsumerScope(EventQueueIntern* _q) : q(_q) {
+			while(q->consumerBusy.exchange(true, std::memory_order_acquire))
+				SDL_Delay(0);
+		}
+		~ConsumerScope() { q->consumerBusy.store(false, std::memory_order_release); }
+	};
+
+	bool ringPush(const EventItem& e) {
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		Cell* cell = NULL;
+		while(true) {
+			cell = &ring[pos & (RingSize - 1)];
+			const size_t seq = cell->seq.load(std::memory_order_acquire);
+			const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+			if(dif == 0) {
+				if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(dif < 0)
+				return false; // full
+			else
+				pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+		cell->item = e;
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool ringPop(EventItem& e) {
+		Cell* cell = &ring[dequeuePos & (RingSize - 1)];
+		const size_t seq = cell->seq.load(std::memory_order_acquire);
+		if((intptr_t)seq - (intptr_t)(dequeuePos + 1) < 0)
+			return false; // empty, or the producer is not done writing yet
+		e = cell->item;
+		cell->seq.store(dequeuePos + RingSize, std::memory_order_release);
+		dequeuePos++;
+		return true;
+	}
+
+	bool ringEmpty() const {
+		return enqueuePos.load(std::memory_order_acquire) == dequeuePos;
+	}
+
+	void push(const EventItem& e) {
+		if(overflowCount.load(std::memory_order_acquire) > 0 || !ringPush(e)) {
+			ScopedLock lock(overflowMutex);
+			overflow.push_back(e);
+			overflowCount.fetch_add(1, std::memory_order_release);
+		}
+
+		// Pairs with the fence in wait(): either we see the consumer sleeping or it sees our event.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(consumerSleeping.load(std::memory_order_relaxed))
+			wake();
+	}
+
+	// only with ConsumerScope
+	bool pop(EventItem& e) {
+		if(!pending.empty()) {
+			e = pending.front();
+			pending.pop_front();
+			return true;
+		}
+		if(ringPop(e)) return true;
+		if(overflowCount.load(std::memory_order_acquire) > 0) {
+			ScopedLock lock(overflowMutex);
+			if(!overflow.empty()) {
+				e = overflow.front();
+				overflow.pop_front();
+				overflowCount.fetch_sub(1, std::memory_order_release);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// only with ConsumerScope; moves everything into pending
+	void collectPending() {
+		EventItem e;
+		while(ringPop(e))
+			pending.push_back(e);
+		if(overflowCount.load(std::memory_order_acquire) > 0) {
+			ScopedLock lock(overflowMutex);
+			pending.splice(pending.end(), overflow);
+			overflowCount.store(0, std::memory_order_release);
+		}
+	}
+
+	bool hasItems() const {
+		return !ringEmpty() || overflowCount.load(std::memory_order_acquire) > 0 || !pending.empty();
 	}
+
+	void wake() {
+		wakeSeq.fetch_add(1, std::memory_order_release);
+#ifdef EVENTQUEUE_FUTEX
+		syscall(SYS_futex, (Uint32*)&wakeSeq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+		ScopedLock lock(sleepMutex);
+		SDL_CondSignal(sleepCond);
+#endif
+	}
+
+	void sleep(Uint32 seq) {
+#ifdef EVENTQUEUE_FUTEX
+		// returns immediately if wakeSeq != seq, i.e. someone pushed meanwhile
+		syscall(SYS_futex, (Uint32*)&wakeSeq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+		ScopedLock lock(sleepMutex);
+		if(wakeSeq.load(std::memory_order_acquire) == seq)
+			SDL_CondWait(sleepCond, sleepMutex);
+#endif
+	}
+
 	void uninit() { // WARNING: don't call this if any other thread could be using this queue
 		while(true) {
 			// We swapped them because some of the code we are calling here at the cleanup could again access us
 			// and that would either cause deadlocks or crashes, thus we still need a vaild eventqueue at this point.
 			std::list<EventItem> tmpList;
 			{
-				ScopedLock lock(mutex);
-				tmpList.swap(queue);
+				ConsumerScope scope(this);
+				collectPending();
+				tmpList.swap(pending);
 			}
 			if(tmpList.size() > 0)
 				warnings << "there are still " << tmpList.size() << " pending events in the event queue" << endl;
@@ -64,11 +240,17 @@ struct EventQueueIntern {
 			}
 		}
 		
-		SDL_DestroyMutex(mutex);
-		mutex = NULL;
-		
-		SDL_DestroyCond(cond);
-		cond = NULL;
+		delete[] ring;
+		ring = NULL;
+
+		SDL_DestroyMutex(overflowMutex);
+		overflowMutex = NULL;
+#ifndef EVENTQUEUE_FUTEX
+		SDL_DestroyMutex(sleepMutex);
+		sleepMutex = NULL;
+		SDL_DestroyCond(sleepCond);
+		sleepCond = NULL;
+#endif
 	}
 };
 
@@ -98,44 +280,36 @@ void ShutdownEventQueue() {
 
 
 bool EventQueue::hasItems() {
-	ScopedLock lock(data->mutex);
-	return !data->queue.empty();
+	return data->hasItems();
 }
 
 bool EventQueue::poll(EventItem& event) {
-	ScopedLock lock(data->mutex);
-	
-	if( data->queue.empty() )
-		return false;
-
-	event = data->queue.front();	
-	data->queue.pop_front();
-	
-	return true;
+	EventQueueIntern::ConsumerScope scope(data);
+	return data->pop(event);
 }
 
 bool EventQueue::wait(EventItem& event) {
-	ScopedLock lock(data->mutex);
-	
-	while( data->queue.empty() ) {
-		SDL_CondWait( data->cond, data->mutex );
+	while(true) {
+		const Uint32 seq = data->wakeSeq.load(std::memory_order_acquire);
+		data->consumerSleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		bool got = false;
+		{
+			EventQueueIntern::ConsumerScope scope(data);
+			got = data->pop(event);
+		}
+		if(got) {
+			data->consumerSleeping.store(false, std::memory_order_relaxed);
+			return true;
+		}
+		data->sleep(seq);
+		data->consumerSleeping.store(false, std::memory_order_relaxed);
 	}
-	
-	event = data->queue.front();
-	data->queue.pop_front();
-	
-	return true;
 }
 
 bool EventQueue::push(const EventItem& event) {
-	{
-		ScopedLock lock(data->mutex);
-
-		// TODO: some limit if queue too full? it could happen that OLX eats up all mem if there is no limit
-		data->queue.push_back(event);
-
-		SDL_CondSignal(data->cond);
-	}
+	// TODO: the overflow list has no limit, it could happen that OLX eats up all mem
+	data->push(event);
 
 #ifdef SINGLETHREADED
 	if(this == mainQueue && !isMainThread()) {
@@ -167,29 +341,31 @@ bool EventQueue::push(Action* act) {
 }
 
 void EventQueue::copyCustomEvents(const _Event* oldOwner, _Event* newOwner) {
-	ScopedLock lock(data->mutex);
+	EventQueueIntern::ConsumerScope scope(data);
+	data->collectPending();
 
-	for(std::list<EventItem>::iterator i = data->queue.begin(); i != data->queue.end(); ++i) {
+	for(std::list<EventItem>::iterator i = data->pending.begin(); i != data->pending.end(); ++i) {
 		if(i->type == SDL_USEREVENT && i->user.code == UE_CustomEventHandler) {
 			CustomEventHandler* hndl = dynamic_cast<CustomEventHandler*>( (Action*)i->user.data1 );
 			if(hndl && hndl->owner() == oldOwner) {
-				data->queue.insert(i, CustomEvent(hndl->copy(newOwner)));
+				data->pending.insert(i, CustomEvent(hndl->copy(newOwner)));
 			}
 		}
 	}
 }
 
 void EventQueue::removeCustomEvents(const _Event* owner) {
-	ScopedLock lock(data->mutex);
+	EventQueueIntern::ConsumerScope scope(data);
+	data->collectPending();
 	
-	for(std::list<EventItem>::iterator i = data->queue.begin(); i != data->queue.end(); ) {
+	for(std::list<EventItem>::iterator i = data->pending.begin(); i != data->pending.end(); ) {
 		std::list<EventItem>::iterator last = i; ++i;
 		const SDL_Event& ev = *last;
 		if(ev.type == SDL_USEREVENT && ev.user.code == UE_CustomEventHandler) {
 			CustomEventHandler* hndl = dynamic_cast<CustomEventHandler*>( (Action*)ev.user.data1 );
 			if(hndl && hndl->owner() == owner) {
 				delete (Action*)ev.user.data1;
-				data->queue.erase(last);
+				data->pending.erase(last);
 			}
 		}
 	}
@@ -0,0 +1,222 @@
+/*
+ *  FileDelta.cpp
+ *  OpenLieroX
+ *
+ *  rsync-style block delta of files, for updating outdated mod/map files
+ *
+ *  code under LGPL
+ *
+ */
+
+#include <vector>
+#include <algorithm>
+#include <zlib.h>
+#include "FileDelta.h"
+#include "CBytestream.h"
+#include "MathLib.h"
+
+
+enum { FD_End = 0, FD_Copy = 1, FD_Literal = 2 };
+enum { FileDeltaMaxFileSize = 256 * 1024 * 1024 };
+
+namespace {
+
+// rsync's rolling checksum: a = sum of the bytes, b = sum of the prefix sums, both mod 2^16
+struct RollingChecksum {
+	Uint32 a, b, len;
+
+	RollingChecksum(const char* data, size_t l) : a(0), b(0), len((Uint32)l) {
+		for(size_t i = 0; i < l; ++i) {
+			a += (Uint8)data[i];
+			b += a;
+		}
+	}
+	void roll(Uint8 out, Uint8 in) {
+		a += in - out;
+		b += a - len * out;
+	}
+	Uint32 get() const { return (a & 0xffff) | (b << 16); }
+};
+
+Uint32 strongChecksum(const char* data, size_t len) {
+	return (Uint32)crc32(crc32(0L, Z_NULL, 0), (const Bytef*)data, (uInt)len);
+}
+
+struct SignatureBlock {
+	Uint32 weak, strong, index;
+	bool operator<(const SignatureBlock& o) const { return weak < o.weak; }
+};
+
+// Merges consecutive block copies into one instruction
+struct DeltaWriter {
+	CBytestream out;
+	Uint32 copyFirst, copyCount;
+	DeltaWriter() : copyFirst(0), copyCount(0) {}
+
+	bool continuesCopy(Uint32 block) const { return copyCount > 0 && block == copyFirst + copyCount; }
+	void copy(Uint32 block) {
+		if(continuesCopy(block)) { copyCount++; return; }
+		flushCopy();
+		copyFirst = block;
+		copyCount = 1;
+	}
+	void flushCopy() {
+		if(copyCount == 0) return;
+		out.writeByte(FD_Copy);
+		out.writeInt((int)copyFirst, 4);
+		out.writeInt((int)copyCount, 4);
+		copyCount = 0;
+	}
+	void literal(const std::string& data, size_t begin, size_t end) {
+		if(begin >= end) return;
+		flushCopy();
+		out.writeByte(FD_Literal);
+		out.writeInt((int)(end - begin), 4);
+		out.writeData(data.substr(begin, end - begin));
+	}
+};
+
+}
+
+Uint32 FileDeltaBlockSize(size_t fileSize) {
+	Uint32 s = (Uint32)((fileSize + FileDeltaMaxSignatureBlocks - 1) / FileDeltaMaxSignatureBlocks);
+	return MAX(s, (Uint32)FileDeltaMinBlockSize);
+}
+
+std::string FileDeltaSignature(const std::string& oldData) {
+	const Uint32 blockSize = FileDeltaBlockSize(oldData.size());
+	CBytestream bs;
+	bs.writeInt((int)blockSize, 4);
+	bs.writeInt((int)oldData.size(), 4);
+	for(size_t pos = 0; pos < oldData.size(); pos += blockSize) {
+		const size_t len = MIN((size_t)blockSize, oldData.size() - pos);
+		bs.writeInt((int)RollingChecksum(oldData.data() + pos, len).get(), 4);
+		bs.writeInt((int)strongChecksum(oldData.data() + pos, len), 4);
+	}
+	return bs.data();
+}
+
+bool FileDeltaCreate(const std::string& signature, const std::string& newData, std::string* delta) {
+	CBytestream sig(signature);
+	const Uint32 blockSize = (Uint32)sig.readInt(4);
+	const Uint32 oldSize = (Uint32)sig.readInt(4);
+	if(blockSize == 0 || oldSize > FileDeltaMaxFileSize) return false;
+	const size_t blocks = (oldSize + blockSize - 1) / blockSize;
+	if(sig.GetRestLen() != blocks * 8) return false;
+
+	// Only full blocks go into the lookup table, the short last block is checked at the end of newData.
+	std::vector<SignatureBlock> table;
+	table.reserve(blocks);
+	SignatureBlock tail = { 0, 0, 0 };
+	const size_t tailLen = oldSize % blockSize;
+	for(size_t i = 0; i < blocks; ++i) {
+		SignatureBlock b;
+		b.weak = (Uint32)sig.readInt(4);
+		b.strong = (Uint32)sig.readInt(4);
+		b.index = (Uint32)i;
+		if(i == blocks - 1 && tailLen != 0)
+			tail = b;
+		else
+			table.push_back(b);
+	}
+	std::stable_sort(table.begin(), table.end());
+	// Most positions do not match at all, this filters them out before the binary search
+	std::vector<bool> tag(1 << 16, false);
+	for(size_t i = 0; i < table.size(); ++i)
+		tag[(table[i].weak ^ (table[i].weak >> 16)) & 0xffff] = true;
+
+	DeltaWriter w;
+	w.out.writeInt((int)newData.size(), 4);
+	w.out.writeInt((int)adler32(adler32(0L, Z_NULL, 0), (const Bytef*)newData.data(), (uInt)newData.size()), 4);
+	w.out.writeInt((int)blockSize, 4);
+
+	size_t literalStart = 0; // newData from here on is not in the delta yet
+	size_t pos = 0;
+	const char* d = newData.data();
+	if(!table.empty() && newData.size() >= blockSize) {
+		RollingChecksum rc(d, blockSize);
+		while(true) {
+			const Uint32 weak = rc.get();
+			int match = -1;
+			if(tag[(weak ^ (weak >> 16)) & 0xffff]) {
+				SignatureBlock key = { weak, 0, 0 };
+				std::vector<SignatureBlock>::const_iterator i = std::lower_bound(table.begin(), table.end(), key);
+				if(i != table.end() && i->weak == weak) {
+					const Uint32 strong = strongChecksum(d + pos, blockSize);
+					for(; i != table.end() && i->weak == weak; ++i)
+						// prefer the block which continues the current copy
+						if(i->strong == strong && (match < 0 || (literalStart == pos && w.continuesCopy(i->index))))
+							match = (int)i->index;
+				}
+			}
+
+			if(match >= 0) {
+				w.literal(newData, literalStart, pos);
+				w.copy((Uint32)match);
+				pos += blockSize;
+				literalStart = pos;
+				if(pos + blockSize > newData.size()) break;
+				rc = RollingChecksum(d + pos, blockSize);
+				continue;
+			}
+
+			if(pos + blockSize >= newData.size()) break;
+			rc.roll((Uint8)d[pos], (Uint8)d[pos + blockSize]);
+			pos++;
+		}
+	}
+
+	// the short last block of the old file, if the new one ends the same way
+	if(tailLen > 0 && newData.size() >= literalStart + tailLen) {
+		const size_t tailPos = newData.size() - tailLen;
+		if(RollingChecksum(d + tailPos, tailLen).get() == tail.weak && strongChecksum(d + tailPos, tailLen) == tail.strong) {
+			w.literal(newData, literalStart, tailPos);
+			w.copy(tail.index);
+			literalStart = newData.size();
+		}
+	}
+	w.literal(newData, literalStart, newData.size());
+	w.flushCopy();
+	w.out.writeByte(FD_End);
+	*delta = w.out.data();
+	return true;
+}
+
+bool FileDeltaApply(const std::string& oldData, const std::string& delta, std::string* newData) {
+	CBytestream bs(delta);
+	const Uint32 newSize = (Uint32)bs.readInt(4);
+	const Uint32 newChecksum = (Uint32)bs.readInt(4);
+	const Uint32 blockSize = (Uint32)bs.readInt(4);
+	if(newSize > FileDeltaMaxFileSize || blockSize == 0) return false;
+
+	std::string result;
+	result.reserve(newSize);
+	while(true) {
+		if(bs.isPosAtEnd()) return false;
+		const int op = bs.readByte();
+		if(op == FD_End) break;
+		if(op == FD_Copy) {
+			const size_t first = (Uint32)bs.readInt(4);
+			const size_t count = (Uint32)bs.readInt(4);
+			if(count == 0 || first >= oldData.size() / blockSize + 1) return false;
+			const size_t begin = first * blockSize;
+			if(begin >= oldData.size() || (count - 1) * blockSize >= oldData.size() - begin) return false;
+			const size_t len = MIN(count * blockSize, oldData.size() - begin);
+			if(result.size() + len > newSize) return false;
+			result.append(oldData, begin, len);
+		}
+		else if(op == FD_Literal) {
+			const size_t len = (Uint32)bs.readInt(4);
+			if(len > bs.GetRestLen() || result.size() + len > newSize) return false;
+			result += bs.readData(len);
+		}
+		else
+			return false;
+	}
+
+	if(result.size() != newSize ||
+	   (Uint32)adler32(adler32(0L, Z_NULL, 0), (const Bytef*)result.data(), (uInt)result.size()) != newChecksum)
+		return false;
+	newData->swap(result);
+	return true;
+}
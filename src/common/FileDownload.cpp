@@ -30,7 +30,13 @@
 #include "FindFile.h"
 #include "EndianSwap.h"
 #include "FileDownload.h"
+#include "FileDelta.h"
 #include "MathLib.h"
+#include "Mutex.h"
+#include "OLXCommand.h"
+#include "Profiler.h"
+#include "Protocol.h"
+#include <zlib.h>
 
 
 
@@ -511,8 +517,218 @@ void CHttpDownloadManager::ProcessDownloads()
 // It might be also used not only in game in the future
 // Valid name will be CFileDownloaderUdp, since it's packet oriented, comments will appear someday (I hope).
 
+namespace {
+
+// The received beginning of an interrupted windowed download. It survives CUdpFileDownloader::reset(),
+// which is called on disconnect, so the download can be resumed after reconnecting.
+struct PartialUdpDownload {
+	Uint32 fileChecksum; // StatInfo checksum when we got it, 0 if unknown
+	Uint32 blobChecksum;
+	Uint32 blobSize;
+	std::string data; // the first chunks of the blob
+};
+typedef std::map<std::string, PartialUdpDownload> PartialUdpDownloads;
+enum { MaxPartialUdpDownloads = 16 };
+
+PartialUdpDownloads& partialUdpDownloads() {
+	static PartialUdpDownloads downloads;
+	return downloads;
+}
+
+size_t windowedChunkCount( size_t blobSize ) {
+	return ( blobSize + CUdpFileDownloader::WindowedChunkSize - 1 ) / CUdpFileDownloader::WindowedChunkSize;
+}
+
+Uint32 adler32Of( const std::string & data ) {
+	return (Uint32)adler32( adler32(0L, Z_NULL, 0), (const Bytef *)data.data(), (uInt)data.size() );
+}
+
+// Server-wide cache of the compressed file blobs, so that a mod is not read and compressed again for every client
+struct UdpFileCacheEntry {
+	time_t mtime;
+	off_t size;
+	Uint32 fileChecksum;
+	UdpFileBlobPtr blob; // can be NULL if only the checksum was needed
+	AbsTime lastUsed;
+	UdpFileCacheEntry() : mtime(0), size(0), fileChecksum(0) {}
+};
+
+struct UdpFileCache {
+	Mutex mutex;
+	std::map<std::string, UdpFileCacheEntry> entries;
+	size_t blobBytes;
+	size_t hits, misses, reusedAfterTouch;
+	UdpFileCache() : blobBytes(0), hits(0), misses(0), reusedAfterTouch(0) {}
+
+	// Expects the mutex to be locked
+	void evict() {
+		while( blobBytes > MaxBlobBytes ) {
+			std::map<std::string, UdpFileCacheEntry>::iterator oldest = entries.end();
+			for( std::map<std::string, UdpFileCacheEntry>::iterator i = entries.begin(); i != entries.end(); ++i )
+				if( i->second.blob.get() && ( oldest == entries.end() || i->second.lastUsed < oldest->second.lastUsed ) )
+					oldest = i;
+			if( oldest == entries.end() ) break;
+			blobBytes -= oldest->second.blob->data.size();
+			oldest->second.blob.reset();
+		}
+	}
+	enum { MaxBlobBytes = 64 * 1024 * 1024 };
+};
+
+UdpFileCache& udpFileCache() {
+	static UdpFileCache cache;
+	return cache;
+}
+
+bool readWholeFile( const std::string & path, std::string & data ) {
+	FILE * ff = OpenGameFile( path, "rb" );
+	if( ff == NULL )
+		return false;
+	char buf[16384];
+	data = "";
+	while( ! feof( ff ) )
+	{
+		size_t read = fread( buf, 1, sizeof(buf), ff );
+		data.append( buf, read );
+	};
+	fclose( ff );
+	return true;
+}
+
+}
+
+UdpFileBlobPtr GetUdpFileBlob( const std::string & path )
+{
+	struct stat st;
+	if( ! StatFile( path, &st ) || ! S_ISREG( st.st_mode ) )
+	{
+		notes << "GetUdpFileBlob(): cannot read file " << path << endl;
+		return UdpFileBlobPtr();
+	};
+
+	UdpFileCache & cache = udpFileCache();
+	UdpFileBlobPtr oldBlob;
+	{
+		Mutex::ScopedLock lock( cache.mutex );
+		std::map<std::string, UdpFileCacheEntry>::iterator i = cache.entries.find( path );
+		if( i != cache.entries.end() )
+		{
+			if( i->second.mtime == st.st_mtime && i->second.size == st.st_size && i->second.blob.get() )
+			{
+				cache.hits++;
+				i->second.lastUsed = tLX->currentTime;
+				return i->second.blob;
+			}
+			oldBlob = i->second.blob;
+		}
+		cache.misses++;
+	}
+
+	// Read and compress without holding the lock, that can take a while for big files
+	std::string data;
+	if( ! readWholeFile( path, data ) )
+	{
+		notes << "GetUdpFileBlob(): cannot read file " << path << endl;
+		return UdpFileBlobPtr();
+	};
+	const Uint32 fileChecksum = adler32Of( data );
+
+	UdpFileBlobPtr blob;
+	bool reused = false;
+	if( oldBlob.get() && oldBlob->fileChecksum == fileChecksum )
+	{
+		blob = oldBlob; // only touched
+		reused = true;
+	}
+	else
+	{
+		bool noCompress = false;
+		if( stringcaserfind( path, ".png" ) != std::string::npos ||
+			stringcaserfind( path, ".lxl" ) != std::string::npos || // LieroX levels are in .png format
+			stringcaserfind( path, ".ogg" ) != std::string::npos ||
+			stringcaserfind( path, ".mp3" ) != std::string::npos )
+			noCompress = true;
+		UdpFileBlob * newBlob = new UdpFileBlob();
+		newBlob->path = path;
+		newBlob->fileChecksum = fileChecksum;
+		std::string data1 = path;
+		data1.append( 1, '\0' );
+		data1.append( data );
+		Compress( data1, &newBlob->data, noCompress );
+		newBlob->blobChecksum = adler32Of( newBlob->data );
+		blob.reset( newBlob );
+	}
+
+	Mutex::ScopedLock lock( cache.mutex );
+	UdpFileCacheEntry & e = cache.entries[ path ];
+	if( e.blob.get() )
+		cache.blobBytes -= e.blob->data.size();
+	e.mtime = st.st_mtime;
+	e.size = st.st_size;
+	e.fileChecksum = fileChecksum;
+	e.blob = blob;
+	e.lastUsed = tLX->currentTime;
+	cache.blobBytes += blob->data.size();
+	if( reused ) cache.reusedAfterTouch++;
+	cache.evict();
+	return blob;
+}
+
+bool GetUdpFileChecksum( const std::string & path, Uint32 * checksum, Uint32 * size )
+{
+	struct stat st;
+	if( ! StatFile( path, &st ) )
+		return false;
+
+	UdpFileCache & cache = udpFileCache();
+	{
+		Mutex::ScopedLock lock( cache.mutex );
+		std::map<std::string, UdpFileCacheEntry>::iterator i = cache.entries.find( path );
+		if( i != cache.entries.end() && i->second.mtime == st.st_mtime && i->second.size == st.st_size )
+		{
+			if( checksum ) *checksum = i->second.fileChecksum;
+			if( size ) *size = (Uint32)i->second.size;
+			return true;
+		}
+	}
+
+	size_t fileChecksum = 0, fileSize = 0;
+	if( ! FileChecksum( path, &fileChecksum, &fileSize ) )
+		return false;
+
+	Mutex::ScopedLock lock( cache.mutex );
+	UdpFileCacheEntry & e = cache.entries[ path ];
+	if( e.fileChecksum != (Uint32)fileChecksum && e.blob.get() )
+	{
+		// the content changed, the blob is outdated
+		cache.blobBytes -= e.blob->data.size();
+		e.blob.reset();
+	}
+	e.mtime = st.st_mtime;
+	e.size = st.st_size;
+	e.fileChecksum = (Uint32)fileChecksum;
+	if( checksum ) *checksum = (Uint32)fileChecksum;
+	if( size ) *size = (Uint32)fileSize;
+	return true;
+}
+
+void DumpUdpFileBlobCache( CmdLineIntf & cli )
+{
+	UdpFileCache & cache = udpFileCache();
+	Mutex::ScopedLock lock( cache.mutex );
+	size_t blobs = 0;
+	for( std::map<std::string, UdpFileCacheEntry>::const_iterator i = cache.entries.begin(); i != cache.entries.end(); ++i )
+		if( i->second.blob.get() ) blobs++;
+	cli.writeMsg( "file blob cache: " + itoa(cache.entries.size()) + " files, " + itoa(blobs) + " compressed blobs, " +
+				 itoa(cache.blobBytes / 1024) + " KB" );
+	cli.writeMsg( "hits: " + itoa(cache.hits) + ", misses: " + itoa(cache.misses) +
+				 ", reused after touch: " + itoa(cache.reusedAfterTouch) );
+	cli.writeMsg( "partial downloads to resume: " + itoa(partialUdpDownloads().size()) );
+}
+
 void CUdpFileDownloader::reset()
 {
+	stashPartialDownload();
 	iPos = 0;
 	tPrevState = S_FINISHED;
 	tState = S_FINISHED;
@@ -522,6 +738,18 @@ void CUdpFileDownloader::reset()
 	tRequestedFiles.clear();
 	bWasAborted = false;
 	bWasError = false;
+	bReplacesLocalFile = false;
+	cUpdateRequested.clear();
+	cSendBlob.reset();
+	cChunkSent.clear();
+	cChunkAcked.clear();
+	iFirstUnacked = iHighestAcked = 0;
+	iRecvBlobChecksum = 0;
+	cChunkReceived.clear();
+	iChunksReceived = iFirstMissing = iChunksSinceAck = 0;
+	bAckDue = false;
+	fLastAckSent = AbsTime();
+	cLastCompleted = std::make_pair((Uint32)0, (Uint32)0);
 }
 
 void CUdpFileDownloader::setDataToSend( const std::string & name, const std::string & data, bool noCompress )
@@ -537,6 +765,7 @@ void CUdpFileDownloader::setDataToSend( const std::string & name, const std::str
 	tState = S_SEND;
 	iPos = 0;
 	sFilename = name;
+	cSendBlob.reset();
 	std::string data1 = sFilename;
 	data1.append( 1, '\0' );
 	data1.append(data);
@@ -546,31 +775,38 @@ void CUdpFileDownloader::setDataToSend( const std::string & name, const std::str
 
 void CUdpFileDownloader::setFileToSend( const std::string & path )
 {
-	FILE * ff = OpenGameFile( path, "rb" );
-	if( ff == NULL )
+	UdpFileBlobPtr blob = GetUdpFileBlob( path );
+	if( blob.get() == NULL )
 	{
 		reset();
 		bWasError = true;
 		return;
 	};
-	char buf[16384];
-	std::string data = "";
+	setBlobToSend( blob );
+};
 
-	while( ! feof( ff ) )
+void CUdpFileDownloader::setBlobToSend( const UdpFileBlobPtr & blob )
+{
+	tPrevState = tState;
+	tState = S_SEND;
+	iPos = 0;
+	sFilename = blob->path;
+	if( bWindowed )
 	{
-		size_t read = fread( buf, 1, sizeof(buf), ff );
-		data.append( buf, read );
-	};
-	fclose( ff );
-
-	bool noCompress = false;
-	if( stringcaserfind( path, ".png" ) != std::string::npos ||
-		stringcaserfind( path, ".lxl" ) != std::string::npos || // LieroX levels are in .png format
-		stringcaserfind( path, ".ogg" ) != std::string::npos ||
-		stringcaserfind( path, ".mp3" ) != std::string::npos )
-		noCompress = true;
-	setDataToSend( path, data, noCompress );
-};
+		sData = "";
+		cSendBlob = blob;
+		size_t chunks = windowedChunkCount( blob->data.size() );
+		cChunkSent.assign( chunks, AbsTime() );
+		cChunkAcked.assign( chunks, false );
+		iFirstUnacked = iHighestAcked = 0;
+	}
+	else
+	{
+		cSendBlob.reset();
+		sData = blob->data;
+	}
+	notes << "CFileDownloaderInGame::setFileToSend() filename " << sFilename << " compressed " << blob->data.size() << (bWindowed ? " windowed" : "") << endl;
+}
 
 enum { MAX_DATA_CHUNK = 254 };	// UCHAR_MAX - 1, client and server should have this equal
 bool CUdpFileDownloader::receive( CBytestream * bs )
@@ -578,6 +814,14 @@ bool CUdpFileDownloader::receive( CBytestream * bs )
 	uint chunkSize = bs->readByte();
 	if( chunkSize == 0 )	// Ping packet with zero data - do not change downloader state
 		return false;
+	if( ! cChunkReceived.empty() )
+	{
+		// The other side sends something else (e.g. ABORT) in the middle of a windowed download
+		stashPartialDownload();
+		cChunkReceived.clear();
+		tPrevState = tState;
+		tState = S_FINISHED;
+	}
 	if( tState == S_FINISHED )
 	{
 		tPrevState = tState;
@@ -612,35 +856,66 @@ bool CUdpFileDownloader::receive( CBytestream * bs )
 	//notes << "CFileDownloaderInGame::receive() chunk " << chunkSize << endl;
 	sData.append( bs->readData(chunkSize) );
 	if( Finished )
+		return finishReceive( sData.size() );
+	return false;
+};
+
+bool CUdpFileDownloader::finishReceive( size_t compressedSize )
+{
+	tPrevState = tState;
+	tState = S_FINISHED;
+	iPos = 0;
+	bReplacesLocalFile = false;
+	bool error = true;
+	if( Decompress( sData, &sFilename ) )
 	{
-		tPrevState = tState;
-		tState = S_FINISHED;
-		iPos = 0;
-		bool error = true;
-		size_t compressedSize = sData.size(); // TODO: unused
-		if( Decompress( sData, &sFilename ) )
+		error = false;
+		std::string::size_type f = sFilename.find('\0');
+		if( f == std::string::npos )
+			error = true;
+		else
 		{
-			error = false;
-			std::string::size_type f = sFilename.find('\0');
-			if( f == std::string::npos )
+			sData.assign( sFilename, f+1, sFilename.size() - (f+1) );
+			sFilename.resize( f );
+			notes << "CFileDownloaderInGame::receive() filename " << sFilename << " data.size() " << sData.size() << " compressed " << compressedSize << endl;
+			std::map< std::string, StatInfo >::const_iterator stat = cStatInfoCache.find( sFilename );
+			if( stat != cStatInfoCache.end() && stat->second.checksum != 0 &&
+				stat->second.checksum != adler32Of( sData ) )
+				warnings << "CFileDownloaderInGame::receive() " << sFilename << " differs from the file info we got before, it was probably changed on the server" << endl;
+		};
+	};
+	if( ! error && sFilename == "DELTA_ACK:" )
+	{
+		std::string path;
+		if( ! applyReceivedDelta( &path ) )
+		{
+			if( path == "" )
 				error = true;
 			else
 			{
-				sData.assign( sFilename, f+1, sFilename.size() - (f+1) );
-				sFilename.resize( f );
-				notes << "CFileDownloaderInGame::receive() filename " << sFilename << " data.size() " << sData.size() << " compressed " << compressedSize << endl;
-			};
-		};
-		if( error )
-		{
-			notes << "CFileDownloaderInGame::receive() error after " << sData.size() << " bytes" << endl;
-			reset();
+				// Our file changed meanwhile or both checksums collided, get the whole file instead
+				cDeltaFailed.insert( path );
+				requestFile( path, false );
+				return true;
+			}
 		}
-		bWasError = error;
-		processFileRequests();
-		return true;	// Receive finished
-	};
-	return false;
+	}
+	else if( ! error && isPathValid( sFilename ) && mayReplaceLocalFile( sFilename ) &&
+			( isLocalFileOutdated( sFilename ) || cDeltaFailed.count( sFilename ) ) )
+	{
+		// We asked for an update (DELTA: or again after a failed delta), and the server
+		// sent the whole file because the delta was not smaller or could not be created
+		bReplacesLocalFile = true;
+		cUpdateRequested.erase( sFilename );
+	}
+	if( error )
+	{
+		notes << "CFileDownloaderInGame::receive() error after " << sData.size() << " bytes" << endl;
+		reset();
+	}
+	bWasError = error;
+	processFileRequests();
+	return true;	// Receive finished
 };
 
 bool CUdpFileDownloader::send( CBytestream * bs )
@@ -676,6 +951,440 @@ void CUdpFileDownloader::sendPing( CBytestream * bs ) const
 	bs->writeByte( 0 );
 }
 
+enum {
+	WindowedMinRto = 100, // ms
+	WindowedAckDelay = 20, // ms, the receiver acks at least that often while data arrives
+	WindowedAckEvery = 8, // chunks
+	WindowedMaxBlobSize = 256 * 1024 * 1024
+};
+
+bool CUdpFileDownloader::sendWindowed( std::vector<CBytestream> & packets, AbsTime now, TimeDiff rtt )
+{
+	if( ! isSendingWindowed() )
+		return true;
+
+	const size_t chunks = cChunkAcked.size();
+	while( iFirstUnacked < chunks && cChunkAcked[iFirstUnacked] )
+		iFirstUnacked++;
+	if( iFirstUnacked >= chunks )
+	{
+		notes << "CFileDownloaderInGame::sendWindowed() " << sFilename << " finished" << endl;
+		tPrevState = tState;
+		tState = S_FINISHED;
+		cSendBlob.reset();
+		cChunkSent.clear();
+		cChunkAcked.clear();
+		return true;
+	}
+
+	// The ack of a chunk is due one round trip plus the ack delay after sending it.
+	// A chunk before the highest acked one is lost for sure after that time (the acks are selective),
+	// otherwise we wait for the RTO in case just the acks were lost.
+	const TimeDiff ackDue = rtt + TimeDiff((int)WindowedAckDelay);
+	const TimeDiff rto = MAX( rtt * 2.0f, TimeDiff((int)WindowedMinRto) ) + TimeDiff((int)WindowedAckDelay);
+	const size_t end = MIN( chunks, iFirstUnacked + (size_t)WindowedMaxInFlight );
+	const std::string & data = cSendBlob->data;
+	for( size_t c = iFirstUnacked; c < end; c++ )
+	{
+		if( cChunkAcked[c] )
+			continue;
+		if( cChunkSent[c] != AbsTime() )
+		{
+			const TimeDiff age = now - cChunkSent[c];
+			if( age < ( c < iHighestAcked ? ackDue : rto ) )
+				continue;
+		}
+		const size_t offset = c * WindowedChunkSize;
+		const size_t len = MIN( (size_t)WindowedChunkSize, data.size() - offset );
+		packets.push_back( CBytestream() );
+		CBytestream & bs = packets.back();
+		bs.writeInt( (int)data.size(), 4 );
+		bs.writeInt( (int)cSendBlob->blobChecksum, 4 );
+		bs.writeInt( (int)c, 4 );
+		bs.writeInt( (int)len, 2 );
+		bs.writeData( data.substr( offset, len ) );
+		cChunkSent[c] = now;
+	}
+	return false;
+}
+
+void CUdpFileDownloader::receiveWindowedAck( CBytestream * bs )
+{
+	const Uint32 blobChecksum = (Uint32)bs->readInt(4);
+	size_t firstMissing = (Uint32)bs->readInt(4);
+	const Uint32 bitmap = (Uint32)bs->readInt(4);
+	if( ! isSendingWindowed() || blobChecksum != cSendBlob->blobChecksum )
+		return; // old ack of a previous transfer
+
+	const size_t chunks = cChunkAcked.size();
+	firstMissing = MIN( firstMissing, chunks );
+	for( size_t c = iFirstUnacked; c < firstMissing; c++ )
+		cChunkAcked[c] = true;
+	if( firstMissing > 0 )
+		iHighestAcked = MAX( iHighestAcked, firstMissing - 1 );
+	for( size_t b = 0; b < WindowedAckBits; b++ )
+	{
+		const size_t c = firstMissing + 1 + b;
+		if( c < chunks && ( bitmap & (1u << b) ) )
+		{
+			cChunkAcked[c] = true;
+			iHighestAcked = MAX( iHighestAcked, c );
+		}
+	}
+	while( iFirstUnacked < chunks && cChunkAcked[iFirstUnacked] )
+		iFirstUnacked++;
+}
+
+bool CUdpFileDownloader::receiveWindowed( CBytestream * bs, AbsTime now )
+{
+	const Uint32 blobSize = (Uint32)bs->readInt(4);
+	const Uint32 blobChecksum = (Uint32)bs->readInt(4);
+	const size_t chunk = (Uint32)bs->readInt(4);
+	const size_t len = bs->readInt(2);
+	const std::string data = bs->readData( len );
+
+	const size_t chunks = windowedChunkCount( blobSize );
+	if( blobSize == 0 || blobSize > WindowedMaxBlobSize || chunk >= chunks || data.size() != len ||
+		len != MIN( (size_t)WindowedChunkSize, blobSize - chunk * WindowedChunkSize ) )
+	{
+		notes << "CFileDownloaderInGame::receiveWindowed(): invalid chunk " << chunk << " of blob size " << blobSize << endl;
+		return false;
+	}
+
+	const bool receivingThis = isReceiving() && ! cChunkReceived.empty() && iRecvBlobChecksum == blobChecksum && sData.size() == blobSize;
+	if( ! receivingThis && cLastCompleted == std::make_pair( blobChecksum, blobSize ) )
+	{
+		bAckDue = true; // retransmit because our final ack got lost
+		return false;
+	}
+	if( isSending() )
+	{
+		notes << "CFileDownloaderInGame::receiveWindowed(): got a chunk while sending, ignoring it" << endl;
+		return false;
+	}
+
+	if( ! receivingThis )
+	{
+		stashPartialDownload(); // if another one was running
+		tPrevState = tState;
+		tState = S_RECEIVE;
+		iPos = 0;
+		sFilename = "";
+		sData.assign( blobSize, '\0' );
+		iRecvBlobChecksum = blobChecksum;
+		cChunkReceived.assign( chunks, false );
+		iChunksReceived = iFirstMissing = iChunksSinceAck = 0;
+		bAckDue = false;
+
+		PartialUdpDownloads::iterator p = partialUdpDownloads().find( sLastFileRequested );
+		if( p != partialUdpDownloads().end() && p->second.blobChecksum == blobChecksum && p->second.blobSize == blobSize )
+		{
+			const size_t resumed = MIN( p->second.data.size() / WindowedChunkSize, chunks );
+			sData.replace( 0, resumed * WindowedChunkSize, p->second.data, 0, resumed * WindowedChunkSize );
+			for( size_t c = 0; c < resumed; c++ )
+				cChunkReceived[c] = true;
+			iChunksReceived = iFirstMissing = resumed;
+			notes << "CFileDownloaderInGame::receiveWindowed() resuming " << sLastFileRequested << " at " << resumed * WindowedChunkSize << " bytes" << endl;
+		}
+		if( p != partialUdpDownloads().end() )
+			partialUdpDownloads().erase( p );
+		notes << "CFileDownloaderInGame::receiveWindowed() started receiving " << sLastFileRequested << ", " << blobSize << " bytes" << endl;
+	}
+
+	if( ! cChunkReceived[chunk] )
+	{
+		sData.replace( chunk * WindowedChunkSize, len, data );
+		cChunkReceived[chunk] = true;
+		iChunksReceived++;
+		iChunksSinceAck++;
+		if( chunk != iFirstMissing )
+			bAckDue = true; // a hole, tell the sender soon
+	}
+	else
+		bAckDue = true; // duplicate, probably our ack got lost
+	while( iFirstMissing < chunks && cChunkReceived[iFirstMissing] )
+		iFirstMissing++;
+	if( iChunksSinceAck >= WindowedAckEvery )
+		bAckDue = true;
+	if( iFirstMissing < chunks )
+		return false;
+
+	// complete
+	cChunkReceived.clear();
+	cLastCompleted = std::make_pair( blobChecksum, blobSize );
+	bAckDue = true;
+	if( adler32Of( sData ) != blobChecksum )
+	{
+		notes << "CFileDownloaderInGame::receiveWindowed() checksum error for " << sLastFileRequested << endl;
+		const std::pair<Uint32, Uint32> completed = cLastCompleted;
+		reset();
+		cLastCompleted = completed; // still ack it, the sender would retransmit it forever otherwise
+		bAckDue = true;
+		bWasError = true;
+		processFileRequests();
+		return true;
+	}
+	return finishReceive( blobSize );
+}
+
+bool CUdpFileDownloader::writeWindowedAck( CBytestream * bs, AbsTime now )
+{
+	const bool receiving = isReceiving() && ! cChunkReceived.empty();
+	if( ! receiving && cLastCompleted.second == 0 )
+		return false;
+	if( ! bAckDue && ! ( receiving && iChunksSinceAck > 0 && now - fLastAckSent >= TimeDiff((int)WindowedAckDelay) ) )
+		return false;
+
+	if( receiving )
+	{
+		Uint32 bitmap = 0;
+		for( size_t b = 0; b < WindowedAckBits; b++ )
+		{
+			const size_t c = iFirstMissing + 1 + b;
+			if( c < cChunkReceived.size() && cChunkReceived[c] )
+				bitmap |= 1u << b;
+		}
+		bs->writeInt( (int)iRecvBlobChecksum, 4 );
+		bs->writeInt( (int)iFirstMissing, 4 );
+		bs->writeInt( (int)bitmap, 4 );
+	}
+	else
+	{
+		bs->writeInt( (int)cLastCompleted.first, 4 );
+		bs->writeInt( (int)windowedChunkCount( cLastCompleted.second ), 4 );
+		bs->writeInt( 0, 4 );
+	}
+	bAckDue = false;
+	iChunksSinceAck = 0;
+	fLastAckSent = now;
+	return true;
+}
+
+void CUdpFileDownloader::stashPartialDownload()
+{
+	if( cChunkReceived.empty() || ! isReceiving() || iFirstMissing == 0 || sLastFileRequested == "" )
+		return;
+	PartialUdpDownloads & downloads = partialUdpDownloads();
+	if( downloads.size() >= MaxPartialUdpDownloads && downloads.find( sLastFileRequested ) == downloads.end() )
+		downloads.erase( downloads.begin() );
+	PartialUdpDownload & p = downloads[ sLastFileRequested ];
+	std::map< std::string, StatInfo >::const_iterator stat = cStatInfoCache.find( sLastFileRequested );
+	p.fileChecksum = ( stat != cStatInfoCache.end() ) ? stat->second.checksum : 0;
+	p.blobChecksum = iRecvBlobChecksum;
+	p.blobSize = (Uint32)sData.size();
+	p.data = sData.substr( 0, iFirstMissing * WindowedChunkSize );
+	cChunkReceived.clear();
+	notes << "CFileDownloaderInGame: keeping " << p.data.size() << "/" << p.blobSize << " bytes of " << sLastFileRequested << " to resume later" << endl;
+}
+
+bool CUdpFileDownloader::isLocalFileOutdated( const std::string & path ) const
+{
+	if( ! bWindowed )
+		return false; // old servers cannot send deltas, and we never overwrote files for them
+	std::map< std::string, StatInfo >::const_iterator stat = cStatInfoCache.find( path );
+	Uint32 checksum = 0, size = 0;
+	if( stat == cStatInfoCache.end() || ! GetUdpFileChecksum( path, &checksum, &size ) )
+		return false;
+	return checksum != stat->second.checksum || size != stat->second.size;
+}
+
+void CUdpFileDownloader::setDeltaToSend( const std::string & path, const std::string & signature )
+{
+	UdpFileBlobPtr full = GetUdpFileBlob( path );
+	std::string data, delta;
+	if( full.get() == NULL || ! readWholeFile( path, data ) || ! FileDeltaCreate( signature, data, &delta ) )
+	{
+		notes << "CFileDownloaderInGame::setDeltaToSend(): cannot create delta for " << path << ", sending whole file" << endl;
+		setFileToSend( path );
+		return;
+	}
+
+	UdpFileBlob * b = new UdpFileBlob();
+	b->path = "DELTA_ACK:";
+	b->fileChecksum = full->fileChecksum;
+	Compress( b->path + std::string( 1, '\0' ) + path + std::string( 1, '\0' ) + delta, &b->data );
+	b->blobChecksum = adler32Of( b->data );
+	UdpFileBlobPtr blob( b );
+	notes << "CFileDownloaderInGame::setDeltaToSend() " << path << ": delta " << blob->data.size() << " bytes, whole file " << full->data.size() << endl;
+	if( blob->data.size() >= full->data.size() )
+		setBlobToSend( full );
+	else
+		setBlobToSend( blob );
+}
+
+bool CUdpFileDownloader::applyReceivedDelta( std::string * path )
+{
+	std::string::size_type f = sData.find( '\0' );
+	if( f == std::string::npos || ! isPathValid( sData.substr( 0, f ) ) )
+	{
+		notes << "CFileDownloaderInGame::applyReceivedDelta(): invalid delta" << endl;
+		return false;
+	}
+	if( ! mayReplaceLocalFile( sData.substr( 0, f ) ) )
+	{
+		// We did not ask for it; a server must not overwrite our files on its own
+		notes << "CFileDownloaderInGame::applyReceivedDelta(): dropping unrequested delta for " << sData.substr( 0, f ) << endl;
+		sFilename = "";
+		sData = "";
+		return true;
+	}
+	*path = sData.substr( 0, f );
+	std::string local, result;
+	if( ! readWholeFile( *path, local ) || ! FileDeltaApply( local, sData.substr( f + 1 ), &result ) )
+	{
+		notes << "CFileDownloaderInGame::applyReceivedDelta(): delta does not fit to our " << *path << endl;
+		return false;
+	}
+	notes << "CFileDownloaderInGame: updated " << *path << " with a delta of " << sData.size() - f - 1 << " bytes, file size " << result.size() << endl;
+	sFilename = *path;
+	sData.swap( result );
+	bReplacesLocalFile = true;
+	cUpdateRequested.erase( *path );
+	return true;
+}
+
+bool CUdpFileDownloader::mayReplaceLocalFile( const std::string & path ) const
+{
+	if( path != sLastFileRequested && cUpdateRequested.count( path ) == 0 )
+		return false;
+	for( size_t i = 0; i < cReplaceableDirs.size(); i++ )
+		if( cReplaceableDirs[i] != "" && stringcasefind( path, cReplaceableDirs[i] ) == 0 )
+			return true;
+	return false;
+}
+
+namespace {
+
+// Lossy one-way link for benchmarkTransfer(), in virtual time
+struct SimulatedLink {
+	std::multimap<Uint64, std::string> inFlight; // arrival time -> packet
+	Uint32 seed;
+	float loss;
+	TimeDiff delay;
+	size_t sent, lost;
+	SimulatedLink( float l, TimeDiff d, Uint32 s ) : seed(s), loss(l), delay(d), sent(0), lost(0) {}
+
+	float random() { seed = seed * 1103515245 + 12345; return float((seed >> 8) & 0xffff) / 65536.0f; }
+	void send( AbsTime now, const std::string & packet ) {
+		sent++;
+		if( random() < loss ) { lost++; return; }
+		inFlight.insert( std::make_pair( ( now + delay ).milliseconds(), packet ) );
+	}
+	bool receive( AbsTime now, std::string & packet ) {
+		if( inFlight.empty() || inFlight.begin()->first > now.milliseconds() ) return false;
+		packet = inFlight.begin()->second;
+		inFlight.erase( inFlight.begin() );
+		return true;
+	}
+};
+
+}
+
+void CUdpFileDownloader::benchmarkTransfer( CmdLineIntf & cli, size_t size, float loss, int rttMs )
+{
+	// Semi-compressible content, somewhat like a mod with scripts and images
+	std::string data;
+	data.reserve( size );
+	Uint32 seed = 42;
+	static const char * words[] = { "weapon ", "projectile ", "speed = ", "damage ", "\n", "sound.ogg ", "0.5 ", "trail " };
+	while( data.size() < size )
+	{
+		seed = seed * 1103515245 + 12345;
+		if( ( seed >> 16 ) % 3 == 0 )
+			data += words[ ( seed >> 8 ) % 8 ];
+		else
+			data += (char)( seed >> 16 );
+	}
+	data.resize( size );
+
+	UdpFileBlob * b = new UdpFileBlob();
+	b->path = "benchmark.dat";
+	b->fileChecksum = adler32Of( data );
+	Compress( b->path + std::string( 1, '\0' ) + data, &b->data );
+	b->blobChecksum = adler32Of( b->data );
+	UdpFileBlobPtr blob( b );
+	cli.writeMsg( "file " + itoa(size / 1024) + " KB, compressed " + itoa(blob->data.size() / 1024) + " KB, loss " +
+				 ftoa(loss * 100.0f) + "%, rtt " + itoa(rttMs) + " ms" );
+
+	const TimeDiff frame( 10 ); // server frame, the game sends at most once per frame
+	const TimeDiff rtt( rttMs );
+	const AbsTime start( 1000 );
+	const AbsTime timeout = start + TimeDiff( 600 * 1000 );
+
+	// Windowed transfer
+	{
+		CUdpFileDownloader sender, receiver;
+		sender.setWindowedTransfer( true );
+		receiver.setWindowedTransfer( true );
+		sender.setBlobToSend( blob );
+		SimulatedLink down( loss, rtt * 0.5f, 1 ), up( loss, rtt * 0.5f, 2 );
+		const Uint64 ticksStart = Profiler::getTicks();
+		AbsTime now = start;
+		bool done = false;
+		for( ; now < timeout && ! done; now += frame )
+		{
+			std::string packet;
+			while( up.receive( now, packet ) )
+			{
+				CBytestream bs( packet );
+				sender.receiveWindowedAck( &bs );
+			}
+			std::vector<CBytestream> packets;
+			sender.sendWindowed( packets, now, rtt );
+			for( size_t i = 0; i < packets.size(); i++ )
+				down.send( now, packets[i].data() );
+			while( down.receive( now, packet ) )
+			{
+				CBytestream bs( packet );
+				if( receiver.receiveWindowed( &bs, now ) )
+					done = true;
+			}
+			CBytestream ack;
+			if( receiver.writeWindowedAck( &ack, now ) )
+				up.send( now, ack.data() );
+		}
+		const Uint64 cpu = Profiler::getTicks() - ticksStart;
+		if( ! done || receiver.wasError() || receiver.getData() != data )
+			cli.writeMsg( "windowed: FAILED after " + ftoa( ( now - start ).seconds() ) + " s", CNC_ERROR );
+		else
+			cli.writeMsg( "windowed: " + ftoa( ( now - start ).seconds() ) + " s, " + itoa(down.sent) + " packets (" +
+						 itoa(down.lost) + " lost), " + itoa(up.sent) + " acks, cpu " + itoa(cpu / 1000) + " ms" );
+	}
+
+	// Old protocol: one chunk of MAX_DATA_CHUNK bytes per reliable packet, which CChannel sends
+	// stop-and-wait, i.e. the next one only after the previous one was acked.
+	// Only a model of it, the channel itself is not simulated here.
+	{
+		SimulatedLink down( loss, rtt * 0.5f, 1 ), up( loss, rtt * 0.5f, 2 );
+		const TimeDiff resend = MAX( rtt, frame ) + frame;
+		size_t pos = 0;
+		AbsTime now = start, lastSent;
+		bool waiting = false;
+		for( ; now < timeout && pos < blob->data.size(); now += frame )
+		{
+			std::string packet;
+			while( up.receive( now, packet ) )
+				if( waiting && from_string<size_t>( packet ) == pos )
+				{
+					pos += MAX_DATA_CHUNK;
+					waiting = false;
+				}
+			if( pos >= blob->data.size() )
+				break;
+			if( ! waiting || now - lastSent >= resend )
+			{
+				down.send( now, itoa(pos) );
+				lastSent = now;
+				waiting = true;
+			}
+			while( down.receive( now, packet ) )
+				up.send( now, packet ); // ack
+		}
+		cli.writeMsg( "old stop-and-wait (model): " + ftoa( ( now - start ).seconds() ) + " s, " +
+					 itoa(down.sent) + " packets (" + itoa(down.lost) + " lost)" );
+	}
+}
+
 void CUdpFileDownloader::allowFileRequest( bool allow )
 {
 	bAllowFileRequest = allow;
@@ -683,7 +1392,40 @@ void CUdpFileDownloader::allowFileRequest( bool allow )
 
 void CUdpFileDownloader::requestFile( const std::string & path, bool retryIfFail )
 {
-	setDataToSend( "GET:", path, false );
+	std::string request = path;
+	cLastCompleted = std::make_pair( (Uint32)0, (Uint32)0 ); // we may get the same blob again
+	PartialUdpDownloads::iterator p = partialUdpDownloads().find( path );
+	std::string local;
+	if( isLocalFileOutdated( path ) && cDeltaFailed.count( path ) == 0 && readWholeFile( path, local ) )
+	{
+		// path '\0' signature of our version, see FileDelta.h
+		setDataToSend( "DELTA:", path + std::string( 1, '\0' ) + FileDeltaSignature( local ) );
+		cUpdateRequested.insert( path );
+	}
+	else
+	{
+		if( bWindowed && p != partialUdpDownloads().end() )
+		{
+			// Ask to resume: path '\0' file checksum, blob checksum, offset
+			Uint32 fileChecksum = p->second.fileChecksum, blobChecksum = p->second.blobChecksum, offset = (Uint32)p->second.data.size();
+			std::map< std::string, StatInfo >::const_iterator stat = cStatInfoCache.find( path );
+			if( stat != cStatInfoCache.end() && fileChecksum != 0 && stat->second.checksum != fileChecksum )
+				partialUdpDownloads().erase( p ); // the file changed on the server since
+			else
+			{
+				EndianSwap( fileChecksum );
+				EndianSwap( blobChecksum );
+				EndianSwap( offset );
+				request += '\0';
+				request += std::string( (const char *) &fileChecksum, 4 );
+				request += std::string( (const char *) &blobChecksum, 4 );
+				request += std::string( (const char *) &offset, 4 );
+			}
+		}
+		setDataToSend( "GET:", request, false );
+		if( cDeltaFailed.count( path ) )
+			cUpdateRequested.insert( path );
+	}
 	if( retryIfFail )
 	{
 		bool exist = false;
@@ -785,27 +1527,73 @@ void CUdpFileDownloader::processFileRequests()
 		return;
 	if( sFilename == "GET:" )
 	{
-		if( ! isPathValid( getData() ) )
+		// Since 0.59 beta11 the path can be followed by '\0' and resume info, see requestFile()
+		std::string path = getData();
+		Uint32 resumeFileChecksum = 0, resumeBlobChecksum = 0, resumeOffset = 0;
+		std::string::size_type f = path.find( '\0' );
+		if( f != std::string::npos )
+		{
+			if( path.size() >= f + 13 )
+			{
+				memcpy( &resumeFileChecksum, path.data() + f + 1, 4 );
+				memcpy( &resumeBlobChecksum, path.data() + f + 5, 4 );
+				memcpy( &resumeOffset, path.data() + f + 9, 4 );
+				EndianSwap( resumeFileChecksum );
+				EndianSwap( resumeBlobChecksum );
+				EndianSwap( resumeOffset );
+			}
+			path.resize( f );
+		}
+		if( ! isPathValid( path ) )
 		{
-			notes << "CFileDownloaderInGame::processFileRequests(): invalid filename "<< getData() << endl;
+			notes << "CFileDownloaderInGame::processFileRequests(): invalid filename "<< path << endl;
 			return;
 		};
 		struct stat st;
-		if( ! StatFile( getData(), &st ) )
+		if( ! StatFile( path, &st ) )
 		{
-			notes << "CFileDownloaderInGame::processFileRequests(): cannot stat file " << getData() << endl;
+			notes << "CFileDownloaderInGame::processFileRequests(): cannot stat file " << path << endl;
 			return;
 		};
 		if( S_ISREG( st.st_mode ) )
 		{
-			setFileToSend( getData() );
+			setFileToSend( path );
+			if( resumeOffset > 0 && isSendingWindowed() &&
+				resumeBlobChecksum == cSendBlob->blobChecksum &&
+				( resumeFileChecksum == 0 || resumeFileChecksum == cSendBlob->fileChecksum ) &&
+				resumeOffset < cSendBlob->data.size() )
+			{
+				iFirstUnacked = resumeOffset / WindowedChunkSize;
+				for( size_t c = 0; c < iFirstUnacked; c++ )
+					cChunkAcked[c] = true;
+				notes << "CFileDownloaderInGame::processFileRequests(): resuming " << path << " at " << iFirstUnacked * WindowedChunkSize << " bytes" << endl;
+			}
 			return;
 		};
 		if( S_ISDIR( st.st_mode ) )
 		{
-			notes << "CFileDownloaderInGame::processFileRequests(): cannot send dir (wrong request): " << getData() << endl;
+			notes << "CFileDownloaderInGame::processFileRequests(): cannot send dir (wrong request): " << path << endl;
+			return;
+		};
+	};
+	if( sFilename == "DELTA:" )
+	{
+		// path '\0' signature, see requestFile()
+		std::string::size_type f = getData().find( '\0' );
+		const std::string path = getData().substr( 0, f );
+		if( f == std::string::npos || ! isPathValid( path ) )
+		{
+			notes << "CFileDownloaderInGame::processFileRequests(): invalid delta request " << path << endl;
 			return;
 		};
+		struct stat st;
+		if( ! StatFile( path, &st ) || ! S_ISREG( st.st_mode ) )
+		{
+			notes << "CFileDownloaderInGame::processFileRequests(): cannot send delta of " << path << endl;
+			return;
+		};
+		setDeltaToSend( path, getData().substr( f + 1 ) );
+		return;
 	};
 	if( sFilename == "STAT:" )
 	{
@@ -957,8 +1745,8 @@ class StatDirList
 
 std::string getStatPacketOneFile( const std::string & path )
 {
-	size_t checksum, size, compressedSize;
-	if( ! FileChecksum( path, &checksum, &size ) )
+	Uint32 checksum, size, compressedSize;
+	if( ! GetUdpFileChecksum( path, &checksum, &size ) )
 		return "";
 	compressedSize = size + path.size() + 24; // Most files from disk are compressed already, so guessing size
 	EndianSwap( checksum );
@@ -998,6 +1786,8 @@ float CUdpFileDownloader::getFileDownloadingProgress() const
 {
 	if( getState() != S_RECEIVE )
 		return 0.0;
+	if( ! cChunkReceived.empty() )
+		return float(iChunksReceived) / float(cChunkReceived.size());
 	if( cStatInfoCache.find(sLastFileRequested) == cStatInfoCache.end() )
 		return 0.0;
 	float ret = float(sData.size()) / float(cStatInfoCache.find(sLastFileRequested)->second.compressedSize);
@@ -1012,6 +1802,8 @@ size_t CUdpFileDownloader::getFileDownloadingProgressBytes() const
 {
 	if( getState() != S_RECEIVE )
 		return 0;
+	if( ! cChunkReceived.empty() )
+		return MIN( iChunksReceived * WindowedChunkSize, sData.size() );
 	return sData.size();
 };
 
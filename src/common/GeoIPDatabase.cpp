@@ -10,6 +10,7 @@
 
 #include "GeoIPDatabase.h"
 #include "FindFile.h"
+#include "MathLib.h"
 
 //
 // Defines
@@ -195,173 +196,157 @@ GeoRecord& GeoRecord::operator= (const GeoRecord& oth)
 //
 
 
-/////////////////
-// Destructor
-GeoIPDatabase::~GeoIPDatabase()
+////////////////
+// Loads the database, returns false on failure
+bool GeoIPDatabase::load(const std::string& filename)
 {
-	if (m_file)  {
-		fclose(m_file);
-	}
-	if (m_dbSegments)  {
-		delete[] m_dbSegments;
-	}
+	close();
 
-	m_file = NULL;
+	FILE *f = OpenGameFile(filename, "rb");
+	if (!f)
+		return false;
+
+	// Read it all at once, the lookups only walk through the memory then
+	std::string data;
+	char buf[65536];
+	size_t read;
+	while ((read = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.append(buf, read);
+	fclose(f);
+
+	if (!loadFromMemory(data))
+		return false;
+	m_fileName = filename;
+	return true;
 }
 
 ////////////////
-// Loads the database, returns false on failure
-bool GeoIPDatabase::load(const std::string& filename)
+// Uses the given database data, returns false if it is invalid
+bool GeoIPDatabase::loadFromMemory(const std::string& data)
 {
-	m_file = OpenGameFile(filename, "rb");
-	if (!m_file)
+	close();
+	if (data.size() < 6)
 		return false;
 
-	m_fileName = filename;
+	m_data = data;
 	if (!setupSegments())  {
-		fclose(m_file);
+		close();
 		return false;
 	}
 
 	return true;
 }
 
+////////////////
+// Frees the database
+void GeoIPDatabase::close()
+{
+	m_data.clear();
+	m_fileName = "";
+	m_dbSegment = 0;
+	m_dbType = 0;
+	m_recordLength = 0;
+}
+
 /////////////////
 // Reads database segments (private)
-// Requires the database file to be open
+// Requires the database to be loaded
 // Returns true on success, false otherwise
 bool GeoIPDatabase::setupSegments()
 {
-	size_t silence;
-
-	// Cleanup
-	if (m_dbSegments)
-		delete[] m_dbSegments;
-	m_dbSegments = NULL;
+	const unsigned char *data = (const unsigned char *)m_data.data();
+	const long size = (long)m_data.size();
 
 	// Default to GeoIP Country Edition
 	m_dbType = GEOIP_COUNTRY_EDITION;
 	m_recordLength = STANDARD_RECORD_LENGTH;
-	fseek(m_file, -3l, SEEK_END);
-	for (int i = 0; i < STRUCTURE_INFO_MAX_SIZE; i++) {
-		unsigned char delim[3];  // Record delimiter
-		silence = fread(delim, 1, 3, m_file);
-		if (delim[0] == 255 && delim[1] == 255 && delim[2] == 255) {
-			silence = fread(&m_dbType, 1, 1, m_file);
-
-			// Backwards compatibility with databases from April 2003 and earlier
-			if (m_dbType >= 106)
-				m_dbType -= 105;
-
-			if (m_dbType == GEOIP_REGION_EDITION_REV0) {
-				// Region Edition, pre June 2003
-				m_dbSegments = new unsigned int[1];
-				m_dbSegments[0] = STATE_BEGIN_REV0;
-			} else if (m_dbType == GEOIP_REGION_EDITION_REV1) {
-				// Region Edition, post June 2003
-				m_dbSegments = new unsigned int[1];
-				m_dbSegments[0] = STATE_BEGIN_REV1;
-			} else if (m_dbType == GEOIP_CITY_EDITION_REV0 ||
-								 m_dbType == GEOIP_CITY_EDITION_REV1 ||
-								 m_dbType == GEOIP_ORG_EDITION ||
-								 m_dbType == GEOIP_ISP_EDITION ||
-								 m_dbType == GEOIP_ASNUM_EDITION) {
-
-				// City/Org Editions have two segments, read offset of second segment
-				m_dbSegments = new unsigned int[1];
-				m_dbSegments[0] = 0;
-
-				unsigned char buf[SEGMENT_RECORD_LENGTH];
-				silence = fread(buf, SEGMENT_RECORD_LENGTH, 1, m_file);
-				for (int j = 0; j < SEGMENT_RECORD_LENGTH; j++)
-					m_dbSegments[0] += (buf[j] << (j * 8));
-				
-				if (m_dbType == GEOIP_ORG_EDITION || m_dbType == GEOIP_ISP_EDITION)
-					m_recordLength = ORG_RECORD_LENGTH;
-			}
+	m_dbSegment = 0;
+
+	// The structure info is at the end, after a record delimiter
+	long pos = size - 3;
+	for (int i = 0; i < STRUCTURE_INFO_MAX_SIZE && pos >= 0; i++, pos--) {
+		if (data[pos] != 255 || data[pos + 1] != 255 || data[pos + 2] != 255)
+			continue;
+
+		if (pos + 3 >= size)
 			break;
-		} else {
-			fseek(m_file, -4l, SEEK_CUR);
+		m_dbType = data[pos + 3];
+
+		// Backwards compatibility with databases from April 2003 and earlier
+		if (m_dbType >= 106)
+			m_dbType -= 105;
+
+		if (m_dbType == GEOIP_REGION_EDITION_REV0) {
+			// Region Edition, pre June 2003
+			m_dbSegment = STATE_BEGIN_REV0;
+		} else if (m_dbType == GEOIP_REGION_EDITION_REV1) {
+			// Region Edition, post June 2003
+			m_dbSegment = STATE_BEGIN_REV1;
+		} else if (m_dbType == GEOIP_CITY_EDITION_REV0 ||
+							 m_dbType == GEOIP_CITY_EDITION_REV1 ||
+							 m_dbType == GEOIP_ORG_EDITION ||
+							 m_dbType == GEOIP_ISP_EDITION ||
+							 m_dbType == GEOIP_ASNUM_EDITION) {
+
+			// City/Org Editions have two segments, read offset of second segment
+			if (pos + 4 + SEGMENT_RECORD_LENGTH > size)
+				return false;
+			for (int j = 0; j < SEGMENT_RECORD_LENGTH; j++)
+				m_dbSegment += (data[pos + 4 + j] << (j * 8));
+
+			if (m_dbType == GEOIP_ORG_EDITION || m_dbType == GEOIP_ISP_EDITION)
+				m_recordLength = ORG_RECORD_LENGTH;
 		}
+		break;
 	}
 
 	if (m_dbType == GEOIP_COUNTRY_EDITION ||
 			m_dbType == GEOIP_PROXY_EDITION ||
 			m_dbType == GEOIP_NETSPEED_EDITION ||
 			m_dbType == GEOIP_COUNTRY_EDITION_V6 ) {
-		m_dbSegments = new unsigned int[1];
-		m_dbSegments[0] = COUNTRY_BEGIN;
+		m_dbSegment = COUNTRY_BEGIN;
 	}
 
-	return true;
+	return m_dbSegment != 0;
 }
 
 ////////////////
 // Seek a record in the database, returns record index or 0 on failure
 unsigned int GeoIPDatabase::seekRecord(unsigned long ipnum) const
 {
-	if (!m_file)
-		return 0;
-
-	unsigned int x;
-	unsigned char stack_buffer[2 * MAX_RECORD_LENGTH];
-	const unsigned char *buf = stack_buffer;
+	const unsigned char *data = (const unsigned char *)m_data.data();
+	const size_t nodeSize = 2 * m_recordLength;
 	unsigned int offset = 0;
 
-	const unsigned char * p;
-	size_t silence;
-
 	for (int depth = 31; depth >= 0; depth--) {
-		// Read from disk
-		fseek(m_file, (long)m_recordLength * 2 * offset, SEEK_SET);
-		silence = fread(stack_buffer, m_recordLength, 2, m_file);
-
-		if (ipnum & (1 << depth)) {
-			// Take the right-hand branch
-			if (m_recordLength == 3) {
-				// Most common case is completely unrolled and uses constants
-				x =   (buf[3*1 + 0] << (0*8))
-					+ (buf[3*1 + 1] << (1*8))
-					+ (buf[3*1 + 2] << (2*8));
-
-			} else {
-				// General case
-				int j = m_recordLength;
-				p = &buf[2*j];
-				x = 0;
-				do {
-					x <<= 8;
-					x += *(--p);
-				} while (--j);
-			}
+		if ((size_t)offset * nodeSize + nodeSize > m_data.size())
+			break;
 
+		// The left-hand branch is the first record of the node, the right-hand one the second
+		const unsigned char *buf = data + (size_t)offset * nodeSize;
+		if (ipnum & (1UL << depth))
+			buf += m_recordLength;
+
+		unsigned int x;
+		if (m_recordLength == 3) {
+			// Most common case is completely unrolled and uses constants
+			x =   (buf[0] << (0*8))
+				+ (buf[1] << (1*8))
+				+ (buf[2] << (2*8));
 		} else {
-			// Take the left-hand branch
-			if (m_recordLength == 3) {
-				// Most common case is completely unrolled and uses constants
-				x =   (buf[3*0 + 0] << (0*8))
-					+ (buf[3*0 + 1] << (1*8))
-					+ (buf[3*0 + 2] << (2*8));
-			} else {
-				// General case
-				int j = m_recordLength;
-				p = &buf[1*j];
-				x = 0;
-				do {
-					x <<= 8;
-					x += *(--p);
-				} while (--j);
-			}
+			// General case
+			x = 0;
+			for (int j = m_recordLength - 1; j >= 0; j--)
+				x = (x << 8) + buf[j];
 		}
 
-		if (x >= m_dbSegments[0])
+		if (x >= m_dbSegment)
 			return x;
 
 		offset = x;
 	}
 
-	// Shouldn't reach here
-	errors << "Error Traversing Database for ipnum = %lu - Perhaps database is corrupt?" << endl;
+	errors << "Error Traversing Database for ipnum = " << ipnum << " - Perhaps database is corrupt?" << endl;
 	return 0;
 }
 
@@ -371,26 +356,23 @@ GeoRecord GeoIPDatabase::extractRecordCity(unsigned int seekRecord) const
 {
 	GeoRecord record;
 
-	int record_pointer;
-	unsigned char *record_buf = NULL;
-	unsigned char *begin_record_buf = NULL;
-	double latitude = 0, longitude = 0;
-	int metroarea_combo = 0;
-	size_t bytes_read = 0;
-	if (seekRecord == m_dbSegments[0])		
+	if (seekRecord == m_dbSegment)
 		return record;
 
-	record_pointer = seekRecord + (2 * m_recordLength - 1) * m_dbSegments[0];
+	const size_t record_pointer = seekRecord + (size_t)(2 * m_recordLength - 1) * m_dbSegment;
+	if (record_pointer >= m_data.size())
+		return record;
 
-	// Seek to the record
-	fseek(m_file, record_pointer, SEEK_SET);
-	begin_record_buf = record_buf = new unsigned char[FULL_RECORD_LENGTH];
-	bytes_read = fread(record_buf, sizeof(char), FULL_RECORD_LENGTH, m_file);
-	if (bytes_read == 0) {
-		// Eof or other error
-		delete[] begin_record_buf;
+	// Copy the record, the zeros after it terminate the strings of a cut record
+	unsigned char buf[FULL_RECORD_LENGTH * 2];
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, m_data.data() + record_pointer, MIN((size_t)FULL_RECORD_LENGTH, m_data.size() - record_pointer));
+	const unsigned char *record_buf = buf;
+	double latitude = 0, longitude = 0;
+	int metroarea_combo = 0;
+
+	if (record_buf[0] >= GeoIP_country_count)
 		return record;
-	}
 
 	// Get country
 	record.continentCode = GeoIP_country_continent[record_buf[0]];
@@ -436,8 +418,6 @@ GeoRecord GeoIPDatabase::extractRecordCity(unsigned int seekRecord) const
 		}
 	}
 
-	delete[] begin_record_buf;
-
 	record.hasCityLevel = true;
 	fillContinent(record);
 
@@ -494,7 +474,7 @@ GeoRecord GeoIPDatabase::extractRecordCtry(unsigned int seekRecord) const
 
 //////////////////
 // Converts a string IP to MaxMind's representation
-unsigned long GeoIPDatabase::convertIp(const std::string& strAddr) const
+unsigned long GeoIPDatabase::convertIp(const std::string& strAddr)
 {
 	unsigned int    octet;
 	unsigned long   ipnum;
@@ -535,7 +515,7 @@ GeoRecord GeoIPDatabase::lookup(const std::string& ip) const
 {
 	GeoRecord res;
 
-	if (!m_file)
+	if (!loaded())
 		return res;
 
 	// IP check
@@ -550,8 +530,18 @@ GeoRecord GeoIPDatabase::lookup(const std::string& ip) const
 		return res;
 	}
 
+	return lookup(l_ip);
+}
+
+/////////////////
+// Performs a search for the given IP number
+GeoRecord GeoIPDatabase::lookup(unsigned long ipnum) const
+{
+	if (!loaded())
+		return GeoRecord();
+
 	// Find the record
-	int record = seekRecord(l_ip);
+	unsigned int record = seekRecord(ipnum);
 
 	// Get information
 	if (m_dbType == GEOIP_CITY_EDITION_REV0 || m_dbType == GEOIP_CITY_EDITION_REV1)
@@ -560,5 +550,5 @@ GeoRecord GeoIPDatabase::lookup(const std::string& ip) const
 		return extractRecordCtry(record);
 
 	errors << "The Geo IP database has an unsupported format" << endl;
-	return res;
+	return GeoRecord();
 }
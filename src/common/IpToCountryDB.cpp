@@ -12,13 +12,22 @@
 #include "GfxPrimitives.h"
 #include "Unicode.h"
 #include "GeoIPDatabase.h"
+#include "OLXCommand.h"
+#include "StringUtils.h"
 
 const char *IP_TO_COUNTRY_FILE = "GeoIP.dat";
 
-IpToCountryDB::IpToCountryDB(const std::string& dbfile) : m_database(NULL) { LoadDBFile(dbfile); }
+IpToCountryDB::IpToCountryDB() : m_database(NULL), m_cacheHits(0), m_cacheMisses(0) {}
+IpToCountryDB::IpToCountryDB(const std::string& dbfile) : m_database(NULL), m_cacheHits(0), m_cacheMisses(0) { LoadDBFile(dbfile); }
 
 void IpToCountryDB::LoadDBFile(const std::string& dbfile)
 {
+	{
+		Mutex::ScopedLock lock(m_cacheMutex);
+		m_cache.clear();
+		m_cacheIndex.clear();
+	}
+
 	if (m_database)  {
 		delete m_database;
 		m_database = NULL;
@@ -30,19 +39,34 @@ void IpToCountryDB::LoadDBFile(const std::string& dbfile)
 		errors << "Error when loading GeoIP database" << endl;
 }
 
-IpInfo IpToCountryDB::GetInfoAboutIP(const std::string& address)
+void IpToCountryDB::LoadDBData(const std::string& data)
 {
-	IpInfo res;
-	if (!m_database || !m_database->loaded())
-		return res;
+	{
+		Mutex::ScopedLock lock(m_cacheMutex);
+		m_cache.clear();
+		m_cacheIndex.clear();
+	}
 
+	if (m_database)  {
+		delete m_database;
+		m_database = NULL;
+	}
+
+	m_database = new GeoIPDatabase();
+	if (!m_database->loadFromMemory(data))
+		errors << "Error when loading GeoIP database from memory" << endl;
+}
+
+// Addresses which are not looked up in the database, returns true for them
+bool IpToCountryDB::GetSpecialInfo(const std::string& address, IpInfo& res)
+{
 	// Home
 	if (address.find("127.0.0.1") == 0)  {
 		res.countryName = "Home";
 		res.city = "Home City";
 		res.region = "Home Region";
 		res.continent = "Earth";
-		return res;
+		return true;
 	}
 
 	// LAN
@@ -50,18 +74,110 @@ IpInfo IpToCountryDB::GetInfoAboutIP(const std::string& address)
 		res.countryName = "Local Area Network";
 		res.city = "Local City";
 		res.region = "Local Area Network";
-		return res;
+		return true;
+	}
+
+	return false;
+}
+
+bool IpToCountryDB::GetCachedInfo(unsigned long ipnum, IpInfo& info)
+{
+	std::unordered_map<unsigned long, CacheList::iterator>::iterator it = m_cacheIndex.find(ipnum);
+	if (it == m_cacheIndex.end())  {
+		m_cacheMisses++;
+		return false;
+	}
+	m_cacheHits++;
+	m_cache.splice(m_cache.begin(), m_cache, it->second);
+	info = it->second->second;
+	return true;
+}
+
+void IpToCountryDB::AddCachedInfo(unsigned long ipnum, const IpInfo& info)
+{
+	if (m_cacheIndex.find(ipnum) != m_cacheIndex.end())
+		return; // another thread was faster
+	m_cache.push_front(std::make_pair(ipnum, info));
+	m_cacheIndex[ipnum] = m_cache.begin();
+	if (m_cache.size() > MaxCachedIPs)  {
+		m_cacheIndex.erase(m_cache.back().first);
+		m_cache.pop_back();
 	}
+}
 
-	GeoRecord rec = m_database->lookup(address);
+IpInfo IpToCountryDB::LookupInfo(unsigned long ipnum)
+{
+	GeoRecord rec = m_database->lookup(ipnum);
 	if (rec.countryCode == "--" || rec.countryCode == "UN")  // Unknown
+		return IpInfo();
+	return rec;
+}
+
+IpInfo IpToCountryDB::GetInfoAboutIP(const std::string& address)
+{
+	IpInfo res;
+	if (!m_database || !m_database->loaded())
 		return res;
 
-	res = rec;
+	if (GetSpecialInfo(address, res))
+		return res;
+
+	const unsigned long ipnum = GeoIPDatabase::convertIp(address);
+	if (!ipnum)
+		return m_database->lookup(address); // invalid address, it knows what to say
 
+	{
+		Mutex::ScopedLock lock(m_cacheMutex);
+		if (GetCachedInfo(ipnum, res))
+			return res;
+	}
+
+	res = LookupInfo(ipnum);
+
+	Mutex::ScopedLock lock(m_cacheMutex);
+	AddCachedInfo(ipnum, res);
 	return res;
 }
 
+void IpToCountryDB::GetInfoAboutIPs(const std::vector<std::string>& addresses, std::vector<IpInfo>& infos)
+{
+	infos.assign(addresses.size(), IpInfo());
+	if (!m_database || !m_database->loaded())
+		return;
+
+	// First everything we have already, then the database for the rest
+	std::vector<unsigned long> ipnums(addresses.size(), 0);
+	std::vector<size_t> missing;
+	{
+		Mutex::ScopedLock lock(m_cacheMutex);
+		for (size_t i = 0; i < addresses.size(); ++i)  {
+			if (GetSpecialInfo(addresses[i], infos[i]))
+				continue;
+			ipnums[i] = GeoIPDatabase::convertIp(addresses[i]);
+			if (!ipnums[i])
+				infos[i] = m_database->lookup(addresses[i]);
+			else if (!GetCachedInfo(ipnums[i], infos[i]))
+				missing.push_back(i);
+		}
+	}
+
+	if (missing.empty())
+		return;
+	for (size_t i = 0; i < missing.size(); ++i)
+		infos[missing[i]] = LookupInfo(ipnums[missing[i]]);
+
+	Mutex::ScopedLock lock(m_cacheMutex);
+	for (size_t i = 0; i < missing.size(); ++i)
+		AddCachedInfo(ipnums[missing[i]], infos[missing[i]]);
+}
+
+void IpToCountryDB::DumpCacheStats(CmdLineIntf& cli)
+{
+	Mutex::ScopedLock lock(m_cacheMutex);
+	cli.writeMsg("GeoIP cache: " + itoa(m_cache.size()) + "/" + itoa((int)MaxCachedIPs) + " IPs, " +
+				 itoa(m_cacheHits) + " hits, " + itoa(m_cacheMisses) + " misses");
+}
+
 SmartPointer<SDL_Surface> IpToCountryDB::GetCountryFlag(const std::string& shortcut)
 {
 	return LoadGameImage("data/flags/" + shortcut + ".png", true);
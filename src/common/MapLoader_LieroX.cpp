@@ -19,6 +19,7 @@
 #include "Color.h"
 #include "PixelFunctors.h"
 #include "Cache.h"
+#include "TaskScheduler.h"
 #include <zlib.h>
 #ifndef DEDICATED_ONLY
 #include <gd.h>
@@ -322,39 +323,39 @@ class ML_LieroX : public MapLoad {
 		LOCK_OR_QUIT(m->bmpDrawImage);
 		LOCK_OR_QUIT(m->bmpBackImageHiRes);
 		
-		Uint32 curcolor=0;
-		Uint8* curpixel = (Uint8*)m->bmpDrawImage.get()->pixels;
-		Uint8* PixelRow = curpixel;
-		Uint8 bpp = m->bmpDrawImage.get()->format->BytesPerPixel;
+		// Convert both images. The rows are independent, so this is split up over the task scheduler.
+		struct ConvertRows {
+			gdImagePtr gdImage;
+			SDL_Surface* dest;
+			int width;
+			int srcY;
+			void operator()(size_t begin, size_t end) const {
+				Uint8 bpp = dest->format->BytesPerPixel;
+				for (size_t y = begin; y < end; y++)  {
+					Uint8* curpixel = (Uint8*)dest->pixels + y * dest->pitch;
+					for (int x = 0; x < width; x++, curpixel += bpp)  {
+						Uint32 curcolor = gdImageGetTrueColorPixel( gdImage, x, (int)y + srcY ); // Maybe we can make direct memory access, but PNG may be palette-based, and I'm too lazy
+						curcolor = Pack(Color(gdTrueColorGetRed(curcolor), gdTrueColorGetGreen(curcolor), gdTrueColorGetBlue(curcolor)), dest->format);
+						PutPixelToAddr(curpixel, curcolor, bpp);
+					}
+				}
+			}
+		};
 		
 		// Load the front image
-		for (Sint64 y = 0; y < head.height*2; y++, PixelRow += m->bmpDrawImage.get()->pitch)  {
-			curpixel = PixelRow;
-			for (Sint64 x = 0; x < head.width*2; x++, curpixel += bpp)  {
-				curcolor = gdImageGetTrueColorPixel( gdImage, (int)x, (int)y ); // Maybe we can make direct memory access, but PNG may be palette-based, and I'm too lazy
-				curcolor = Pack(Color(gdTrueColorGetRed(curcolor), gdTrueColorGetGreen(curcolor), gdTrueColorGetBlue(curcolor)), m->bmpDrawImage->format);
-				PutPixelToAddr(curpixel, curcolor, bpp);
-			}
-		}
+		ConvertRows front = { gdImage, m->bmpDrawImage.get(), (int)head.width*2, 0 };
+		parallel_for(0, (size_t)head.height*2, 0, front, TaskGroup::P_Background);
 		
-		curpixel = (Uint8*)m->bmpBackImageHiRes.get()->pixels;
-		PixelRow = curpixel;
-		Sint64 HeightX2 = head.height*2;
 		// Load the back image
-		for (Sint64 y = 0; y < head.height*2; y++, PixelRow += m->bmpBackImageHiRes.get()->pitch)  {
-			curpixel = PixelRow;
-			for (Sint64 x = 0; x < head.width*2; x++, curpixel += bpp)  {
-				curcolor = gdImageGetTrueColorPixel( gdImage, (int)x, (int)y + (int)HeightX2 ); // Maybe we can make direct memory access, but PNG may be palette-based, and I'm too lazy
-				curcolor = Pack(Color(gdTrueColorGetRed(curcolor), gdTrueColorGetGreen(curcolor), gdTrueColorGetBlue(curcolor)), m->bmpBackImageHiRes->format);
-				PutPixelToAddr(curpixel, curcolor, bpp);
-			}
-		}
+		ConvertRows back = { gdImage, m->bmpBackImageHiRes.get(), (int)head.width*2, (int)head.height*2 };
+		parallel_for(0, (size_t)head.height*2, 0, back, TaskGroup::P_Background);
 		
 		// Update image according to the pixel flags
 		Uint64 n=0;
 		
-		curpixel = (Uint8 *)m->bmpDrawImage.get()->pixels;
-		PixelRow = curpixel;
+		Uint8 *curpixel = (Uint8 *)m->bmpDrawImage.get()->pixels;
+		Uint8 *PixelRow = curpixel;
+		Uint8 bpp = m->bmpDrawImage.get()->format->BytesPerPixel;
 		Uint8 *backpixel = (Uint8 *)m->bmpBackImageHiRes.get()->pixels;
 		Uint8 *BackPixelRow = backpixel;
 		
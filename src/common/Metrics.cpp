@@ -0,0 +1,555 @@
+/*
+	OpenLieroX
+
+	runtime metrics (counters, gauges, histograms) in the Prometheus text format
+
+	code under LGPL
+*/
+
+#include <map>
+#include <vector>
+#include <set>
+#include <cmath>
+#include <cstdio>
+#include "Metrics.h"
+#include "Mutex.h"
+#include "ThreadPool.h"
+#include "OLXCommand.h"
+#include "StringUtils.h"
+#include "Profiler.h"
+#include "Debug.h"
+#include "MathLib.h"
+
+#ifdef WIN32
+#include <winsock2.h>
+typedef int socklen_t;
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#define closesocket close
+#define INVALID_SOCKET -1
+typedef int SOCKET;
+#endif
+
+
+namespace Metrics {
+
+void Gauge::add(double d) {
+	double old = m_value.load(std::memory_order_relaxed);
+	while(!m_value.compare_exchange_weak(old, old + d, std::memory_order_relaxed)) {}
+}
+
+Histogram::Histogram(const double* bounds, size_t n) : m_numBounds(MIN(n, (size_t)MaxBuckets)), m_count(0), m_sum(0) {
+	for(size_t i = 0; i < m_numBounds; ++i)
+		m_bounds[i] = bounds[i];
+	for(size_t i = 0; i <= MaxBuckets; ++i)
+		m_buckets[i] = 0;
+}
+
+void Histogram::observe(double v) {
+	size_t i = 0;
+	while(i < m_numBounds && v > m_bounds[i]) ++i;
+	m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+	double old = m_sum.load(std::memory_order_relaxed);
+	while(!m_sum.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {}
+}
+
+// ---------- Registry ----------
+
+enum Type { T_COUNTER, T_GAUGE, T_HISTOGRAM };
+static const char* typeNames[] = { "counter", "gauge", "histogram" };
+
+struct Sample {
+	std::string labels;
+	void* metric;
+};
+
+struct Family {
+	Type type;
+	std::string help;
+	std::vector<Sample> samples;
+};
+
+// Metrics are never freed, references to them are kept in static variables all over the code.
+static Mutex registryMutex;
+static std::map<std::string, Family> families;
+
+static void* lookup(const std::string& name, const std::string& help, const std::string& labels, Type type) {
+	std::map<std::string, Family>::iterator f = families.find(name);
+	if(f == families.end()) {
+		Family& fam = families[name];
+		fam.type = type;
+		fam.help = help;
+		return NULL;
+	}
+	if(f->second.type != type) {
+		errors << "Metrics: " << name << " is already registered as " << typeNames[f->second.type] << endl;
+		return NULL;
+	}
+	for(size_t i = 0; i < f->second.samples.size(); ++i)
+		if(f->second.samples[i].labels == labels)
+			return f->second.samples[i].metric;
+	return NULL;
+}
+
+static void add(const std::string& name, const std::string& labels, Type type, void* metric) {
+	Family& fam = families[name];
+	if(fam.type != type) return; // see lookup(), it stays unregistered
+	Sample s;
+	s.labels = labels;
+	s.metric = metric;
+	fam.samples.push_back(s);
+}
+
+Counter& counter(const std::string& name, const std::string& help, const std::string& labels) {
+	Mutex::ScopedLock lock(registryMutex);
+	if(void* m = lookup(name, help, labels, T_COUNTER)) return *(Counter*)m;
+	Counter* c = new Counter();
+	add(name, labels, T_COUNTER, c);
+	return *c;
+}
+
+Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels) {
+	Mutex::ScopedLock lock(registryMutex);
+	if(void* m = lookup(name, help, labels, T_GAUGE)) return *(Gauge*)m;
+	Gauge* g = new Gauge();
+	add(name, labels, T_GAUGE, g);
+	return *g;
+}
+
+Histogram& histogram(const std::string& name, const std::string& help, const double* bounds, size_t numBounds, const std::string& labels) {
+	Mutex::ScopedLock lock(registryMutex);
+	if(void* m = lookup(name, help, labels, T_HISTOGRAM)) return *(Histogram*)m;
+	Histogram* h = new Histogram(bounds, numBounds);
+	add(name, labels, T_HISTOGRAM, h);
+	return *h;
+}
+
+// ---------- Export ----------
+
+static std::string formatValue(double v) {
+	if(v != v) return "NaN";
+	if(std::isinf(v)) return v > 0 ? "+Inf" : "-Inf";
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.10g", v);
+	return buf;
+}
+
+static std::string escapeHelp(const std::string& help) {
+	std::string ret;
+	ret.reserve(help.size());
+	for(size_t i = 0; i < help.size(); ++i) {
+		if(help[i] == '\\') ret += "\\\\";
+		else if(help[i] == '\n') ret += "\\n";
+		else ret += help[i];
+	}
+	return ret;
+}
+
+static std::string withLabels(const std::string& name, const std::string& labels, const std::string& extra = "") {
+	if(labels == "" && extra == "") return name;
+	return name + "{" + labels + ((labels != "" && extra != "") ? "," : "") + extra + "}";
+}
+
+std::string exportText() {
+	std::string out;
+	Mutex::ScopedLock lock(registryMutex);
+	for(std::map<std::string, Family>::const_iterator f = families.begin(); f != families.end(); ++f) {
+		const std::string& name = f->first;
+		if(f->second.samples.empty()) continue;
+		out += "# HELP " + name + " " + escapeHelp(f->second.help) + "\n";
+		out += "# TYPE " + name + " " + typeNames[f->second.type] + "\n";
+		for(size_t i = 0; i < f->second.samples.size(); ++i) {
+			const Sample& s = f->second.samples[i];
+			switch(f->second.type) {
+				case T_COUNTER:
+					out += withLabels(name, s.labels) + " " + itoa(((Counter*)s.metric)->value()) + "\n";
+					break;
+				case T_GAUGE:
+					out += withLabels(name, s.labels) + " " + formatValue(((Gauge*)s.metric)->value()) + "\n";
+					break;
+				case T_HISTOGRAM: {
+					const Histogram& h = *(Histogram*)s.metric;
+					// read the count first, so the buckets are never less than it when updated meanwhile
+					const Uint64 count = h.count();
+					Uint64 cumulative = 0;
+					for(size_t b = 0; b < h.numBounds(); ++b) {
+						cumulative += h.bucket(b);
+						out += withLabels(name + "_bucket", s.labels, "le=\"" + formatValue(h.bound(b)) + "\"") + " " + itoa(cumulative) + "\n";
+					}
+					cumulative += h.bucket(h.numBounds());
+					out += withLabels(name + "_bucket", s.labels, "le=\"+Inf\"") + " " + itoa(MAX(cumulative, count)) + "\n";
+					out += withLabels(name + "_sum", s.labels) + " " + formatValue(h.sum()) + "\n";
+					out += withLabels(name + "_count", s.labels) + " " + itoa(MAX(cumulative, count)) + "\n";
+					break;
+				}
+			}
+		}
+	}
+	return out;
+}
+
+void dump(CmdLineIntf& cli) {
+	const std::string text = exportText();
+	size_t start = 0;
+	while(start < text.size()) {
+		size_t end = text.find('\n', start);
+		if(end == std::string::npos) end = text.size();
+		cli.writeMsg(text.substr(start, end - start));
+		start = end + 1;
+	}
+}
+
+// ---------- Endpoint ----------
+
+// true if sock is readable within timeout ms
+static bool waitReadable(SOCKET sock, int timeout) {
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(sock, &set);
+	timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	return select((int)sock + 1, &set, NULL, NULL, &tv) > 0;
+}
+
+static bool sendAll(SOCKET sock, const std::string& data) {
+	size_t pos = 0;
+	while(pos < data.size()) {
+		int ret = send(sock, data.data() + pos, (int)(data.size() - pos), 0);
+		if(ret <= 0) return false;
+		pos += ret;
+	}
+	return true;
+}
+
+struct Endpoint {
+	std::atomic<bool> quit;
+	SOCKET listenSock;
+	std::string address;
+	std::string unixPath;
+	ThreadPoolItem* thread;
+
+	Endpoint() : quit(false), listenSock(INVALID_SOCKET), thread(NULL) {}
+
+	void serve(SOCKET client) {
+		static Counter& scrapes = counter("olx_metrics_scrapes_total", "Requests answered by the metrics endpoint");
+
+		// we only need the request line
+		std::string request;
+		char buf[1024];
+		while(request.find("\r\n") == std::string::npos && request.find('\n') == std::string::npos && request.size() < 4096) {
+			if(!waitReadable(client, 1000)) break;
+			int ret = recv(client, buf, sizeof(buf), 0);
+			if(ret <= 0) break;
+			request.append(buf, ret);
+		}
+
+		std::string response;
+		if(subStrCaseEqual(request, "GET ", 4) || subStrCaseEqual(request, "HEAD ", 5)) {
+			scrapes.inc();
+			const std::string body = exportText();
+			response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + itoa(body.size()) +
+				"\r\nConnection: close\r\n\r\n";
+			if(!subStrCaseEqual(request, "HEAD ", 5))
+				response += body;
+		}
+		else
+			response = "HTTP/1.0 400 Bad Request\r\nConnection: close\r\n\r\n";
+		sendAll(client, response);
+		closesocket(client);
+	}
+
+	Result run() {
+		while(!quit) {
+			if(!waitReadable(listenSock, 200)) continue;
+			SOCKET client = accept(listenSock, NULL, NULL);
+			if(client == INVALID_SOCKET) continue;
+			serve(client);
+		}
+		return true;
+	}
+
+	struct Runner : Action {
+		Endpoint* endpoint;
+		Runner(Endpoint* e) : endpoint(e) {}
+		Result handle() { return endpoint->run(); }
+	};
+};
+
+static Endpoint endpoint;
+
+static bool openListenSocket(const std::string& where, SOCKET& sock, std::string& address, std::string& unixPath) {
+	if(subStrEqual(where, "unix:", 5)) {
+#ifdef WIN32
+		errors << "Metrics endpoint: Unix domain sockets are not supported here" << endl;
+		return false;
+#else
+		unixPath = where.substr(5);
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		if(unixPath == "" || unixPath.size() >= sizeof(addr.sun_path)) {
+			errors << "Metrics endpoint: invalid socket path " << unixPath << endl;
+			return false;
+		}
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, unixPath.c_str());
+		struct stat st;
+		if(lstat(unixPath.c_str(), &st) == 0) {
+			// only remove a socket from an old run, never some other file (e.g. a typo in the option)
+			if(!S_ISSOCK(st.st_mode)) {
+				errors << "Metrics endpoint: " << unixPath << " exists and is not a socket" << endl;
+				return false;
+			}
+			unlink(unixPath.c_str());
+		}
+		sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(sock == INVALID_SOCKET) return false;
+		if(bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, 8) != 0) {
+			errors << "Metrics endpoint: cannot listen on " << unixPath << endl;
+			closesocket(sock);
+			return false;
+		}
+		address = where;
+		return true;
+#endif
+	}
+
+	bool fail = false;
+	int port = from_string<int>(where, fail);
+	if(fail || port < 0 || port > 65535) {
+		errors << "Metrics endpoint: " << where << " is neither a port nor unix:<path>" << endl;
+		return false;
+	}
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // never reachable from outside
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if(sock == INVALID_SOCKET) return false;
+	int yes = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+	if(bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, 8) != 0) {
+		errors << "Metrics endpoint: cannot listen on 127.0.0.1:" << port << endl;
+		closesocket(sock);
+		return false;
+	}
+	socklen_t len = sizeof(addr);
+	getsockname(sock, (sockaddr*)&addr, &len); // for port 0
+	address = "127.0.0.1:" + itoa(ntohs(addr.sin_port));
+	return true;
+}
+
+bool startEndpoint(const std::string& where) {
+	stopEndpoint();
+	if(where == "" || where == "off") return true;
+
+	if(!openListenSocket(where, endpoint.listenSock, endpoint.address, endpoint.unixPath))
+		return false;
+	endpoint.quit = false;
+	endpoint.thread = threadPool->start(new Endpoint::Runner(&endpoint), "metrics endpoint");
+	notes << "Metrics endpoint on " << endpoint.address << endl;
+	return true;
+}
+
+void stopEndpoint() {
+	if(!endpoint.thread) return;
+	endpoint.quit = true;
+	threadPool->wait(endpoint.thread, NULL);
+	endpoint.thread = NULL;
+	closesocket(endpoint.listenSock);
+	endpoint.listenSock = INVALID_SOCKET;
+#ifndef WIN32
+	if(endpoint.unixPath != "")
+		unlink(endpoint.unixPath.c_str());
+#endif
+	endpoint.unixPath = "";
+	endpoint.address = "";
+}
+
+std::string endpointAddress() {
+	return endpoint.thread ? endpoint.address : "";
+}
+
+// ---------- Checks ----------
+
+static SOCKET connectTo(const std::string& address) {
+#ifndef WIN32
+	if(subStrEqual(address, "unix:", 5)) {
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, address.c_str() + 5, sizeof(addr.sun_path) - 1);
+		SOCKET sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(sock != INVALID_SOCKET && connect(sock, (sockaddr*)&addr, sizeof(addr)) != 0) {
+			closesocket(sock);
+			return INVALID_SOCKET;
+		}
+		return sock;
+	}
+#endif
+	const size_t colon = address.rfind(':');
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)from_string<int>(address.substr(colon + 1)));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+	if(sock != INVALID_SOCKET && connect(sock, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		closesocket(sock);
+		return INVALID_SOCKET;
+	}
+	return sock;
+}
+
+// sample lines of the export, "name{labels}" -> value
+static void parseSamples(const std::string& text, std::map<std::string, std::string>& samples, size_t& families) {
+	size_t start = 0;
+	families = 0;
+	while(start < text.size()) {
+		size_t end = text.find('\n', start);
+		if(end == std::string::npos) end = text.size();
+		const std::string line = text.substr(start, end - start);
+		start = end + 1;
+		if(line == "") continue;
+		if(line[0] == '#') {
+			if(subStrEqual(line, "# TYPE ", 7)) families++;
+			continue;
+		}
+		const size_t space = line.rfind(' ');
+		if(space == std::string::npos) continue;
+		samples[line.substr(0, space)] = line.substr(space + 1);
+	}
+}
+
+void checkEndpoint(CmdLineIntf& cli) {
+	const bool started = endpointAddress() == "";
+	if(started && !startEndpoint("0")) {
+		cli.writeMsg("cannot start the metrics endpoint", CNC_ERROR);
+		return;
+	}
+	const std::string address = endpointAddress();
+
+	std::string response;
+	SOCKET sock = connectTo(address);
+	if(sock == INVALID_SOCKET)
+		cli.writeMsg("cannot connect to " + address, CNC_ERROR);
+	else {
+		sendAll(sock, "GET /metrics HTTP/1.0\r\n\r\n");
+		char buf[4096];
+		while(waitReadable(sock, 2000)) {
+			int ret = recv(sock, buf, sizeof(buf), 0);
+			if(ret <= 0) break;
+			response.append(buf, ret);
+		}
+		closesocket(sock);
+	}
+	const std::string local = exportText();
+	if(started) stopEndpoint();
+	if(sock == INVALID_SOCKET) return;
+
+	const size_t bodyStart = response.find("\r\n\r\n");
+	if(!subStrEqual(response, "HTTP/1.0 200", 12) || bodyStart == std::string::npos) {
+		cli.writeMsg("bad response from " + address + ": " + response.substr(0, response.find('\r')), CNC_ERROR);
+		return;
+	}
+
+	std::map<std::string, std::string> scraped, expected;
+	size_t scrapedFamilies = 0, expectedFamilies = 0;
+	parseSamples(response.substr(bodyStart + 4), scraped, scrapedFamilies);
+	parseSamples(local, expected, expectedFamilies);
+
+	int problems = 0;
+	for(std::map<std::string, std::string>::iterator i = scraped.begin(); i != scraped.end(); ++i) {
+		bool fail = false;
+		if(i->second != "NaN" && i->second != "+Inf" && i->second != "-Inf")
+			from_string<double>(i->second, fail);
+		if(fail) {
+			cli.writeMsg("invalid value: " + i->first + " " + i->second, CNC_ERROR);
+			problems++;
+		}
+		else if(expected.find(i->first) == expected.end()) {
+			cli.writeMsg("unknown sample: " + i->first, CNC_ERROR);
+			problems++;
+		}
+	}
+	for(std::map<std::string, std::string>::iterator i = expected.begin(); i != expected.end(); ++i)
+		if(scraped.find(i->first) == scraped.end() && i->first != "olx_metrics_scrapes_total") {
+			cli.writeMsg("missing sample: " + i->first, CNC_ERROR);
+			problems++;
+		}
+
+	cli.writeMsg("read " + itoa(scraped.size()) + " samples of " + itoa(scrapedFamilies) + " metrics from " + address +
+				 (started ? " (started for the check)" : ""));
+	if(problems == 0)
+		cli.writeMsg("the endpoint matches the registry");
+}
+
+// ---------- Benchmark ----------
+
+namespace {
+	struct ContendedIncrements : Action {
+		Counter* counter;
+		int ops;
+		ContendedIncrements(Counter* c, int n) : counter(c), ops(n) {}
+		Result handle() {
+			for(int i = 0; i < ops; ++i) counter->inc();
+			return true;
+		}
+	};
+}
+
+void benchmark(CmdLineIntf& cli, int ops) {
+	// unregistered, so they don't show up in the export
+	Counter c;
+	Gauge g;
+	static const double bounds[] = { 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1 };
+	Histogram h(bounds, sizeof(bounds) / sizeof(bounds[0]));
+
+	Uint64 start = Profiler::getTicks();
+	for(int i = 0; i < ops; ++i) c.inc();
+	const float incNs = float(Profiler::getTicks() - start) * 1000.0f / ops;
+
+	start = Profiler::getTicks();
+	for(int i = 0; i < ops; ++i) g.set(i);
+	const float setNs = float(Profiler::getTicks() - start) * 1000.0f / ops;
+
+	start = Profiler::getTicks();
+	for(int i = 0; i < ops; ++i) h.observe((i % 100) * 0.001);
+	const float observeNs = float(Profiler::getTicks() - start) * 1000.0f / ops;
+
+	enum { Threads = 4 };
+	Counter shared;
+	std::vector<ThreadPoolItem*> threads;
+	start = Profiler::getTicks();
+	for(int t = 0; t < Threads; ++t)
+		threads.push_back(threadPool->start(new ContendedIncrements(&shared, ops), "metrics benchmark"));
+	for(size_t t = 0; t < threads.size(); ++t)
+		threadPool->wait(threads[t], NULL);
+	const float contendedNs = float(Profiler::getTicks() - start) * 1000.0f / ops;
+
+	start = Profiler::getTicks();
+	const std::string text = exportText();
+	const Uint64 exportTime = Profiler::getTicks() - start;
+
+	cli.writeMsg("counter inc " + ftoa(incNs) + " ns, gauge set " + ftoa(setNs) + " ns, histogram observe " + ftoa(observeNs) + " ns");
+	cli.writeMsg(itoa(Threads) + " threads on one counter: " + ftoa(contendedNs) + " ns per round of " + itoa(Threads) + " incs" +
+				 (shared.value() == (Uint64)ops * Threads ? "" : " (LOST INCREMENTS)"));
+	cli.writeMsg("export: " + itoa(text.size()) + " bytes in " + itoa(exportTime) + " us (on the endpoint thread)");
+
+	// 32 players at 100 FPS: per frame about one packet in and out per client, packets and bytes
+	// counted for each, the frame histogram, and the per client gauges once per second
+	const float frameNs = 32 * 2 * 2 * incNs + observeNs + (32 * 3 + 4) * setNs / 100;
+	cli.writeMsg("estimate for 32 players at 100 FPS: " + ftoa(frameNs / 1000.0f) + " us per 10 ms frame (" +
+				 ftoa(frameNs / 10000000.0f * 100.0f) + "%)");
+}
+
+}
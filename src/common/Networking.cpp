@@ -35,6 +35,7 @@
 #include "TaskManager.h"
 #include "ReadWriteLock.h"
 #include "Mutex.h"
+#include "Metrics.h"
 
 
 
@@ -955,6 +956,13 @@ int NetworkSocket::Write(const void* buffer, int nbytes) {
 		errors << "WriteSocket: Could not send the packet, network buffers are full." << endl;
 	}*/
 
+	static Metrics::Counter& packetsOut = Metrics::counter("olx_net_packets_total", "UDP packets sent and received", "dir=\"out\"");
+	static Metrics::Counter& bytesOut = Metrics::counter("olx_net_bytes_total", "Bytes sent and received over UDP and TCP", "dir=\"out\"");
+	if(ret > 0) {
+		bytesOut.inc(ret);
+		if(m_type != NST_TCP) packetsOut.inc();
+	}
+
 	return ret;
 }
 
@@ -981,6 +989,13 @@ int NetworkSocket::Read(void* buffer, int nbytes) {
 		return NL_INVALID;
 	}
 
+	static Metrics::Counter& packetsIn = Metrics::counter("olx_net_packets_total", "UDP packets sent and received", "dir=\"in\"");
+	static Metrics::Counter& bytesIn = Metrics::counter("olx_net_bytes_total", "Bytes sent and received over UDP and TCP", "dir=\"in\"");
+	if(ret > 0) {
+		bytesIn.inc(ret);
+		if(m_type != NST_TCP) packetsIn.inc();
+	}
+
 	return ret;
 }
 
@@ -113,7 +113,7 @@ AbsTime ReCalculationTimeMs;
 TimeDiff PingTimeMs = TimeDiff(250);	// Send at least one packet in 10 ms - 10 packets per second, huge net load
 // TODO: calculate DrawDelayMs from other client pings
 // TimeDiff DrawDelayMs = TimeDiff(100);	// Not used currently // Delay the drawing until all packets are received, otherwise worms will teleport
-TimeDiff ReCalculationMinimumTimeMs = TimeDiff(150);	// Re-calculate not faster than 7.5 times per second - eats CPU
+TimeDiff ReCalculationMinimumTimeMs = TimeDiff(0);	// Re-calculate on every frame, terrain snapshots only copy the changed tiles now
 TimeDiff CalculateChecksumTime = TimeDiff(10000); // Calculate checksum once per 10 seconds - should be equal for all clients
 
 int NumPlayers = -1;
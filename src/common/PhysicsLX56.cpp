@@ -38,6 +38,8 @@
 #include "sound/SoundsBase.h"
 #include "game/Sounds.h"
 #include "game/Game.h"
+#include "OLXCommand.h"
+#include "Profiler.h"
 
 
 // defined in PhysicsLX56_Projectiles
@@ -68,12 +70,55 @@ static float getNinjaropePrecision() {
 
 static bool m_inited = false;
 
+// The lobby settings of the worm simulation. They don't change during a physics frame,
+// so they are read once per frame and not again for every worm and every sub-step.
+struct WormPhysicsSettings {
+	bool valid;
+	AbsTime time;
+	bool wrapAround, gusanosWormPhysics, relativeAirJump, jumpToAimDir;
+	float groundSpeed, airSpeed, maxGroundMoveSpeed, maxAirMoveSpeed;
+	float jumpForce, relativeAirJumpDelay, airFriction, gravity, friction, groundFriction, groundStopSpeed;
+	// only for checkWormSteps: probe the terrain pixel by pixel like before, no sparkles and sounds
+	bool perPixelProbes, quiet;
+	WormPhysicsSettings() : valid(false), perPixelProbes(false), quiet(false) {}
+
+	void load() {
+		const EngineSettings& lobby = cClient->getGameLobby();
+		wrapAround = lobby[FT_InfiniteMap];
+		gusanosWormPhysics = lobby[FT_GusanosWormPhysics];
+		relativeAirJump = lobby[FT_RelativeAirJump];
+		jumpToAimDir = lobby[FT_JumpToAimDir];
+		groundSpeed = lobby[FT_WormGroundSpeed];
+		airSpeed = lobby[FT_WormAirSpeed];
+		maxGroundMoveSpeed = lobby[FT_WormMaxGroundMoveSpeed];
+		maxAirMoveSpeed = lobby[FT_WormMaxAirMoveSpeed];
+		jumpForce = lobby[FT_WormJumpForce];
+		relativeAirJumpDelay = lobby[FT_RelativeAirJumpDelay];
+		airFriction = lobby[FT_WormAirFriction];
+		gravity = lobby[FT_WormGravity];
+		friction = lobby[FT_WormFriction];
+		groundFriction = lobby[FT_WormGroundFriction];
+		groundStopSpeed = lobby[FT_WormGroundStopSpeed];
+	}
+};
+
+static WormPhysicsSettings wormSettings;
+
+static const WormPhysicsSettings& getWormPhysicsSettings() {
+	if(!wormSettings.valid || wormSettings.time != GetPhysicsTime()) {
+		wormSettings.load();
+		wormSettings.time = GetPhysicsTime();
+		wormSettings.valid = true;
+	}
+	return wormSettings;
+}
+
 // ---------
 
 std::string PhysicsEngine::name() { return "LX56 physics"; }
 
-void PhysicsEngine::initGame() { m_inited = true; }
-void PhysicsEngine::uninitGame() { m_inited = false; }
+void PhysicsEngine::initGame() { m_inited = true; wormSettings.valid = false; }
+void PhysicsEngine::uninitGame() { m_inited = false; wormSettings.valid = false; }
 bool PhysicsEngine::isInitialised() { return m_inited; }
 
 
@@ -83,9 +128,19 @@ static void simulateWormWeapon(float dt, CWorm* worm);
 // -----------------------------
 // ------ worm -----------------
 
+// The terrain probes as moveAndCheckWormCollision did them before it fetched whole rows,
+// one lookup per pixel. checkWormSteps compares the worm movement against it.
+static void getPixelFlagsPerPixel(int x, int y, int dx, int dy, int n, uchar* flags, bool wrapAround) {
+	for(int i = 0; i < n; ++i) {
+		int posx = x + i * dx; if(wrapAround) { posx %= (int)game.gameMap()->GetWidth(); if(posx < 0) posx += game.gameMap()->GetWidth(); }
+		int posy = y + i * dy; if(wrapAround) { posy %= (int)game.gameMap()->GetHeight(); if(posy < 0) posy += game.gameMap()->GetHeight(); }
+		flags[i] = game.gameMap()->GetPixelFlag(posx, posy);
+	}
+}
+
 // Check collisions with the level
 // HINT: it directly manipulates vPos!
-static bool moveAndCheckWormCollision(AbsTime currentTime, float dt, CWorm* worm, CVec pos, CVec *vel, CVec vOldPos, bool jump ) {
+static bool moveAndCheckWormCollision(const WormPhysicsSettings& settings, float dt, CWorm* worm, CVec pos, CVec *vel, CVec vOldPos, bool jump ) {
 	static const int maxspeed2 = 10; // this should not be too high as we could run out of the game.gameMap() without checking else
 
 	// Can happen when starting a game
@@ -101,11 +156,11 @@ static bool moveAndCheckWormCollision(AbsTime currentTime, float dt, CWorm* worm
 	// though perhaps it is as with higher speed the way we have to check is longer
 	if( (*vel * dt * worm->speedFactor()).GetLength2() > maxspeed2 && dt > 0.001f ) {
 		dt /= 2;
-		if(moveAndCheckWormCollision(currentTime, dt,worm,pos,vel,vOldPos,jump)) return true;
-		return moveAndCheckWormCollision(currentTime, dt,worm,worm->getPos(),vel,vOldPos,jump);
+		if(moveAndCheckWormCollision(settings, dt,worm,pos,vel,vOldPos,jump)) return true;
+		return moveAndCheckWormCollision(settings, dt,worm,worm->getPos(),vel,vOldPos,jump);
 	}
 
-	bool wrapAround = cClient->getGameLobby()[FT_InfiniteMap];
+	const bool wrapAround = settings.wrapAround;
 	pos += *vel * dt * worm->speedFactor();
 	if(wrapAround) {
 		FMOD(pos.x, (float)game.gameMap()->GetWidth());
@@ -120,8 +175,14 @@ static bool moveAndCheckWormCollision(AbsTime currentTime, float dt, CWorm* worm
 	bool coll = false;
 
 	if(y >= 0 && (uint)y < game.gameMap()->GetHeight()) {
+		// the flags of the row from x-3 to x+3, fetched at once
+		uchar rowFlags[7];
+		if(settings.perPixelProbes)
+			getPixelFlagsPerPixel((int)pos.x - 3, y, 1, 0, 7, rowFlags, wrapAround);
+		else
+			game.gameMap()->GetPixelFlagRow((int)pos.x - 3, y, 7, rowFlags, wrapAround);
+
 		for(x=-3;x<4;x++) {
-			// Optimize: pixelflag++
 
 			// Left side clipping
 			if(!wrapAround && (pos.x+x <= 2)) {
@@ -147,8 +208,7 @@ static bool moveAndCheckWormCollision(AbsTime currentTime, float dt, CWorm* worm
 				continue; // Note: This was break in LX56, but continue is really better here
 			}
 
-			int posx = (int)pos.x + x; if(wrapAround) { posx %= (int)game.gameMap()->GetWidth(); if(posx < 0) posx += game.gameMap()->GetWidth(); }
-			if(!(game.gameMap()->GetPixelFlag(posx,y) & PX_EMPTY)) {
+			if(!(rowFlags[x + 3] & PX_EMPTY)) {
 				coll = true;
 
 				// NOTE: Be carefull that you don't do any float->int->float conversions here.
@@ -182,8 +242,14 @@ static bool moveAndCheckWormCollision(AbsTime currentTime, float dt, CWorm* worm
 	x = (int)pos.x;
 
 	if(x >= 0 && (uint)x < game.gameMap()->GetWidth()) {
+		// the flags of the column from y-4 to y+5
+		uchar columnFlags[10];
+		if(settings.perPixelProbes)
+			getPixelFlagsPerPixel(x, (int)pos.y - 4, 0, 1, 10, columnFlags, wrapAround);
+		else
+			game.gameMap()->GetPixelFlagColumn(x, (int)pos.y - 4, 10, columnFlags, wrapAround);
+
 		for(y=5;y>-5;y--) {
-			// Optimize: pixelflag + Width
 
 			// Top side clipping
 			if(!wrapAround && (pos.y+y <= 1)) {
@@ -212,8 +278,7 @@ static bool moveAndCheckWormCollision(AbsTime currentTime, float dt, CWorm* worm
 				continue; // Note: This was break in LX56, but continue is really better here
 			}
 
-			int posy = (int)pos.y + y; if(wrapAround) { posy %= (int)game.gameMap()->GetHeight(); if(posy < 0) posy += game.gameMap()->GetHeight(); }
-			if(!(game.gameMap()->GetPixelFlag(x,posy) & PX_EMPTY)) {
+			if(!(columnFlags[y + 4] & PX_EMPTY)) {
 				coll = true;
 
 				if(!hit && !jump) {
@@ -257,7 +322,7 @@ static bool moveAndCheckWormCollision(AbsTime currentTime, float dt, CWorm* worm
 	}
 
 	// If we collided with the ground and we were going pretty fast, make a bump sound
-	if(coll) {
+	if(coll && !settings.quiet) {
 		if( fabs(vel->x) > 30 && (clip & 0x01 || clip & 0x02) )
 			StartSound( sfxGame.smpBump, worm->pos(), worm->getLocal(), -1 );
 		else if( fabs(vel->y) > 30 && (clip & 0x04 || clip & 0x08) )
@@ -268,6 +333,100 @@ static bool moveAndCheckWormCollision(AbsTime currentTime, float dt, CWorm* worm
 }
 
 
+// The LX56 worm movement: walking, jumping, drag, gravity, friction and the terrain collision.
+static void simulateWormMovement(const WormPhysicsSettings& settings, float dt, CWorm* worm, const worm_state_t& ws) {
+	// Process the moving
+	if(ws.bMove) {
+		const bool onGround = worm->isOnGround();
+		const float speed = onGround ? settings.groundSpeed : settings.airSpeed;
+		const float maxspeed = onGround ? settings.maxGroundMoveSpeed : settings.maxAirMoveSpeed;
+
+		if(worm->getMoveDirectionSide() == DIR_RIGHT) {
+			// Right
+			if(worm->velocity().get().x < maxspeed)
+				worm->velocity().write().x += speed * dt * 90.0f;
+		} else {
+			// Left
+			if(worm->velocity().get().x > -maxspeed)
+				worm->velocity().write().x -= speed * dt * 90.0f;
+		}
+	}
+
+
+	// Process the jump
+	bool jumped = false;
+	{
+		const bool onGround = worm->CheckOnGround();
+		const float jumpForce = settings.jumpForce;
+
+		if( onGround )
+			worm->setLastAirJumpTime(AbsTime());
+		if(ws.bJump && ( onGround || worm->canAirJump() ||
+			( settings.relativeAirJump && GetPhysicsTime() >
+				worm->getLastAirJumpTime() + settings.relativeAirJumpDelay ) ))
+		{
+			if( onGround )
+				worm->velocity().write().y = jumpForce;
+			else {
+				// GFX effect, as in TeeWorlds (we'll change velocity after that)
+				if(!settings.quiet) {
+					SpawnEntity(ENT_SPARKLE, 10, worm->getPos() + CVec( 0, 4 ), worm->velocity() + CVec( 0, 40 ), Color(), NULL );
+					SpawnEntity(ENT_SPARKLE, 10, worm->getPos() + CVec( 2, 4 ), worm->velocity() + CVec( 20, 40 ), Color(), NULL );
+					SpawnEntity(ENT_SPARKLE, 10, worm->getPos() + CVec( -2, 4 ), worm->velocity() + CVec( -20, 40 ), Color(), NULL );
+				}
+
+				if( !settings.jumpToAimDir && worm->canAirJump() && worm->velocity().get().y > jumpForce ) // Negative Y coord = moving up
+					worm->velocity().write().y = jumpForce; // Absolute velocity - instant air jump
+				else {
+					CVec dir = settings.jumpToAimDir ? -worm->getFaceDirection() : CVec(0.0f,1.0f);
+					worm->velocity() += dir * jumpForce; // Relative velocity - relative air jump
+				}
+			}
+			worm->setLastAirJumpTime(GetPhysicsTime());
+			worm->setOnGround( false );
+			jumped = true;
+		}
+	}
+
+	{
+		// Air drag (Mainly to dampen the ninja rope)
+		const float Drag = settings.airFriction;
+
+		if(!worm->isOnGround())	{
+			worm->velocity().write().x -= SQR(worm->velocity().get().x) * SIGN(worm->velocity().get().x) * Drag * dt;
+			worm->velocity().write().y += -SQR(worm->velocity().get().y) * SIGN(worm->velocity().get().y) * Drag * dt;
+		}
+	}
+
+	// Gravity
+	worm->velocity().write().y += settings.gravity * dt;
+
+	{
+		const float friction = settings.friction;
+		if(friction > 0) {
+			static const float wormSize = 5.0f;
+			static const float wormMass = (wormSize/2) * (wormSize/2) * (float)PI;
+			static const float wormDragCoeff = 0.1f; // Note: Never ever change this! (Or we have to make this configureable)
+			applyFriction(worm->velocity().write(), dt, wormSize, wormMass, wormDragCoeff, friction);
+		}
+	}
+
+
+	// Check collisions and move
+	moveAndCheckWormCollision( settings, dt, worm, worm->getPos(), &worm->velocity().write(), worm->getPos(), jumped );
+
+
+	// Ultimate in friction
+	if(worm->isOnGround()) {
+		worm->velocity().write().x *= 1.0f - settings.groundFriction;
+
+		// Too slow, just stop
+		if(fabs(worm->velocity().get().x) < settings.groundStopSpeed && !ws.bMove)
+			worm->velocity().write().x = 0;
+	}
+}
+
+
 void PhysicsEngine::simulateWorm(CWorm* worm, bool local) {
 	if(game.gameScript()->gusEngineUsed()) return;
 
@@ -351,94 +510,9 @@ void PhysicsEngine::simulateWorm(CWorm* worm, bool local) {
 		worm->velocity() += worm->getNinjaRope()->GetForce() * dt;
 	}
 
-	if(!(bool)cClient->getGameLobby()[FT_GusanosWormPhysics]) {
-		// Process the moving
-		if(ws->bMove) {
-			const bool onGround = worm->isOnGround();
-			const float speed = onGround ? (float)cClient->getGameLobby()[FT_WormGroundSpeed] : (float)cClient->getGameLobby()[FT_WormAirSpeed];
-			const float maxspeed = onGround ? (float)cClient->getGameLobby()[FT_WormMaxGroundMoveSpeed] : (float)cClient->getGameLobby()[FT_WormMaxAirMoveSpeed];
-
-			if(worm->getMoveDirectionSide() == DIR_RIGHT) {
-				// Right
-				if(worm->velocity().get().x < maxspeed)
-					worm->velocity().write().x += speed * dt * 90.0f;
-			} else {
-				// Left
-				if(worm->velocity().get().x > -maxspeed)
-					worm->velocity().write().x -= speed * dt * 90.0f;
-			}
-		}
-
-
-		// Process the jump
-		bool jumped = false;
-		{
-			const bool onGround = worm->CheckOnGround();
-			const float jumpForce = cClient->getGameLobby()[FT_WormJumpForce];
-
-			if( onGround )
-				worm->setLastAirJumpTime(AbsTime());
-			if(ws->bJump && ( onGround || worm->canAirJump() ||
-				( bool(cClient->getGameLobby()[FT_RelativeAirJump]) && GetPhysicsTime() >
-					worm->getLastAirJumpTime() + float( cClient->getGameLobby()[FT_RelativeAirJumpDelay] ) ) ))
-			{
-				if( onGround )
-					worm->velocity().write().y = jumpForce;
-				else {
-					// GFX effect, as in TeeWorlds (we'll change velocity after that)
-					SpawnEntity(ENT_SPARKLE, 10, worm->getPos() + CVec( 0, 4 ), worm->velocity() + CVec( 0, 40 ), Color(), NULL );
-					SpawnEntity(ENT_SPARKLE, 10, worm->getPos() + CVec( 2, 4 ), worm->velocity() + CVec( 20, 40 ), Color(), NULL );
-					SpawnEntity(ENT_SPARKLE, 10, worm->getPos() + CVec( -2, 4 ), worm->velocity() + CVec( -20, 40 ), Color(), NULL );
-
-					if( !(bool)cClient->getGameLobby()[FT_JumpToAimDir] && worm->canAirJump() && worm->velocity().get().y > jumpForce ) // Negative Y coord = moving up
-						worm->velocity().write().y = jumpForce; // Absolute velocity - instant air jump
-					else {
-						CVec dir = (bool)cClient->getGameLobby()[FT_JumpToAimDir] ? -worm->getFaceDirection() : CVec(0.0f,1.0f);
-						worm->velocity() += dir * jumpForce; // Relative velocity - relative air jump
-					}
-				}
-				worm->setLastAirJumpTime(GetPhysicsTime());
-				worm->setOnGround( false );
-				jumped = true;
-			}
-		}
-
-		{
-			// Air drag (Mainly to dampen the ninja rope)
-			const float Drag = cClient->getGameLobby()[FT_WormAirFriction];
-
-			if(!worm->isOnGround())	{
-				worm->velocity().write().x -= SQR(worm->velocity().get().x) * SIGN(worm->velocity().get().x) * Drag * dt;
-				worm->velocity().write().y += -SQR(worm->velocity().get().y) * SIGN(worm->velocity().get().y) * Drag * dt;
-			}
-		}
-
-		// Gravity
-		worm->velocity().write().y += (float)cClient->getGameLobby()[FT_WormGravity] * dt;
-
-		{
-			const float friction = cClient->getGameLobby()[FT_WormFriction];
-			if(friction > 0) {
-				static const float wormSize = 5.0f;
-				static const float wormMass = (wormSize/2) * (wormSize/2) * (float)PI;
-				static const float wormDragCoeff = 0.1f; // Note: Never ever change this! (Or we have to make this configureable)
-				applyFriction(worm->velocity().write(), dt, wormSize, wormMass, wormDragCoeff, friction);
-			}
-		}
-
-
-		// Check collisions and move
-		moveAndCheckWormCollision( GetPhysicsTime(), dt, worm, worm->getPos(), &worm->velocity().write(), worm->getPos(), jumped );
-
-
-		// Ultimate in friction
-		if(worm->isOnGround()) {
-			worm->velocity().write().x *= 1.0f - float(cClient->getGameLobby()[FT_WormGroundFriction]);
-
-			// Too slow, just stop
-			if(fabs(worm->velocity().get().x) < (float)cClient->getGameLobby()[FT_WormGroundStopSpeed] && !ws->bMove)
-				worm->velocity().write().x = 0;
-		}
+	const WormPhysicsSettings& settings = getWormPhysicsSettings();
+	if(!settings.gusanosWormPhysics) {
+		simulateWormMovement(settings, dt, worm, *ws);
 	}
 
 	// Gusanos worm physics
@@ -467,6 +541,82 @@ void PhysicsEngine::simulateWorm(CWorm* worm, bool local) {
 	worm->posRecordings.push_back(worm->getPos());
 }
 
+void PhysicsEngine::checkWormSteps(CmdLineIntf& cli, int steps) {
+	if(!game.gameMap() || !game.gameScript() || game.gameScript()->gusEngineUsed()) {
+		cli.writeMsg("no LX56 game is running", CNC_ERROR);
+		return;
+	}
+	WormPhysicsSettings settings;
+	settings.load();
+	settings.quiet = true;
+	if(settings.gusanosWormPhysics) {
+		cli.writeMsg("the worms use the Gusanos worm physics", CNC_ERROR);
+		return;
+	}
+	WormPhysicsSettings perPixel = settings;
+	perPixel.perPixelProbes = true;
+
+	const float dt = LX56PhysicsDT.seconds();
+	size_t runs = 0, mismatches = 0;
+	Uint64 times[2] = { 0, 0 };
+	for_each_iterator(CWorm*, w_, game.aliveWorms()) {
+		CWorm* worm = w_->get();
+		const CVec startPos = worm->getPos(), startVel = worm->velocity().get();
+		const bool startOnGround = worm->isOnGround();
+		const AbsTime startAirJumpTime = worm->getLastAirJumpTime();
+
+		// the current velocity, and slow and fast ones in all directions; the fast ones split the collision step
+		for(int v = 0; v < 17; ++v) {
+			const float angle = v * (float)PI / 8;
+			const CVec vel = (v == 0) ? startVel : CVec(cosf(angle), sinf(angle)) * ((v % 2) ? 60.0f : 400.0f);
+			for(int input = 0; input < 4; ++input) {
+				worm_state_t ws = worm->tState.get();
+				ws.bMove = (input & 1) != 0;
+				ws.bJump = (input & 2) != 0;
+
+				CVec pos[2], endVel[2];
+				bool onGround[2];
+				for(int variant = 0; variant < 2; ++variant) {
+					worm->pos() = startPos;
+					worm->velocity() = vel;
+					worm->setOnGround(startOnGround);
+					worm->setLastAirJumpTime(startAirJumpTime);
+					const Uint64 start = Profiler::getTicks();
+					for(int i = 0; i < steps; ++i)
+						simulateWormMovement(variant ? perPixel : settings, dt, worm, ws);
+					times[variant] += Profiler::getTicks() - start;
+					pos[variant] = worm->getPos();
+					endVel[variant] = worm->velocity().get();
+					onGround[variant] = worm->isOnGround();
+				}
+				runs++;
+				if(pos[0] != pos[1] || endVel[0] != endVel[1] || onGround[0] != onGround[1]) {
+					if(mismatches == 0)
+						cli.writeMsg("worm " + itoa(worm->getID()) + " ends at " + ftoa(pos[0].x) + "," + ftoa(pos[0].y) +
+									 " but at " + ftoa(pos[1].x) + "," + ftoa(pos[1].y) + " with per-pixel probes", CNC_ERROR);
+					mismatches++;
+				}
+			}
+		}
+
+		worm->pos() = startPos;
+		worm->velocity() = startVel;
+		worm->setOnGround(startOnGround);
+		worm->setLastAirJumpTime(startAirJumpTime);
+	}
+
+	if(runs == 0) {
+		cli.writeMsg("no worm is alive", CNC_ERROR);
+		return;
+	}
+	cli.writeMsg(itoa(runs) + " worm movements of " + itoa(steps) + " steps: by row/column " + itoa(times[0]) +
+				 " us, per pixel " + itoa(times[1]) + " us");
+	if(mismatches > 0)
+		cli.writeMsg(itoa(mismatches) + " movements end in a different position, velocity or ground contact", CNC_ERROR);
+	else
+		cli.writeMsg("all movements are the same");
+}
+
 static void simulateWormWeapon(float dt, CWorm* worm) {
 	if(worm->tWeapons.size() == 0) return;
 
@@ -39,6 +39,7 @@
 #include <WeaponDesc.h>
 #include "sound/SoundsBase.h"
 #include "game/Game.h"
+#include "Profiler.h"
 
 #ifdef __MINGW32_VERSION
 // TODO: ugly hack, fix it - mingw stdlib seems to be broken
@@ -1385,6 +1386,7 @@ finalMapPosIndexUpdate:
 
 
 void LX56_simulateProjectiles(Iterator<CProjectile*>::Ref projs) {
+	PROFILE_ZONE("LX56_simulateProjectiles");
 	// Note: This function can be called with any FPS -
 	// LX56_simulateProjectile will handle its own internal FPS
 	// via CProjectile::fLastSimulationTime.
@@ -0,0 +1,216 @@
+/*
+	OpenLieroX
+
+	frame profiler with scoped zones
+
+	code under LGPL
+*/
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include "Profiler.h"
+#include "Mutex.h"
+#include "ThreadPool.h"
+#include "OLXCommand.h"
+#include "FindFile.h"
+#include "Debug.h"
+#include "LieroX.h"
+#include "MathLib.h"
+
+
+namespace Profiler {
+
+bool enabled = false;
+
+static const size_t ZonesPerThread = 1 << 16;
+static const Uint64 SummaryInterval = 10 * 1000 * 1000; // 10 s, for dedicated servers
+
+struct Zone {
+	const char* name;
+	Uint64 start;
+	Uint32 duration;
+	Uint32 depth;
+};
+
+struct ThreadBuffer {
+	std::string threadName;
+	size_t index; // used as tid in the trace
+	Uint32 depth;
+	std::atomic<Uint64> written; // only written by the owning thread
+	Zone zones[ZonesPerThread];
+	ThreadBuffer() : index(0), depth(0), written(0) {}
+};
+
+// Buffers are never freed. Only a handful of threads ever record zones
+// and a thread may exit while we export its buffer.
+static Mutex buffersMutex;
+static std::vector<ThreadBuffer*> buffers;
+static THREAD_LOCAL ThreadBuffer* curThreadBuffer = NULL;
+// zones started before this are ignored (clear() doesn't touch the buffers to stay lock-free)
+static std::atomic<Uint64> clearTicks(0);
+static Uint64 lastSummaryTicks = 0;
+
+ThreadBuffer* getThreadBuffer() {
+	if(curThreadBuffer) return curThreadBuffer;
+	ThreadBuffer* buf = new ThreadBuffer();
+	buf->threadName = getCurThreadName();
+	Mutex::ScopedLock lock(buffersMutex);
+	buf->index = buffers.size();
+	buffers.push_back(buf);
+	curThreadBuffer = buf;
+	return buf;
+}
+
+Uint64 getTicks() {
+	static const double factor = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+	return (Uint64)((double)SDL_GetPerformanceCounter() * factor);
+}
+
+void start() {
+	lastSummaryTicks = getTicks();
+	enabled = true;
+}
+
+void stop() {
+	enabled = false;
+}
+
+void clear() {
+	clearTicks = getTicks();
+}
+
+template<typename _Handler>
+static void forEachZone(_Handler& handler, Uint64 sinceTicks) {
+	sinceTicks = MAX(sinceTicks, clearTicks.load());
+	Mutex::ScopedLock lock(buffersMutex);
+	for(size_t i = 0; i < buffers.size(); ++i) {
+		ThreadBuffer* buf = buffers[i];
+		// The owning thread might continue writing. We only lose the oldest zones then.
+		Uint64 end = buf->written.load(std::memory_order_acquire);
+		Uint64 begin = (end > ZonesPerThread) ? (end - ZonesPerThread) : 0;
+		for(Uint64 z = begin; z < end; ++z) {
+			const Zone& zone = buf->zones[z % ZonesPerThread];
+			if(zone.start < sinceTicks) continue;
+			handler(*buf, zone);
+		}
+	}
+}
+
+static void writeJsonString(FILE* f, const char* str) {
+	fputc('"', f);
+	for(; *str; ++str) {
+		if(*str == '"' || *str == '\\') fputc('\\', f);
+		if((unsigned char)*str < 0x20) continue;
+		fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+bool exportChromeTrace(const std::string& filename) {
+	FILE* f = OpenGameFile(filename, "w");
+	if(!f) {
+		errors << "Profiler: cannot open " << filename << " for writing" << endl;
+		return false;
+	}
+
+	struct Writer {
+		FILE* f;
+		bool first;
+		void sep() { if(!first) fputs(",\n", f); first = false; }
+		void operator()(const ThreadBuffer& buf, const Zone& zone) {
+			sep();
+			fputs("{\"name\":", f);
+			writeJsonString(f, zone.name);
+			fprintf(f, ",\"cat\":\"olx\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%u}",
+					(unsigned int)buf.index, (unsigned long long)zone.start, (unsigned int)zone.duration);
+		}
+	} writer;
+	writer.f = f;
+	writer.first = true;
+
+	fputs("{\"traceEvents\":[\n", f);
+	{
+		Mutex::ScopedLock lock(buffersMutex);
+		for(size_t i = 0; i < buffers.size(); ++i) {
+			writer.sep();
+			fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", (unsigned int)buffers[i]->index);
+			writeJsonString(f, buffers[i]->threadName.c_str());
+			fputs("}}", f);
+		}
+	}
+	forEachZone(writer, 0);
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f);
+	fclose(f);
+	return true;
+}
+
+void collectZoneStats(ZoneStats& stats, Uint64 sinceTicks) {
+	struct Collector {
+		ZoneStats& stats;
+		Collector(ZoneStats& s) : stats(s) {}
+		void operator()(const ThreadBuffer&, const Zone& zone) {
+			ZoneStat& s = stats[zone.name];
+			s.total += zone.duration;
+			s.max = MAX(s.max, zone.duration);
+			s.calls++;
+		}
+	} collector(stats);
+	forEachZone(collector, sinceTicks);
+}
+
+void printTopZones(CmdLineIntf& cli, size_t count, Uint64 sinceTicks) {
+	ZoneStats stats;
+	collectZoneStats(stats, sinceTicks);
+
+	typedef std::pair<Uint64, const char*> Entry;
+	std::vector<Entry> sorted;
+	sorted.reserve(stats.size());
+	for(ZoneStats::iterator i = stats.begin(); i != stats.end(); ++i)
+		sorted.push_back(Entry(i->second.total, i->first));
+	std::sort(sorted.rbegin(), sorted.rend());
+
+	if(sorted.empty()) {
+		cli.writeMsg("no profiler zones recorded");
+		return;
+	}
+	for(size_t i = 0; i < sorted.size() && i < count; ++i) {
+		const ZoneStat& s = stats[sorted[i].second];
+		cli.writeMsg(std::string(sorted[i].second) + ": " + ftoa(s.total / 1000.0f) + " ms total, " +
+					 itoa(s.calls) + " calls, " + itoa(s.calls ? Uint32(s.total / s.calls) : 0) + " us avg, " +
+					 itoa(s.max) + " us max");
+	}
+}
+
+void frame() {
+	if(LIKELY(!enabled) || !bDedicated) return;
+	Uint64 now = getTicks();
+	if(now - lastSummaryTicks < SummaryInterval) return;
+	hints << "Profiler: top zones of the last " << ((now - lastSummaryTicks) / 1000000) << " seconds:" << endl;
+	printTopZones(stdoutCLI(), 10, lastSummaryTicks);
+	lastSummaryTicks = now;
+}
+
+}
+
+
+void ProfileZone::begin(const char* n) {
+	name = n;
+	buffer = Profiler::getThreadBuffer();
+	buffer->depth++;
+	startTicks = Profiler::getTicks();
+}
+
+void ProfileZone::end() {
+	Uint64 endTicks = Profiler::getTicks();
+	buffer->depth--;
+	Uint64 i = buffer->written.load(std::memory_order_relaxed);
+	Profiler::Zone& zone = buffer->zones[i % Profiler::ZonesPerThread];
+	zone.name = name;
+	zone.start = startTicks;
+	zone.duration = (Uint32)MIN(endTicks - startTicks, (Uint64)0xffffffff);
+	zone.depth = buffer->depth;
+	buffer->written.store(i + 1, std::memory_order_release);
+}
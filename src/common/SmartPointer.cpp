@@ -9,7 +9,41 @@
 
 #include "SmartPointer.h"
 
-#ifdef DEBUG
-SDL_mutex *SmartPointer_CollMutex = NULL;
-std::map< void *, SDL_mutex * > * SmartPointer_CollisionDetector = NULL;
+#ifdef SMARTPOINTER_COLLDETECT
+#include <set>
+#include <cstdio>
+#include <cstdlib>
+
+// Both are intentionally never freed: SmartPointers of global objects are
+// released during static deinit, when most other things are already gone.
+static SDL_mutex* collDetectMutex() {
+	static SDL_mutex* mutex = SDL_CreateMutex();
+	return mutex;
+}
+
+static std::set<void*>& collDetectObjs() {
+	static std::set<void*>* objs = new std::set<void*>();
+	return *objs;
+}
+
+void SmartPointer_CollDetect_Register(void* obj) {
+	SDL_mutexP(collDetectMutex());
+	bool collision = !collDetectObjs().insert(obj).second;
+	SDL_mutexV(collDetectMutex());
+	if(collision) {
+		// no logging system here, we might be in static init
+		printf("ERROR! SmartPointer collision detected, %p is already owned by another SmartPointer\n", obj);
+		assert(false);
+	}
+}
+
+void SmartPointer_CollDetect_Unregister(void* obj) {
+	SDL_mutexP(collDetectMutex());
+	bool found = collDetectObjs().erase(obj) > 0;
+	SDL_mutexV(collDetectMutex());
+	if(!found) {
+		printf("ERROR! SmartPointer already deleted reference %p\n", obj);
+		assert(false);
+	}
+}
 #endif
@@ -12,6 +12,8 @@
 #include "Debug.h"
 #include "ReadWriteLock.h"
 #include "OLXCommand.h"
+#include "TaskScheduler.h"
+#include <boost/bind.hpp>
 
 TaskManager* taskManager = NULL;
 
@@ -80,6 +82,11 @@ TaskManager::~TaskManager() {
 }
 
 
+static void runSchedulerTask(Action* handler) {
+	handler->handle();
+	delete handler;
+}
+
 void TaskManager::start(Task* t, QueueType queue) {
 	Mutex::ScopedLock tlock(*t->mutex);
 	ScopedLock lock(mutex);
@@ -105,6 +112,10 @@ void TaskManager::start(Task* t, QueueType queue) {
 		queue = QT_NoQueue;
 	}
 	
+	// without workers, the scheduler would run it right here, with our locks held
+	if(queue == QT_Scheduler && (!taskScheduler || taskScheduler->workerCount() == 0))
+		queue = QT_GlobalQueue;
+	
 	runningTasks.insert(t);
 	
 	struct TaskHandler : Action {
@@ -157,6 +168,9 @@ void TaskManager::start(Task* t, QueueType queue) {
 	if(queue == QT_NoQueue) {
 		t->state = Task::TS_WAITFORIMMSTART;
 		threadPool->start(handler, t->name + " handler", true);
+	} else if(queue == QT_Scheduler) {
+		t->state = Task::TS_QUEUED;
+		taskScheduler->spawn(boost::bind(&runSchedulerTask, handler), TaskGroup::P_Background);
 	} else {
 		t->state = Task::TS_QUEUED;
 		queuedTasks.push_back(handler);
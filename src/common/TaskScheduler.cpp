@@ -0,0 +1,301 @@
+/*
+ *  TaskScheduler.cpp
+ *  OpenLieroX
+ *
+ *  work-stealing scheduler for short engine tasks
+ *
+ *  code under LGPL
+ *
+ */
+
+#include <deque>
+#include <vector>
+#include <SDL.h>
+#include <boost/bind.hpp>
+#include "TaskScheduler.h"
+#include "ThreadPool.h"
+#include "Mutex.h"
+#include "Condition.h"
+#include "Debug.h"
+#include "OLXCommand.h"
+#include "StringUtils.h"
+#include "CodeAttributes.h"
+#include "util/macros.h"
+
+
+namespace {
+
+struct TaskItem {
+	TaskScheduler::Func func;
+	TaskGroup* group;
+	TaskItem() : group(NULL) {}
+	TaskItem(const TaskScheduler::Func& f, TaskGroup* g) : func(f), group(g) {}
+};
+
+// Deques are short and only contended by thieves, a plain mutex per deque is good enough.
+struct TaskDeque {
+	mutable Mutex mutex;
+	std::deque<TaskItem> items;
+
+	void pushBack(const TaskItem& t) { Mutex::ScopedLock lock(mutex); items.push_back(t); }
+	bool popBack(TaskItem& t) {
+		Mutex::ScopedLock lock(mutex);
+		if(items.empty()) return false;
+		t = items.back();
+		items.pop_back();
+		return true;
+	}
+	bool popFront(TaskItem& t) {
+		Mutex::ScopedLock lock(mutex);
+		if(items.empty()) return false;
+		t = items.front();
+		items.pop_front();
+		return true;
+	}
+	size_t size() const { Mutex::ScopedLock lock(mutex); return items.size(); }
+};
+
+struct Worker {
+	TaskDeque deques[TaskGroup::P_Count];
+	ThreadPoolItem* thread;
+	std::atomic<Uint64> executed;
+	std::atomic<Uint64> steals;
+	Worker() : thread(NULL), executed(0), steals(0) {}
+};
+
+}
+
+struct TaskSchedulerIntern {
+	std::vector<Worker*> workers;
+	TaskDeque injected[TaskGroup::P_Count]; // from non-worker threads
+	std::atomic<int> queued; // over all deques
+	std::atomic<int> sleeping;
+	std::atomic<bool> quit;
+	Mutex idleMutex;
+	Condition idleCond;
+	Mutex groupMutex;
+	Condition groupFinished;
+	std::atomic<Uint64> executedExternal; // by waiting non-worker threads
+
+	static THREAD_LOCAL TaskSchedulerIntern* curScheduler;
+	static THREAD_LOCAL Worker* curWorker;
+
+	TaskSchedulerIntern() : queued(0), sleeping(0), quit(false), executedExternal(0) {}
+
+	void push(const TaskItem& t, TaskGroup::Priority p) {
+		if(t.group) t.group->pending.fetch_add(1, std::memory_order_relaxed);
+		if(curScheduler == this && curWorker)
+			curWorker->deques[p].pushBack(t);
+		else
+			injected[p].pushBack(t);
+		queued.fetch_add(1);
+		// seq_cst pairs with the sleeping/queued check in workerLoop, so no wakeup gets lost
+		if(sleeping.load() > 0) {
+			Mutex::ScopedLock lock(idleMutex);
+			idleCond.signal();
+		}
+	}
+
+	bool take(Worker* self, int maxPriority, TaskItem& t) {
+		if(queued.load(std::memory_order_acquire) <= 0) return false;
+		for(int p = 0; p <= maxPriority; ++p) {
+			if(self && self->deques[p].popBack(t)) return taken();
+			if(injected[p].popFront(t)) return taken();
+			// steal, starting at our right neighbour so that not all thieves go for the same victim
+			size_t start = 0;
+			for(size_t i = 0; i < workers.size(); ++i)
+				if(workers[i] == self) { start = i + 1; break; }
+			for(size_t i = 0; i < workers.size(); ++i) {
+				Worker* victim = workers[(start + i) % workers.size()];
+				if(victim == self) continue;
+				if(victim->deques[p].popFront(t)) {
+					if(self) self->steals.fetch_add(1, std::memory_order_relaxed);
+					return taken();
+				}
+			}
+		}
+		return false;
+	}
+
+	bool taken() { queued.fetch_sub(1, std::memory_order_relaxed); return true; }
+
+	void run(TaskItem& t, Worker* self) {
+		t.func();
+		if(self) self->executed.fetch_add(1, std::memory_order_relaxed);
+		else executedExternal.fetch_add(1, std::memory_order_relaxed);
+		if(t.group && t.group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			Mutex::ScopedLock lock(groupMutex);
+			groupFinished.broadcast();
+		}
+	}
+
+	void wait(TaskGroup& group) {
+		Worker* self = (curScheduler == this) ? curWorker : NULL;
+		while(!group.done()) {
+			TaskItem t;
+			if(take(self, group.priority, t)) {
+				run(t, self);
+				continue;
+			}
+			// Nothing we may help with. The timeout is for tasks which are spawned meanwhile.
+			Mutex::ScopedLock lock(groupMutex);
+			if(!group.done())
+				groupFinished.wait(groupMutex, 1);
+		}
+	}
+
+	Result workerLoop(Worker* self) {
+		curScheduler = this;
+		curWorker = self;
+		while(true) {
+			TaskItem t;
+			if(take(self, TaskGroup::P_Count - 1, t)) {
+				run(t, self);
+				continue;
+			}
+			Mutex::ScopedLock lock(idleMutex);
+			sleeping.fetch_add(1);
+			while(queued.load() <= 0 && !quit)
+				idleCond.wait(idleMutex);
+			sleeping.fetch_sub(1);
+			if(quit && queued.load() <= 0) break;
+		}
+		curScheduler = NULL;
+		curWorker = NULL;
+		return true;
+	}
+};
+
+THREAD_LOCAL TaskSchedulerIntern* TaskSchedulerIntern::curScheduler = NULL;
+THREAD_LOCAL Worker* TaskSchedulerIntern::curWorker = NULL;
+
+
+void TaskGroup::wait() {
+	if(done()) return;
+	if(!taskScheduler) {
+		errors << "TaskGroup::wait: no task scheduler but tasks are pending" << endl;
+		return;
+	}
+	taskScheduler->data->wait(*this);
+}
+
+
+TaskScheduler::TaskScheduler(unsigned int workers) {
+	data = new TaskSchedulerIntern();
+	notes << "TaskScheduler: starting " << workers << " workers ..." << endl;
+	for(unsigned int i = 0; i < workers; ++i)
+		data->workers.push_back(new Worker());
+	// start them after all exist, they steal from each other
+	for(unsigned int i = 0; i < workers; ++i)
+		data->workers[i]->thread = threadPool->start(
+			boost::bind(&TaskSchedulerIntern::workerLoop, data, data->workers[i]),
+			"task scheduler worker " + itoa(i));
+}
+
+TaskScheduler::~TaskScheduler() {
+	{
+		Mutex::ScopedLock lock(data->idleMutex);
+		data->quit = true;
+		data->idleCond.broadcast();
+	}
+	foreach(w, data->workers) {
+		threadPool->wait((*w)->thread);
+	}
+	// without workers (or if someone spawned while we were stopping), run the rest here
+	TaskItem t;
+	while(data->take(NULL, TaskGroup::P_Count - 1, t))
+		data->run(t, NULL);
+	foreach(w, data->workers) {
+		delete *w;
+	}
+	delete data;
+	data = NULL;
+}
+
+unsigned int TaskScheduler::workerCount() const {
+	return (unsigned int)data->workers.size();
+}
+
+void TaskScheduler::spawn(const Func& f, TaskGroup* group) {
+	if(data->workers.empty() || data->quit) {
+		// SINGLETHREADED or shutting down
+		f();
+		return;
+	}
+	data->push(TaskItem(f, group), group ? group->getPriority() : TaskGroup::P_Background);
+}
+
+void TaskScheduler::spawn(const Func& f, TaskGroup::Priority p) {
+	if(data->workers.empty() || data->quit) {
+		f();
+		return;
+	}
+	data->push(TaskItem(f, NULL), p);
+}
+
+void TaskScheduler::parallel_for(size_t begin, size_t end, size_t grain, const RangeFunc& body, TaskGroup::Priority p) {
+	if(begin >= end) return;
+	const size_t n = end - begin;
+	if(grain == 0)
+		// a few chunks per thread, so that stealing can even out uneven chunks
+		grain = MAX(n / ((data->workers.size() + 1) * 4), (size_t)1);
+	if(data->workers.empty() || grain >= n) {
+		body(begin, end);
+		return;
+	}
+
+	TaskGroup group(p);
+	// the first chunk is done by ourself
+	for(size_t i = begin + grain; i < end; i += grain)
+		spawn(boost::bind(body, i, MIN(i + grain, end)), &group);
+	body(begin, begin + grain);
+	data->wait(group);
+}
+
+void TaskScheduler::dumpState(CmdLineIntf& cli) const {
+	static const char* prioNames[TaskGroup::P_Count] = { "latency-critical", "background" };
+	cli.writeMsg("scheduler: " + itoa(data->workers.size()) + " workers, " +
+				 itoa(data->queued.load()) + " queued tasks, " +
+				 itoa(data->sleeping.load()) + " sleeping, " +
+				 itoa(data->executedExternal.load()) + " tasks run by waiting threads");
+	for(int p = 0; p < TaskGroup::P_Count; ++p)
+		cli.writeMsg(std::string("global queue ") + prioNames[p] + ": " + itoa(data->injected[p].size()));
+	for(size_t i = 0; i < data->workers.size(); ++i) {
+		const Worker* w = data->workers[i];
+		cli.writeMsg("worker " + itoa(i) + ": queue " +
+					 itoa(w->deques[TaskGroup::P_LatencyCritical].size()) + " latency-critical, " +
+					 itoa(w->deques[TaskGroup::P_Background].size()) + " background; " +
+					 itoa(w->executed.load()) + " executed, " + itoa(w->steals.load()) + " stolen");
+	}
+}
+
+
+TaskScheduler* taskScheduler = NULL;
+
+void InitTaskScheduler() {
+	if(taskScheduler) {
+		errors << "TaskScheduler inited twice" << endl;
+		return;
+	}
+#ifdef SINGLETHREADED
+	unsigned int workers = 0;
+#else
+	// the main thread (or whoever waits) also works on the tasks
+	unsigned int workers = (unsigned int)MAX(SDL_GetCPUCount() - 1, 1);
+#endif
+	taskScheduler = new TaskScheduler(workers);
+}
+
+void UnInitTaskScheduler() {
+	if(taskScheduler) {
+		delete taskScheduler;
+		taskScheduler = NULL;
+	}
+}
+
+void parallel_for(size_t begin, size_t end, size_t grain, const TaskScheduler::RangeFunc& body, TaskGroup::Priority p) {
+	if(taskScheduler)
+		taskScheduler->parallel_for(begin, end, grain, body, p);
+	else if(begin < end)
+		body(begin, end);
+}
@@ -8,6 +8,7 @@
  */
 
 #include <SDL_thread.h>
+#include <SDL.h>
 #include "ThreadPool.h"
 #include "Debug.h"
 #include "AuxLib.h"
@@ -273,6 +274,13 @@ void ThreadPool::getAllWorkingThreads(std::map<ThreadId, std::string>& threads)
 ThreadPool* threadPool = NULL;
 
 void InitThreadPool(unsigned int size) {
+	if(size == 0) {
+		// The pool is for the long-living threads (main loop, timers, logging, socket checkers, ...)
+		// and for work which blocks. Short work goes to the TaskScheduler, whose workers (one per
+		// core) live in the pool as well. If more threads block at once, the pool grows.
+		const int cpus = SDL_GetCPUCount();
+		size = 24 + (unsigned int)(cpus > 0 ? cpus : 1);
+	}
 #ifdef SINGLETHREADED
 	size = 0;
 #endif
@@ -26,6 +26,7 @@
 #include "Debug.h"
 #include "InputEvents.h"
 #include "game/Game.h"
+#include "MathLib.h"
 
 
 TimeCounter timeCounter;
@@ -145,66 +146,267 @@ struct TimerData {
 	Uint32				interval;
 	bool				once;
 	bool				quitSignal;
-	SDL_cond*			quitCond;
 	SDL_mutex*			mutex;
-	ThreadPoolItem*		thread;
+
+	// owned by the timer service, protected by its mutex
+	bool				scheduled;
+	Uint64				expires; // in ms of the service clock
+	TimerData*			prev;
+	TimerData*			next;
+	TimerData**			slot; // the list head in the wheel
 	
-	TimerData() : timer(NULL), userData(NULL), interval(0), once(false), quitSignal(false), quitCond(NULL), mutex(NULL), thread(NULL) {
+	TimerData() : timer(NULL), userData(NULL), interval(0), once(false), quitSignal(false), mutex(NULL),
+	scheduled(false), expires(0), prev(NULL), next(NULL), slot(NULL) {
 		mutex = SDL_CreateMutex();
-		quitCond = SDL_CreateCond();
 		// TODO: not threadsafe
 		//timers.push_back(data); // Add it to the global timer array
 	}
 	~TimerData() {
-		breakThread();
-		if(thread) threadPool->wait(thread, NULL); thread = NULL;
+		cancel();
 		SDL_DestroyMutex(mutex); mutex = NULL;
-		SDL_DestroyCond(quitCond); quitCond = NULL;
 		RemoveTimerFromGlobalList(this);
 	}
 	
-	void breakThread() {
-		ScopedLock lock(mutex);
-		quitSignal = true;
-		SDL_CondSignal(quitCond);
+	void cancel();
+	void schedule();
+};
+
+
+/*
+	Timer service
+
+	All running timers share one thread. It keeps them in a hierarchical
+	timing wheel with millisecond ticks: 4 levels of 64 slots each, so level L
+	covers delays up to 64^(L+1) ms (about 4.6 hours for the last level;
+	longer timers are clamped and rescheduled when they come up).
+	Every slot is an intrusive doubly linked list, so scheduling and
+	cancelling a timer is O(1). When the lower bits of the wheel clock wrap,
+	the matching slot of the next level is cascaded down.
+
+	The thread sleeps until the next non-empty slot comes up, so an idle
+	server with a few long timers barely wakes up at all.
+*/
+
+namespace {
+
+enum {
+	WheelBits = 6,
+	WheelSize = 1 << WheelBits,
+	WheelMask = WheelSize - 1,
+	WheelLevels = 4,
+};
+static const Uint64 WheelMaxDelay = ((Uint64)1 << (WheelBits * WheelLevels)) - 1;
+
+struct TimerService {
+	SDL_mutex* mutex;
+	SDL_cond* wakeup;
+	ThreadPoolItem* thread;
+	bool quit;
+
+	TimerData* slots[WheelLevels][WheelSize];
+	Uint64 wheelTime; // the ms up to (including) which we have processed everything
+	Uint32 lastTicks;
+	Uint64 clock; // monotonic ms, SDL_GetTicks() without wraparound
+	size_t timerCount;
+	size_t wakeups;
+
+	TimerService() : mutex(NULL), wakeup(NULL), thread(NULL), quit(false), wheelTime(0), lastTicks(0), clock(0), timerCount(0), wakeups(0) {
+		for(int l = 0; l < WheelLevels; ++l)
+			for(int i = 0; i < WheelSize; ++i)
+				slots[l][i] = NULL;
 	}
 
-	void startThread() {
-		assert(thread == NULL);
-		
-		struct TimerHandler : Action {
-			TimerData* data;
-			
-			// thread function
-			Result handle() {
-	
-				SDL_mutexP(data->mutex);
-				while(true) {
-					SDL_CondWaitTimeout(data->quitCond, data->mutex, data->interval);
-					
-					bool lastEvent = data->once || data->quitSignal || game.state == Game::S_Quit;
-					onInternTimerSignal.pushToMainQueue(InternTimerEventData(data, lastEvent));
-	
-					if(lastEvent) {
-						SDL_mutexV(data->mutex);
-						// we have to return it here to ensure that this callback is never called again
-						// we also have to ensure that there is only *one* event with lastEvent=true
-						// (and this event has to be of course the last event for this timer in the queue)
-						return true;
-					}
+	Uint64 now() {
+		Uint32 ticks = SDL_GetTicks();
+		clock += (Uint32)(ticks - lastTicks);
+		lastTicks = ticks;
+		return clock;
+	}
+
+	void link(TimerData* t) {
+		// clamp too long delays, see fire()
+		const Uint64 expires = MIN(t->expires, wheelTime + WheelMaxDelay);
+		const Uint64 delta = (expires > wheelTime) ? (expires - wheelTime) : 0;
+		int level = 0;
+		while(level < WheelLevels - 1 && delta >= ((Uint64)1 << (WheelBits * (level + 1))))
+			level++;
+		TimerData*& head = slots[level][(expires >> (WheelBits * level)) & WheelMask];
+		t->prev = NULL;
+		t->next = head;
+		t->slot = &head;
+		if(head) head->prev = t;
+		head = t;
+	}
+
+	void unlink(TimerData* t) {
+		if(t->prev)
+			t->prev->next = t->next;
+		else
+			*t->slot = t->next;
+		if(t->next) t->next->prev = t->prev;
+		t->prev = t->next = NULL;
+		t->slot = NULL;
+	}
+
+	// The ms at which the next non-empty slot is processed, or (Uint64)-1.
+	Uint64 nextEventTime() const {
+		Uint64 best = (Uint64)-1;
+		for(int k = 1; k <= WheelSize; ++k)
+			if(slots[0][(wheelTime + k) & WheelMask]) { best = wheelTime + k; break; }
+		for(int l = 1; l < WheelLevels; ++l) {
+			const int shift = WheelBits * l;
+			for(int k = 1; k <= WheelSize; ++k) {
+				const Uint64 block = (wheelTime >> shift) + k;
+				if(slots[l][block & WheelMask]) {
+					best = MIN(best, block << shift);
+					break;
 				}
-		
-				return "should not happen";
 			}
-		
-			TimerHandler(TimerData* d) : data(d) {}
-		};
-		
-		thread = threadPool->start(new TimerHandler(this), name + " timer");
+		}
+		return best;
+	}
+
+	void cascade(int level) {
+		TimerData* t = slots[level][(wheelTime >> (WheelBits * level)) & WheelMask];
+		slots[level][(wheelTime >> (WheelBits * level)) & WheelMask] = NULL;
+		while(t) {
+			TimerData* next = t->next;
+			link(t);
+			t = next;
+		}
+	}
+
+	void fire(TimerData* t) {
+		if(t->expires > wheelTime) { // was clamped
+			link(t);
+			return;
+		}
+		const bool lastEvent = t->once || game.state == Game::S_Quit;
+		onInternTimerSignal.pushToMainQueue(InternTimerEventData(t, lastEvent));
+		if(lastEvent) {
+			// we have to ensure that there is only *one* event with lastEvent=true
+			// (and this event has to be of course the last event for this timer in the queue)
+			t->scheduled = false;
+			timerCount--;
+			return;
+		}
+		t->expires = wheelTime + MAX(t->interval, (Uint32)1);
+		link(t);
+	}
+
+	// process everything up to the current time
+	void advance() {
+		const Uint64 target = now();
+		while(true) {
+			const Uint64 next = nextEventTime();
+			if(next > target) {
+				// all slots until then are empty, nothing to cascade
+				wheelTime = MAX(wheelTime, target);
+				return;
+			}
+			wheelTime = next;
+			for(int l = 1; l < WheelLevels; ++l) {
+				if((wheelTime & (((Uint64)1 << (WheelBits * l)) - 1)) != 0) break;
+				cascade(l);
+			}
+			TimerData* t = slots[0][wheelTime & WheelMask];
+			slots[0][wheelTime & WheelMask] = NULL;
+			while(t) {
+				TimerData* next = t->next;
+				t->prev = t->next = NULL;
+				t->slot = NULL;
+				fire(t);
+				t = next;
+			}
+		}
+	}
+
+	Result run() {
+		ScopedLock lock(mutex);
+		while(!quit) {
+			advance();
+			const Uint64 next = nextEventTime();
+			const Uint64 cur = now();
+			if(next == (Uint64)-1)
+				SDL_CondWait(wakeup, mutex);
+			else if(next > cur)
+				SDL_CondWaitTimeout(wakeup, mutex, (Uint32)MIN(next - cur, (Uint64)0xffffffff));
+			wakeups++;
+		}
+		return true;
+	}
+
+	struct Runner : Action {
+		TimerService* service;
+		Runner(TimerService* s) : service(s) {}
+		Result handle() { return service->run(); }
+	};
+
+	void init() {
+		if(mutex) return;
+		mutex = SDL_CreateMutex();
+		wakeup = SDL_CreateCond();
+		lastTicks = SDL_GetTicks();
+		wheelTime = clock;
+	}
+
+	void add(TimerData* t) {
+		ScopedLock lock(mutex);
+		if(!thread) {
+			quit = false;
+			thread = threadPool->start(new Runner(this), "timer service");
+		}
+		// The wheel clock may lag behind if the thread sleeps, base on the current time.
+		t->expires = MAX(now(), wheelTime) + MAX(t->interval, (Uint32)1);
+		t->scheduled = true;
+		timerCount++;
+		link(t);
+		SDL_CondSignal(wakeup);
+	}
+
+	void remove(TimerData* t) {
+		if(!mutex) return;
+		ScopedLock lock(mutex);
+		if(!t->scheduled) return;
+		unlink(t);
+		t->scheduled = false;
+		timerCount--;
+		// this is the last event, it's handled in the main thread and deletes t
+		onInternTimerSignal.pushToMainQueue(InternTimerEventData(t, true));
+	}
+
+	void shutdown() {
+		if(!mutex) return;
+		SDL_mutexP(mutex);
+		quit = true;
+		SDL_CondSignal(wakeup);
+		ThreadPoolItem* t = thread;
+		thread = NULL;
+		SDL_mutexV(mutex);
+		if(t) threadPool->wait(t, NULL);
+		if(timerCount > 0)
+			warnings << "ShutdownTimers: " << timerCount << " timers are still running" << endl;
+		notes << "timer service: " << wakeups << " wakeups" << endl;
+		wakeups = 0;
 	}
-	
 };
 
+static TimerService timerService;
+
+}
+
+void TimerData::cancel() {
+	ScopedLock lock(mutex);
+	quitSignal = true;
+	timerService.remove(this);
+}
+
+void TimerData::schedule() {
+	assert(!scheduled);
+	timerService.init();
+	timerService.add(this);
+}
+
 // Global list that holds info about headless timers
 // Used to make sure there are no memory leaks
 // TODO: not threadsafe
@@ -215,7 +417,7 @@ std::list<TimerData *> timers;
 // Initialize working with timers
 void InitializeTimers()
 {
-
+	InitTimerSystem();
 }
 
 ///////////////////////
@@ -226,6 +428,8 @@ void ShutdownTimers()
 // TODO: why not std::set?
 	//assert(!EventSystemInited()); // Make sure the event system is shut down (to avoid double freed memory)
 
+	timerService.shutdown();
+
 	/*
 	// Stop and free all the running timers
 	for (std::list<TimerData *>::iterator it = timers.begin(); it != timers.end(); it++)  {
@@ -233,7 +437,7 @@ void ShutdownTimers()
 		// Call the user function, because it might free some data
 		Event<Timer::EventData>::Handler& handler = (*it)->timer ? (*it)->timer->onTimer.handler().get() : (*it)->onTimerHandler.get();
 		bool cont = true;
-		(*it)->breakThread();
+		(*it)->cancel();
 		if (&handler) // Make sure it exists
 			handler(Timer::EventData(NULL, (*it)->userData, cont));
 
@@ -333,7 +537,7 @@ bool Timer::start()
 		data->name = "unnamed";
 	}
 	
-	data->startThread();
+	data->schedule();
 
 	m_running = true;
 	return true;
@@ -364,7 +568,7 @@ bool Timer::startHeadless()
 		data->once = true;
 	}
 	
-	data->startThread();
+	data->schedule();
 	
 	return true;
 }
@@ -377,7 +581,7 @@ void Timer::stop()
 	if(!m_running) return;
 	
 	SDL_mutexP(m_lastData->mutex);
-	m_lastData->breakThread(); // it will be removed in the last event
+	m_lastData->cancel(); // it will be removed in the last event
 	m_lastData->timer = NULL;
 	SDL_mutexV(m_lastData->mutex);
 	
@@ -417,7 +621,7 @@ static void Timer_handleEvent(InternTimerEventData data)
 			}
 			
 			// just to be sure; does not hurt
-			timer_data->breakThread();
+			timer_data->cancel();
 		}
 	}
 	SDL_mutexV(timer_data->mutex);
@@ -0,0 +1,440 @@
+/*
+ *  Benchmark.cpp
+ *  OpenLieroX
+ *
+ *  deterministic headless game simulation benchmark
+ *
+ *  code under LGPL
+ *
+ */
+
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include "Benchmark.h"
+#include "game/Game.h"
+#include "game/Settings.h"
+#include "game/Mod.h"
+#include "game/Level.h"
+#include "Timer.h"
+#include "Profiler.h"
+#include "OLXCommand.h"
+#include "Options.h"
+#include "LieroX.h"
+#include "CClient.h"
+#include "Consts.h"
+#include "FindFile.h"
+#include "Unicode.h"
+#include "StringUtils.h"
+#include "Debug.h"
+#include "util/math_func.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+
+// With ALLOC_COUNTING (CMake option, off by default), every operator new of the program is
+// counted for the allocation numbers in the report, with one relaxed atomic increment.
+// The atomic is constant-initialized, so it is ready before any static constructor allocates.
+// MEMSTATS builds replace these operators themselves (memstats.h), so we don't count there.
+#if defined(ALLOC_COUNTING) && !defined(MEMSTATS)
+static std::atomic<Uint64> allocationCount(0);
+
+void* operator new(size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) throw() { free(p); }
+void operator delete[](void* p) throw() { free(p); }
+#endif
+
+
+namespace Benchmark {
+
+struct Scenario {
+	const char* name;
+	const char* map;
+	const char* mod;
+	int bots;
+	const char* description;
+};
+
+static const Scenario scenarios[] = {
+	{ "lx56", "CastleStrike.lxl", "Classic", 8, "classic LX56 deathmatch" },
+	{ "projswarm", "Complex.lxl", "Crazy", 20, "many bots with projectile heavy weapons" },
+	{ "gusanos", "Earth", "Gusanos", 8, "Gusanos mod and level, Lua and Gusanos particles" },
+};
+
+static const int WarmupFrames = 100;
+static const int SetupTimeoutFrames = 60 * Game::FixedFPS; // of virtual time
+static const int ZoneCollectInterval = 1000; // frames; profiler ring buffers are bounded
+
+enum State {
+	S_Off,
+	S_Setup,
+	S_WaitLobby,
+	S_WaitGame,
+	S_Warmup,
+	S_Measure
+};
+
+static State state = S_Off;
+static bool lastRunFailed = false;
+static Settings settings;
+static const Scenario* scenario = NULL;
+static int stateFrames = 0;
+static Uint64 frameStartTicks = 0;
+static Uint64 measureStartTicks = 0;
+static Uint64 collectedUntilTicks = 0;
+static std::vector<Uint32> frameTimes; // in microseconds
+static Profiler::ZoneStats zoneStats;
+static bool profilerWasEnabled = false;
+static long long heapStart = -1;
+static Uint64 allocationsStart = 0;
+
+static std::vector<std::string> checks;
+static bool checksFailed = false;
+
+static const Scenario* findScenario(const std::string& name) {
+	for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+		if(stringcaseequal(scenarios[i].name, name))
+			return &scenarios[i];
+	return NULL;
+}
+
+// -1 if we cannot tell on this system
+static long long heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+	return (long long)mi.uordblks + (long long)mi.hblkhd;
+#elif defined(__GLIBC__)
+	struct mallinfo mi = mallinfo();
+	return (long long)(unsigned int)mi.uordblks + (long long)(unsigned int)mi.hblkhd;
+#else
+	return -1;
+#endif
+}
+
+// in KB, -1 if we cannot tell on this system
+static long long peakRss() {
+#ifndef WIN32
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss / 1024; // bytes on Mac
+#else
+	return (long long)usage.ru_maxrss;
+#endif
+#else
+	return -1;
+#endif
+}
+
+static std::string jsonString(const std::string& str) {
+	std::string ret = "\"";
+	for(std::string::const_iterator i = str.begin(); i != str.end(); ++i) {
+		if(*i == '"' || *i == '\\') ret += '\\';
+		if((unsigned char)*i < 0x20) continue;
+		ret += *i;
+	}
+	return ret + "\"";
+}
+
+static Uint32 percentile(const std::vector<Uint32>& sorted, int p) {
+	if(sorted.empty()) return 0;
+	return sorted[(sorted.size() - 1) * p / 100];
+}
+
+static void stop(bool success) {
+	state = S_Off;
+	lastRunFailed = !success;
+	timeCounter.setManual(false);
+	if(!profilerWasEnabled) Profiler::stop();
+	frameTimes.clear();
+	zoneStats.clear();
+	game.state = Game::S_Quit;
+}
+
+static void fail(const std::string& reason) {
+	errors << "Benchmark " << scenario->name << " failed: " << reason << endl;
+	stop(false);
+}
+
+static void collectZones() {
+	Uint64 now = Profiler::getTicks();
+	Profiler::collectZoneStats(zoneStats, collectedUntilTicks);
+	collectedUntilTicks = now;
+}
+
+static void writeReport() {
+	Uint64 wallTime = Profiler::getTicks() - measureStartTicks;
+	std::vector<Uint32> sorted(frameTimes);
+	std::sort(sorted.begin(), sorted.end());
+	Uint64 sum = 0;
+	for(size_t i = 0; i < sorted.size(); ++i) sum += sorted[i];
+
+	std::string r = "{";
+	r += "\"scenario\":" + jsonString(scenario->name);
+	r += ",\"map\":" + jsonString(scenario->map);
+	r += ",\"mod\":" + jsonString(scenario->mod);
+	r += ",\"bots\":" + itoa(settings.bots);
+	r += ",\"seed\":" + itoa(settings.seed);
+	r += ",\"frames\":" + itoa(sorted.size());
+	r += ",\"simulated_ms\":" + itoa(sorted.size() * Game::FixedFrameTime);
+	r += ",\"wall_us\":" + itoa(wallTime);
+	r += ",\"frame_us\":{";
+	r += "\"mean\":" + itoa(sorted.empty() ? (Uint64)0 : sum / sorted.size());
+	r += ",\"p50\":" + itoa(percentile(sorted, 50));
+	r += ",\"p90\":" + itoa(percentile(sorted, 90));
+	r += ",\"p99\":" + itoa(percentile(sorted, 99));
+	r += ",\"max\":" + itoa(sorted.empty() ? 0 : sorted.back());
+	r += "},\"zones\":{";
+	for(Profiler::ZoneStats::iterator i = zoneStats.begin(); i != zoneStats.end(); ++i) {
+		if(i != zoneStats.begin()) r += ",";
+		r += jsonString(i->first) + ":{\"total_us\":" + itoa(i->second.total) +
+			",\"calls\":" + itoa(i->second.calls) + ",\"max_us\":" + itoa(i->second.max) + "}";
+	}
+	long long heapEnd = heapInUse();
+	r += "},\"heap_bytes_start\":" + to_string<long long>(heapStart);
+	r += ",\"heap_bytes_end\":" + to_string<long long>(heapEnd);
+	r += ",\"peak_rss_kb\":" + to_string<long long>(peakRss());
+#if defined(ALLOC_COUNTING) && !defined(MEMSTATS)
+	const Uint64 allocs = allocations() - allocationsStart;
+	r += ",\"allocations\":" + itoa(allocs);
+	r += ",\"allocations_per_frame\":" + itoa(sorted.empty() ? (Uint64)0 : allocs / sorted.size());
+#endif
+	r += "}";
+
+	hints << "Benchmark result: " << r << endl;
+
+	if(settings.outputFile != "") {
+		FILE* f = IsAbsolutePath(settings.outputFile) ?
+			fopen(Utf8ToSystemNative(settings.outputFile).c_str(), "w") :
+			OpenGameFile(settings.outputFile, "w");
+		if(!f) {
+			errors << "Benchmark: cannot open " << settings.outputFile << " for writing" << endl;
+			return;
+		}
+		fputs(r.c_str(), f);
+		fputc('\n', f);
+		fclose(f);
+		notes << "Benchmark: report written to " << settings.outputFile << endl;
+	}
+}
+
+static void setState(State s) {
+	state = s;
+	stateFrames = 0;
+}
+
+static void setupGame() {
+	srand(settings.seed);
+	rndgen.seed(settings.seed);
+
+	tLXOptions->iMaxPlayers = MAX_PLAYERS;
+	gameSettings.overwrite[FT_Map].as<LevelInfo>()->path = scenario->map;
+	gameSettings.overwrite[FT_Mod].as<ModInfo>()->path = scenario->mod;
+	gameSettings.overwrite[FT_Lives] = -2;
+	gameSettings.overwrite[FT_KillLimit] = -1;
+	gameSettings.overwrite[FT_TimeLimit] = -1.0f;
+
+	Execute_Here("startLobby");
+	if(game.state <= Game::S_Inactive) {
+		fail("cannot start lobby");
+		return;
+	}
+	setState(S_WaitLobby);
+}
+
+static void beginMeasure() {
+	setState(S_Measure);
+	frameTimes.reserve(settings.frames);
+	zoneStats.clear();
+	profilerWasEnabled = Profiler::enabled;
+	Profiler::clear();
+	Profiler::start();
+	heapStart = heapInUse();
+	allocationsStart = allocations();
+	measureStartTicks = collectedUntilTicks = Profiler::getTicks();
+}
+
+static bool reject(CmdLineIntf& cli, const std::string& msg) {
+	cli.writeMsg(msg, CNC_WARNING);
+	lastRunFailed = true;
+	return false;
+}
+
+bool start(const Settings& s, CmdLineIntf& cli) {
+	if(state != S_Off)
+		return reject(cli, "benchmark is already running");
+	if(!bDedicated)
+		return reject(cli, "benchmark only works in dedicated mode, use -benchmark on the command line");
+	if(game.state != Game::S_Inactive)
+		return reject(cli, "benchmark needs an inactive game, stop the current game first");
+	scenario = findScenario(s.scenario);
+	if(!scenario) {
+		listScenarios(cli);
+		return reject(cli, "unknown benchmark scenario " + s.scenario);
+	}
+
+	settings = s;
+	if(settings.bots < 0) settings.bots = scenario->bots;
+	settings.bots = CLAMP(settings.bots, 1, MAX_WORMS - 1);
+	settings.frames = MAX(settings.frames, 1);
+
+	notes << "Benchmark: " << scenario->name << " (" << scenario->description << "), "
+		<< settings.bots << " bots, " << settings.frames << " frames, seed " << settings.seed << endl;
+	lastRunFailed = false;
+	timeCounter.setManual(true);
+	setState(S_Setup);
+	return true;
+}
+
+void listScenarios(CmdLineIntf& cli) {
+	for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+		cli.writeMsg(std::string(scenarios[i].name) + ": " + scenarios[i].description +
+					 " (" + scenarios[i].mod + " on " + scenarios[i].map + ", " + itoa(scenarios[i].bots) + " bots)");
+}
+
+bool isActive() { return state != S_Off; }
+bool failed() { return lastRunFailed || checksFailed; }
+
+#if defined(ALLOC_COUNTING) && !defined(MEMSTATS)
+Uint64 allocations() { return allocationCount.load(std::memory_order_relaxed); }
+#else
+Uint64 allocations() { return 0; }
+#endif
+
+namespace {
+struct CheckCLI : CmdLineIntf {
+	std::string cmd;
+	bool quitWhenDone;
+	static int pending; // queued checks which didn't finish yet
+	CheckCLI(const std::string& c, bool q) : cmd(c), quitWhenDone(q) {}
+
+	virtual void pushReturnArg(const std::string& str) {
+		notes << "Check " << cmd << ": " << str << endl;
+	}
+	virtual void finalizeReturn() {}
+	virtual void writeMsg(const std::string& msg, CmdLineMsgType type) {
+		if(type == CNC_ERROR) {
+			errors << "Check " << cmd << " failed: " << msg << endl;
+			checksFailed = true;
+		}
+		else
+			notes << "Check " << cmd << ": " << msg << endl;
+	}
+	virtual void finishedCommand(const std::string&) {
+		if(quitWhenDone && --pending == 0)
+			game.state = Game::S_Quit;
+	}
+};
+int CheckCLI::pending = 0;
+}
+
+// false (and the run fails) if cmd is no command
+static bool checkKnown(const std::string& cmd) {
+	std::vector<std::string> params = ParseParams(cmd);
+	if(params.size() > 0 && GetCommandDesc(params[0])) return true;
+	errors << "Check: unknown command " << cmd << endl;
+	checksFailed = true;
+	return false;
+}
+
+void addCheck(const std::string& cmd) { checks.push_back(cmd); }
+bool haveChecks() { return !checks.empty(); }
+
+void queueChecks() {
+	static std::list<CheckCLI> clis; // they must live until the commands are done
+	for(size_t i = 0; i < checks.size(); ++i) {
+		if(!checkKnown(checks[i])) continue;
+		clis.push_back(CheckCLI(checks[i], true));
+		CheckCLI::pending++;
+		Execute(&clis.back(), checks[i]);
+	}
+	checks.clear();
+	if(CheckCLI::pending == 0)
+		game.state = Game::S_Quit;
+}
+
+static void runChecks() {
+	for(size_t i = 0; i < checks.size(); ++i) {
+		if(!checkKnown(checks[i])) continue;
+		CheckCLI cli(checks[i], false);
+		Execute_Here(cli, checks[i]);
+	}
+	checks.clear();
+}
+
+void frameBegin() {
+	frameStartTicks = Profiler::getTicks();
+}
+
+void frameEnd() {
+	Uint64 frameTime = Profiler::getTicks() - frameStartTicks;
+	stateFrames++;
+
+	if(state >= S_Warmup && game.state < Game::S_Preparing) {
+		fail("game stopped, state is " + Game::StateAsStr(game.state));
+		return;
+	}
+
+	switch(state) {
+	case S_Off: return;
+
+	case S_Setup:
+		setupGame();
+		break;
+
+	case S_WaitLobby:
+		if(game.state == Game::S_Lobby && cClient->getStatus() == NET_CONNECTED) {
+			Execute_Here("addBots " + itoa(settings.bots));
+			Execute_Here("startGame");
+			setState(S_WaitGame);
+		}
+		else if(stateFrames > SetupTimeoutFrames)
+			fail("timeout while waiting for the lobby");
+		break;
+
+	case S_WaitGame:
+		if(game.state == Game::S_Playing)
+			setState(S_Warmup);
+		else if(stateFrames > SetupTimeoutFrames)
+			fail("timeout while waiting for the game start");
+		break;
+
+	case S_Warmup:
+		if(stateFrames >= WarmupFrames)
+			beginMeasure();
+		break;
+
+	case S_Measure:
+		frameTimes.push_back((Uint32)MIN(frameTime, (Uint64)0xffffffff));
+		if(frameTimes.size() % ZoneCollectInterval == 0)
+			collectZones();
+		if((int)frameTimes.size() >= settings.frames) {
+			collectZones();
+			writeReport();
+			runChecks();
+			stop(true);
+			return;
+		}
+		break;
+	}
+
+	if(state != S_Off)
+		timeCounter.advance(TimeDiff(Game::FixedFrameTime));
+}
+
+}
@@ -0,0 +1,72 @@
+/*
+ *  Benchmark.h
+ *  OpenLieroX
+ *
+ *  deterministic headless game simulation benchmark
+ *
+ *  code under LGPL
+ *
+ */
+
+#ifndef __OLX_BENCHMARK_H__
+#define __OLX_BENCHMARK_H__
+
+#include <string>
+#include <SDL.h>
+
+struct CmdLineIntf;
+
+/*
+	The benchmark runs a dedicated server with a fixed number of bots on a
+	known map+mod and simulates a fixed number of frames through the normal
+	Game::frame(). The game clock (timeCounter) is switched to manual mode
+	and advanced by exactly Game::FixedFrameTime per frame, so there is no
+	sleeping and every frame simulates exactly one physics step, no matter
+	how fast the machine is.
+
+	All rand() users and the Gusanos generator are seeded with the given seed.
+	The local client still talks to the server over a loopback socket, so
+	runs are reproducible but not necessarily bit-identical.
+
+	When it is done, a JSON report (frame time percentiles, per-subsystem
+	times from the profiler zones, heap usage, peak RSS) is printed and
+	optionally written to a file, and the game quits.
+
+	Start it with "-benchmark <scenario>" on the command line or with the
+	console command "benchmark".
+
+	Checks ("-check <command>" on the command line, several are allowed) are
+	console commands which report problems as CNC_ERROR messages, like
+	checkMetrics. With a benchmark, they run at the end of the measurement
+	while the game is still running (so they have a map, worms and bots),
+	otherwise in the first frames, and then the game quits. An error message
+	or an unknown command makes the run fail, the exit code is 1 then. The
+	CMake tests (ctest) are such runs.
+*/
+namespace Benchmark {
+	struct Settings {
+		std::string scenario;
+		int frames;
+		int bots; // < 0: default of the scenario
+		Uint32 seed;
+		std::string outputFile; // empty: only print
+		Settings() : frames(3000), bots(-1), seed(1) {}
+	};
+
+	bool start(const Settings& settings, CmdLineIntf& cli);
+	void listScenarios(CmdLineIntf& cli);
+	bool isActive();
+	bool failed(); // the last run didn't finish or a check failed
+
+	void addCheck(const std::string& cmd);
+	bool haveChecks();
+	void queueChecks(); // without a benchmark: run them in the next frames and quit
+
+	Uint64 allocations(); // operator new calls so far; always 0 without ALLOC_COUNTING
+
+	// Called from Game::frame(). frameEnd() replaces CapFPS() while we are active.
+	void frameBegin();
+	void frameEnd();
+}
+
+#endif
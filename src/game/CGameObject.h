@@ -28,6 +28,7 @@
 struct ALLEGRO_BITMAP;
 class CViewport;
 class CWormInputHandler;
+struct Net_Node;
 
 class CGameObject : public CustomVar {
 public:
@@ -99,6 +100,9 @@ public:
 	// Gets the object's dir ( left = -1 right = 1 )
 	virtual int getDir();
 	
+	// Gets the network node of the object ( NULL if it is not replicated )
+	virtual Net_Node* getNode() { return NULL; }
+	
 	// Returns true if the object is colliding with a circle of the given radius in the given point
 	virtual bool isCollidingWith( const Vec& point, float radius );
 	
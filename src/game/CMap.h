@@ -20,6 +20,7 @@
 #include <SDL.h>
 #include <string>
 #include <set>
+#include <vector>
 #include "ReadWriteLock.h"
 #include "SmartPointer.h"
 #include "LieroX.h" // for maprandom_t
@@ -33,6 +34,7 @@
 
 class CViewport;
 class CCache;
+struct CmdLineIntf;
 
 
 class CWorm;
@@ -108,9 +110,10 @@ public:
 		AdditionalData.clear();
 		
 		bMapSavingToMemory = false;
-		bmpSavedImage = NULL;
-		savedPixelFlags = NULL;
-		savedMapCoords.clear();
+		savedTilesX = savedTilesY = 0;
+		
+		terrainVersion = 0;
+		terrainRegionsX = terrainRegionsY = 0;
 		
 		gusInit();
    	}
@@ -162,22 +165,24 @@ private:
 	std::map< std::string, std::string > AdditionalData; // Not used currently, maybe will contain CTF info in Beta10
 
 	// Save/restore from memory, for commit/rollback net mechanism
+	// The map is split into tiles, a tile is copied the first time it is changed after the snapshot.
 	bool		bMapSavingToMemory;
-	SmartPointer<SDL_Surface> bmpSavedImage;
-	uchar *		savedPixelFlags;
 	enum { MAP_SAVE_CHUNK = 16 };
-	struct SavedMapCoord_t {
-		int X, Y;
-		SavedMapCoord_t(int x = 0, int y = 0) : X(x), Y(y) {}
-		bool operator < (const SavedMapCoord_t & m) const
-		{
-			if( Y < m.Y ) return true;
-			else if( Y > m.Y ) return false;
-			else if( X < m.X ) return true;
-			else return false;
-		}
+	struct SavedTile_t {
+		uchar flags[MAP_SAVE_CHUNK * MAP_SAVE_CHUNK];
+		std::vector<Uint8> image; // of bmpDrawImage, only with a hi-res map
 	};
-	std::set< SavedMapCoord_t > savedMapCoords;
+	uint		savedTilesX, savedTilesY;
+	std::vector<Uint32> savedTileBits; // one bit per tile, set if it is in savedTiles
+	std::vector< std::pair<uint, SavedTile_t*> > savedTiles; // tile index and its copy
+	std::vector<SavedTile_t*> savedTilePool; // unused copies, to avoid allocations
+
+	// Terrain versions, for caches of traces through the pixel flags (bot AI).
+	// Every change of the flags increments terrainVersion and stamps the changed regions with it.
+	enum { TERRAIN_REGION_SIZE = 64 };
+	Uint32		terrainVersion;
+	uint		terrainRegionsX, terrainRegionsY;
+	std::vector<Uint32> terrainRegionVersions; // created on the first change
 
 private:
 	// Update functions
@@ -262,6 +267,7 @@ private:
 	
 	// Saves region of map to savebuffer for RestoreFromMemory() - called from CarveHole()/PlaceDirt()/PlaceGreenDirt()
 	void SaveToMemoryInternal(int x, int y, int w, int h);
+	void RecycleSavedTiles();
 
 
 public:	
@@ -302,6 +308,38 @@ public:
 	}
 	uchar GetPixelFlag(const CVec& pos) const { return GetPixelFlag((long)pos.x, (long)pos.y); }
 
+	// Same as GetPixelFlag for the n pixels from (x,y) to the right, but only one line lookup
+	void GetPixelFlagRow(long x, long y, int n, uchar* flags, bool wrapAround = false) const {
+		if(wrapAround)
+			y = WrapAroundY((int)y);
+		else if(y < 0 || (unsigned long)y >= Height) {
+			for(int i = 0; i < n; ++i) flags[i] = PX_ROCK;
+			return;
+		}
+		const unsigned char* line = material->line[y];
+		for(int i = 0; i < n; ++i, ++x) {
+			if(x >= 0 && (unsigned long)x < Width)
+				flags[i] = m_materialList[(unsigned char)line[x]].toLxFlags();
+			else
+				flags[i] = wrapAround ? m_materialList[(unsigned char)line[WrapAroundX((int)x)]].toLxFlags() : (uchar)PX_ROCK;
+		}
+	}
+	// Same as GetPixelFlag for the n pixels from (x,y) downwards
+	void GetPixelFlagColumn(long x, long y, int n, uchar* flags, bool wrapAround = false) const {
+		if(wrapAround)
+			x = WrapAroundX((int)x);
+		else if(x < 0 || (unsigned long)x >= Width) {
+			for(int i = 0; i < n; ++i) flags[i] = PX_ROCK;
+			return;
+		}
+		for(int i = 0; i < n; ++i, ++y) {
+			if(y >= 0 && (unsigned long)y < Height)
+				flags[i] = m_materialList[(unsigned char)material->line[y][x]].toLxFlags();
+			else
+				flags[i] = wrapAround ? m_materialList[(unsigned char)material->line[WrapAroundY((int)y)][x]].toLxFlags() : (uchar)PX_ROCK;
+		}
+	}
+
 	bool CheckAreaFree(int x, int y, int w, int h);
 	
 	Color	getColorAt(long x, long y);
@@ -343,9 +381,18 @@ public:
 	CVec		groundPos(const CVec& pos);
 	
 	// Save/restore from memory, for commit/rollback net mechanism
-	void		NewNet_SaveToMemory();
+	void		NewNet_SaveToMemory(); // if called again without restore, the current state is the new snapshot
 	void		NewNet_RestoreFromMemory();
 	void		NewNet_Deinit();
+	// Measures snapshot, carving and rollback with more and more craters
+	void		NewNet_BenchmarkRollback(CmdLineIntf& cli, int maxCraters);
+	// Compares GetPixelFlagRow/Column with GetPixelFlag at random positions (the worm collision probes), and times both
+	void		CheckPixelFlagProbes(CmdLineIntf& cli, int probes);
+	
+	Uint32		GetTerrainVersion() const	{ return terrainVersion; }
+	void		MarkTerrainChanged(int x, int y, int w, int h);
+	// True if a pixel flag in the rect (inclusive) changed after the given terrain version
+	bool		TerrainChangedSince(int x1, int y1, int x2, int y2, Uint32 version) const;
 
 	theme_t		*GetTheme()		{ return &Theme; }
 
@@ -522,8 +569,10 @@ public:
 	
 	void putMaterial( unsigned char index, unsigned int x, unsigned int y )
 	{
-		if(x < static_cast<unsigned int>(material->w) && y < static_cast<unsigned int>(material->h))
+		if(x < static_cast<unsigned int>(material->w) && y < static_cast<unsigned int>(material->h)) {
 			material->line[y][x] = index;
+			MarkTerrainChanged(x, y, 1, 1);
+		}
 	}
 	
 	void putMaterial( Material const& mat, unsigned int x, unsigned int y )
@@ -0,0 +1,422 @@
+/*
+ *  Demo.cpp
+ *  OpenLieroX
+ *
+ *  server-side demo recording and headless playback
+ *
+ *  code under LGPL
+ *
+ */
+
+#include <cstring>
+#include "Demo.h"
+#include "game/GameState.h"
+#include "game/Game.h"
+#include "game/Settings.h"
+#include "game/Mod.h"
+#include "game/Level.h"
+#include "Version.h"
+#include "OLXCommand.h"
+#include "FindFile.h"
+#include "StringUtils.h"
+#include "Debug.h"
+#include "MathLib.h"
+#include "Profiler.h"
+#include "util/macros.h"
+
+
+static const char DemoMagic[] = "OLXDEMO";
+static const char DemoEndMagic[] = "OLXDEND"; // with the terminating 0, 8 bytes
+static const Uint8 DemoVersion = 1;
+static const Uint32 RecordEveryFrames = 2; // 50 records per second
+static const Uint32 KeyframeEveryRecords = 500; // 10 seconds
+
+
+static void writeBs(FILE* f, const CBytestream& bs, size_t& bytesWritten) {
+	fwrite(bs.data().data(), 1, bs.data().size(), f);
+	bytesWritten += bs.data().size();
+}
+
+static bool readBs(FILE* f, size_t len, CBytestream& bs) {
+	std::string data(len, '\0');
+	if(len > 0 && fread(&data[0], 1, len, f) != len) return false;
+	bs = CBytestream(data);
+	return true;
+}
+
+static bool applyRecord(CBytestream& bs, GameState& s, const GameState* old, Uint64& frame, std::vector<std::string>* changes);
+
+
+bool DemoRecorder::start(const std::string& fn) {
+	stop();
+	file = OpenGameFile(fn, "wb");
+	if(!file) {
+		errors << "DemoRecorder: cannot open " << fn << " for writing" << endl;
+		return false;
+	}
+	filename = fn;
+	state = new GameState();
+	// What happened before is only in the updates the game accumulated. Walk them once,
+	// after that we only get the changes since the last record.
+	foreach(o, game.gameStateUpdates->objCreations)
+		if(o->obj.get() && !state->haveObject(*o))
+			state->addObject(*o);
+	foreach(u, game.gameStateUpdates->objs)
+		if(u->obj.obj.get() && state->haveObject(u->obj))
+			state->setObjAttr(*u, u->get());
+	changes = new GameStateUpdates();
+	game.gameStateUpdates->listener = changes;
+	block.Clear();
+	recordsInBlock = 0;
+	lastFrame = (Uint64)-1;
+	index.clear();
+	bytesWritten = 0;
+	records = 0;
+	startTicks = Profiler::getTicks();
+	recordTicks = 0;
+
+	CBytestream header;
+	header.writeData(std::string(DemoMagic, sizeof(DemoMagic) - 1));
+	header.writeByte(DemoVersion);
+	header.writeString(GetFullGameName());
+	header.writeString(gameSettings[FT_Map].as<LevelInfo>()->path);
+	header.writeString(gameSettings[FT_Mod].as<ModInfo>()->path);
+	header.writeInt(RecordEveryFrames, 4);
+	header.writeInt(KeyframeEveryRecords, 4);
+	writeBs(file, header, bytesWritten);
+
+	notes << "DemoRecorder: recording to " << fn << endl;
+	return true;
+}
+
+void DemoRecorder::stop() {
+	if(!file) return;
+	flushBlock();
+
+	CBytestream bs;
+	const Uint64 indexOffset = bytesWritten;
+	bs.writeInt((int)index.size(), 4);
+	for(size_t i = 0; i < index.size(); ++i) {
+		bs.writeUInt64(index[i].first);
+		bs.writeUInt64(index[i].second);
+	}
+	bs.writeUInt64(indexOffset);
+	bs.writeData(std::string(DemoEndMagic, sizeof(DemoEndMagic)));
+	writeBs(file, bs, bytesWritten);
+
+	fclose(file);
+	file = NULL;
+	if(game.gameStateUpdates.get() && game.gameStateUpdates->listener == changes)
+		game.gameStateUpdates->listener = NULL;
+	delete changes;
+	changes = NULL;
+	delete state;
+	state = NULL;
+	block.Clear();
+	notes << "DemoRecorder: " << filename << " done, " << records << " records, " << index.size() << " keyframes, " << bytesWritten << " bytes, " <<
+		(recordTicks / MAX(records, (size_t)1)) << " us per record" << endl;
+}
+
+void DemoRecorder::flushBlock() {
+	if(recordsInBlock == 0) return;
+	std::string compressed;
+	if(!Compress(block.data(), &compressed)) {
+		errors << "DemoRecorder: compression failed, dropping " << recordsInBlock << " records" << endl;
+		compressed = "";
+	}
+	else {
+		index.push_back(std::make_pair((Uint64)bytesWritten, blockFirstFrame));
+		CBytestream len;
+		len.writeInt((int)compressed.size(), 4);
+		writeBs(file, len, bytesWritten);
+		fwrite(compressed.data(), 1, compressed.size(), file);
+		bytesWritten += compressed.size();
+	}
+	block.Clear();
+	recordsInBlock = 0;
+}
+
+void DemoRecorder::writeRecord(bool keyframe) {
+	GameState& s = *state;
+
+	std::vector<ObjRef> created, deleted;
+	foreach(o, changes->objCreations) {
+		if(!o->obj.get()) continue;
+		if(s.haveObject(*o)) continue;
+		s.addObject(*o);
+		created.push_back(*o);
+	}
+	foreach(o, changes->objDeletions) {
+		if(!s.haveObject(*o)) continue;
+		s.removeObject(*o);
+		deleted.push_back(*o);
+	}
+
+	// Unlike GameStateUpdates::diffFromStateToCurrent, we want everything,
+	// no matter who owns it, and we must not touch the S2CupdateNeeded flags.
+	std::vector<ObjAttrRef> changed;
+	foreach(u, changes->objs) {
+		if(!u->obj.obj.get()) continue;
+		if(!s.haveObject(u->obj)) continue;
+		ScriptVar_t curValue = u->get();
+		if(curValue == s.getValue(*u)) continue;
+		s.setObjAttr(*u, curValue);
+		changed.push_back(*u);
+	}
+	changes->reset();
+
+	block.writeUInt64(game.serverFrame);
+	if(keyframe) {
+		block.writeInt16((Sint16)s.objs.size());
+		foreach(o, s.objs)
+			o->first.writeToBs(&block);
+		block.writeInt16(0);
+		size_t count = 0;
+		foreach(o, s.objs) count += o->second.attribs.size();
+		block.writeInt((int)count, 4);
+		foreach(o, s.objs) {
+			foreach(a, o->second.attribs) {
+				ObjAttrRef r;
+				r.obj = o->first;
+				r.attr = a->first;
+				r.writeToBs(&block);
+				block.writeVar(a->second.value);
+			}
+		}
+	}
+	else {
+		block.writeInt16((Sint16)created.size());
+		foreach(o, created) o->writeToBs(&block);
+		block.writeInt16((Sint16)deleted.size());
+		foreach(o, deleted) o->writeToBs(&block);
+		block.writeInt((int)changed.size(), 4);
+		foreach(u, changed) {
+			u->writeToBs(&block);
+			block.writeVar(s.getValue(*u));
+		}
+	}
+	recordsInBlock++;
+	records++;
+}
+
+void DemoRecorder::frame() {
+	if(!file) return;
+	if(game.state != Game::S_Playing) return;
+	const Uint64 f = game.serverFrame;
+	if(f == lastFrame || f % RecordEveryFrames != 0) return;
+	lastFrame = f;
+
+	const Uint64 start = Profiler::getTicks();
+	if(recordsInBlock >= KeyframeEveryRecords)
+		flushBlock();
+	const bool keyframe = recordsInBlock == 0;
+	if(keyframe) blockFirstFrame = f;
+	writeRecord(keyframe);
+	recordTicks += Profiler::getTicks() - start;
+}
+
+void DemoRecorder::printStatus(CmdLineIntf& cli) const {
+	if(!file)
+		cli.writeMsg("demo recording: off");
+	else {
+		cli.writeMsg("demo recording: " + filename + ", " + itoa(records) + " records, " +
+					 itoa(index.size()) + " keyframes, " + itoa(bytesWritten) + " bytes written");
+		// the share of one core, compare it with the server load
+		const Uint64 elapsed = MAX(Profiler::getTicks() - startTicks, (Uint64)1);
+		cli.writeMsg("recording time: " + itoa(recordTicks / MAX(records, (size_t)1)) + " us per record, " +
+					 ftoa(100.0f * recordTicks / elapsed, 3) + "% of the time since the start");
+	}
+}
+
+
+bool DemoPlayer::open(const std::string& fn) {
+	close();
+	file = OpenGameFile(fn, "rb");
+	if(!file) {
+		errors << "DemoPlayer: cannot open " << fn << endl;
+		return false;
+	}
+
+	// The header is small, read a generous chunk and parse it.
+	CBytestream bs;
+	{
+		char buf[4096];
+		size_t len = fread(buf, 1, sizeof(buf), file);
+		bs = CBytestream(std::string(buf, len));
+	}
+	if(bs.readData(sizeof(DemoMagic) - 1) != std::string(DemoMagic, sizeof(DemoMagic) - 1) || bs.readByte() != DemoVersion) {
+		errors << "DemoPlayer: " << fn << " is not a demo of a supported version" << endl;
+		close();
+		return false;
+	}
+	header.gameVersion = bs.readString();
+	header.map = bs.readString();
+	header.mod = bs.readString();
+	header.recordEveryFrames = (Uint32)bs.readInt(4);
+	header.keyframeEveryRecords = (Uint32)bs.readInt(4);
+	const long firstBlockOffset = (long)bs.GetPos();
+
+	// trailer: index offset + end magic
+	bool haveIndex = false;
+	if(fseek(file, -16, SEEK_END) == 0 && readBs(file, 16, bs)) {
+		Uint64 indexOffset = bs.readUInt64();
+		if(bs.readData(sizeof(DemoEndMagic)) == std::string(DemoEndMagic, sizeof(DemoEndMagic)) &&
+		   fseek(file, (long)indexOffset, SEEK_SET) == 0 && readBs(file, 4, bs)) {
+			size_t count = (size_t)(Uint32)bs.readInt(4);
+			if(readBs(file, count * 16, bs)) {
+				index.resize(count);
+				for(size_t i = 0; i < count; ++i) {
+					index[i].first = bs.readUInt64();
+					index[i].second = bs.readUInt64();
+				}
+				haveIndex = true;
+			}
+		}
+	}
+	if(!haveIndex) {
+		warnings << "DemoPlayer: " << fn << " has no index (recording not finished?), rebuilding it" << endl;
+		if(!rebuildIndex(firstBlockOffset)) {
+			close();
+			return false;
+		}
+	}
+
+	state = new GameState();
+	return seek(getFirstFrame());
+}
+
+bool DemoPlayer::rebuildIndex(long offset) {
+	index.clear();
+	CBytestream bs;
+	while(fseek(file, offset, SEEK_SET) == 0 && readBs(file, 4, bs)) {
+		size_t len = (size_t)(Uint32)bs.readInt(4);
+		CBytestream data;
+		if(!readBs(file, len, data)) break;
+		std::string raw;
+		if(!Decompress(data.data(), &raw)) break;
+		CBytestream rawBs(raw);
+		index.push_back(std::make_pair((Uint64)offset, rawBs.readUInt64()));
+		offset += 4 + (long)len;
+	}
+	return !index.empty();
+}
+
+void DemoPlayer::close() {
+	if(file) {
+		fclose(file);
+		file = NULL;
+	}
+	delete state;
+	state = NULL;
+	index.clear();
+	block.Clear();
+	curFrame = 0;
+}
+
+bool DemoPlayer::readBlock(size_t i) {
+	CBytestream bs;
+	if(fseek(file, (long)index[i].first, SEEK_SET) != 0 || !readBs(file, 4, bs)) return false;
+	size_t len = (size_t)(Uint32)bs.readInt(4);
+	if(!readBs(file, len, bs)) return false;
+	std::string raw;
+	if(!Decompress(bs.data(), &raw)) {
+		errors << "DemoPlayer: block " << i << " is corrupt" << endl;
+		return false;
+	}
+	block = CBytestream(raw);
+	return true;
+}
+
+bool DemoPlayer::seek(Uint64 frame) {
+	if(index.empty()) return false;
+	if(frame < getFirstFrame()) return false;
+
+	// Blocks are evenly spaced, so this is the right one unless the recording had gaps.
+	const Uint64 framesPerBlock = (Uint64)header.recordEveryFrames * header.keyframeEveryRecords;
+	size_t i = framesPerBlock ? (size_t)MIN((frame - getFirstFrame()) / framesPerBlock, (Uint64)index.size() - 1) : 0;
+	while(i > 0 && index[i].second > frame) --i;
+	while(i + 1 < index.size() && index[i + 1].second <= frame) ++i;
+
+	if(!readBlock(i)) return false;
+	state->reset();
+	// apply the keyframe and go forward to the frame
+	if(!applyRecord(block, *state, NULL, curFrame, NULL)) {
+		block.SkipAll();
+		return false;
+	}
+	while(curFrame < frame && !block.isPosAtEnd())
+		if(!step()) return false;
+	return true;
+}
+
+// Reads one record from bs into s. If old is given, the record is a keyframe
+// and changes are reported relative to old.
+static bool applyRecord(CBytestream& bs, GameState& s, const GameState* old, Uint64& frame, std::vector<std::string>* changes) {
+	const GameState& cmp = old ? *old : s;
+	frame = bs.readUInt64();
+
+	const Uint16 creations = (Uint16)bs.readInt16();
+	for(Uint16 i = 0; i < creations; ++i) {
+		ObjRef o;
+		o.readFromBs(&bs);
+		if(!s.haveObject(o)) s.addObject(o);
+		if(changes && !cmp.haveObject(o)) changes->push_back("created " + o.description());
+	}
+	const Uint16 deletions = (Uint16)bs.readInt16();
+	for(Uint16 i = 0; i < deletions; ++i) {
+		ObjRef o;
+		o.readFromBs(&bs);
+		if(s.haveObject(o)) s.removeObject(o);
+		if(changes) changes->push_back("deleted " + o.description());
+	}
+	const Uint32 attribs = (Uint32)bs.readInt(4);
+	for(Uint32 i = 0; i < attribs; ++i) {
+		ObjAttrRef r;
+		r.readFromBs(&bs);
+		if(r.attr.getAttrDesc() == NULL) {
+			errors << "DemoPlayer: unknown attribute " << r.description() << " at frame " << frame << endl;
+			return false;
+		}
+		ScriptVar_t value;
+		if(!bs.readVar(value)) {
+			errors << "DemoPlayer: cannot read value of " << r.description() << " at frame " << frame << endl;
+			return false;
+		}
+		if(!s.haveObject(r.obj)) s.addObject(r.obj);
+		if(changes && (!cmp.haveObject(r.obj) || !(value == cmp.getValue(r))))
+			changes->push_back(r.description() + " = " + value.toString());
+		s.setObjAttr(r, value);
+	}
+
+	if(old && changes) {
+		foreach(o, old->objs)
+			if(!s.haveObject(o->first))
+				changes->push_back("deleted " + o->first.description());
+	}
+	return true;
+}
+
+bool DemoPlayer::step(std::vector<std::string>* changes) {
+	if(block.isPosAtEnd()) {
+		// Next block. It starts with a keyframe which replaces our state.
+		size_t i = 0;
+		while(i < index.size() && index[i].second <= curFrame) ++i;
+		if(i >= index.size() || !readBlock(i)) return false;
+
+		GameState* keyframe = new GameState();
+		if(!applyRecord(block, *keyframe, state, curFrame, changes)) {
+			delete keyframe;
+			block.SkipAll();
+			return false;
+		}
+		delete state;
+		state = keyframe;
+		return true;
+	}
+
+	if(!applyRecord(block, *state, NULL, curFrame, changes)) {
+		block.SkipAll();
+		return false;
+	}
+	return true;
+}
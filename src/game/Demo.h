@@ -0,0 +1,122 @@
+/*
+ *  Demo.h
+ *  OpenLieroX
+ *
+ *  server-side demo recording and headless playback
+ *
+ *  code under LGPL
+ *
+ */
+
+#ifndef __OLX_DEMO_H__
+#define __OLX_DEMO_H__
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <SDL.h>
+#include "CBytestream.h"
+#include "CodeAttributes.h"
+
+struct GameState;
+struct GameStateUpdates;
+struct CmdLineIntf;
+
+/*
+	A demo is the stream of the object/attribute state (see GameState.h) of
+	the server, sampled every RecordEveryFrames simulation frames. That
+	includes worm positions, velocities, health, weapons, scores and the
+	game settings.
+
+	File layout:
+
+		header: "OLXDEMO" version, game version, map, mod, RecordEveryFrames, KeyframeEveryRecords
+		blocks: Uint32 length, zlib compressed data
+			Every block starts with a keyframe (full state), followed by the
+			deltas of the next records. So a block can be decoded on its own.
+		index: Uint32 count, for each block: Uint64 file offset, Uint64 first server frame
+		trailer: Uint64 index offset, "OLXDEND"
+
+	Records are "Uint64 serverFrame, Int16 #creations, ObjRefs, Int16 #deletions,
+	ObjRefs, Int32 #attribs, (ObjAttrRef, var)*", just like GameStateUpdates
+	but always with full values. Keyframes list all objects as creations.
+
+	Blocks are evenly spaced in server frames, so a seek is a lookup in the
+	index. If a recording was not closed (crash), the index is rebuilt by
+	walking the block headers.
+
+	The recorder listens to game.gameStateUpdates, so a record only looks at
+	what changed since the one before. The playback applies the records; it
+	does not run the physics, and it is not rendered.
+*/
+
+class DemoRecorder : DontCopyTag {
+private:
+	FILE* file;
+	std::string filename;
+	GameState* state; // what we have recorded so far
+	GameStateUpdates* changes; // since the last record, pushed by game.gameStateUpdates
+	CBytestream block;
+	Uint64 blockFirstFrame;
+	size_t recordsInBlock;
+	Uint64 lastFrame;
+	std::vector< std::pair<Uint64, Uint64> > index; // offset, first frame
+	size_t bytesWritten;
+	size_t records;
+	Uint64 startTicks, recordTicks; // for the CPU share in printStatus
+
+	void writeRecord(bool keyframe);
+	void flushBlock();
+public:
+	DemoRecorder() : file(NULL), state(NULL), changes(NULL), blockFirstFrame(0), recordsInBlock(0), lastFrame((Uint64)-1), bytesWritten(0), records(0), startTicks(0), recordTicks(0) {}
+	~DemoRecorder() { stop(); }
+
+	bool start(const std::string& fn);
+	void stop();
+	bool isRecording() const { return file != NULL; }
+	const std::string& getFilename() const { return filename; }
+
+	// Called every server simulation frame.
+	void frame();
+	void printStatus(CmdLineIntf& cli) const;
+};
+
+class DemoPlayer : DontCopyTag {
+public:
+	struct Header {
+		std::string gameVersion;
+		std::string map;
+		std::string mod;
+		Uint32 recordEveryFrames;
+		Uint32 keyframeEveryRecords;
+	};
+private:
+	FILE* file;
+	Header header;
+	std::vector< std::pair<Uint64, Uint64> > index; // offset, first frame
+	GameState* state;
+	CBytestream block; // the current block
+	Uint64 curFrame;
+
+	bool readBlock(size_t i);
+	bool rebuildIndex(long firstBlockOffset);
+public:
+	DemoPlayer() : file(NULL), state(NULL), curFrame(0) {}
+	~DemoPlayer() { close(); }
+
+	bool open(const std::string& fn);
+	void close();
+	const Header& getHeader() const { return header; }
+	size_t getKeyframeCount() const { return index.size(); }
+	Uint64 getFirstFrame() const { return index.empty() ? 0 : index.front().second; }
+
+	// Jumps to the keyframe at or before the given server frame. Returns false if there is none.
+	bool seek(Uint64 serverFrame);
+	// Applies the next record. Returns false at the end of the demo.
+	// changes (if given) gets the descriptions of all changed attributes.
+	bool step(std::vector<std::string>* changes = NULL);
+	Uint64 getFrame() const { return curFrame; }
+	const GameState& getState() const { return *state; }
+};
+
+#endif
@@ -26,11 +26,15 @@
 #include "Physics.h"
 #include "DeprecatedGUI/Menu.h"
 #include "Cache.h"
+#include "Profiler.h"
+#include "Metrics.h"
+#include "game/Benchmark.h"
 #include "gusanos/gusanos.h"
 #include "gusanos/gusgame.h"
 #include "game/WormInputHandler.h"
 #include "CWormHuman.h"
 #include "gusanos/luaapi/context.h"
+#include "gusanos/luaapi/memory.h"
 #ifndef DEDICATED_ONLY
 #include "sound/sfx.h"
 #endif
@@ -652,8 +656,27 @@ struct GusSpeedScope {
 	}
 };
 
+// Frame time and the sampled game state for the metrics endpoint
+static void updateFrameMetrics(Uint64 frameTime) {
+	static const double bounds[] = { 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.25 };
+	static Metrics::Histogram& frameSeconds = Metrics::histogram("olx_frame_seconds", "Work time of a main loop frame, without the sleep of the FPS limit",
+																  bounds, sizeof(bounds) / sizeof(bounds[0]));
+	frameSeconds.observe(frameTime / 1000000.0);
+
+	static AbsTime lastSample;
+	if(tLX->currentTime - lastSample < 1.0f) return;
+	lastSample = tLX->currentTime;
+
+	static Metrics::Gauge& projectiles = Metrics::gauge("olx_projectiles", "LX56 projectiles in the game");
+	static Metrics::Gauge& luaHeap = Metrics::gauge("olx_lua_heap_bytes", "Heap of the game Lua state");
+	projectiles.set(cClient ? (double)cClient->getProjectiles().size() : 0);
+	LuaMemory* mem = luaIngame ? LuaMemory::get(luaIngame) : NULL;
+	luaHeap.set(mem ? (double)mem->bytesInUse() : 0);
+}
+
 void Game::frame() {
 	SetCrashHandlerReturnPoint("main game loop");
+	const Uint64 frameStart = Profiler::getTicks();
 
 	// Timing
 	tLX->currentTime = GetTime();
@@ -661,6 +684,8 @@ void Game::frame() {
 	tLX->fRealDeltaTime = tLX->fDeltaTime;
 	oldtime = tLX->currentTime;
 
+	if(Benchmark::isActive()) Benchmark::frameBegin();
+
 	ProcessEvents();
 
 	// Main frame
@@ -679,7 +704,14 @@ void Game::frame() {
 	if(DbgSimulateSlow) SDL_Delay(700);
 
 	doVideoFrameInMainThread();
-	CapFPS();
+	// The Lua collector does not run during the frame, it gets its time budget here.
+	luaIngame.gcFrame();
+	Profiler::frame();
+	updateFrameMetrics(Profiler::getTicks() - frameStart);
+	if(Benchmark::isActive())
+		Benchmark::frameEnd(); // advances the game time by exactly one frame, no sleeping
+	else
+		CapFPS();
 }
 
 
@@ -688,6 +720,7 @@ void Game::frame() {
 // Game loop
 void Game::frameInner()
 {
+	PROFILE_ZONE("Game::frameInner");
 	HandlePendingCommands();
 	
 	if(bDedicated)
@@ -918,6 +951,7 @@ void Game::frameInner()
 	if(state > Game::S_Inactive) {
 		// Gusanos network
 		{
+			PROFILE_ZONE("network.update");
 			GusSpeedScope speedScope;
 			network.update();
 		}
@@ -275,11 +275,13 @@ void GameStateUpdates::handleFromBs(CBytestream* bs, CServerConnection* source)
 
 void GameStateUpdates::pushObjAttrUpdate(ObjAttrRef a) {
 	objs.insert(a);
+	if(listener) listener->pushObjAttrUpdate(a);
 }
 
 void GameStateUpdates::pushObjCreation(ObjRef o) {
 	objDeletions.erase(o);
 	objCreations.insert(o);
+	if(listener) listener->pushObjCreation(o);
 }
 
 void GameStateUpdates::pushObjDeletion(ObjRef o) {
@@ -288,6 +290,7 @@ void GameStateUpdates::pushObjDeletion(ObjRef o) {
 	objs.erase(itStart, itEnd);
 	objCreations.erase(o);
 	objDeletions.insert(o);
+	if(listener) listener->pushObjDeletion(o);
 }
 
 void GameStateUpdates::reset() {
@@ -44,7 +44,10 @@ struct GameStateUpdates {
 	std::set<ObjRef> objDeletions;
 	std::set<ObjRef> objCreations;
 	Objs objs;
+	// gets the same pushes; e.g. the demo recorder collects the changes since its last record there
+	GameStateUpdates* listener;
 
+	GameStateUpdates() : listener(NULL) {}
 	operator bool() const;
 	void writeToBs(CBytestream* bs, const GameState& oldState) const;
 	static void handleFromBs(CBytestream* bs, CServerConnection* source);
@@ -7,6 +7,7 @@
  *
  */
 
+#include <algorithm>
 #include "ServerList.h"
 #include "TaskManager.h"
 #include "CBytestream.h"
@@ -21,6 +22,9 @@
 #include "IpToCountryDB.h"
 #include "FeatureList.h"
 #include "FindFile.h"
+#include "OLXCommand.h"
+#include "Profiler.h"
+#include "Debug.h"
 
 
 // TODO: move this out here
@@ -210,7 +214,10 @@ ServerList::Ptr ServerList::get()
 
 ///////////////////
 // Initialize the list
-ServerList::ServerList() {
+ServerList::ServerList() :
+	m_probesInFlight(0), m_maxProbesInFlight(DefaultProbesInFlight), m_probeSent(false),
+	m_probeWheelPos(0), m_probeWheelStarted(false)
+{
     loadList("cfg/svrlist.dat", SLFT_CustomSettings);
 	loadList("cfg/favourites.dat", SLFT_Favourites);	
 }
@@ -226,9 +233,10 @@ void ServerList::clear(SvrListFilterType filterType)
 {
 	SvrList::Writer l(psServerList);
     for(SvrList::type::iterator it = l.get().begin(); it != l.get().end();) {
-		if((*it)->matches(filterType))
+		if((*it)->matches(filterType)) {
+			forgetServer(*it);
 			it = l.get().erase(it);
-		else
+		} else
 			++it;
 	}
 }
@@ -241,9 +249,10 @@ void ServerList::clearAuto()
 	SvrList::Writer l(psServerList);
     for(SvrList::type::iterator it = l.get().begin(); it != l.get().end();)
     {
-        if(!(*it)->bManual && (*it)->matches(SLFT_CustomSettings)) 
+        if(!(*it)->bManual && (*it)->matches(SLFT_CustomSettings)) {
+			forgetServer(*it);
         	it = l.get().erase(it);
-		else
+		} else
 			it++;
     }
 }
@@ -254,6 +263,8 @@ void ServerList::clearAuto()
 void ServerList::shutdown()
 {
 	SvrList::Writer l(psServerList);
+	for(SvrList::type::iterator it = l.get().begin(); it != l.get().end(); ++it)
+		forgetServer(*it);
 	l.get().clear();
 }
 
@@ -552,6 +563,9 @@ void ServerList::refreshServer(server_t::Ptr s, bool updategui)
 	{
 		s->ports.push_back(std::make_pair((int)GetNetAddrPort(s->sAddress), -1));
 	}
+	
+	indexServer(s);
+	scheduleProbe(s);
 }
 
 
@@ -577,6 +591,7 @@ void ServerList::mergeWithNewInfo(server_t::Ptr found, const std::string& addres
 				return;
 		
 		found->ports.push_back( std::make_pair( port, udpMasterserverIndex ) );	
+		indexServer(found);
 	}
 }
 
@@ -632,8 +647,12 @@ server_t::Ptr ServerList::addServer(const std::string& address, bool bManual, co
 	else
 		svr->bBehindNat = false;
 	
-	SvrList::Writer l(psServerList);
-    l.get().push_back(svr);
+	{
+		SvrList::Writer l(psServerList);
+		l.get().push_back(svr);
+	}
+	indexServer(svr);
+	scheduleProbe(svr);
 	return svr;
 }
 
@@ -644,9 +663,10 @@ void ServerList::removeServer(const std::string& szAddress)
 {
 	SvrList::Writer l(psServerList);
 	for(SvrList::type::iterator it = l.get().begin(); it != l.get().end(); )
-		if( (*it)->szAddress == szAddress )
+		if( (*it)->szAddress == szAddress ) {
+			forgetServer(*it);
 			it = l.get().erase( it );
-		else
+		} else
 			it++;
 }
 
@@ -663,8 +683,61 @@ server_t::Ptr ServerList::findServerStr(const std::string& szAddress, const std:
 }
 
 
+namespace {
+
+// One subitem of a row in the server list
+struct SvrListCell {
+	int type;
+	std::string text;
+	SmartPointer<DynDrawIntf> image;
+	std::string tooltip;
+	SvrListCell(int t, const std::string& s, const SmartPointer<DynDrawIntf>& img = NULL, const std::string& tip = "") :
+		type(t), text(s), image(img), tooltip(tip) {}
+};
+
+void addSvrListCell(std::vector<SvrListCell>& cells, int type, const std::string& text, const SmartPointer<DynDrawIntf>& img = NULL, const std::string& tooltip = "") {
+	// CListview::AddSubitem drops images without a surface, so we do too
+	if(type == DeprecatedGUI::LVS_IMAGE && !img.get()) return;
+	cells.push_back(SvrListCell(type, text, img, tooltip));
+}
+
+enum SvrListRowUpdate { SLRU_Unchanged, SLRU_Updated, SLRU_Rebuild };
+
+// Updates the row in place if it has the same subitems and only texts, images or colours changed
+SvrListRowUpdate updateSvrListRow(DeprecatedGUI::lv_item_t* item, Color colour, const std::vector<SvrListCell>& cells) {
+	size_t n = 0;
+	for(DeprecatedGUI::lv_subitem_t* sub = item->tSubitems; sub; sub = sub->tNext, ++n)
+		if(n >= cells.size() || sub->iType != cells[n].type)
+			return SLRU_Rebuild;
+	if(n != cells.size())
+		return SLRU_Rebuild;
+	
+	SvrListRowUpdate result = SLRU_Unchanged;
+	if(item->iColour != colour) {
+		item->iColour = colour;
+		result = SLRU_Updated;
+	}
+	n = 0;
+	for(DeprecatedGUI::lv_subitem_t* sub = item->tSubitems; sub; sub = sub->tNext, ++n) {
+		const SvrListCell& c = cells[n];
+		// images have a text which identifies them (e.g. the ping class), so comparing that is enough
+		if(sub->sText == c.text && sub->sTooltip == c.tooltip && sub->iColour == colour)
+			continue;
+		sub->sText = c.text;
+		sub->sTooltip = c.tooltip;
+		sub->iColour = colour;
+		if(c.type == DeprecatedGUI::LVS_IMAGE)
+			sub->bmpImage = c.image;
+		result = SLRU_Updated;
+	}
+	return result;
+}
+
+}
+
 ///////////////////
 // Fill a listview box with the server list
+// Only rows which changed are touched, so it can be called after every received pong
 void ServerList::fillList(DeprecatedGUI::CListview *lv, SvrListFilterType filterType, SvrListSettingsFilter::Ptr settingsFilter)
 {
 	if (!lv)
@@ -672,24 +745,35 @@ void ServerList::fillList(DeprecatedGUI::CListview *lv, SvrListFilterType filter
 	
 	std::string		addr;
 	static const std::string states[] = {"Open", "Loading", "Playing", "Open/Loading", "Open/Playing"};
+	static const int StaleRow = -1;
 	
-    // Store the ID of the currently selected item
+    // Store the selected server, and its position in case it is removed
+	const std::string curAddr = lv->getCurSIndex();
     int curID = lv->getSelectedID();
 	
-	lv->SaveScrollbarPos();
-	lv->Clear();
+	// The rows we have already. All are stale until a server claims them.
+	typedef std::unordered_map<std::string, DeprecatedGUI::lv_item_t*> Rows;
+	Rows rows;
+	for(DeprecatedGUI::lv_item_t* it = lv->getItems(); it; it = it->tNext) {
+		rows.insert(Rows::value_type(it->sIndex, it));
+		it->iIndex = StaleRow;
+	}
 	
 	SvrList::type serverList;
 	{
 		SvrList::Reader l(psServerList);
 		serverList = l.get();
 	}
+	bool changed = false;
+	std::vector<SvrListCell> cells;
 	for(SvrList::type::const_iterator i = serverList.begin(); i != serverList.end(); i++)
 	{
 		const SvrList::type::value_type& s = *i;
 		if(!s->matches(filterType, settingsFilter)) continue;
 		
-		bool processing = s->bProcessing && !getUdpMasterserverForServer( s->szAddress );
+		// only NAT servers can be registered at an UDP masterserver, don't read the list for the others
+		const bool natViaMasterserver = s->bBehindNat && getUdpMasterserverForServer( s->szAddress );
+		bool processing = s->bProcessing && !natViaMasterserver;
 		
 		// Ping Image
 		int num = 3;
@@ -702,10 +786,6 @@ void ServerList::fillList(DeprecatedGUI::CListview *lv, SvrListFilterType filter
 		
 		if(s->nPing == -2)	num = 4; // Server behind a NAT
 		
-		// Address
-		//GetRemoteNetAddr(tSocket, &s->sAddress);
-		//NetAddrToString(&s->sAddress, addr);
-		
 		// show port if special
 		addr = s->szAddress;
 		size_t p = addr.rfind(':');
@@ -728,33 +808,29 @@ void ServerList::fillList(DeprecatedGUI::CListview *lv, SvrListFilterType filter
 		if(processing)
 			colour = tLX->clDisabled;
 		
-		
-		// Add the server to the list
-		lv->AddItem(s->szAddress, 0, colour);
-		lv->AddSubitem(DeprecatedGUI::LVS_IMAGE, itoa(num,10), DeprecatedGUI::tMenu->bmpConnectionSpeeds[num], NULL);
-		lv->AddSubitem(DeprecatedGUI::LVS_TEXT, s->szName, (DynDrawIntf*)NULL, NULL);
+		cells.clear();
+		addSvrListCell(cells, DeprecatedGUI::LVS_IMAGE, itoa(num,10), DynDrawFromSurface(DeprecatedGUI::tMenu->bmpConnectionSpeeds[num]));
+		addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, s->szName);
         if(processing) {
 			if(IsNetAddrValid(s->sAddress))
-				lv->AddSubitem(DeprecatedGUI::LVS_TEXT, "Querying...", (DynDrawIntf*)NULL, NULL);
+				addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, "Querying...");
 			else
-				lv->AddSubitem(DeprecatedGUI::LVS_TEXT, "Lookup...", (DynDrawIntf*)NULL, NULL);
+				addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, "Lookup...");
         } else if( num == 3 )
-            lv->AddSubitem(DeprecatedGUI::LVS_TEXT, "Down", (DynDrawIntf*)NULL, NULL);
+            addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, "Down");
         else
-		    lv->AddSubitem(DeprecatedGUI::LVS_TEXT, states[state], (DynDrawIntf*)NULL, NULL);
+		    addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, states[state]);
 		
-		bool unknownData = ( s->bProcessing || num == 3 ) && 
-			!getUdpMasterserverForServer( s->szAddress );
+		bool unknownData = ( s->bProcessing || num == 3 ) && !natViaMasterserver;
 		
 		// Players
-		lv->AddSubitem(DeprecatedGUI::LVS_TEXT,
-					   unknownData ? "?" : (itoa(s->nNumPlayers,10)+"/"+itoa(s->nMaxPlayers,10)),
-					   (DynDrawIntf*)NULL, NULL);
+		addSvrListCell(cells, DeprecatedGUI::LVS_TEXT,
+					   unknownData ? "?" : (itoa(s->nNumPlayers,10)+"/"+itoa(s->nMaxPlayers,10)));
 		
 		if (s->nPing <= -2) // Server behind a NAT or not queried, it will add spaces if s->nPing == -3 so not queried servers will be below NAT ones
-			lv->AddSubitem(DeprecatedGUI::LVS_TEXT, "N/A" + std::string(' ', -2 - s->nPing), (DynDrawIntf*)NULL, NULL);
+			addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, "N/A" + std::string(' ', -2 - s->nPing));
 		else
-			lv->AddSubitem(DeprecatedGUI::LVS_TEXT, unknownData ? "∞" : itoa(s->nPing,10), (DynDrawIntf*)NULL, NULL); // TODO: the infinity symbol isn't shown correctly
+			addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, unknownData ? "∞" : itoa(s->nPing,10)); // TODO: the infinity symbol isn't shown correctly
 		
 		// Country
 		if (tLXOptions->bUseIpToCountry) {
@@ -763,22 +839,51 @@ void ServerList::fillList(DeprecatedGUI::CListview *lv, SvrListFilterType filter
 			{
 				SmartPointer<SDL_Surface> flag = tIpToCountryDB->GetCountryFlag(inf.countryCode);
 				if (flag.get())
-					lv->AddSubitem(DeprecatedGUI::LVS_IMAGE, "", flag, NULL, DeprecatedGUI::VALIGN_MIDDLE, inf.countryName);
+					addSvrListCell(cells, DeprecatedGUI::LVS_IMAGE, "", DynDrawFromSurface(flag), inf.countryName);
 				else
-					lv->AddSubitem(DeprecatedGUI::LVS_TEXT, inf.countryCode, (DynDrawIntf*)NULL, NULL);
+					addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, inf.countryCode);
 			}
 			else
 			{
-				lv->AddSubitem(DeprecatedGUI::LVS_TEXT, inf.countryName, (DynDrawIntf*)NULL, NULL);
+				addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, inf.countryName);
 			}
 		}
 		
 		// Address
-		lv->AddSubitem(DeprecatedGUI::LVS_TEXT, addr, (DynDrawIntf*)NULL, NULL);
+		addSvrListCell(cells, DeprecatedGUI::LVS_TEXT, addr);
+		
+		// Update the row of the server if we have one
+		Rows::iterator row = rows.find(s->szAddress);
+		if(row != rows.end() && row->second) {
+			DeprecatedGUI::lv_item_t* item = row->second;
+			row->second = NULL; // another server with the same address gets its own row
+			SvrListRowUpdate u = updateSvrListRow(item, colour, cells);
+			if(u != SLRU_Rebuild) {
+				item->iIndex = 0;
+				if(u == SLRU_Updated) changed = true;
+				continue;
+			}
+		}
+		
+		// Add the server to the list
+		changed = true;
+		lv->AddItem(s->szAddress, 0, colour);
+		for(size_t c = 0; c < cells.size(); ++c)
+			lv->AddSubitem(cells[c].type, cells[c].text, cells[c].image, NULL, DeprecatedGUI::VALIGN_MIDDLE, cells[c].tooltip);
 	}
 	
+	bool haveStaleRows = false;
+	for(DeprecatedGUI::lv_item_t* it = lv->getItems(); it && !haveStaleRows; it = it->tNext)
+		haveStaleRows = it->iIndex == StaleRow;
+	if(!changed && !haveStaleRows)
+		return;
+	
+	lv->SaveScrollbarPos();
+	if(haveStaleRows)
+		lv->RemoveItem(StaleRow);
 	lv->ReSort();
-    lv->setSelectedID(curID);
+	DeprecatedGUI::lv_item_t* selected = curAddr.empty() ? NULL : lv->getItem(curAddr);
+    lv->setSelectedID(selected ? selected->_iID : curID);
 	lv->RestoreScrollbarPos();
 }
 
@@ -791,6 +896,11 @@ bool ServerList::process()
 	CBytestream		bs;
 	bool			update = false;
 	
+	if(!m_probeWheelStarted) {
+		m_probeWheelTime = tLX->currentTime;
+		m_probeWheelStarted = true;
+	}
+	m_probeSent = false;
 	
 	// Process any packets on the net socket
 	while(bs.Read(tSocket[SCK_NET])) {
@@ -813,86 +923,177 @@ bool ServerList::process()
 		update = true;
 	}
 	
-	bool repaint = false;
+	// Ping or Query the servers which need it
+	processProbes(update);
 	
+	// Make sure the list repaints when the ping/query is received
+	if (m_probeSent)
+		Timer("Menu_SvrList_Process ping waiter", null, NULL, PingWait + 100, true).startHeadless();
 	
-	// Ping or Query any servers in the list that need it
-	SvrList::Reader l(psServerList);
-	for(SvrList::type::const_iterator i = l.get().begin(); i != l.get().end(); i++)
-	{
-		const SvrList::type::value_type& s = *i;
-		
-		// Ignore this server? (timed out)
-		if(s->bIgnore)
-			continue;
-		
-		if(!IsNetAddrValid(s->sAddress)) {
-			if(tLX->currentTime - s->fInitTime >= DNS_TIMEOUT) {
-				s->bIgnore = true; // timeout
-				update = true;
-			}
-			continue;
-		} else {
-			if(!s->bAddrReady) {
-				s->bAddrReady = true;
-				update = true;
-				
-				size_t f = s->szAddress.find(":");
-				if(f != std::string::npos) {
-					SetNetAddrPort(s->sAddress, from_string<int>(s->szAddress.substr(f + 1)));
-				} else
-					SetNetAddrPort(s->sAddress, LX_PORT);
-				
-			}
+	return update;
+}
+
+
+///////////////////
+// Queue a server for pinging and querying
+void ServerList::scheduleProbe(const server_t::Ptr& s)
+{
+	Mutex::ScopedLock lock(m_probeMutex);
+	// If it is being probed already, probeStep sees the new state by itself
+	if(s->probeState != server_t::PS_Idle)
+		return;
+	s->probeState = server_t::PS_Queued;
+	m_probeQueue.push_back(s);
+}
+
+///////////////////
+// Let the probe of the server continue at the given time
+void ServerList::scheduleProbeAt(const server_t::Ptr& s, const AbsTime& t)
+{
+	size_t slot = 0;
+	if(t > m_probeWheelTime) {
+		Uint64 slots = ((t - m_probeWheelTime).milliseconds() + ProbeWheelSlotMs - 1) / ProbeWheelSlotMs;
+		// a later time wraps around, probeStep then just schedules it again
+		slot = (size_t)MIN(slots, (Uint64)ProbeWheelSlots - 1);
+	}
+	s->probeSerial++;
+	m_probeWheel[(m_probeWheelPos + slot) % ProbeWheelSlots].push_back(ProbeTimer(s, s->probeSerial));
+}
+
+///////////////////
+// Send the next ping or query of the server if it is due, and schedule the next step.
+// Returns false if the server is done (it answered the query or it timed out).
+bool ServerList::probeStep(const server_t::Ptr& s, bool& update)
+{
+	// Ignore this server? (timed out or removed)
+	if(s->bIgnore)
+		return false;
+	
+	if(!IsNetAddrValid(s->sAddress)) {
+		if(tLX->currentTime - s->fInitTime >= DNS_TIMEOUT) {
+			s->bIgnore = true; // timeout
+			s->bProcessing = false;
+			update = true;
+			return false;
 		}
+		scheduleProbeAt(s, tLX->currentTime + TimeDiff((int)DnsPollMs));
+		return true;
+	}
+	
+	if(!s->bAddrReady) {
+		s->bAddrReady = true;
+		update = true;
 		
-		// Need a pingin'?
-		if(!s->bgotPong) {
-			if(tLX->currentTime - s->fLastPing > (float)PingWait / 1000.0f) {
-				
-				if(s->nPings >= MaxPings) {
-					s->bIgnore = true;
-					
-					update = true;
-				}
-				else  {
-					// Ping the server
-					pingServer(s);
-					repaint = true;
-				}
+		size_t f = s->szAddress.find(":");
+		if(f != std::string::npos) {
+			SetNetAddrPort(s->sAddress, from_string<int>(s->szAddress.substr(f + 1)));
+		} else
+			SetNetAddrPort(s->sAddress, LX_PORT);
+		indexServer(s);
+	}
+	
+	// Need a pingin'?
+	if(!s->bgotPong) {
+		if(tLX->currentTime - s->fLastPing > (float)PingWait / 1000.0f) {
+			if(s->nPings >= MaxPings) {
+				s->bIgnore = true;
+				s->bProcessing = false;
+				update = true;
+				return false;
 			}
+			pingServer(s);
+			m_probeSent = true;
 		}
-		
-		// Need a querying?
-		if(s->bgotPong && !s->bgotQuery) {
-			if(tLX->currentTime - s->fLastQuery > (float)QueryWait / 1000.0f) {
-				
-				if(s->nQueries >= MaxQueries) {
-					s->bIgnore = true;
-					
-					update = true;
-				}
-				else  {
-					// Query the server
-					queryServer(s);
-					repaint = true;
-				}
+		AbsTime next = s->fLastPing + TimeDiff(PingWait + 1);
+		if(next <= tLX->currentTime) // the ping could not be sent
+			next = tLX->currentTime + TimeDiff(PingWait);
+		scheduleProbeAt(s, next);
+		return true;
+	}
+	
+	// Need a querying?
+	if(!s->bgotQuery) {
+		if(tLX->currentTime - s->fLastQuery > (float)QueryWait / 1000.0f) {
+			if(s->nQueries >= MaxQueries) {
+				s->bIgnore = true;
+				s->bProcessing = false;
+				update = true;
+				return false;
 			}
+			queryServer(s);
+			m_probeSent = true;
 		}
-		
-		// If we are ignoring this server now, set it to not processing
-		if(s->bIgnore) {
-			s->bProcessing = false;
-			update = true;
-		}
-		
+		scheduleProbeAt(s, s->fLastQuery + TimeDiff(QueryWait + 1));
+		return true;
 	}
 	
-	// Make sure the list repaints when the ping/query is received
-	if (repaint)
-		Timer("Menu_SvrList_Process ping waiter", null, NULL, PingWait + 100, true).startHeadless();
+	return false;
+}
+
+void ServerList::runProbe(const server_t::Ptr& s, bool& update)
+{
+	if(!probeStep(s, update))
+		finishProbe(s);
+}
+
+void ServerList::finishProbe(const server_t::Ptr& s)
+{
+	s->probeSerial++; // drops its timer
+	Mutex::ScopedLock lock(m_probeMutex);
+	m_probesInFlight--;
+	// another thread could have reset it meanwhile, e.g. the UDP masterserver list
+	if(!s->bIgnore && !s->bgotQuery) {
+		s->probeState = server_t::PS_Queued;
+		m_probeQueue.push_back(s);
+	}
+	else
+		s->probeState = server_t::PS_Idle;
+}
+
+// A pong or a query return arrived. Go on right away (i.e. send the query) if the server is being probed.
+void ServerList::continueProbe(const server_t::Ptr& s, bool& update)
+{
+	if(s->probeState == server_t::PS_Active)
+		runProbe(s, update);
+	else
+		scheduleProbe(s);
+}
+
+///////////////////
+// Run the due timers and start queued probes, as far as the in-flight limit allows
+void ServerList::processProbes(bool& update)
+{
+	// After a long break (e.g. the game was running), run all slots once and go on from now
+	const TimeDiff wheelSpan((int)(ProbeWheelSlots * ProbeWheelSlotMs));
+	if(m_probeWheelTime + wheelSpan < tLX->currentTime)
+		m_probeWheelTime = tLX->currentTime - wheelSpan;
+	
+	while(m_probeWheelTime <= tLX->currentTime) {
+		std::vector<ProbeTimer> due;
+		due.swap(m_probeWheel[m_probeWheelPos]);
+		// advance first, timers scheduled from here go into the following slots
+		m_probeWheelPos = (m_probeWheelPos + 1) % ProbeWheelSlots;
+		m_probeWheelTime += TimeDiff((int)ProbeWheelSlotMs);
+		for(size_t i = 0; i < due.size(); ++i)
+			if(due[i].serial == due[i].server->probeSerial)
+				runProbe(due[i].server, update);
+	}
 	
-	return update;
+	while(true) {
+		server_t::Ptr s;
+		{
+			Mutex::ScopedLock lock(m_probeMutex);
+			if(m_probesInFlight >= m_maxProbesInFlight || m_probeQueue.empty())
+				break;
+			s = m_probeQueue.front();
+			m_probeQueue.pop_front();
+			if(s->probeState != server_t::PS_Queued)
+				continue;
+			s->probeState = server_t::PS_Active;
+			m_probesInFlight++;
+		}
+		runProbe(s, update);
+	}
 }
 
 
@@ -927,6 +1128,8 @@ bool ServerList::parsePacket(CBytestream *bs, const SmartPointer<NetworkSocket>&
 				NetAddrToString(svr->sAddress, svr->szAddress);
 				svr->ports.clear();
 				svr->ports.push_back( std::make_pair( (int)GetNetAddrPort(adrFrom), -1 ) );
+				indexServer(svr);
+				continueProbe(svr, update);
 				
 			} else {
 				
@@ -944,6 +1147,7 @@ bool ServerList::parsePacket(CBytestream *bs, const SmartPointer<NetworkSocket>&
 					svr->bgotPong = true;
 					svr->nQueries = 0;
 					svr->isLan = true;
+					continueProbe(svr, update);
 					
 					//Menu_SvrList_RemoveDuplicateNATServers(svr); // We don't know the name of server yet
 				}
@@ -964,6 +1168,7 @@ bool ServerList::parsePacket(CBytestream *bs, const SmartPointer<NetworkSocket>&
 				svr->bgotQuery = true;
 				svr->bBehindNat = false;
 				parseQuery(svr, bs);
+				continueProbe(svr, update);
 				
 			}
 			
@@ -982,50 +1187,119 @@ bool ServerList::parsePacket(CBytestream *bs, const SmartPointer<NetworkSocket>&
 }
 
 
+// The IP of the address as string, without the port
+static std::string AddrIndexIp(const NetworkAddr& addr)
+{
+	std::string ip = NetAddrToString(addr);
+	size_t p = ip.rfind(':');
+	if(p != std::string::npos)
+		ip.erase(p);
+	return ip;
+}
+
+///////////////////
+// Put the server into the address index, or update it there after its address or ports changed
+void ServerList::indexServer(const server_t::Ptr& s)
+{
+	std::vector<std::string> keys;
+	if(IsNetAddrValid(s->sAddress)) {
+		const std::string ip = AddrIndexIp(s->sAddress);
+		keys.push_back(ip);
+		keys.push_back(ip + ":" + itoa(GetNetAddrPort(s->sAddress)));
+		for(size_t i = 0; i < s->ports.size(); i++)
+			keys.push_back(ip + ":" + itoa(s->ports[i].first));
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	}
+	
+	Mutex::ScopedLock lock(m_indexMutex);
+	if(keys == s->indexKeys) return;
+	for(size_t i = 0; i < s->indexKeys.size(); i++) {
+		AddrIndex::iterator f = m_addrIndex.find(s->indexKeys[i]);
+		if(f == m_addrIndex.end()) continue;
+		f->second.erase(std::remove(f->second.begin(), f->second.end(), s), f->second.end());
+		if(f->second.empty()) m_addrIndex.erase(f);
+	}
+	for(size_t i = 0; i < keys.size(); i++)
+		m_addrIndex[keys[i]].push_back(s);
+	s->indexKeys.swap(keys);
+}
+
+void ServerList::unindexServer(const server_t::Ptr& s)
+{
+	Mutex::ScopedLock lock(m_indexMutex);
+	for(size_t i = 0; i < s->indexKeys.size(); i++) {
+		AddrIndex::iterator f = m_addrIndex.find(s->indexKeys[i]);
+		if(f == m_addrIndex.end()) continue;
+		f->second.erase(std::remove(f->second.begin(), f->second.end(), s), f->second.end());
+		if(f->second.empty()) m_addrIndex.erase(f);
+	}
+	s->indexKeys.clear();
+}
+
+///////////////////
+// The server is removed from the list
+void ServerList::forgetServer(const server_t::Ptr& s)
+{
+	unindexServer(s);
+	s->bIgnore = true; // a running probe stops with this
+}
+
+
 ///////////////////
 // Find a server from the list by address
 server_t::Ptr ServerList::findServer(const NetworkAddr& addr, const std::string & name)
 {
-	SvrList::Reader l(psServerList);
-	for(SvrList::type::const_iterator s = l.get().begin(); s != l.get().end(); s++)
+	if(!IsNetAddrValid(addr))
+		return server_t::Ptr((server_t*)NULL);
+	
+	// Only servers with the same IP can match
+	const std::string ip = AddrIndexIp(addr);
+	std::vector<server_t::Ptr> samePort, sameIp;
 	{
-		if( AreNetAddrEqual( addr, (*s)->sAddress ) )
-			return *s;
+		Mutex::ScopedLock lock(m_indexMutex);
+		AddrIndex::const_iterator f = m_addrIndex.find(ip + ":" + itoa(GetNetAddrPort(addr)));
+		if(f != m_addrIndex.end()) samePort = f->second;
+		if(name != "Untitled") {
+			f = m_addrIndex.find(ip);
+			if(f != m_addrIndex.end()) sameIp = f->second;
+		}
 	}
 	
-    NetworkAddr addr1 = addr;
-    SetNetAddrPort(addr1, LX_PORT);
+	for(size_t i = 0; i < samePort.size(); i++)
+	{
+		if( AreNetAddrEqual( addr, samePort[i]->sAddress ) )
+			return samePort[i];
+	}
 	
-	for(SvrList::type::const_iterator i = l.get().begin(); i != l.get().end(); i++)
+	for(size_t i = 0; i < samePort.size(); i++)
 	{
-		const SvrList::type::value_type& s = *i;
+		const server_t::Ptr& s = samePort[i];
 		
 		// Check if any port number match from the server entry
 		NetworkAddr addr2 = s->sAddress;
-		for( size_t i = 0; i < s->ports.size(); i++ )
+		for( size_t p = 0; p < s->ports.size(); p++ )
 		{
-			SetNetAddrPort(addr2, s->ports[i].first);
+			SetNetAddrPort(addr2, s->ports[p].first);
 			if( AreNetAddrEqual( addr, addr2 ) )
 				return s;
 		}
+	}
+	
+    NetworkAddr addr1 = addr;
+    SetNetAddrPort(addr1, LX_PORT);
+	
+	for(size_t i = 0; i < sameIp.size(); i++)
+	{
+		const server_t::Ptr& s = sameIp[i];
 		
 		// Check if IP without port and name match
+		NetworkAddr addr2 = s->sAddress;
 		SetNetAddrPort(addr2, LX_PORT);
-		if( AreNetAddrEqual( addr1, addr2 ) && name == s->szName && name != "Untitled" )
+		if( name == s->szName && AreNetAddrEqual( addr1, addr2 ) )
 			return s;
 	}
 	
-	/*
-	 for(std::list<server_t>::iterator s = psServerList.begin(); s != psServerList.end(); s++)
-	 {
-	 // Check if just an IP without port match
-	 NetworkAddr addr2 = s->sAddress;
-	 SetNetAddrPort(addr2, LX_PORT);
-	 if( AreNetAddrEqual( addr1, addr2 ) )
-	 return &(*s);
-	 }
-	 */
-	
 	// None found
 	return server_t::Ptr((server_t*)NULL);
 }
@@ -1069,17 +1343,25 @@ void ServerList::parseQuery(server_t::Ptr svr, CBytestream *bs)
 	}
 	
 	// We got server name in a query. let's remove servers with the same name and IP, which we got from UDP masterserver
+	std::vector<server_t::Ptr> duplicates;
+	{
+		Mutex::ScopedLock lock(m_indexMutex);
+		AddrIndex::const_iterator f = m_addrIndex.find(AddrIndexIp(svr->sAddress));
+		if(f != m_addrIndex.end())
+			for(size_t i = 0; i < f->second.size(); i++)
+				if( f->second[i] != svr && f->second[i]->szName == svr->szName )
+					duplicates.push_back(f->second[i]);
+	}
+	if(duplicates.empty()) return;
+	
 	SvrList::Writer l(psServerList);
 	for(SvrList::type::iterator it = l.get().begin(); it != l.get().end(); )
 	{
-		NetworkAddr addr1 = (*it)->sAddress;
-		SetNetAddrPort(addr1, LX_PORT);
-		NetworkAddr addr2 = svr->sAddress;
-		SetNetAddrPort(addr2, LX_PORT);
-		if( (*it)->szName == svr->szName && AreNetAddrEqual(addr1, addr2) && svr != *it )
+		if( std::find(duplicates.begin(), duplicates.end(), *it) != duplicates.end() )
 		{
 			//Duplicate server - delete it
 			//hints << "Menu_SvrList_ParseQuery(): removing duplicate " << it->szName << " " << it->szAddress << endl;
+			forgetServer(*it);
 			it = l.get().erase(it);
 		}
 		else
@@ -1294,6 +1576,7 @@ std::string ServerList::parseUdpServerlist(CBytestream *bs, int UdpMasterserverI
 		svr->tVersion = version;
 		svr->bAllowConnectDuringGame = allowConnectDuringGame;
 		svr->bBehindNat = true;
+		scheduleProbe(svr);
 	}
 	
 	return "";
@@ -1520,7 +1803,7 @@ bool ServerList::isProcessing() {
 	for(SvrList::type::const_iterator i = serverList.begin(); i != serverList.end(); i++)
 	{
 		const SvrList::type::value_type& s = *i;		
-		bool processing = s->bProcessing && !getUdpMasterserverForServer( s->szAddress );
+		bool processing = s->bProcessing && !(s->bBehindNat && getUdpMasterserverForServer( s->szAddress ));
 		if(processing) return true;
 	}
 	
@@ -1528,6 +1811,116 @@ bool ServerList::isProcessing() {
 	return false;
 }
 
+// Answers pings and queries like a game server would, for benchmarkRefresh
+static void AnswerBenchmarkProbes(NetworkSocket* sock, const std::string& name)
+{
+	CBytestream bs;
+	while(bs.Read(sock)) {
+		if(bs.readInt(4) != -1) continue;
+		const std::string cmd = bs.readString();
+		CBytestream reply;
+		reply.writeInt(-1, 4);
+		if(cmd == "lx::ping")
+			reply.writeString("lx::pong");
+		else if(cmd == "lx::query") {
+			int num = bs.readByte();
+			reply.writeString("lx::queryreturn");
+			reply.writeString(name);
+			reply.writeByte(0); // players
+			reply.writeByte(8); // max players
+			reply.writeByte(0); // state
+			reply.writeByte(num);
+			reply.writeString(GetGameVersion().asString());
+			reply.writeByte(0); // connect during game
+		}
+		else
+			continue;
+		// Read has set the remote address to the sender
+		reply.Send(sock);
+	}
+}
+
+void ServerList::benchmarkRefresh(CmdLineIntf& cli, int servers, int maxProbesInFlight)
+{
+	if(!DeprecatedGUI::tMenu || !DeprecatedGUI::tMenu->tSocket[SCK_NET].get() || !DeprecatedGUI::tMenu->tSocket[SCK_NET]->isOpen()) {
+		cli.writeMsg("the server list sockets are not open, run this from the network menu", CNC_ERROR);
+		return;
+	}
+	
+	// Servers are identified by their address, so every fake server needs its own socket
+	std::vector<NetworkSocket*> fakeSockets;
+	for(int i = 0; i < servers; ++i) {
+		NetworkSocket* sock = new NetworkSocket();
+		if(!sock->OpenUnreliable(0)) {
+			delete sock;
+			cli.writeMsg("could open only " + itoa(fakeSockets.size()) + " sockets", CNC_WARNING);
+			break;
+		}
+		fakeSockets.push_back(sock);
+	}
+	
+	std::vector<server_t::Ptr> fakeServers;
+	for(size_t i = 0; i < fakeSockets.size(); ++i)
+		fakeServers.push_back(addServer("127.0.0.1:" + itoa(GetNetAddrPort(fakeSockets[i]->localAddress())), false, "benchmark " + itoa(i)));
+	
+	const int oldMaxProbes = m_maxProbesInFlight;
+	m_maxProbesInFlight = maxProbesInFlight;
+	
+	// a listview like in the internet menu, to include the GUI updates
+	DeprecatedGUI::CListview lv;
+	lv.Setup(0, 0, 0, 600, 400);
+	lv.Create();
+	const char* columns[] = { "", "Server Name", "State", "Players", "Ping", "Country", "Address" };
+	for(size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); ++i)
+		if(tLXOptions->bUseIpToCountry || std::string(columns[i]) != "Country")
+			lv.AddColumn(columns[i], 80);
+	lv.SetSortColumn(4, true);
+	
+	const AbsTime start = GetTime();
+	Uint64 processTime = 0, fillTime = 0;
+	int frames = 0, fills = 0;
+	size_t answered = 0, done = 0;
+	refreshList();
+	while(true) {
+		tLX->currentTime = GetTime();
+		Uint64 t = Profiler::getTicks();
+		bool update = process();
+		processTime += Profiler::getTicks() - t;
+		if(update) {
+			t = Profiler::getTicks();
+			fillList(&lv, SLFT_CustomSettings);
+			fillTime += Profiler::getTicks() - t;
+			fills++;
+		}
+		frames++;
+		
+		for(size_t i = 0; i < fakeSockets.size(); ++i)
+			AnswerBenchmarkProbes(fakeSockets[i], fakeServers[i]->szName);
+		
+		answered = done = 0;
+		for(size_t i = 0; i < fakeServers.size(); ++i) {
+			if(fakeServers[i]->bgotQuery) answered++;
+			if(fakeServers[i]->bgotQuery || fakeServers[i]->bIgnore) done++;
+		}
+		if(done == fakeServers.size() || GetTime() - start > 60.0f)
+			break;
+		SDL_Delay(5); // like a frame
+	}
+	const TimeDiff wallTime = GetTime() - start;
+	
+	m_maxProbesInFlight = oldMaxProbes;
+	for(size_t i = 0; i < fakeServers.size(); ++i)
+		removeServer(fakeServers[i]->szAddress);
+	for(size_t i = 0; i < fakeSockets.size(); ++i) {
+		fakeSockets[i]->Close();
+		delete fakeSockets[i];
+	}
+	
+	cli.writeMsg("refreshed " + itoa(answered) + "/" + itoa(fakeServers.size()) + " fake servers with at most " +
+				 itoa(maxProbesInFlight) + " in flight in " + itoa(wallTime.milliseconds()) + " ms (" + itoa(frames) + " frames)");
+	cli.writeMsg("process: " + itoa(processTime / 1000) + " ms, fillList: " + itoa(fillTime / 1000) + " ms in " + itoa(fills) + " updates");
+}
+
 
 bool SvrListSettingsFilter::loadFromFile(const std::string& cfgfile) {
 	// TODO ...
@@ -13,10 +13,14 @@
 #include <string>
 #include <map>
 #include <list>
+#include <deque>
+#include <vector>
+#include <unordered_map>
 #include <boost/shared_ptr.hpp>
 #include "Networking.h"
 #include "CScriptableVars.h"
 #include "ThreadVar.h"
+#include "Mutex.h"
 #include "Version.h"
 
 enum {
@@ -49,6 +53,8 @@ struct server_t {
 		bBehindNat = false;
 		lastPingedPort = 0;
 		isLan = isFavourite = false;
+		probeState = PS_Idle;
+		probeSerial = 0;
 	}
 	
 	bool	bIgnore;
@@ -86,6 +92,12 @@ struct server_t {
 	bool	isLan;
 	bool	isFavourite;
 	
+	// Bookkeeping of ServerList, see ServerList::probeStep and ServerList::indexServer
+	enum ProbeState { PS_Idle, PS_Queued, PS_Active };
+	ProbeState probeState;
+	int		probeSerial; // timeout wheel entries with an older serial are outdated
+	std::vector<std::string> indexKeys;
+	
 	std::string serverID;
 	typedef std::map<std::string, ScriptVar_t> SettingsMap;
 	SettingsMap settings;	
@@ -155,6 +167,7 @@ struct UdpMasterserverInfo {
 
 typedef ThreadVar< std::list<server_t::Ptr> > SvrList;
 namespace DeprecatedGUI { class CListview; }
+struct CmdLineIntf;
 
 // Server list
 class ServerList  {
@@ -174,6 +187,47 @@ private:
 	SvrList psServerList;
 	static Ptr m_instance;
 
+	/*
+	 Every server which needs a ping and a query gets into the probe queue.
+	 At most m_maxProbesInFlight of them are probed at the same time, the
+	 others wait. A pong is answered with the query right away. Retries and
+	 timeouts are kept in a timing wheel, so process() only looks at the
+	 servers which have something to do.
+	 The queue can be filled from any thread (the list updaters add servers),
+	 the wheel is only used by the main thread.
+	*/
+	enum { ProbeWheelSlots = 64, ProbeWheelSlotMs = 50, DefaultProbesInFlight = 32, DnsPollMs = 100 };
+	struct ProbeTimer {
+		server_t::Ptr server;
+		int serial;
+		ProbeTimer(const server_t::Ptr& s, int n) : server(s), serial(n) {}
+	};
+	Mutex m_probeMutex;
+	std::deque<server_t::Ptr> m_probeQueue;
+	int m_probesInFlight;
+	int m_maxProbesInFlight;
+	bool m_probeSent;
+	std::vector<ProbeTimer> m_probeWheel[ProbeWheelSlots];
+	size_t m_probeWheelPos;
+	AbsTime m_probeWheelTime; // when the slot at m_probeWheelPos is due
+	bool m_probeWheelStarted;
+
+	// "ip" and "ip:port" (of the address and all known ports) -> servers, for findServer
+	typedef std::unordered_map< std::string, std::vector<server_t::Ptr> > AddrIndex;
+	Mutex m_indexMutex;
+	AddrIndex m_addrIndex;
+
+	void scheduleProbe(const server_t::Ptr& s);
+	void scheduleProbeAt(const server_t::Ptr& s, const AbsTime& t);
+	bool probeStep(const server_t::Ptr& s, bool& update);
+	void runProbe(const server_t::Ptr& s, bool& update);
+	void finishProbe(const server_t::Ptr& s);
+	void continueProbe(const server_t::Ptr& s, bool& update);
+	void processProbes(bool& update);
+	void indexServer(const server_t::Ptr& s);
+	void unindexServer(const server_t::Ptr& s);
+	void forgetServer(const server_t::Ptr& s);
+
 	void saveList(const std::string& szFilename, SvrListFilterType filterType, SvrListSettingsFilter::Ptr settingsFilter = SvrListSettingsFilter::Ptr((SvrListSettingsFilter*)NULL));
 	void loadList(const std::string& szFilename, SvrListFilterType filterType);
 	void mergeWithNewInfo(server_t::Ptr found, const std::string& address, const std::string & name, int udpMasterserverIndex);
@@ -212,6 +266,9 @@ public:
 
 	void fillList(DeprecatedGUI::CListview *lv, SvrListFilterType filterType, SvrListSettingsFilter::Ptr settingsFilter = SvrListSettingsFilter::Ptr((SvrListSettingsFilter*)NULL));
 
+	// Refreshes the given number of fake servers on localhost and prints how long it took
+	void benchmarkRefresh(CmdLineIntf& cli, int servers, int maxProbesInFlight);
+
 	void each(Action& act);
 	void eachConst(Action& act) const;
 
@@ -4,35 +4,63 @@
 
 #include "LuaCallbacks.h"
 #include "CWormHuman.h"
+#include "OLXCommand.h"
+#include "StringUtils.h"
+#include "MathLib.h"
+#include "Profiler.h"
 
-void LuaCallbackProxy::_pushFunc(LuaCallbackRef& c) {
-	c.context.push(LuaContext::errorReport);
-	c.context.push(c.ref);
+extern "C"
+{
+	#include "lauxlib.h"
 }
 
-int LuaCallbackProxy::_exec(LuaCallbackRef& c, int nparams) {
-	if(lua_isnil(c.context, -nparams-1))
+bool LuaCallbackProxy::_call(size_t i, int errFunc, int nparams) {
+	if(!callbacks[i]) return false;
+	LuaContext context = callbacks[i].context;
+	context.pushReference(callbacks[i].idx);
+	if(lua_isnil(context, -1))
 	{
-		c.context.pop(nparams + 2);
-		return 0;
+		context.pop(1);
+		return false;
 	}
+	for(int p = 1; p <= nparams; ++p)
+		lua_pushvalue(context, errFunc + p);
 
-	int r = c.context.call(nparams, nreturns, -nparams-2);
-
+	owner.stats.calls++;
+	int r = context.call(nparams, nreturns, errFunc);
 	if(r < 0)
 	{
-		c.context.pop(1); // Pop error function
-		c.ref.invalidate();
-		return 0;
+		callbacks[i].invalidate();
+		r = 0;
 	}
+	else
+		r = nreturns;
 
-	lua_remove(c.context, -nreturns-1); // Pop error function
-	return nreturns;
+	if(postHandler)
+		postHandler(context, r);
+	context.pop(r);
+	return true;
+}
+
+void LuaCallbackBatch::add(int top) {
+	const int nparams = lua_gettop(context) - top;
+	context.pushReference(table);
+	if(nparams == 1)
+		lua_pushvalue(context, top + 1);
+	else {
+		lua_createtable(context, nparams, 0);
+		for(int p = 1; p <= nparams; ++p) {
+			lua_pushvalue(context, top + p);
+			lua_rawseti(context, -2, p);
+		}
+	}
+	lua_rawseti(context, -2, ++count);
+	lua_settop(context, top);
 }
 
 LuaCallbacks luaCallbacks;
 
-void LuaCallbacks::bind(const LuaContext& ctx, std::string callback, LuaReference ref)
+int LuaCallbacks::callbackIndex(const std::string& callback)
 {
 	int idx = -1;
 
@@ -87,18 +115,190 @@ void LuaCallbacks::bind(const LuaContext& ctx, std::string callback, LuaReferenc
 	CB(gotoLobby);
 	CB(wormPrepare);
 
-	if(idx != -1)
-		callbacks[idx].push_back(LuaCallbackRef(ctx, ref));
-	else
+	#undef CB
+	return idx;
+}
+
+bool LuaCallbacks::batchable(Type t)
+{
+	// events which can wait until the end of the logic frame
+	return t == playerUpdate || t == wormDeath;
+}
+
+void LuaCallbacks::bind(const LuaContext& ctx, std::string callback, LuaReference ref)
+{
+	bool batched = false;
+	int idx = callbackIndex(callback);
+	if(idx == -1 && callback.size() > 5 && callback.compare(callback.size() - 5, 5, "Batch") == 0) {
+		idx = callbackIndex(callback.substr(0, callback.size() - 5));
+		batched = true;
+	}
+
+	if(idx == -1) {
 		warnings << "LuaCallbacks::bind: '" << callback << "' unknown" << endl;
+		return;
+	}
+	if(!batched) {
+		callbacks[idx].push_back(LuaCallbackRef(ctx, ref));
+		return;
+	}
+	if(!batchable(Type(idx))) {
+		warnings << "LuaCallbacks::bind: '" << callback << "' cannot be batched" << endl;
+		return;
+	}
+
+	LuaCallbackBatch* batch = NULL;
+	foreach(b, batches[idx])
+		if(b->context == ctx) batch = &*b;
+	if(!batch) {
+		LuaContext context(ctx);
+		lua_newtable(context);
+		batches[idx].push_back(LuaCallbackBatch(ctx, context.createReference()));
+		batch = &batches[idx].back();
+	}
+	batch->callbacks.push_back(LuaCallbackRef(ctx, ref));
+}
+
+static void removeInvalid(LuaCallbackList& l) {
+	for(LuaCallbackList::iterator i = l.begin(); i != l.end();) {
+		if(!*i)
+			i = l.erase(i);
+		else
+			++i;
+	}
 }
 
 void LuaCallbacks::cleanup() {
-	for(int e = 0; e < LuaCallbacks::max; ++e)
-		for(LuaCallbackList::iterator i = callbacks[e].begin(); i != callbacks[e].end();) {
-			if(!*i)
-				i = callbacks[e].erase(i);
+	for(int e = 0; e < LuaCallbacks::max; ++e) {
+		removeInvalid(callbacks[e]);
+		for(std::vector<LuaCallbackBatch>::iterator b = batches[e].begin(); b != batches[e].end();) {
+			removeInvalid(b->callbacks);
+			if(!b->context)
+				b = batches[e].erase(b);
 			else
-				++i;
+				++b;
+		}
+	}
+}
+
+void LuaCallbacks::clear() {
+	for(int e = 0; e < LuaCallbacks::max; ++e) {
+		foreach(c, callbacks[e])
+			c->ref.destroy();
+		callbacks[e].clear();
+		foreach(b, batches[e]) {
+			foreach(c, b->callbacks)
+				c->ref.destroy();
+			if(b->context)
+				b->context.destroyReference(b->table);
+		}
+		batches[e].clear();
+	}
+}
+
+void LuaCallbacks::flushBatches() {
+	for(int e = 0; e < LuaCallbacks::max; ++e)
+		for(size_t bi = 0; bi < batches[e].size(); ++bi) {
+			if(!batches[e][bi] || batches[e][bi].count == 0) continue;
+			LuaContext context = batches[e][bi].context;
+			const int count = batches[e][bi].count;
+			context.push(LuaContext::errorReport);
+			const int errFunc = lua_gettop(context);
+			context.pushReference(batches[e][bi].table);
+
+			// a callback can bind new ones, so no references into the vectors
+			for(size_t i = 0; i < batches[e][bi].callbacks.size(); ++i) {
+				if(!batches[e][bi].callbacks[i]) continue;
+				context.pushReference(batches[e][bi].callbacks[i].idx);
+				lua_pushvalue(context, errFunc + 1);
+				lua_pushinteger(context, count);
+				stats.calls++;
+				stats.callsSaved += count - 1;
+				if(context.call(2, 0, errFunc) < 0)
+					batches[e][bi].callbacks[i].invalidate();
+			}
+
+			// Events which the callbacks caused themselves move to the front, the rest is cleared.
+			LuaCallbackBatch& batch = batches[e][bi];
+			const int table = errFunc + 1;
+			for(int i = count + 1; i <= batch.count; ++i) {
+				lua_rawgeti(context, table, i);
+				lua_rawseti(context, table, i - count);
+			}
+			for(int i = MAX(batch.count - count, 0) + 1; i <= batch.count; ++i) {
+				lua_pushnil(context);
+				lua_rawseti(context, table, i);
+			}
+			batch.count -= count;
+			lua_settop(context, errFunc - 1);
 		}
+
+	lastFrameStats.calls = stats.calls - frameStart.calls;
+	lastFrameStats.sharedParams = stats.sharedParams - frameStart.sharedParams;
+	lastFrameStats.callsSaved = stats.callsSaved - frameStart.callsSaved;
+	frameStart = stats;
+}
+
+void LuaCallbacks::dumpStats(CmdLineIntf& cli) const {
+	size_t bound = 0, batched = 0;
+	for(int e = 0; e < LuaCallbacks::max; ++e) {
+		bound += callbacks[e].size();
+		foreach(b, batches[e])
+			batched += b->callbacks.size();
+	}
+	cli.writeMsg("bound callbacks: " + itoa(bound) + ", batched: " + itoa(batched));
+	cli.writeMsg("last frame: " + itoa(lastFrameStats.calls) + " Lua calls, " + itoa(lastFrameStats.sharedParams) +
+				 " with shared parameters, " + itoa(lastFrameStats.callsSaved) + " saved by batching");
+	cli.writeMsg("total: " + itoa(stats.calls) + " Lua calls, " + itoa(stats.sharedParams) +
+				 " with shared parameters, " + itoa(stats.callsSaved) + " saved by batching");
+}
+
+static Uint64 benchCallbacks(LuaCallbacks& cb, int objects, int frames) {
+	const Uint64 start = Profiler::getTicks();
+	for(int f = 0; f < frames; ++f) {
+		for(int i = 0; i < objects; ++i)
+			LuaCallbackProxy(cb, LuaCallbacks::playerUpdate, 0, NULL)(i)();
+		cb.flushBatches();
+	}
+	return Profiler::getTicks() - start;
+}
+
+void LuaCallbacks::benchmark(CmdLineIntf& cli, int objects, int callbacks, int frames) {
+	if(!luaIngame) {
+		cli.writeMsg("Lua is not loaded", CNC_ERROR);
+		return;
+	}
+	AssertStack as(luaIngame);
+	const char* script =
+		"local n = 0\n"
+		"return function(obj) n = n + obj end,\n"
+		"	function(objs, count) for i = 1, count do n = n + objs[i] end end\n";
+	if(luaL_dostring(luaIngame, script) != 0) {
+		cli.writeMsg("Lua error: " + std::string(luaIngame.tostring(-1)), CNC_ERROR);
+		luaIngame.pop(1);
+		return;
+	}
+
+	LuaCallbacks perObject, batched;
+	for(int i = 0; i < callbacks; ++i) {
+		LuaReference ref, batchRef;
+		lua_pushvalue(luaIngame, -2);
+		ref.create(luaIngame);
+		perObject.bind(luaIngame, "playerUpdate", ref);
+		lua_pushvalue(luaIngame, -1);
+		batchRef.create(luaIngame);
+		batched.bind(luaIngame, "playerUpdateBatch", batchRef);
+	}
+	luaIngame.pop(2);
+
+	const Uint64 perObjectTime = benchCallbacks(perObject, objects, frames);
+	const Uint64 batchedTime = benchCallbacks(batched, objects, frames);
+	cli.writeMsg(itoa(objects) + " events per frame to " + itoa(callbacks) + " callbacks, " + itoa(frames) + " frames");
+	cli.writeMsg("per event: " + itoa(perObject.stats.calls / frames) + " Lua calls per frame (" +
+				 itoa(perObject.stats.sharedParams / frames) + " with shared parameters), " +
+				 itoa(perObjectTime / frames) + " us per frame");
+	cli.writeMsg("batched: " + itoa(batched.stats.calls / frames) + " Lua calls per frame (" +
+				 itoa(batched.stats.callsSaved / frames) + " saved), " + itoa(batchedTime / frames) + " us per frame");
+	perObject.clear();
+	batched.clear();
 }
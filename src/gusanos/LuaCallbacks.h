@@ -8,40 +8,133 @@
 #include <string>
 #include <vector>
 #include <boost/function.hpp>
+#include <SDL.h>
 #include "gusanos/luaapi/types.h"
 #include "gusanos/luaapi/context.h"
 #include "util/macros.h"
 
+struct CmdLineIntf;
+
 #define C_LocalPlayer_ActionCount 8
 
 struct LuaCallbackRef {
 	LuaContext context;
 	LuaReference ref;
-	LuaCallbackRef(const LuaContext& ctx_, const LuaReference& ref_) : context(ctx_), ref(ref_) {}
-	operator bool() const { return context && ref.isSet(context); }
+	LuaReference::Idx idx; // registry index of the function, resolved at bind time; 0 if invalid
+	LuaCallbackRef(const LuaContext& ctx_, const LuaReference& ref_) : context(ctx_), ref(ref_), idx(ref_.index(ctx_)) {}
+	operator bool() const { return idx != 0 && context; }
+	void invalidate() { ref.invalidate(); idx = 0; }
 };
 typedef std::vector<LuaCallbackRef> LuaCallbackList;
 
+// Callbacks which get all events of one type of a logic frame at once, see LuaCallbacks::bind.
+struct LuaCallbackBatch {
+	LuaContext context;
+	LuaReference::Idx table; // array of the collected events, reused for every frame
+	int count;
+	LuaCallbackList callbacks;
+	LuaCallbackBatch(const LuaContext& ctx_, LuaReference::Idx table_) : context(ctx_), table(table_), count(0) {}
+	operator bool() const { return context && !callbacks.empty(); }
+	void add(int top); // takes the event parameters above top from the stack
+};
+
+struct LuaCallbacks
+{
+	enum Type
+	{
+		exit,
+		serverStart,
+		serverStop,
+		serverJoined,
+		serverLeft,
+		gamePrepare,
+		gameBegin,
+		gameOver,
+		gotoLobby,
+		afterRender,
+		afterUpdate,
+		wormRender,
+		viewportRender,
+		wormPrepare,
+		wormDeath,
+		wormRemoved,
+		playerUpdate,
+		playerInit,
+		playerRemoved,
+		playerNetworkInit,
+		gameNetworkInit,
+		gameEnded,
+		localplayerEventAny,
+		localplayerInit,
+		localplayerEvent,
+		networkStateChange = localplayerEvent+C_LocalPlayer_ActionCount,
+		gameError,
+		max
+	};
+	struct Stats {
+		Uint64 calls; // Lua calls of callbacks
+		Uint64 sharedParams; // calls which reused the parameters pushed for the callback before
+		Uint64 callsSaved; // calls which batched callbacks would have needed without batching
+		Stats() : calls(0), sharedParams(0), callsSaved(0) {}
+	};
+
+	// A callback name with the suffix "Batch" (e.g. playerUpdateBatch) binds a batched callback,
+	// only for the events of batchable().
+	void bind(const LuaContext& ctx, std::string callback, LuaReference ref);
+	static bool batchable(Type t);
+	LuaCallbackList callbacks[max];
+	std::vector<LuaCallbackBatch> batches[max]; // one per Lua context
+	Stats stats, lastFrameStats;
+	void cleanup();
+	void clear(); // unbinds everything
+	void flushBatches(); // once per logic frame
+	void dumpStats(CmdLineIntf& cli) const;
+	static void benchmark(CmdLineIntf& cli, int objects, int callbacks, int frames);
+private:
+	static int callbackIndex(const std::string& callback); // -1 if unknown
+	Stats frameStart;
+};
+
 struct LuaCallbackProxy {
+	LuaCallbacks& owner;
+	LuaCallbacks::Type type;
 	LuaCallbackList& callbacks;
 	int nreturns;
 	typedef boost::function<void(LuaContext&,int)> PostHandler;
 	PostHandler postHandler;
-	LuaCallbackProxy(LuaCallbackList& callbacks_, int nreturns_, PostHandler postHandler_)
-		: callbacks(callbacks_), nreturns(nreturns_), postHandler(postHandler_) {}
+	LuaCallbackProxy(LuaCallbacks& owner_, LuaCallbacks::Type type_, int nreturns_, PostHandler postHandler_)
+		: owner(owner_), type(type_), callbacks(owner_.callbacks[type_]), nreturns(nreturns_), postHandler(postHandler_) {}
 
 	LuaCallbackProxy& root() { return *this; }
 
+	// The parameters are pushed once per Lua context and copied for every callback.
+	// Indices and not iterators, because a callback can bind new callbacks.
 	template<typename T>
 	static void _Exec(T& base) {
-		foreach(f, base.root().callbacks) {
-			if(!*f) continue;
-			base.root()._pushFunc(*f);
-			base._pushParams(f->context);
-			int r = base._exec(*f, 0);
-			if(base.root().postHandler)
-				base.root().postHandler(f->context, r);
-			f->context.pop(r);
+		LuaCallbackProxy& root = base.root();
+		for(size_t i = 0; i < root.callbacks.size(); ) {
+			if(!root.callbacks[i]) { ++i; continue; }
+			LuaContext context = root.callbacks[i].context;
+			context.push(LuaContext::errorReport);
+			const int errFunc = lua_gettop(context);
+			base._pushParams(context);
+			const int nparams = lua_gettop(context) - errFunc;
+			int called = 0;
+			for(; i < root.callbacks.size() && root.callbacks[i].context == context; ++i)
+				if(root._call(i, errFunc, nparams))
+					called++;
+			if(called > 1)
+				root.owner.stats.sharedParams += called - 1;
+			lua_settop(context, errFunc - 1);
+		}
+
+		std::vector<LuaCallbackBatch>& batches = root.owner.batches[root.type];
+		for(size_t b = 0; b < batches.size(); ++b) {
+			if(!batches[b]) continue;
+			LuaContext context = batches[b].context;
+			const int top = lua_gettop(context);
+			base._pushParams(context);
+			batches[b].add(top);
 		}
 	}
 
@@ -52,7 +145,6 @@ struct LuaCallbackProxy {
 		WithParam(BaseT& base_, const T& p_) : base(base_), param(p_) {}
 
 		LuaCallbackProxy& root() { return base.root(); }
-		int _exec(LuaCallbackRef& ref, int nparams) { return base._exec(ref, nparams + 1); }
 		void _pushParams(LuaContext& context) {
 			base._pushParams(context);
 			context.push(param);
@@ -67,8 +159,7 @@ struct LuaCallbackProxy {
 	};
 
 	void _pushParams(LuaContext&) {}
-	void _pushFunc(LuaCallbackRef& c);
-	int _exec(LuaCallbackRef& ref, int nparams);
+	bool _call(size_t i, int errFunc, int nparams); // false if the callback was not called
 
 	void operator()() { _Exec(*this); }
 
@@ -78,51 +169,13 @@ struct LuaCallbackProxy {
 	}
 };
 
-struct LuaCallbacks
-{
-	enum Type
-	{
-		exit,
-		serverStart,
-		serverStop,
-		serverJoined,
-		serverLeft,
-		gamePrepare,
-		gameBegin,
-		gameOver,
-		gotoLobby,
-		afterRender,
-		afterUpdate,
-		wormRender,
-		viewportRender,
-		wormPrepare,
-		wormDeath,
-		wormRemoved,
-		playerUpdate,
-		playerInit,
-		playerRemoved,
-		playerNetworkInit,
-		gameNetworkInit,
-		gameEnded,
-		localplayerEventAny,
-		localplayerInit,
-		localplayerEvent,
-		networkStateChange = localplayerEvent+C_LocalPlayer_ActionCount,
-		gameError,
-		max
-	};
-	void bind(const LuaContext& ctx, std::string callback, LuaReference ref);
-	LuaCallbackList callbacks[max];
-	void cleanup();
-};
-
 extern LuaCallbacks luaCallbacks;
 
 struct LuaCallbackProxyEnv {
 	LuaCallbacks::Type t;
 	LuaCallbackProxyEnv(LuaCallbacks::Type t_) : t(t_) {}
 	LuaCallbackProxy call(int nreturns = 0, LuaCallbackProxy::PostHandler postHandler = NULL) {
-		return LuaCallbackProxy(luaCallbacks.callbacks[t], nreturns, postHandler);
+		return LuaCallbackProxy(luaCallbacks, t, nreturns, postHandler);
 	}
 };
 
@@ -30,6 +30,7 @@
 #include "lua/bindings.h"
 #include "util/log.h"
 #include "game/Game.h"
+#include "Profiler.h"
 #include <memory>
 #include <string>
 #include <vector>
@@ -61,6 +62,7 @@ bool gusInit(const std::string& mod) {
 }
 
 void gusLogicFrame() {
+	PROFILE_ZONE("gusLogicFrame");
 	for ( Grid::iterator iter = game.objects.beginAll(); iter;)
 	{
 		if(iter->deleteMe)
@@ -94,6 +96,7 @@ void gusLogicFrame() {
 
 	spriteList.think();
 
+	luaCallbacks.flushBatches();
 	LUACALLBACK(afterUpdate).call()();
 }
 
@@ -226,6 +226,7 @@ bool GusGame::init()
 	scriptLocator.registerLoader(&LuaLoader::instance);
 	
 	luaIngame.init();
+	luaIngame.manageGC();
 	LuaBindings::init(luaIngame);
 
 	m_modPath = "Gusanos";
@@ -538,6 +539,7 @@ void GusGame::unload()
 
 	network.clear();
 	luaIngame.reset();
+	luaIngame.manageGC();
 	luaCallbacks.cleanup(); // remove invalidated callbacks
 	LuaBindings::init(luaIngame);
 #ifndef DEDICATED_ONLY
@@ -107,6 +107,15 @@ int print(lua_State* L)
 	This is called in every logic cycle for every player. //player// is the relevant CWormHumanInputHandler object.
 */
 
+/*! bindings.playerUpdateBatch(players, count)
+
+	Like playerUpdate, but called only once per logic cycle, after all players were updated.
+	//players// is an array of the //count// CWormHumanInputHandler objects. The array is
+	reused in the next cycle, so don't keep it.
+	
+	wormDeath can be batched in the same way with bindings.wormDeathBatch(worms, count).
+*/
+
 /*! bindings.playerInit(player)
 
 	This is called when a new player is added to the game. //player// is the CWormHumanInputHandler object that was added.
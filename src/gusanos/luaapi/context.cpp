@@ -1,5 +1,6 @@
 #include <cstdlib>
 #include "context.h"
+#include "memory.h"
 #include "Debug.h"
 
 extern "C"
@@ -103,23 +104,9 @@ LuaContext::LuaContext(lua_State* L) {
 		assert(false);
 }
 
-namespace
-{
-	void* l_alloc (void*, void* ptr, size_t, size_t nsize)
-	{
-		if (nsize == 0)
-		{
-			free(ptr);
-			return 0;
-		}
-		else
-			return realloc(ptr, nsize);
-	}
-}
-
 void LuaContext::init()
 {
-	weakRef.set(lua_newstate(l_alloc, 0));
+	weakRef.set(lua_newstate(&LuaMemory::alloc, new LuaMemory()));
 
 	lua_pushinteger(*this, 3);
 	lua_rawseti(*this, LUA_REGISTRYINDEX, ARRAY_SIZE);
@@ -944,11 +931,26 @@ Result LuaContext::toScriptVar(int idx, ScriptVar_t& var) {
 void LuaContext::close()
 {
 	if(weakRef) {
+		LuaMemory* mem = LuaMemory::get(*this);
 		lua_close(*this);
+		delete mem;
 		weakRef.overwriteShared(NULL);
 	}
 }
 
+void LuaContext::manageGC()
+{
+	if(LuaMemory* mem = LuaMemory::get(*this))
+		mem->manage(*this);
+}
+
+void LuaContext::gcFrame()
+{
+	if(!weakRef) return;
+	if(LuaMemory* mem = LuaMemory::get(*this))
+		mem->frameStep(*this);
+}
+
 LuaContext::~LuaContext()
 {
 	// We might not always use the global instance but have a local one,
@@ -1046,6 +1048,13 @@ bool LuaReference::isSet(const LuaContext& ctx) const {
 	return i != idxs->end();
 }
 
+LuaReference::Idx LuaReference::index(const LuaContext& ctx) const {
+	if(isNilRef) return 0;
+	assert(idxs.get());
+	IdxMap::iterator i = idxs->find(ctx.weakRef);
+	return (i != idxs->end()) ? i->second : 0;
+}
+
 void LuaReference::destroy() {
 	if(isNilRef) return;
 	assert(idxs.get());
@@ -143,6 +143,9 @@ public:
 	
 	void init();
 	void reset();
+	// Stops the automatic garbage collector, gcFrame() must be called once per frame then.
+	void manageGC();
+	void gcFrame();
 	
 	static const char * istreamChunkReader(lua_State *L, void *data, size_t *size);
 
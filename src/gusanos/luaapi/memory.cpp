@@ -0,0 +1,268 @@
+#include "memory.h"
+#include <cstdlib>
+#include <algorithm>
+#include "Profiler.h"
+#include "OLXCommand.h"
+#include "StringUtils.h"
+#include "Debug.h"
+#include "util/macros.h"
+
+extern "C"
+{
+	#include "lua.h"
+	#include "lualib.h"
+	#include "lauxlib.h"
+}
+
+int LuaMemory::stepBudget = 1000;
+int LuaMemory::pause = 200;
+int LuaMemory::stepMul = 400;
+
+namespace
+{
+	const size_t classSizes[] = { 16, 32, 48, 64, 96, 128, 192, 256 };
+}
+
+LuaMemory::LuaMemory()
+: m_chunkPos(NULL), m_chunkLeft(0), m_inUse(0), m_largeInUse(0)
+, m_managed(false), m_inCycle(false), m_cycleThreshold(MinCycleThreshold)
+, m_frames(0), m_cycles(0), m_forcedCollections(0)
+, m_lastFrameTime(0), m_maxFrameTime(0), m_totalTime(0)
+{
+	for(int i = 0; i < NumClasses; ++i)
+		m_free[i] = NULL;
+}
+
+LuaMemory::~LuaMemory()
+{
+	if(m_inUse > 0)
+		warnings << "LuaMemory: " << m_inUse << " bytes not freed by Lua" << endl;
+	foreach(c, m_chunks)
+		free(*c);
+}
+
+int LuaMemory::sizeClass(size_t size)
+{
+	for(int i = 0; i < NumClasses; ++i)
+		if(size <= classSizes[i])
+			return i;
+	return -1;
+}
+
+void* LuaMemory::allocSmall(int c)
+{
+	if(FreeNode* n = m_free[c]) {
+		m_free[c] = n->next;
+		return n;
+	}
+	const size_t size = classSizes[c];
+	if(m_chunkLeft < size) {
+		// the rest of the old chunk goes to the free list of the biggest class which fits
+		for(int i = c - 1; i >= 0 && m_chunkLeft > 0; --i)
+			while(m_chunkLeft >= classSizes[i]) {
+				freeSmall(m_chunkPos, i);
+				m_chunkPos += classSizes[i];
+				m_chunkLeft -= classSizes[i];
+			}
+		char* chunk = (char*)malloc(ChunkSize);
+		if(!chunk) return NULL;
+		m_chunks.push_back(chunk);
+		m_chunkPos = chunk;
+		m_chunkLeft = ChunkSize;
+	}
+	void* p = m_chunkPos;
+	m_chunkPos += size;
+	m_chunkLeft -= size;
+	return p;
+}
+
+void LuaMemory::freeSmall(void* p, int c)
+{
+	FreeNode* n = (FreeNode*)p;
+	n->next = m_free[c];
+	m_free[c] = n;
+}
+
+void* LuaMemory::alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	LuaMemory& m = *(LuaMemory*)ud;
+	// Lua passes osize = 0 for new blocks
+	const int oc = ptr ? sizeClass(osize) : -1;
+
+	if(nsize == 0) {
+		if(!ptr) return NULL;
+		if(oc >= 0) m.freeSmall(ptr, oc);
+		else { free(ptr); m.m_largeInUse -= osize; }
+		m.m_inUse -= osize;
+		return NULL;
+	}
+
+	const int nc = sizeClass(nsize);
+	void* ret = NULL;
+	if(ptr && oc == nc) {
+		if(oc >= 0)
+			ret = ptr; // same class, the block is big enough already
+		else {
+			ret = realloc(ptr, nsize);
+			if(!ret) return NULL;
+			m.m_largeInUse += nsize - osize;
+		}
+	}
+	else {
+		if(nc >= 0)
+			ret = m.allocSmall(nc);
+		else {
+			ret = malloc(nsize);
+			if(ret) m.m_largeInUse += nsize;
+		}
+		if(!ret) return NULL;
+		if(ptr) {
+			memcpy(ret, ptr, MIN(osize, nsize));
+			if(oc >= 0) m.freeSmall(ptr, oc);
+			else { free(ptr); m.m_largeInUse -= osize; }
+		}
+	}
+	m.m_inUse += nsize - (ptr ? osize : 0);
+	return ret;
+}
+
+LuaMemory* LuaMemory::get(lua_State* L)
+{
+	void* ud = NULL;
+	if(lua_getallocf(L, &ud) != &LuaMemory::alloc) return NULL;
+	return (LuaMemory*)ud;
+}
+
+void LuaMemory::manage(lua_State* L)
+{
+	m_managed = true;
+	m_inCycle = false;
+	lua_gc(L, LUA_GCSETSTEPMUL, stepMul);
+	lua_gc(L, LUA_GCSTOP, 0);
+	cycleFinished();
+}
+
+void LuaMemory::cycleFinished()
+{
+	m_cycleThreshold = MAX(m_inUse / 100 * pause, (size_t)MinCycleThreshold);
+}
+
+void LuaMemory::frameStep(lua_State* L)
+{
+	if(!m_managed) return;
+	const Uint64 start = Profiler::getTicks();
+
+	if(m_inUse > 2 * m_cycleThreshold) {
+		// the steps did not keep up with the allocations
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		m_inCycle = false;
+		m_cycles++;
+		m_forcedCollections++;
+		cycleFinished();
+	}
+	else if(m_inCycle || m_inUse >= m_cycleThreshold) {
+		m_inCycle = true;
+		lua_gc(L, LUA_GCSETSTEPMUL, stepMul);
+		do {
+			// one collector step per call, returns 1 at the end of the cycle
+			if(lua_gc(L, LUA_GCSTEP, 0)) {
+				m_inCycle = false;
+				m_cycles++;
+				cycleFinished();
+				break;
+			}
+		} while(Profiler::getTicks() - start < (Uint64)stepBudget);
+	}
+	// a step enables the automatic collector again
+	lua_gc(L, LUA_GCSTOP, 0);
+
+	m_lastFrameTime = Profiler::getTicks() - start;
+	m_maxFrameTime = MAX(m_maxFrameTime, m_lastFrameTime);
+	m_totalTime += m_lastFrameTime;
+	m_frames++;
+}
+
+void LuaMemory::dumpStats(CmdLineIntf& cli) const
+{
+	cli.writeMsg("heap: " + itoa(m_inUse / 1024) + " KB (" + itoa(m_largeInUse / 1024) + " KB big blocks), " +
+				 itoa(m_chunks.size() * (ChunkSize / 1024)) + " KB in pool chunks");
+	if(!m_managed) {
+		cli.writeMsg("collector paced by Lua");
+		return;
+	}
+	cli.writeMsg("collector: budget " + itoa(stepBudget) + " us/frame, pause " + itoa(pause) + "%, stepmul " + itoa(stepMul) +
+				 ", next cycle at " + itoa(m_cycleThreshold / 1024) + " KB" + (m_inCycle ? ", in cycle" : ""));
+	cli.writeMsg("frames: " + itoa(m_frames) + ", GC time last " + itoa(m_lastFrameTime) + " us, max " + itoa(m_maxFrameTime) +
+				 " us, avg " + ftoa(m_frames ? float(m_totalTime) / m_frames : 0.0f) + " us");
+	cli.writeMsg("cycles: " + itoa(m_cycles) + ", forced full collections: " + itoa(m_forcedCollections));
+}
+
+
+namespace
+{
+	const char* benchScript =
+		"local ring = {}\n"
+		"local pos = 0\n"
+		"function benchFrame(n)\n"
+		"	for i = 1, n do\n"
+		"		pos = pos % 2000 + 1\n"
+		"		ring[pos] = { x = i, y = i * 0.5, vel = { i, -i }, name = \"p\" .. (i % 97) }\n"
+		"	end\n"
+		"end\n";
+
+	Uint64 percentile(const std::vector<Uint64>& sorted, int p)
+	{
+		if(sorted.empty()) return 0;
+		return sorted[(sorted.size() - 1) * p / 100];
+	}
+
+	// returns false on Lua errors
+	bool runBench(lua_State* L, LuaMemory* mem, int frames, int allocsPerFrame, std::vector<Uint64>& times)
+	{
+		if(luaL_dostring(L, benchScript) != 0) return false;
+		times.clear();
+		times.reserve(frames);
+		for(int f = 0; f < frames; ++f) {
+			const Uint64 start = Profiler::getTicks();
+			lua_getglobal(L, "benchFrame");
+			lua_pushinteger(L, allocsPerFrame);
+			if(lua_pcall(L, 1, 0, 0) != 0) return false;
+			if(mem) mem->frameStep(L);
+			times.push_back(Profiler::getTicks() - start);
+		}
+		std::sort(times.begin(), times.end());
+		return true;
+	}
+
+	std::string timesSummary(const std::vector<Uint64>& times)
+	{
+		return "p50 " + itoa(percentile(times, 50)) + " us, p95 " + itoa(percentile(times, 95)) +
+			" us, p99 " + itoa(percentile(times, 99)) + " us, max " + itoa(times.empty() ? 0 : times.back()) + " us";
+	}
+}
+
+void LuaMemory::benchmark(CmdLineIntf& cli, int frames, int allocsPerFrame)
+{
+	std::vector<Uint64> times;
+
+	lua_State* L = luaL_newstate();
+	luaopen_base(L);
+	if(!runBench(L, NULL, frames, allocsPerFrame, times))
+		cli.writeMsg(std::string("Lua error: ") + lua_tostring(L, -1), CNC_ERROR);
+	else
+		cli.writeMsg("Lua allocator and pacing: " + timesSummary(times));
+	lua_close(L);
+
+	LuaMemory* mem = new LuaMemory();
+	L = lua_newstate(&LuaMemory::alloc, mem);
+	luaopen_base(L);
+	mem->manage(L);
+	if(!runBench(L, mem, frames, allocsPerFrame, times))
+		cli.writeMsg(std::string("Lua error: ") + lua_tostring(L, -1), CNC_ERROR);
+	else {
+		cli.writeMsg("pooled, frame budget:     " + timesSummary(times));
+		mem->dumpStats(cli);
+	}
+	lua_close(L);
+	delete mem;
+}
@@ -0,0 +1,76 @@
+#ifndef LUA_MEMORY_H
+#define LUA_MEMORY_H
+
+#include <cstring> //size_t
+#include <vector>
+#include <SDL.h>
+
+struct lua_State;
+struct CmdLineIntf;
+
+/*
+ Memory of a Lua state: the allocator and, if wanted, the pacing of the
+ garbage collector.
+
+ Lua allocates mostly small blocks (table nodes, strings, closures), these
+ come from free lists of a few size classes which are carved out of big
+ chunks. Lua always tells us the old size of a block, so we don't need any
+ headers.
+
+ With Lua's own pacing, the collector runs inside the allocations, so a
+ script which allocates much in a particle callback pays for the collection
+ right there. A managed state has its collector stopped during the frame
+ and frameStep() does the work at the end of the frame in steps, until the
+ time budget is used up. If the budget does not keep up with the
+ allocations, a full collection is done (and counted).
+*/
+class LuaMemory
+{
+public:
+	LuaMemory();
+	~LuaMemory(); // the state must be closed already
+
+	static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize); // lua_Alloc, ud is the LuaMemory
+	static LuaMemory* get(lua_State* L); // NULL if L does not use a LuaMemory
+
+	void manage(lua_State* L);
+	bool managed() const { return m_managed; }
+	void frameStep(lua_State* L); // once per game frame
+
+	size_t bytesInUse() const { return m_inUse; }
+	Uint64 lastFrameGCTime() const { return m_lastFrameTime; } // in microseconds
+	void dumpStats(CmdLineIntf& cli) const;
+
+	static void benchmark(CmdLineIntf& cli, int frames, int allocsPerFrame);
+
+	// Settings for managed states
+	static int stepBudget; // microseconds per frame
+	static int pause; // a new cycle starts when the heap grew to this percentage of its size after the last one
+	static int stepMul; // work per collector step, see LUA_GCSETSTEPMUL
+
+private:
+	enum { NumClasses = 8, ChunkSize = 64 * 1024, MinCycleThreshold = 512 * 1024 };
+	struct FreeNode { FreeNode* next; };
+
+	static int sizeClass(size_t size);
+	void* allocSmall(int c);
+	void freeSmall(void* p, int c);
+	void cycleFinished();
+
+	FreeNode* m_free[NumClasses];
+	std::vector<char*> m_chunks;
+	char* m_chunkPos;
+	size_t m_chunkLeft;
+
+	size_t m_inUse;
+	size_t m_largeInUse;
+
+	bool m_managed;
+	bool m_inCycle;
+	size_t m_cycleThreshold;
+
+	Uint64 m_frames, m_cycles, m_forcedCollections;
+	Uint64 m_lastFrameTime, m_maxFrameTime, m_totalTime;
+};
+
+#endif // LUA_MEMORY_H
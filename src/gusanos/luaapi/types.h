@@ -30,6 +30,7 @@ public:
 	void create(LuaContext& ctx); // [-1,0]
 	void push(LuaContext& ctx) const; // [0,1]
 	bool isSet(const LuaContext& ctx) const;
+	Idx index(const LuaContext& ctx) const; // registry index, 0 if not set
 
 	void destroy();
 	void invalidate();
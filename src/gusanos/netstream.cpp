@@ -20,6 +20,10 @@
 #include "CClient.h"
 #include "CServerNetEngine.h"
 #include "CChannel.h"
+#include "OLXCommand.h"
+#include "Profiler.h"
+#include "MathLib.h"
+#include <algorithm>
 
 
 struct NetControlIntern {
@@ -41,7 +45,7 @@ struct NetControlIntern {
 	
 	// A raw data package structure. All Gusanos packages are of this kind.
 	struct DataPackage {
-		DataPackage() : type(Type(-1)), sendMode(eNet_ReliableOrdered), repRules(Net_REPRULE_NONE) {}
+		DataPackage() : type(Type(-1)), sendMode(eNet_ReliableOrdered), repRules(Net_REPRULE_NONE), fullUpdate(false) {}
 
 		enum Type {
 			GPT_NodeInit,
@@ -63,6 +67,7 @@ struct NetControlIntern {
 		BitStream data;
 		eNet_SendMode sendMode;
 		Net_RepRules repRules; // if node is set, while sending, these are checked
+		bool fullUpdate; // GPT_NodeUpdate with all replicators; not sent, only for the NodeUpdateManager
 		
 		bool nodeMustBeSet() { return type < GPT_Direct; }
 		
@@ -85,19 +90,52 @@ struct NetControlIntern {
 	// They will be pushed into this structure and handled specially here -
 	// the main addition is a bandwidth check.
 	// Every connection/Net_ConnID has its own manager.
-	struct NodeUpdateManager {		
-		typedef std::list<DataPackage> Updates;
+	//
+	// On the server, the manager also knows the area of interest of the connection
+	// (see olxSetInterest). Updates of spatial nodes outside of it are dropped, and
+	// a waiting update gains the weight of its node as priority on every send; it
+	// goes out when the priority reached 1. So far nodes update less often, and if
+	// the bandwidth is short, the highest priorities go first.
+	struct NodeUpdateManager {
+		NodeUpdateManager() : interestSet(false), enters(0), leaves(0), heldBack(0), sentUpdates(0), sentBytes(0) {}
+
+		struct Update {
+			DataPackage package;
+			float priority;
+			bool stale; // a waiting package was replaced by one which may lack some of its replicators
+			bool fullRequested;
+			Update(const DataPackage& p) : package(p), priority(0), stale(false), fullRequested(false) {}
+		};
+		typedef std::list<Update> Updates;
 		Updates updates;
 		typedef std::map<NetNodeIntern*,Updates::iterator> NodeMap;
 		NodeMap nodeMap;
 		
-		void pushUpdate(const DataPackage& p) {
+		bool interestSet;
+		typedef std::map<NetNodeIntern*,float> Relevant; // spatial node -> weight
+		Relevant relevant;
+		std::list< SmartPointer<NetNodeIntern> > entered; // they get a full update in Net_processOutput
+		
+		size_t enters, leaves, heldBack, sentUpdates, sentBytes;
+		
+		float weight(NetNodeIntern* node, Net_ConnID cid) const; // 0 if not relevant
+		
+		void pushUpdate(const DataPackage& p, Net_ConnID cid) {
+			if(weight(p.node.get(), cid) <= 0) {
+				heldBack++;
+				return;
+			}
 			NodeMap::iterator f = nodeMap.find(p.node.get());
 			if(f != nodeMap.end()) {
-				*f->second = p;
+				// Packages only have the replicators which changed. The replaced one can have had others,
+				// so unless this is a full update, the node needs one before we send it (see compose).
+				Update& u = *f->second;
+				u.package = p;
+				u.stale = !p.fullUpdate;
+				if(p.fullUpdate) u.fullRequested = false;
 			}
 			else {
-				updates.push_back(p);
+				updates.push_back(Update(p));
 				Updates::iterator& last = nodeMap[p.node.get()] = updates.end(); --last;
 			}
 		}
@@ -110,11 +148,28 @@ struct NetControlIntern {
 			}
 		}
 		
+		// node is going to be deleted
+		void forget(NetNodeIntern* node) {
+			remove(node);
+			relevant.erase(node);
+			for(std::list< SmartPointer<NetNodeIntern> >::iterator i = entered.begin(); i != entered.end(); )
+				if(i->get() == node) i = entered.erase(i); else ++i;
+		}
+		
 		void clear() {
 			updates.clear();
 			nodeMap.clear();
+			clearInterest();
+		}
+		
+		void clearInterest() {
+			interestSet = false;
+			relevant.clear();
+			entered.clear();
 		}
 		
+		void setInterest(const SmartPointer<NetControlIntern>& con, Net_ConnID cid, const std::vector<Net_InterestItem>& items);
+		bool compose(const SmartPointer<NetControlIntern>& con, Net_ConnID target, size_t maxBytes, CBytestream& bs);
 		bool send(const SmartPointer<NetControlIntern>& con, Net_ConnID target, size_t maxBytes);
 	};
 	std::map<Net_ConnID,NodeUpdateManager> nodeUpdateManager;
@@ -172,7 +227,7 @@ struct NetControlIntern {
 struct NetNodeIntern {
 	NetNodeIntern() :
 	publicOwner(NULL), control(NULL), classId(INVALID_CLASS_ID), nodeId(INVALID_NODE_ID), role(eNet_RoleUndefined),
-	eventForInit(false), eventForRemove(false),
+	eventForInit(false), eventForRemove(false), eventForInterest(false), spatial(false),
 	ownerConn(NetConnID_server()),
 	forthcomingReplicatorInterceptID(0), interceptor(NULL) {}
 	~NetNodeIntern() { clearReplicationSetup(); }
@@ -182,7 +237,8 @@ struct NetNodeIntern {
 	Net_ClassID classId;
 	Net_NodeID nodeId;
 	eNet_NodeRole role;
-	bool eventForInit, eventForRemove;
+	bool eventForInit, eventForRemove, eventForInterest;
+	bool spatial; // class has Net_CLASSFLAG_SPATIAL
 	std::auto_ptr<BitStream> announceData;
 	Net_ConnID ownerConn;
 	
@@ -208,6 +264,8 @@ struct NetNodeIntern {
 		static Event NodeInit(Net_ConnID c) { return Event(eNet_EventInit, eNet_RoleAuthority /* TODO? */, c, BitStream()); }
 		static Event NodeRemoved(Net_ConnID c) { return Event(eNet_EventRemoved, eNet_RoleAuthority /* TODO? */, c, BitStream()); }
 		static Event User(const BitStream& s, Net_ConnID c) { return Event(eNet_EventUser, eNet_RoleAuthority /* TODO? */, c, s); }
+		static Event EnterInterest(Net_ConnID c) { return Event(eNet_EventEnterInterest, eNet_RoleProxy, c, BitStream()); }
+		static Event LeaveInterest(Net_ConnID c) { return Event(eNet_EventLeaveInterest, eNet_RoleProxy, c, BitStream()); }
 	};
 	
 	typedef std::list<Event> Events;
@@ -242,6 +300,16 @@ Net_Control::~Net_Control() {
 
 void Net_Control::Shutdown() {}
 
+bool Net_Control::interestEnabled = true;
+int Net_Control::interestViewW = 160; // a LX viewport shows up to 320x240 pixels of the map
+int Net_Control::interestViewH = 120;
+int Net_Control::interestMargin = 480;
+
+float Net_Control::interestWeight(float distToView) {
+	if(distToView <= 0) return 1.0f;
+	return 1.0f / (1.0f + 3.0f * distToView / MAX(interestMargin, 1));
+}
+
 
 static std::string rawFromBits(BitStream& bits) {
 	size_t oldPos = bits.bitPos();
@@ -359,7 +427,7 @@ static bool composePackagesForConn(CBytestream& bs, const SmartPointer<NetContro
 			}
 			
 			if(i->type == NetControlIntern::DataPackage::GPT_NodeUpdate)
-				con->nodeUpdateManager[connid].pushUpdate(*i);
+				con->nodeUpdateManager[connid].pushUpdate(*i, connid);
 			else
 				packages.push_back(&*i);
 		}
@@ -418,27 +486,103 @@ void Net_Control::olxSend(bool /* sendPendingOnly */) {
 	intern->packetsToSend.clear();
 }
 
-bool NetControlIntern::NodeUpdateManager::send(const SmartPointer<NetControlIntern>& con, Net_ConnID target, size_t maxBytes) {
+float NetControlIntern::NodeUpdateManager::weight(NetNodeIntern* node, Net_ConnID cid) const {
+	if(!interestSet || !node->spatial || node->ownerConn == cid) return 1.0f;
+	Relevant::const_iterator f = relevant.find(node);
+	return (f != relevant.end()) ? f->second : 0.0f;
+}
+
+void NetControlIntern::NodeUpdateManager::setInterest(const SmartPointer<NetControlIntern>& con, Net_ConnID cid, const std::vector<Net_InterestItem>& items) {
+	if(!interestSet) {
+		// so far, all nodes were relevant
+		for(NetControlIntern::Nodes::iterator i = con->nodes.begin(); i != con->nodes.end(); ++i)
+			if(i->second->intern->spatial && i->second->intern->ownerConn != cid)
+				relevant[i->second->intern.get()] = 1.0f;
+		interestSet = true;
+	}
+	
+	Relevant next;
+	for(std::vector<Net_InterestItem>::const_iterator i = items.begin(); i != items.end(); ++i) {
+		NetNodeIntern* node = i->node->intern.get();
+		if(!node->spatial || !node->isRegistered() || node->ownerConn == cid) continue;
+		
+		Relevant::iterator n = next.find(node);
+		if(n != next.end()) { // near to several worms of the connection
+			n->second = MAX(n->second, i->weight);
+			continue;
+		}
+		if(relevant.find(node) == relevant.end()) {
+			if(!i->canEnter) continue;
+			entered.push_back(i->node->intern);
+			enters++;
+			if(node->eventForInterest)
+				node->incomingEvents.push_back( NetNodeIntern::Event::EnterInterest(cid) );
+		}
+		next[node] = i->weight;
+	}
+	
+	for(Relevant::iterator i = relevant.begin(); i != relevant.end(); ++i) {
+		if(next.find(i->first) != next.end()) continue;
+		remove(i->first);
+		leaves++;
+		if(i->first->eventForInterest)
+			i->first->incomingEvents.push_back( NetNodeIntern::Event::LeaveInterest(cid) );
+	}
+	
+	relevant.swap(next);
+}
+
+static bool higherUpdatePriority(const NetControlIntern::NodeUpdateManager::Updates::iterator& a, const NetControlIntern::NodeUpdateManager::Updates::iterator& b) {
+	return a->priority > b->priority;
+}
+
+bool NetControlIntern::NodeUpdateManager::compose(const SmartPointer<NetControlIntern>& con, Net_ConnID target, size_t maxBytes, CBytestream& bs) {
 	if(updates.size() == 0) return false;
+	
+	std::vector<Updates::iterator> ready;
+	ready.reserve(updates.size());
+	for(Updates::iterator i = updates.begin(); i != updates.end(); ++i) {
+		i->priority += weight(i->package.node.get(), target);
+		if(i->priority >= 1.0f) ready.push_back(i);
+	}
+	// stable, so updates with the same priority keep their order
+	std::stable_sort(ready.begin(), ready.end(), higherUpdatePriority);
+	
 	CBytestream tmpbs;
 
 	size_t count = 0;
-	while(updates.size() > 0) {
+	for(size_t i = 0; i < ready.size(); ++i) {
+		if(ready[i]->stale) {
+			// Net_processOutput pushes a full update, it replaces this one
+			if(!ready[i]->fullRequested) {
+				entered.push_back(ready[i]->package.node);
+				ready[i]->fullRequested = true;
+			}
+			continue;
+		}
 		CBytestream tmpbs2;
-		updates.front().send(tmpbs2, false);
+		ready[i]->package.send(tmpbs2, false);
 		if(tmpbs.GetLength() + tmpbs2.GetLength() + eliasGammaEncodedByteLen(count) + 1 > maxBytes)
 			break;
 		
 		tmpbs.Append(&tmpbs2);
-		remove(updates.front().node.get());
+		remove(ready[i]->package.node.get());
 		count++;
 	}
 	if(count == 0) return false;
 	
-	CBytestream bs;
 	bs.writeByte(con->isServer ? (uchar)S2C_GUSANOSUPDATE : (uchar)C2S_GUSANOSUPDATE);
 	writeEliasGammaNr(bs, count - 1);
 	bs.Append(&tmpbs);
+	
+	sentUpdates += count;
+	sentBytes += bs.GetLength();
+	return true;
+}
+
+bool NetControlIntern::NodeUpdateManager::send(const SmartPointer<NetControlIntern>& con, Net_ConnID target, size_t maxBytes) {
+	CBytestream bs;
+	if(!compose(con, target, maxBytes, bs)) return false;
 
 	if(con->isServer)
 		serverConnFromNetConnID(target)->getNetEngine()->SendPacket(&bs);
@@ -452,6 +596,42 @@ bool Net_Control::olxSendNodeUpdates(Net_ConnID target, size_t maxBytes) {
 	return intern->nodeUpdateManager[target].send(intern, target, maxBytes);
 }
 
+void Net_Control::olxSetInterest(Net_ConnID cid, const std::vector<Net_InterestItem>& items) {
+	intern->nodeUpdateManager[cid].setInterest(intern, cid, items);
+}
+
+void Net_Control::olxClearInterest(Net_ConnID cid) {
+	NetControlIntern::NodeUpdateManager& m = intern->nodeUpdateManager[cid];
+	if(!m.interestSet) return;
+	
+	// the nodes which were held back enter again
+	for(NetControlIntern::Nodes::iterator i = intern->nodes.begin(); i != intern->nodes.end(); ++i) {
+		NetNodeIntern* node = i->second->intern.get();
+		if(!node->spatial || node->ownerConn == cid) continue;
+		if(m.relevant.find(node) != m.relevant.end()) continue;
+		m.entered.push_back(i->second->intern);
+		m.enters++;
+		if(node->eventForInterest)
+			node->incomingEvents.push_back( NetNodeIntern::Event::EnterInterest(cid) );
+	}
+	m.interestSet = false;
+	m.relevant.clear();
+}
+
+void Net_Control::olxDumpInterest(CmdLineIntf& cli) {
+	if(intern->nodeUpdateManager.empty()) {
+		cli.writeMsg("no connections");
+		return;
+	}
+	for(std::map<Net_ConnID,NetControlIntern::NodeUpdateManager>::iterator i = intern->nodeUpdateManager.begin(); i != intern->nodeUpdateManager.end(); ++i) {
+		const NetControlIntern::NodeUpdateManager& m = i->second;
+		cli.writeMsg("conn " + itoa(i->first) + ": " +
+					 (m.interestSet ? itoa(m.relevant.size()) + " relevant nodes" : std::string("no area of interest")) +
+					 ", " + itoa(m.updates.size()) + " updates waiting, " + itoa(m.enters) + " enters, " + itoa(m.leaves) + " leaves, " +
+					 itoa(m.heldBack) + " updates held back, " + itoa(m.sentUpdates) + " sent in " + itoa(m.sentBytes) + " bytes");
+	}
+}
+
 void Net_Control::olxParse(Net_ConnID src, CBytestream& bs) {
 	//size_t bsStart = bs.GetPos();
 	size_t len = readEliasGammaNr(bs) + 1;
@@ -494,13 +674,174 @@ void Net_Control::olxHandleClientDisconnect(Net_ConnID cl) {
 	intern->nodeUpdateManager[cl].clear();
 }
 
-static void pushNodeUpdate(Net_Node* node, const std::vector<BitStream>& replData, Net_RepRules rule) {
+namespace {
+	struct BenchObj {
+		float x, y, vx, vy;
+		void move(float w, float h) {
+			x += vx; y += vy;
+			if(x < 0 || x >= w) { vx = -vx; x += 2 * vx; }
+			if(y < 0 || y >= h) { vy = -vy; y += 2 * vy; }
+		}
+	};
+	
+	float distToView(const BenchObj& view, const BenchObj& o) {
+		const float dx = MAX(fabs(o.x - view.x) - Net_Control::interestViewW, 0.0f);
+		const float dy = MAX(fabs(o.y - view.y) - Net_Control::interestViewH, 0.0f);
+		return sqrtf(dx * dx + dy * dy);
+	}
+	
+	struct BenchRand {
+		Uint32 s;
+		BenchRand() : s(12345) {}
+		float operator()(float max) { s = s * 1103515245 + 12345; return max * ((s >> 8) & 0xffff) / 65536.0f; }
+	};
+}
+
+void Net_Control::olxBenchmarkInterest(CmdLineIntf& cli, int players, int nodes, int seconds) {
+	// a big map; physics with 100 FPS, the server sends to each client every 3rd frame
+	const float mapW = 4000, mapH = 3000;
+	const int fps = 100, sendEvery = 3, interestEvery = 10;
+	
+	SmartPointer<NetControlIntern> con = new NetControlIntern();
+	con->isServer = true;
+	std::vector<Net_Node*> netNodes(nodes);
+	for(int i = 0; i < nodes; ++i) {
+		// not registered, so nobody is told about them
+		netNodes[i] = new Net_Node();
+		netNodes[i]->intern->control = con;
+		netNodes[i]->intern->nodeId = i + 2;
+		netNodes[i]->intern->spatial = true;
+	}
+	
+	size_t passBytes[2] = { 0, 0 }, passEnters = 0, passRelevant = 0;
+	for(int pass = 0; pass < 2; ++pass) {
+		const bool withInterest = pass == 1;
+		BenchRand rnd;
+		std::vector<BenchObj> objs(nodes), views(players);
+		for(int i = 0; i < nodes; ++i) {
+			BenchObj o = { rnd(mapW), rnd(mapH), rnd(4) - 2, rnd(4) - 2 };
+			objs[i] = o;
+		}
+		for(int p = 0; p < players; ++p) {
+			BenchObj v = { rnd(mapW), rnd(mapH), rnd(2) - 1, rnd(2) - 1 };
+			views[p] = v;
+		}
+		
+		std::vector<NetControlIntern::NodeUpdateManager> managers(players);
+		std::vector<size_t> bytes(players, 0);
+		std::vector<Net_InterestItem> items;
+		Uint64 interestTime = 0;
+		size_t relevantSum = 0, interestUpdates = 0;
+		
+		for(int frame = 0; frame < fps * seconds; ++frame) {
+			for(int i = 0; i < nodes; ++i) objs[i].move(mapW, mapH);
+			for(int p = 0; p < players; ++p) views[p].move(mapW, mapH);
+			
+			if(withInterest && frame % interestEvery == 0) {
+				const Uint64 start = Profiler::getTicks();
+				for(int p = 0; p < players; ++p) {
+					items.clear();
+					for(int i = 0; i < nodes; ++i) {
+						const float d = distToView(views[p], objs[i]);
+						if(d <= interestMargin + InterestHysteresis)
+							items.push_back(Net_InterestItem(netNodes[i], interestWeight(d), d <= interestMargin));
+					}
+					managers[p].setInterest(con, p + 1, items);
+					relevantSum += managers[p].relevant.size();
+					managers[p].entered.clear(); // every node has an update in each frame anyway
+				}
+				interestTime += Profiler::getTicks() - start;
+				interestUpdates++;
+			}
+			
+			// every object moves, so every node has an update, like from a PosSpdReplicator
+			for(int i = 0; i < nodes; ++i) {
+				NetControlIntern::DataPackage u;
+				u.type = NetControlIntern::DataPackage::GPT_NodeUpdate;
+				u.node = netNodes[i]->intern;
+				u.fullUpdate = true; // the position is the whole state
+				u.data.addBool(true);
+				u.data.addInt((int)objs[i].x, 12);
+				u.data.addInt((int)objs[i].y, 12);
+				u.data.addBool(false);
+				for(int p = 0; p < players; ++p)
+					managers[p].pushUpdate(u, p + 1);
+			}
+			
+			if(frame % sendEvery == 0)
+				for(int p = 0; p < players; ++p) {
+					CBytestream bs;
+					if(managers[p].compose(con, p + 1, (size_t)-1, bs))
+						bytes[p] += bs.GetLength();
+				}
+		}
+		
+		size_t sum = 0, maxBytes = 0, updates = 0, enters = 0;
+		for(int p = 0; p < players; ++p) {
+			sum += bytes[p];
+			maxBytes = MAX(maxBytes, bytes[p]);
+			updates += managers[p].sentUpdates;
+			enters += managers[p].enters;
+		}
+		cli.writeMsg(std::string(withInterest ? "area of interest:" : "to everybody:   ") +
+					 " avg " + itoa(sum / players / seconds / 1024) + " KB/s, max " + itoa(maxBytes / seconds / 1024) +
+					 " KB/s per client, " + itoa(updates / players / seconds) + " updates/s per client");
+		passBytes[pass] = sum;
+		if(withInterest) {
+			passEnters = enters;
+			passRelevant = relevantSum;
+		}
+		if(withInterest)
+			cli.writeMsg("  " + itoa(relevantSum / MAX(interestUpdates * players, (size_t)1)) + " of " + itoa(nodes) +
+						 " nodes relevant per client, " + itoa(enters) + " enters, interest set " +
+						 itoa(interestTime / MAX(interestUpdates, (size_t)1)) + " us for all clients (brute force, the game uses the grid)");
+	}
+	
+	if(passBytes[0] == 0)
+		cli.writeMsg("nothing was sent to anybody", CNC_ERROR);
+	else if(passBytes[1] >= passBytes[0])
+		cli.writeMsg("the area of interest did not save any traffic", CNC_ERROR);
+	if(passRelevant == 0 || passEnters == 0)
+		cli.writeMsg("no node came into the area of interest of any client", CNC_ERROR);
+	
+	// A far node whose waiting update gets replaced by a partial one must not go out with
+	// only the new replicators; it waits for a full update instead, which it requests.
+	if(nodes > 0) {
+		NetControlIntern::NodeUpdateManager m;
+		m.interestSet = true;
+		m.relevant[netNodes[0]->intern.get()] = 0.25f;
+		NetControlIntern::DataPackage u;
+		u.type = NetControlIntern::DataPackage::GPT_NodeUpdate;
+		u.node = netNodes[0]->intern;
+		u.data.addBool(true);
+		u.data.addBool(false);
+		m.pushUpdate(u, 1);
+		CBytestream bs;
+		m.compose(con, 1, (size_t)-1, bs); // priority 0.25, keeps waiting
+		m.pushUpdate(u, 1);
+		for(int i = 0; i < 4; ++i) m.compose(con, 1, (size_t)-1, bs);
+		bool ok = m.sentUpdates == 0 && m.entered.size() == 1;
+		u.fullUpdate = true;
+		m.pushUpdate(u, 1);
+		ok = ok && m.compose(con, 1, (size_t)-1, bs) && m.sentUpdates == 1;
+		if(!ok)
+			cli.writeMsg("a replaced partial update was sent without the full state", CNC_ERROR);
+	}
+	
+	for(int i = 0; i < nodes; ++i) {
+		netNodes[i]->intern->nodeId = INVALID_NODE_ID; // nothing to unregister
+		delete netNodes[i];
+	}
+}
+
+static void pushNodeUpdate(Net_Node* node, const std::vector<BitStream>& replData, Net_RepRules rule, Net_ConnID target, bool fullUpdate) {
 	NetControlIntern::DataPackage p;
-	p.connID = INVALID_CONN_ID;
+	p.connID = target;
 	p.sendMode = eNet_ReliableOrdered; // TODO ?
 	p.repRules = rule;
 	p.type = NetControlIntern::DataPackage::GPT_NodeUpdate;
 	p.node = node->intern;
+	p.fullUpdate = fullUpdate;
 	
 	size_t count = 0;
 	size_t k = 0;
@@ -522,7 +863,7 @@ static void pushNodeUpdate(Net_Node* node, const std::vector<BitStream>& replDat
 		node->intern->control->pushPackageToSend() = p;
 }
 
-static void handleNodeForUpdate(Net_Node* node, bool forceUpdate) {
+static void handleNodeForUpdate(Net_Node* node, bool forceUpdate, Net_ConnID target = INVALID_CONN_ID) {
 	if(node->intern->interceptor)
 		if(!node->intern->interceptor->outPreUpdate(node, eNet_RoleProxy))
 			return;
@@ -556,11 +897,11 @@ static void handleNodeForUpdate(Net_Node* node, bool forceUpdate) {
 	if(count == 0) return;
 	
 	if(node->intern->role == eNet_RoleAuthority) {
-		pushNodeUpdate(node, replData, Net_REPRULE_AUTH_2_PROXY);
-		pushNodeUpdate(node, replData, Net_REPRULE_AUTH_2_OWNER);
+		pushNodeUpdate(node, replData, Net_REPRULE_AUTH_2_PROXY, target, forceUpdate);
+		pushNodeUpdate(node, replData, Net_REPRULE_AUTH_2_OWNER, target, forceUpdate);
 	}
 	else if(node->intern->role == eNet_RoleOwner) {						
-		pushNodeUpdate(node, replData, Net_REPRULE_OWNER_2_AUTH);
+		pushNodeUpdate(node, replData, Net_REPRULE_OWNER_2_AUTH, target, forceUpdate);
 	}	
 }
 
@@ -613,6 +954,14 @@ void Net_Control::Net_processOutput() {
 		Net_Node* node = i->second;
 		handleNodeForUpdate(node, false);		
 	}
+	
+	// nodes which came into the area of interest of a connection get their full state there
+	for(std::map<Net_ConnID,NetControlIntern::NodeUpdateManager>::iterator m = intern->nodeUpdateManager.begin(); m != intern->nodeUpdateManager.end(); ++m) {
+		for(std::list< SmartPointer<NetNodeIntern> >::iterator i = m->second.entered.begin(); i != m->second.entered.end(); ++i)
+			if((*i)->publicOwner && (*i)->isRegistered())
+				handleNodeForUpdate((*i)->publicOwner, true, m->first);
+		m->second.entered.clear();
+	}
 }
 
 static void doNodeUpdate(Net_Node* node, BitStream& bs, Net_ConnID cid) {
@@ -884,6 +1233,10 @@ static bool __unregisterNode(Net_Node* node) {
 			
 			nodes.erase(i);
 
+			// pending updates and the areas of interest refer to the node
+			for(std::map<Net_ConnID,NetControlIntern::NodeUpdateManager>::iterator m = node->intern->control->nodeUpdateManager.begin(); m != node->intern->control->nodeUpdateManager.end(); ++m)
+				m->second.forget(node->intern.get());
+
 			if(node->intern->role == eNet_RoleAuthority) {
 				NetControlIntern::DataPackage& p = node->intern->control->pushPackageToSend();
 				p.connID = 0;
@@ -966,6 +1319,7 @@ static bool registerNode(Net_ClassID classid, Net_Node* node, Net_NodeID nid, eN
 	node->intern->classId = classid;
 	node->intern->nodeId = nid;
 	node->intern->role = role;
+	node->intern->spatial = (con->classes[classid].flags & Net_CLASSFLAG_SPATIAL) != 0;
 	
 	if(nid == UNIQUE_NODE_ID) {
 		if(con->getLocalNode(classid) != NULL)
@@ -1036,6 +1390,8 @@ void Net_Node::setEventNotification(bool eventForInit /* eNet_EventInit */, bool
 	intern->eventForRemove = eventForRemove;
 }
 
+void Net_Node::setInterestNotification(bool eventForInterest) { intern->eventForInterest = eventForInterest; }
+
 static void __sendNodeEvent(Net_ConnID connId, eNet_SendMode m, Net_RepRules rules, Net_Node* node, BitStream& s) {
 	NetControlIntern::DataPackage& p = node->intern->control->pushPackageToSend();
 	p.connID = connId;
@@ -64,13 +64,16 @@ enum Net_RepFlag {
 
 typedef Net_U8 Net_ClassFlags;
 enum {
-	Net_CLASSFLAG_ANNOUNCEDATA = 1
+	Net_CLASSFLAG_ANNOUNCEDATA = 1,
+	Net_CLASSFLAG_SPATIAL = 2 // nodes belong to an object in the game grid, the server sends their updates by area of interest
 };
 
 enum eNet_Event {
 	eNet_EventUser,
 	eNet_EventInit,
-	eNet_EventRemoved
+	eNet_EventRemoved,
+	eNet_EventEnterInterest, // server only, the node came into the area of interest of the connection
+	eNet_EventLeaveInterest
 };
 
 
@@ -103,6 +106,7 @@ struct Net_FileTransInfo {
 
 class BitStream;
 class CBytestream;
+struct CmdLineIntf;
 
 class CServerConnection;
 Net_ConnID NetConnID_server();
@@ -140,6 +144,7 @@ struct Net_Node : DontCopyTag {
 	
 	
 	void setEventNotification(bool,bool); // TODO: true,false -> enables eEvent_Init
+	void setInterestNotification(bool); // enables eNet_EventEnterInterest and eNet_EventLeaveInterest
 	void sendEvent(eNet_SendMode, Net_RepRules rules, BitStream*);
 	void sendEventDirect(eNet_SendMode, BitStream*, Net_ConnID);
 	bool checkEventWaiting();
@@ -162,6 +167,14 @@ struct Net_Node : DontCopyTag {
 struct NetControlIntern;
 template <> void SmartPointer_ObjectDeinit<NetControlIntern> ( NetControlIntern * obj );
 
+// A spatial node near a connection's view, see Net_Control::olxSetInterest
+struct Net_InterestItem {
+	Net_Node* node;
+	float weight; // update priority gained per send, 1 in the view, less far away
+	bool canEnter; // false if the node is only near enough to stay relevant
+	Net_InterestItem(Net_Node* n = NULL, float w = 1.0f, bool e = true) : node(n), weight(w), canEnter(e) {}
+};
+
 struct Net_Control : DontCopyTag {
 	// we have that as smartptr because we may still refer to it after Net_Control was deleted
 	SmartPointer<NetControlIntern> intern;
@@ -181,6 +194,23 @@ struct Net_Control : DontCopyTag {
 	void olxParse(Net_ConnID src, CBytestream& bs);
 	void olxParseUpdate(Net_ConnID src, CBytestream& bs);
 	void olxHandleClientDisconnect(Net_ConnID cl);
+
+	// Area of interest (server): updates of spatial nodes which are not in the last
+	// given set are held back for that connection. The first call enables this for
+	// the connection, olxClearInterest makes all nodes relevant again.
+	void olxSetInterest(Net_ConnID cid, const std::vector<Net_InterestItem>& items);
+	void olxClearInterest(Net_ConnID cid);
+	void olxDumpInterest(CmdLineIntf& cli);
+	static void olxBenchmarkInterest(CmdLineIntf& cli, int players, int nodes, int seconds);
+
+	// Area of interest around each worm of a connection, in pixels. Nodes in the view
+	// have weight 1, it falls to 1/4 at the margin; a node must come into the margin
+	// to enter and leaves at a bit more distance.
+	static bool interestEnabled;
+	static int interestViewW, interestViewH; // half sizes
+	static int interestMargin;
+	static const int InterestHysteresis = 64;
+	static float interestWeight(float distToView);
 	
 	void Net_processOutput();
 	void Net_processInput();
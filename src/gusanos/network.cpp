@@ -124,10 +124,10 @@ namespace
 
 	void registerClasses() // Factorization of class registering in client and server
 	{
-		CWorm::classID = m_control->Net_registerClass("worm",Net_CLASSFLAG_ANNOUNCEDATA);
+		CWorm::classID = m_control->Net_registerClass("worm",Net_CLASSFLAG_ANNOUNCEDATA | Net_CLASSFLAG_SPATIAL);
 		CWormInputHandler::classID = m_control->Net_registerClass("player",Net_CLASSFLAG_ANNOUNCEDATA);
 		GusGame::classID = m_control->Net_registerClass("gusGame",0);
-		Particle::classID = m_control->Net_registerClass("particle",Net_CLASSFLAG_ANNOUNCEDATA);
+		Particle::classID = m_control->Net_registerClass("particle",Net_CLASSFLAG_ANNOUNCEDATA | Net_CLASSFLAG_SPATIAL);
 	}
 }
 
@@ -190,6 +190,8 @@ Net_ConnID Network::getServerID()
 void Network::update()
 {
 	if ( m_control ) {
+		if(game.isServer())
+			static_cast<Server*>(m_control)->updateInterest();
 		m_control->Net_processOutput();
 		m_control->Net_processInput();
 	}
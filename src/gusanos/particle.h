@@ -51,6 +51,7 @@ public:
 #endif
 	void customEvent( size_t index );
 	void sendLuaEvent(LuaEventDef* event, eNet_SendMode mode, Net_U8 rules, BitStream* userdata, Net_ConnID connID);
+	Net_Node* getNode() { return m_node; }
 	void damage(float amount, CWormInputHandler* damager );
 	void remove();
 	//virtual void deleteThis();
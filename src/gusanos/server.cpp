@@ -12,6 +12,11 @@
 #include "encoding.h"
 #include "game/CMap.h"
 #include "game/Game.h"
+#include "CServer.h"
+#include "CServerConnection.h"
+#include "LieroX.h"
+#include "Profiler.h"
+#include "MathLib.h"
 
 #include "netstream.h"
 #include "gusanos/allegro.h"
@@ -54,3 +59,61 @@ void Server::Net_cbConnectionClosed(Net_ConnID _id)
 	DLOG("A connection was closed");
 }
 
+
+Uint64 Server::lastInterestTime = 0;
+
+static void addInterestAround(const CVec& pos, std::vector<Net_InterestItem>& items)
+{
+	const int range = Net_Control::interestMargin + Net_Control::InterestHysteresis;
+	const int w = Net_Control::interestViewW + range, h = Net_Control::interestViewH + range;
+	const int x = (int)pos.x, y = (int)pos.y;
+	
+	for(int layer = 0; layer < Grid::ColLayerCount; ++layer) {
+		forrange_bool(obj, game.objects.beginArea(x - w, y - h, x + w, y + h, layer))
+		{
+			if(obj->deleteMe) continue;
+			Net_Node* node = obj->getNode();
+			if(!node || !node->isNodeRegistered()) continue;
+			
+			const CVec p = obj->getPos();
+			const float dx = MAX(fabs(p.x - pos.x) - Net_Control::interestViewW, 0.0f);
+			const float dy = MAX(fabs(p.y - pos.y) - Net_Control::interestViewH, 0.0f);
+			const float d = sqrtf(dx * dx + dy * dy);
+			if(d > range) continue; // the grid returns whole squares
+			items.push_back(Net_InterestItem(node, Net_Control::interestWeight(d), d <= Net_Control::interestMargin));
+		}
+	}
+}
+
+void Server::updateInterest()
+{
+	if(!cServer || !cServer->getClients()) return;
+	if(Net_Control::interestEnabled && tLX->currentTime - m_lastInterestUpdate < 0.1f) return;
+	m_lastInterestUpdate = tLX->currentTime;
+	
+	const Uint64 start = Profiler::getTicks();
+	std::vector<Net_InterestItem> items;
+	CServerConnection *cl = cServer->getClients();
+	for(int c = 0; c < MAX_CLIENTS; c++, cl++) {
+		if(cl->getStatus() == NET_DISCONNECTED || cl->getStatus() == NET_ZOMBIE) continue;
+		if(cl->getNetEngine() == NULL || cl->isLocalClient()) continue;
+		const Net_ConnID cid = NetConnID_conn(cl);
+		
+		items.clear();
+		bool haveWorms = false, haveView = false;
+		if(Net_Control::interestEnabled)
+			for_each_iterator(CWorm*, w, game.wormsOfClient(cl)) {
+				haveWorms = true;
+				if(!w->get()->getAlive()) continue;
+				haveView = true;
+				addInterestAround(w->get()->getPos(), items);
+			}
+		
+		if(haveView)
+			olxSetInterest(cid, items);
+		else if(!haveWorms)
+			olxClearInterest(cid); // we don't know where a spectator looks
+		// else all worms are dead: keep the last area, clearing it would send every node on the map at each death
+	}
+	lastInterestTime = Profiler::getTicks() - start;
+}
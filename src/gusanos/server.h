@@ -4,6 +4,7 @@
 #include "game/WormInputHandler.h"
 
 #include "netstream.h"
+#include "olx-types.h"
 #include <map>
 #include <boost/shared_ptr.hpp>
 
@@ -20,6 +21,11 @@ public:
 	
 	void preShutdown() { m_preShutdown = true; }
 	
+	// Sets the area of interest of each connection from the game grid around its
+	// living worms; clients without any see everything.
+	void updateInterest();
+	static Uint64 lastInterestTime; // of the last update with grid queries, in microseconds
+	
 protected:
 		
 	// called when incoming connection has been established
@@ -34,6 +40,7 @@ protected:
 	void Net_cbNodeRequest_Dynamic( Net_ConnID _id, Net_ClassID _requested_class, BitStream *_announcedata, eNet_NodeRole _role, Net_NodeID _net_id ) {}
 	
 	bool socketsInited;
+	AbsTime m_lastInterestUpdate;
 };
 
 #endif // _SERVER_H_
@@ -44,6 +44,7 @@
 #include "Music.h"
 #include "Debug.h"
 #include "TaskManager.h"
+#include "TaskScheduler.h"
 #include "CGameMode.h"
 #include "ConversationLogger.h"
 #include "OLXCommand.h"
@@ -52,7 +53,9 @@
 #include "game/Game.h"
 #include "sound/SoundsBase.h"
 #include "game/ServerList.h"
+#include "game/Benchmark.h"
 #include "client/StdinCLISupport.h"
+#include "Metrics.h"
 
 #include "DeprecatedGUI/CBar.h"
 #include "DeprecatedGUI/Graphics.h"
@@ -85,6 +88,7 @@ static void ParseArguments_BeforeInit(int argc, char *argv[]);
 static void ParseArguments_AfterInit(int argc, char *argv[]);
 
 static std::list<std::string> startupCommands;
+static bool benchmarkArg = false; // -benchmark was given
 
 
 //
@@ -253,6 +257,7 @@ int real_main(int argc, char *argv[])
 startpoint:
 
 	InitTaskManager();
+	InitTaskScheduler();
 	
 	// Load options and other settings
 	if(!GameOptions::Init()) {
@@ -281,6 +286,12 @@ startpoint:
 	// overwrite the default options
 	ParseArguments_AfterInit(argc, argv);
 
+	if(tLXOptions->bLogAsync)
+		StartAsyncLogging(tLXOptions->sLogJsonFile);
+
+	if(tLXOptions->sMetricsEndpoint != "")
+		Metrics::startEndpoint(tLXOptions->sMetricsEndpoint);
+
 	// Start the G15 support, it's suitable that the display is showing while loading.
 #ifdef WITH_G15
 	OLXG15 = new OLXG15_t;
@@ -371,6 +382,8 @@ startpoint:
 		Execute(dynamic_cast<CmdLineIntf*>(startupCLI.get()), startupCLI, *i);
 	}
 	startupCommands.clear(); // don't execute them again
+	if(Benchmark::haveChecks() && !benchmarkArg)
+		Benchmark::queueChecks();
 
 	doMainLoop();
 	
@@ -383,6 +396,7 @@ startpoint:
 
 	notes << "waiting for all left threads and tasks" << endl;
 	taskManager->finishQueuedTasks();
+	UnInitTaskScheduler(); // its workers would block waitAll
 	threadPool->waitAll(); // do that before uniniting task manager because some threads could access it
 
 	// do that after shutting down the timers and other threads
@@ -416,7 +430,7 @@ startpoint:
 
 	quitStdinCLISupport();
 	teeStdoutQuit();
-	return 0;
+	return Benchmark::failed() ? 1 : 0;
 }
 
 
@@ -499,6 +513,37 @@ static void ParseArguments_AfterInit(int argc, char *argv[])
 				warnings << "-connect needs an additinal parameter" << endl;
 		} else
 
+		// -benchmark
+		// runs the headless benchmark (next param: scenario [frames] [bots] [seed] [outputfile]) and quits
+		if( stricmp(a, "-benchmark") == 0 ) {
+			if(argv[i + 1] != NULL) {
+				bDedicated = true;
+				bDisableSound = true;
+				tLXOptions->sDedicatedScript = "/dev/null";
+				tLXOptions->bRegServer = false;
+				tLXOptions->bEnableChat = false;
+				startupCommands.push_back("benchmark " + std::string(argv[++i]));
+				benchmarkArg = true;
+			}
+			else
+				warnings << "-benchmark needs an additinal parameter" << endl;
+		} else
+
+		// -check
+		// runs a console command as a check (at the end of -benchmark, or alone) and quits, see Benchmark.h
+		if( stricmp(a, "-check") == 0 ) {
+			if(argv[i + 1] != NULL) {
+				bDedicated = true;
+				bDisableSound = true;
+				tLXOptions->sDedicatedScript = "/dev/null";
+				tLXOptions->bRegServer = false;
+				tLXOptions->bEnableChat = false;
+				Benchmark::addCheck(argv[++i]);
+			}
+			else
+				warnings << "-check needs an additinal parameter" << endl;
+		} else
+
 		// -exec
 		// pushes a startup command
 		if( stricmp(a, "-exec") == 0 ) {
@@ -557,6 +602,10 @@ static void ParseArguments_AfterInit(int argc, char *argv[])
         	printf("available parameters:\n");
 			printf("   -connect srv  Connects to the server\n");
 			printf("   -exec cmd     Executes the command in console\n");
+			printf("   -benchmark \"scenario [frames] [bots] [seed] [outfile]\"\n");
+			printf("                 Runs a headless benchmark and quits\n");
+			printf("   -check cmd    Runs the command as a check (at the end of -benchmark)\n");
+			printf("                 and quits, the exit code is 1 if it reported an error\n");
      		printf("   -opengl       OpenLieroX will use OpenGL for drawing\n");
      		printf("   -noopengl     Explicitly disable using OpenGL\n");
      		printf("   -dedicated    Dedicated mode\n");
@@ -585,8 +634,9 @@ static void ParseArguments_AfterInit(int argc, char *argv[])
 		{
 			InitializeLieroX();
 			TestCChannelRobustness();
+			const bool ok = TestCChannelCongestion(stdoutCLI());
 			ShutdownLieroX();
-     		exit(0);
+     		exit(ok ? 0 : 1);
 		}
 		#endif
     }
@@ -839,6 +889,11 @@ void ShutdownLieroX()
 
 	ShutdownSounds();
 
+	Metrics::stopEndpoint();
+
+	// the log writer prints to the console, and it would block threadPool->waitAll()
+	StopAsyncLogging();
+
     Con_Shutdown();
 
 	ShutdownLoading();  // In case we're called when an error occured
@@ -52,6 +52,8 @@
 #include "game/Level.h"
 #include "game/SettingsPreset.h"
 #include "CGameScript.h"
+#include "Profiler.h"
+#include "Metrics.h"
 #include "client/ClientConnectionRequestInfo.h" // for WormJoinInfo
 
 
@@ -490,6 +492,9 @@ void GameServer::BeginMatch(CServerConnection* receiver)
 		game.gameMode()->BeginMatch();
 		
 		DumpGameState(&stdoutCLI());
+
+		if(tLXOptions->bRecordServerDemos && !cDemoRecorder.isRecording())
+			cDemoRecorder.start("demos/" + GetDateTimeFilename() + ".olxdemo");
 	}
 
 	if(firstStart)
@@ -686,6 +691,7 @@ CWorm *GameServer::getFirstAliveWorm() const
 // Main server frame
 void GameServer::Frame()
 {
+	PROFILE_ZONE("GameServer::Frame");
 	
 	// test code to do profiling
 	/*if(game.state == Game::S_Playing) {
@@ -707,8 +713,49 @@ void GameServer::Frame()
 	}*/
 	
 	SimulateGame();
+	cDemoRecorder.frame();
 
 	CheckTimeouts();
+	UpdateMetrics();
+}
+
+////////////////////
+// Samples the traffic of the clients for the metrics endpoint, once per second
+void GameServer::UpdateMetrics()
+{
+	static AbsTime lastUpdate;
+	if(tLX->currentTime - lastUpdate < 1.0f)
+		return;
+	lastUpdate = tLX->currentTime;
+
+	static Metrics::Gauge& clients = Metrics::gauge("olx_server_clients", "Connected clients");
+	static Metrics::Gauge* bytesOut[MAX_CLIENTS] = {};
+	static Metrics::Gauge* bytesIn[MAX_CLIENTS] = {};
+	static Metrics::Gauge* ping[MAX_CLIENTS] = {};
+	if(!bytesOut[0]) {
+		for(int i = 0; i < MAX_CLIENTS; i++) {
+			const std::string client = "client=\"" + itoa(i) + "\"";
+			bytesOut[i] = &Metrics::gauge("olx_client_bytes_per_second", "Traffic of each client slot", client + ",dir=\"out\"");
+			bytesIn[i] = &Metrics::gauge("olx_client_bytes_per_second", "Traffic of each client slot", client + ",dir=\"in\"");
+			ping[i] = &Metrics::gauge("olx_client_ping_ms", "Ping of each client slot", client);
+		}
+	}
+
+	int connected = 0;
+	CServerConnection *cl = cClients;
+	for(int i = 0; i < MAX_CLIENTS; i++, cl++) {
+		if(cl->getStatus() == NET_DISCONNECTED || cl->getChannel() == NULL) {
+			bytesOut[i]->set(0);
+			bytesIn[i]->set(0);
+			ping[i]->set(0);
+			continue;
+		}
+		connected++;
+		bytesOut[i]->set(cl->getChannel()->getOutgoingRate());
+		bytesIn[i]->set(cl->getChannel()->getIncomingRate());
+		ping[i]->set(cl->getChannel()->getPing());
+	}
+	clients.set(connected);
 }
 
 ////////////////////
@@ -718,89 +765,133 @@ bool GameServer::ReadPacketsFromSocket(const SmartPointer<NetworkSocket>& sock)
 	if (!sock->isReady())
 		return false;
 
-	netError = "";
 	CBytestream bs;
 
 	bool anythingNew = false;
 	while(bs.Read(sock)) {
-#if defined(DEBUG) || !defined(FUZZY_ERROR_TESTING_C2S)
-#define NETDEBUG
-#endif
-#ifdef NETDEBUG
-		CBytestream bsCopy = bs;
-#endif
 		anythingNew = true;
 		
 		// Set out address to addr from where last packet was sent, used for NAT traverse
 		sock->reapplyRemoteAddress();
 		NetworkAddr addrFrom = sock->remoteAddress();
-		
-		// Check for connectionless packets (four leading 0xff's)
-		if(bs.readInt(4) == -1) {
-			std::string address;
-			NetAddrToString(addrFrom, address);
-			bs.ResetPosToBegin();
-			// parse all connectionless packets
-			// For example lx::openbeta* was sent in a way that 2 packages were sent at once.
-			// <rev1457 (incl. Beta3) versions only will parse one package at a time.
-			// I fixed that now since >rev1457 that it parses multiple packages here
-			// (but only for new net-commands).
-			// Same thing in CClient.cpp in ReadPackets
-			while(!bs.isPosAtEnd() && bs.readInt(4) == -1)
-				ParseConnectionlessPacket(sock, &bs, address);
+
+		if(UNLIKELY(cPacketLogWriter.isOpen()))
+			cPacketLogWriter.write(tLX->currentTime, addrFrom, bs);
+
+		ProcessPacket(sock, bs, addrFrom);
+	}
+
+	return anythingNew;
+}
+
+////////////////////
+// Handles one received datagram
+void GameServer::ProcessPacket(const SmartPointer<NetworkSocket>& sock, CBytestream& bs, const NetworkAddr& addrFrom)
+{
+	netError = "";
+
+#if defined(DEBUG) || !defined(FUZZY_ERROR_TESTING_C2S)
+#define NETDEBUG
+#endif
 #ifdef NETDEBUG
-			if(netError != "") {
-				warnings << "GS: read conless error " << netError << endl;
-				bsCopy.Skip(bs.GetPos());
-				bsCopy.Dump();
-				netError = "";				
-			}
+	CBytestream bsCopy = bs;
 #endif
-			continue;
-		}
+
+	// Check for connectionless packets (four leading 0xff's)
+	if(bs.readInt(4) == -1) {
+		std::string address;
+		NetAddrToString(addrFrom, address);
 		bs.ResetPosToBegin();
+		// parse all connectionless packets
+		// For example lx::openbeta* was sent in a way that 2 packages were sent at once.
+		// <rev1457 (incl. Beta3) versions only will parse one package at a time.
+		// I fixed that now since >rev1457 that it parses multiple packages here
+		// (but only for new net-commands).
+		// Same thing in CClient.cpp in ReadPackets
+		while(!bs.isPosAtEnd() && bs.readInt(4) == -1)
+			ParseConnectionlessPacket(sock, &bs, address);
+#ifdef NETDEBUG
+		if(netError != "") {
+			warnings << "GS: read conless error " << netError << endl;
+			bsCopy.Skip(bs.GetPos());
+			bsCopy.Dump();
+			netError = "";				
+		}
+#endif
+		return;
+	}
+	bs.ResetPosToBegin();
 
-		// Reset the suicide packet count
-		iSuicidesInPacket = 0;
+	// Reset the suicide packet count
+	iSuicidesInPacket = 0;
 
-		// Read packets
-		CServerConnection *cl = cClients;
-		for (int c = 0; c < MAX_CLIENTS; c++, cl++) {
+	// Read packets
+	CServerConnection *cl = cClients;
+	for (int c = 0; c < MAX_CLIENTS; c++, cl++) {
 
-			// Player not connected
-			if(cl->getStatus() == NET_DISCONNECTED)
-				continue;
+		// Player not connected
+		if(cl->getStatus() == NET_DISCONNECTED)
+			continue;
 
-			// Check if the packet is from this player
-			if(!AreNetAddrEqual(addrFrom, cl->getChannel()->getAddress()))
-				continue;
+		// Check if the packet is from this player
+		if(!AreNetAddrEqual(addrFrom, cl->getChannel()->getAddress()))
+			continue;
 
-			// Check the port
-			if (GetNetAddrPort(addrFrom) != GetNetAddrPort(cl->getChannel()->getAddress()))
-				continue;
+		// Check the port
+		if (GetNetAddrPort(addrFrom) != GetNetAddrPort(cl->getChannel()->getAddress()))
+			continue;
 
-			// Parse the packet - process continuously in case we've received multiple logical packets on new CChannel
-			uint n = 0;
-			while (cl->getChannel()->Process(&bs))  {
-				// Only process the actual packet for playing clients
-				if( cl->getStatus() != NET_ZOMBIE )
-					cl->getNetEngine()->ParsePacket(&bs);
-				bs.Clear();
+		// Parse the packet - process continuously in case we've received multiple logical packets on new CChannel
+		uint n = 0;
+		while (cl->getChannel()->Process(&bs))  {
+			// Only process the actual packet for playing clients
+			if( cl->getStatus() != NET_ZOMBIE )
+				cl->getNetEngine()->ParsePacket(&bs);
+			bs.Clear();
 #ifdef NETDEBUG
-				if(netError != "") {
-					warnings << "GS: " << cl->debugName(true) << " read error (" << n << ") " << netError << endl;
-					bs.Dump();
-					notes << "Original data:" << endl;
-					bsCopy.Dump();
-					netError = "";
-				}
+			if(netError != "") {
+				warnings << "GS: " << cl->debugName(true) << " read error (" << n << ") " << netError << endl;
+				bs.Dump();
+				notes << "Original data:" << endl;
+				bsCopy.Dump();
+				netError = "";
+			}
 #endif
-				n++;
+			n++;
+		}
+	}
+}
+
+////////////////////
+// Handles a replayed datagram, see PacketReplayer
+void GameServer::InjectPacket(const NetworkAddr& addrFrom, CBytestream& bs)
+{
+	const SmartPointer<NetworkSocket>& sock = tSockets[0];
+	if(!sock.get() || !sock->isOpen()) return;
+
+	// A replayed connect carries the challenge of the recorded session, give it the one we handed out.
+	if(bs.readInt(4) == -1 && bs.readString() == "lx::connect" && !bs.isPosAtEnd()) {
+		int protocolVersion = bs.readInt(1);
+		bs.Skip(4); // recorded challenge
+		std::string rest = bs.readData();
+		for (int i = 0; i < MAX_CHALLENGES; i++) {
+			if (IsNetAddrValid(tChallenges[i].Address) && AreNetAddrEqual(addrFrom, tChallenges[i].Address) &&
+				GetNetAddrPort(addrFrom) == GetNetAddrPort(tChallenges[i].Address)) {
+				bs.Clear();
+				bs.writeInt(-1, 4);
+				bs.writeString("lx::connect");
+				bs.writeInt(protocolVersion, 1);
+				bs.writeInt(tChallenges[i].iNum, 4);
+				bs.writeData(rest);
+				break;
 			}
 		}
 	}
+	bs.ResetPosToBegin();
 
-	return anythingNew;
+	// Answers go to addrFrom
+	sock->setRemoteAddress(addrFrom);
+	ProcessPacket(sock, bs, addrFrom);
 }
 
 
@@ -808,12 +899,16 @@ bool GameServer::ReadPacketsFromSocket(const SmartPointer<NetworkSocket>& sock)
 // Read packets
 bool GameServer::ReadPackets()
 {	
+	PROFILE_ZONE("GameServer::ReadPackets");
 	bool anythingNew = false;
 	// Main sockets
 	for( int i = 0; i < MAX_SERVER_SOCKETS; i++ )
 		if( ReadPacketsFromSocket(tSockets[i]) )
 			anythingNew = true;
 
+	if( cPacketReplayer.frame(this) )
+		anythingNew = true;
+
 	// Traverse sockets
 	// HINT: copy the list, because tNatClients can change during the loop (client leaves)
 	NatConnList nat_copy = tNatClients;
@@ -2153,6 +2248,10 @@ void GameServer::Shutdown()
 		cClients = NULL;
 	}
 
+	cPacketReplayer.stop();
+	cPacketLogWriter.close();
+	cDemoRecorder.stop();
+
 	ResetSockets();
 
 	if(m_flagInfo) {
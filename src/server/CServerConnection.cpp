@@ -171,6 +171,7 @@ void CServerConnection::Shutdown()
 void CServerConnection::setClientVersion(const Version& v)
 {
 	cClientVersion = v;
+	cUdpFileDownloader.setWindowedTransfer( v >= OLXBetaVersion(0,59,11) );
 }
 
 void CServerConnection::resetNetEngine() {
@@ -199,7 +200,9 @@ CChannel * CServerConnection::createChannel(const Version& v)
 {
 	if( cNetChan )
 		delete cNetChan;
-	if( v >= OLXBetaVersion(0,58,1) )
+	if( v >= OLXBetaVersion(0,59,11) )
+		cNetChan = new CChannel4();
+	else if( v >= OLXBetaVersion(0,58,1) )
 		cNetChan = new CChannel3();
 	else if( v >= OLXBetaVersion(0,57,6) )
 		cNetChan = new CChannel2();
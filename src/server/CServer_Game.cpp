@@ -479,6 +479,8 @@ void GameServer::gotoLobby()
 		errors << "server gotolobby handling: not in lobby, current state: " << game.state << endl;
 		return;
 	}
+
+	cDemoRecorder.stop();
 	
 	// Tell all the clients
 	CBytestream bs;
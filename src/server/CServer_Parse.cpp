@@ -160,6 +160,10 @@ void CServerNetEngine::ParsePacket(CBytestream *bs) {
 			ParseSendFile(bs);
 			break;
 
+		case C2S_FILETRANSFER:
+			ParseFileTransfer(bs);
+			break;
+
 		case C2S_REPORTDAMAGE:
 			ParseReportDamage(bs);
 			break;
@@ -701,7 +705,7 @@ void CServerNetEngineBeta7::ParseChatCommandCompletionRequest(CBytestream *bs) {
 			int connectionIndex = getConnectionArrayIndex();
 			if(connectionIndex < 0) return;
 			
-			taskManager->start(new AutoCompleter(startStr, cmdToBeCompleted, connectionIndex, this), TaskManager::QT_GlobalQueue);
+			taskManager->start(new AutoCompleter(startStr, cmdToBeCompleted, connectionIndex, this), TaskManager::QT_Scheduler);
 			return;
 		} // end autocomplete for ded
 		   
@@ -907,13 +911,20 @@ void CServerNetEngine::ParseSendFile(CBytestream *bs)
 	if( cl->getUdpFileDownloader()->receive(bs) )
 	{
 		if( cl->getUdpFileDownloader()->isFinished() &&
-			( cl->getUdpFileDownloader()->getFilename() == "GET:" || cl->getUdpFileDownloader()->getFilename() == "STAT:" ) )
+			( cl->getUdpFileDownloader()->getFilename() == "GET:" || cl->getUdpFileDownloader()->getFilename() == "STAT:" ||
+			cl->getUdpFileDownloader()->getFilename() == "DELTA:" ) )
 		{
 			cl->getUdpFileDownloader()->abortDownload();	// We can't provide that file or statistics on it
 		}
 	}
 }
 
+void CServerNetEngine::ParseFileTransfer(CBytestream *bs)
+{
+	// Ack of the windowed transfer
+	cl->getUdpFileDownloader()->receiveWindowedAck(bs);
+}
+
 /////////////////
 // Parse a command from chat
 bool CServerNetEngine::ParseChatCommand(const std::string& message)
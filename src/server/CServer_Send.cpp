@@ -39,6 +39,7 @@
 #include "game/Level.h"
 #include "CGameScript.h"
 #include "Utils.h"
+#include "Profiler.h"
 #include "game/GameState.h"
 
 
@@ -420,6 +421,7 @@ static float maxRateForClient(CServerConnection* cl) {
 // Returns true if we sent an update
 bool GameServer::SendUpdate()
 {
+	PROFILE_ZONE("GameServer::SendUpdate");
 	if(NewNet::Active())
 		return false;
 		
@@ -1007,6 +1009,23 @@ int CServerNetEngineBeta5::SendFiles()
 	if(cl->getStatus() == NET_DISCONNECTED || cl->getStatus() == NET_ZOMBIE)
 		return 0;
 	int ping = 0;
+	if( cl->getUdpFileDownloader()->isSendingWindowed() )
+	{
+		// Unreliable chunks with selective acks, see CUdpFileDownloader
+		ping = cl->getChannel()->getPing() != 0 ? cl->getChannel()->getPing() : minPingDefault;
+		if( ! server->checkBandwidth(cl) )
+			return ping;
+		std::vector<CBytestream> packets;
+		cl->getUdpFileDownloader()->sendWindowed( packets, tLX->currentTime, TimeDiff(ping) );
+		for( size_t i = 0; i < packets.size(); i++ )
+		{
+			CBytestream bs;
+			bs.writeByte(S2C_FILETRANSFER);
+			bs.Append(&packets[i]);
+			cl->getChannel()->Transmit(&bs);
+		}
+		return ping;
+	}
 	// That's a bit floody algorithm, it can be optimized I think
 	if( cl->getUdpFileDownloader()->isSending() &&
 		( cl->getChannel()->getBufferEmpty() ||
@@ -0,0 +1,234 @@
+/*
+	OpenLieroX
+
+	record and replay of inbound server datagrams, for offline load tests
+
+	code under LGPL
+*/
+
+#include <cstring>
+#include "PacketLog.h"
+#include "CBytestream.h"
+#include "CServer.h"
+#include "OLXCommand.h"
+#include "FindFile.h"
+#include "StringUtils.h"
+#include "LieroX.h"
+#include "Debug.h"
+
+
+static const char PacketLogMagic[] = "OLXPKTLOG";
+static const Uint8 PacketLogVersion = 1;
+
+static void writeVarUInt(FILE* f, Uint64 v) {
+	while(v >= 0x80) {
+		fputc((int)(v & 0x7f) | 0x80, f);
+		v >>= 7;
+	}
+	fputc((int)v, f);
+}
+
+static bool readVarUInt(FILE* f, Uint64& v) {
+	v = 0;
+	for(unsigned int shift = 0; shift < 64; shift += 7) {
+		int c = fgetc(f);
+		if(c == EOF) return false;
+		v |= (Uint64)(c & 0x7f) << shift;
+		if((c & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+static bool readBlob(FILE* f, std::string& data) {
+	Uint64 len = 0;
+	if(!readVarUInt(f, len) || len > 0x10000) return false;
+	data.resize((size_t)len);
+	return len == 0 || fread(&data[0], 1, (size_t)len, f) == len;
+}
+
+
+bool PacketLogWriter::open(const std::string& fn) {
+	close();
+	file = OpenGameFile(fn, "wb");
+	if(!file) {
+		errors << "PacketLogWriter: cannot open " << fn << " for writing" << endl;
+		return false;
+	}
+	filename = fn;
+	fwrite(PacketLogMagic, 1, sizeof(PacketLogMagic) - 1, file);
+	fputc(PacketLogVersion, file);
+	startTime = tLX->currentTime;
+	lastWrittenMs = 0;
+	addrIds.clear();
+	packets = bytes = 0;
+	notes << "PacketLogWriter: recording inbound server packets to " << fn << endl;
+	return true;
+}
+
+void PacketLogWriter::close() {
+	if(!file) return;
+	fclose(file);
+	file = NULL;
+	notes << "PacketLogWriter: recorded " << packets << " packets (" << bytes << " bytes) to " << filename << endl;
+}
+
+void PacketLogWriter::write(AbsTime time, const NetworkAddr& from, const CBytestream& bs) {
+	if(!file) return;
+
+	// The time can only go forward, see Game::frame.
+	const Uint64 ms = (time > startTime) ? (Uint64)(time - startTime).milliseconds() : 0;
+	writeVarUInt(file, (ms > lastWrittenMs) ? ms - lastWrittenMs : 0);
+	lastWrittenMs = MAX(ms, lastWrittenMs);
+
+	const std::string addr = NetAddrToString(from);
+	std::map<std::string, Uint32>::iterator i = addrIds.find(addr);
+	if(i != addrIds.end())
+		writeVarUInt(file, i->second);
+	else {
+		Uint32 id = (Uint32)addrIds.size();
+		addrIds[addr] = id;
+		writeVarUInt(file, id);
+		writeVarUInt(file, addr.size());
+		fwrite(addr.data(), 1, addr.size(), file);
+	}
+
+	const std::string& data = bs.data();
+	writeVarUInt(file, data.size());
+	fwrite(data.data(), 1, data.size(), file);
+
+	packets++;
+	bytes += data.size();
+}
+
+void PacketLogWriter::printStatus(CmdLineIntf& cli) const {
+	if(!file)
+		cli.writeMsg("packet recording: off");
+	else
+		cli.writeMsg("packet recording: " + itoa(packets) + " packets, " + itoa(bytes) + " bytes, " +
+					 itoa(addrIds.size()) + " addresses to " + filename);
+}
+
+
+bool PacketLog::load(const std::string& fn) {
+	clear();
+	FILE* f = OpenGameFile(fn, "rb");
+	if(!f) {
+		errors << "PacketLog: cannot open " << fn << endl;
+		return false;
+	}
+
+	char magic[sizeof(PacketLogMagic) - 1];
+	if(fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, PacketLogMagic, sizeof(magic)) != 0 ||
+	   fgetc(f) != PacketLogVersion) {
+		errors << "PacketLog: " << fn << " is not a packet log of a supported version" << endl;
+		fclose(f);
+		return false;
+	}
+
+	Uint32 time = 0;
+	Uint64 dt = 0;
+	while(readVarUInt(f, dt)) {
+		Packet p;
+		time += (Uint32)dt;
+		p.time = time;
+		Uint64 addrId = 0;
+		if(!readVarUInt(f, addrId) || addrId > addresses.size()) break;
+		if(addrId == addresses.size()) {
+			std::string addr;
+			if(!readBlob(f, addr)) break;
+			addresses.push_back(addr);
+		}
+		p.addrId = (Uint32)addrId;
+		if(!readBlob(f, p.data)) break;
+		packets.push_back(p);
+	}
+	if(!feof(f))
+		warnings << "PacketLog: " << fn << " is corrupt after " << packets.size() << " packets, ignoring the rest" << endl;
+
+	fclose(f);
+	return true;
+}
+
+
+bool PacketReplayer::start(const std::string& fn, int c, float s, CmdLineIntf& cli) {
+	stop();
+	if(c <= 0 || s <= 0.0f) {
+		cli.writeMsg("copies and speed must be positive", CNC_WARNING);
+		return false;
+	}
+	if(!log.load(fn)) {
+		cli.writeMsg("cannot load packet log " + fn, CNC_WARNING);
+		return false;
+	}
+
+	remapped.resize(c * log.addresses.size());
+	size_t n = 0;
+	for(int copy = 0; copy < c; ++copy)
+		for(size_t a = 0; a < log.addresses.size(); ++a) {
+			NetworkAddr& addr = remapped[copy * log.addresses.size() + a];
+			ResetNetAddr(addr);
+			NetworkAddr orig = StringToNetAddr(log.addresses[a]);
+			if(!IsNetAddrValid(orig) || strStartsWith(log.addresses[a], "127.0.0.1:"))
+				continue; // the local client of the recording server
+			// 127.1.x.y is loopback on all systems we care about, answers are just dropped
+			std::string ip = "127.1." + itoa(n / 254) + "." + itoa(1 + n % 254);
+			n++;
+			StringToNetAddr(ip, addr);
+			SetNetAddrPort(addr, GetNetAddrPort(orig));
+		}
+	if(n == 0) {
+		cli.writeMsg("packet log " + fn + " has no remote clients", CNC_WARNING);
+		log.clear();
+		remapped.clear();
+		return false;
+	}
+
+	copies = c;
+	speed = s;
+	startTime = tLX->currentTime;
+	next = 0;
+	packetsInjected = bytesInjected = 0;
+	cli.writeMsg("replaying " + itoa(log.packets.size()) + " packets from " + itoa(n / c) +
+				 " clients, " + itoa(c) + " copies, speed " + ftoa(s));
+	return true;
+}
+
+void PacketReplayer::stop() {
+	if(!isActive()) return;
+	notes << "PacketReplayer: stopped, injected " << packetsInjected << " packets (" << bytesInjected << " bytes)" << endl;
+	copies = 0;
+	log.clear();
+	remapped.clear();
+}
+
+bool PacketReplayer::frame(GameServer* server) {
+	if(!isActive()) return false;
+
+	const float replayTime = (tLX->currentTime - startTime).milliseconds() * speed;
+	bool anythingNew = false;
+	for(; next < log.packets.size() && log.packets[next].time <= replayTime; ++next) {
+		const PacketLog::Packet& p = log.packets[next];
+		for(int copy = 0; copy < copies; ++copy) {
+			const NetworkAddr& addr = remapped[copy * log.addresses.size() + p.addrId];
+			if(!IsNetAddrValid(addr)) continue;
+			CBytestream bs(p.data);
+			server->InjectPacket(addr, bs);
+			packetsInjected++;
+			bytesInjected += p.data.size();
+			anythingNew = true;
+		}
+	}
+
+	if(next >= log.packets.size())
+		stop();
+	return anythingNew;
+}
+
+void PacketReplayer::printStatus(CmdLineIntf& cli) const {
+	if(!isActive())
+		cli.writeMsg("packet replay: off");
+	else
+		cli.writeMsg("packet replay: " + itoa(next) + "/" + itoa(log.packets.size()) + " packets, " +
+					 itoa(packetsInjected) + " injected (" + itoa(bytesInjected) + " bytes), " +
+					 itoa(copies) + " copies, speed " + ftoa(speed));
+}
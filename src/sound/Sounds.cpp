@@ -28,6 +28,7 @@
 #include "AuxLib.h"
 #include "Cache.h"
 #include "StringUtils.h"
+#include "Metrics.h"
 #include "MathLib.h"
 #include "Timer.h"
 #include "Options.h"
@@ -198,12 +199,18 @@ bool FreeSoundSample(SoundSample* sample) {
 	return true;
 }
 
+static void CountSoundPlayed() {
+	static Metrics::Counter& played = Metrics::counter("olx_sounds_played_total", "Sound samples started");
+	played.inc();
+}
+
 bool PlaySoundSample(SoundSample* sample) {
 	if(!SoundSystemAvailable || !SoundSystemStarted) return false;
 
 	if(sample == NULL)
 		return false;
 	
+	CountSoundPlayed();
 	sfx.playSimpleGlobal(sample);
 	return true;
 }
@@ -255,12 +262,14 @@ void StartSound(SoundSample* smp, CVec pos, bool local, int volume)
 			return;*/
 	}
 	
+	CountSoundPlayed();
 	sfx.playSimple2D(smp, pos);
 	// this was the old call (using BASS_SamplePlayEx):
 	//PlayExSampleSoundEx(smp,0,-1,volume,pan,-1);
 }
 
 void StartSound(SoundSample* smp, CVec pos) {
+	CountSoundPlayed();
 	sfx.playSimple2D(smp, pos);
 }
 
@@ -1,6 +1,6 @@
 #!/usr/bin/python
 
-import sys,os,re
+import sys,os,re,json
 
 opts = [ opt for opt in sys.argv[1:] if not os.path.exists(opt) ]
 files = [ f for f in sys.argv[1:] if f not in opts ]
@@ -8,7 +8,14 @@ files = [ f for f in sys.argv[1:] if f not in opts ]
 def Stream(files):
 	for fn in files:
 		for l in open(fn, "r"):
-			yield l.strip("\n")
+			l = l.strip("\n")
+			if l.startswith("{"):
+				# JSON lines log (Misc.LogJsonFile), rebuild the plain log lines
+				e = json.loads(l)
+				for msgline in e["msg"].split("\n"):
+					yield e["level"] + ": " + msgline
+			else:
+				yield l
 
 reJoin = re.compile("^H: Worm joined: (?P<name>.*) \\(id (?P<id>[0-9]+), from (?P<ip>[0-9.]+):[0-9]+\\((?P<version>.*)\\)\\)$")
 